@@ -0,0 +1,699 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "archive.h"
+#include <QFileInfo>
+#include <zlib.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define ARCHIVE_READ_SIZE       (64 * 1024)
+#define TAR_BLOCK_SIZE          512
+#define TAR_MAX_EXTENDED_SIZE   (1024 * 1024)  //of a long name or extended header, which is read into memory whole
+#define ZIP_EOCD_SIZE           22      //end of central directory record, without its comment
+#define ZIP_EOCD64_SIZE         56
+#define ZIP_LOCATOR64_SIZE      20
+#define ZIP_DIRENTRY_SIZE       46
+#define ZIP_LOCALHEADER_SIZE    30
+#define ZIP_MAX_COMMENT         0xFFFF
+
+
+static quint16 getLE16(const char *p)
+{
+    const unsigned char *pU = (const unsigned char *)p;
+    return (quint16)(pU[0] | (pU[1] << 8));
+}
+
+static quint32 getLE32(const char *p)
+{
+    const unsigned char *pU = (const unsigned char *)p;
+    return (quint32)pU[0] | ((quint32)pU[1] << 8) | ((quint32)pU[2] << 16) | ((quint32)pU[3] << 24);
+}
+
+static quint64 getLE64(const char *p)
+{
+    return (quint64)getLE32(p) | ((quint64)getLE32(p + 4) << 32);
+}
+
+static qint64 dosTimeToMSecs(quint16 nDate, quint16 nTime)
+{
+    //zip times are local time, to the nearest two seconds
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    t.tm_year = ((nDate >> 9) & 0x7f) + 80;
+    t.tm_mon = ((nDate >> 5) & 0x0f) - 1;
+    t.tm_mday = nDate & 0x1f;
+    t.tm_hour = nTime >> 11;
+    t.tm_min = (nTime >> 5) & 0x3f;
+    t.tm_sec = (nTime & 0x1f) * 2;
+    t.tm_isdst = -1;
+    return (qint64)mktime(&t) * 1000;
+}
+
+static qint64 parseTarNumber(const char *p, int nLength)
+{
+    //octal text, or big endian binary with the top bit set for values that don't fit (GNU tar)
+    const unsigned char *pU = (const unsigned char *)p;
+    qint64 n = 0;
+    if (pU[0] & 0x80) {
+        n = pU[0] & 0x7f;
+        for (int i=1; i<nLength; i++)
+            n = (n << 8) | pU[i];
+        return n;
+    }
+
+    int i = 0;
+    while ((i < nLength) && ((p[i] == ' ') || (p[i] == '\0')))
+        i++;
+    for ( ; (i < nLength) && (p[i] >= '0') && (p[i] <= '7'); i++)
+        n = (n << 3) | (p[i] - '0');
+    return n;
+}
+
+static std::string tarField(const char *p, int nLength)
+{
+    //fields are NUL terminated unless they fill their space
+    int n = 0;
+    while ((n < nLength) && p[n])
+        n++;
+    return std::string(p, n);
+}
+
+static bool isTarHeader(const char *p)
+{
+    //the checksum is the sum of the header's bytes, with the checksum field counted as spaces
+    unsigned int nSum = 0;
+    for (int i=0; i<TAR_BLOCK_SIZE; i++)
+        nSum += ((i >= 148) && (i < 156)) ? ' ' : (unsigned char)p[i];
+    return nSum == (unsigned int)parseTarNumber(p + 148, 8);
+}
+
+static bool isZeroBlock(const char *p)
+{
+    for (int i=0; i<TAR_BLOCK_SIZE; i++)
+        if (p[i])
+            return false;
+    return true;
+}
+
+
+CArchiveStream::CArchiveStream()
+{
+    m_pData = NULL;
+    m_nDataPos = 0;
+    m_nStorage = ARCHIVE_STORED;
+    m_pStream = NULL;
+    m_nInputLeft = -1;
+    m_nOutputLeft = -1;
+    m_bEnd = false;
+}
+
+CArchiveStream::~CArchiveStream()
+{
+    Close();
+}
+
+bool CArchiveStream::Open(const QString& strPath, qint64 nOffset, qint64 nLength, int nStorage, qint64 nSize)
+{
+    Close();
+
+    m_file.setFileName(strPath);
+    if (!m_file.open(QIODevice::ReadOnly) || !m_file.seek(nOffset))
+        return false;
+
+    m_nStorage = nStorage;
+    m_nInputLeft = nLength;
+    m_nOutputLeft = nSize;
+    if (nStorage == ARCHIVE_STORED)
+        return true;
+
+    m_pStream = new z_stream;
+    memset(m_pStream, 0, sizeof(z_stream));
+    if (inflateInit2(m_pStream, (nStorage == ARCHIVE_DEFLATED) ? -MAX_WBITS : 16 + MAX_WBITS) != Z_OK) {
+        delete m_pStream;
+        m_pStream = NULL;
+        return false;
+    }
+    m_input.resize(ARCHIVE_READ_SIZE);
+    return true;
+}
+
+void CArchiveStream::OpenData(const QByteArray& data)
+{
+    Close();
+    m_pData = &data;
+}
+
+void CArchiveStream::Close()
+{
+    if (m_pStream) {
+        inflateEnd(m_pStream);
+        delete m_pStream;
+        m_pStream = NULL;
+    }
+    m_file.close();
+    m_pData = NULL;
+    m_nDataPos = 0;
+    m_nStorage = ARCHIVE_STORED;
+    m_nInputLeft = -1;
+    m_nOutputLeft = -1;
+    m_bEnd = false;
+}
+
+qint64 CArchiveStream::readStored(char *pData, qint64 nMax)
+{
+    if ((m_nInputLeft >= 0) && (nMax > m_nInputLeft))
+        nMax = m_nInputLeft;
+
+    qint64 nRead = 0;
+    if (m_pData) {
+        nRead = qMin(nMax, (qint64)m_pData->size() - m_nDataPos);
+        memcpy(pData, m_pData->constData() + m_nDataPos, nRead);
+        m_nDataPos += nRead;
+    }
+    else {
+        while (nRead < nMax) {
+            qint64 n = m_file.read(pData + nRead, nMax - nRead);
+            if (n < 0)
+                return -1;
+            if (n == 0)
+                break;
+            nRead += n;
+        }
+    }
+
+    if (m_nInputLeft >= 0)
+        m_nInputLeft -= nRead;
+    return nRead;
+}
+
+qint64 CArchiveStream::Read(char *pData, qint64 nMax)
+{
+    if ((m_nOutputLeft >= 0) && (nMax > m_nOutputLeft))
+        nMax = m_nOutputLeft;
+    nMax = qMin(nMax, (qint64)1 << 30);  //zlib counts in unsigned ints
+
+    qint64 nRead;
+    if (!m_pStream)
+        nRead = readStored(pData, nMax);
+    else {
+        m_pStream->next_out = (Bytef *)pData;
+        m_pStream->avail_out = (uInt)nMax;
+        while ((m_pStream->avail_out > 0) && !m_bEnd)
+        {
+            if (m_pStream->avail_in == 0) {
+                qint64 nInput = readStored(&m_input[0], m_input.size());
+                if (nInput <= 0)
+                    return -1;  //read error, or cut short
+                m_pStream->next_in = (Bytef *)&m_input[0];
+                m_pStream->avail_in = (uInt)nInput;
+            }
+
+            int nResult = inflate(m_pStream, Z_NO_FLUSH);
+            if (nResult == Z_STREAM_END) {
+                if (m_nStorage != ARCHIVE_GZIPPED) {
+                    m_bEnd = true;
+                    break;
+                }
+                //gzip files can be several members one after another, and tarballs are often padded with zeros
+                if (m_pStream->avail_in == 0) {
+                    qint64 nInput = readStored(&m_input[0], m_input.size());
+                    if (nInput < 0)
+                        return -1;
+                    m_pStream->next_in = (Bytef *)&m_input[0];
+                    m_pStream->avail_in = (uInt)nInput;
+                }
+                if ((m_pStream->avail_in == 0) || (*m_pStream->next_in != 0x1f))
+                    m_bEnd = true;
+                else
+                    inflateReset(m_pStream);
+            }
+            else if ((nResult != Z_OK) && (nResult != Z_BUF_ERROR))
+                return -1;
+        }
+        nRead = nMax - m_pStream->avail_out;
+    }
+
+    if ((nRead > 0) && (m_nOutputLeft >= 0))
+        m_nOutputLeft -= nRead;
+    return nRead;
+}
+
+bool CArchiveStream::Skip(qint64 nBytes)
+{
+    if (!m_pStream && !m_pData) {
+        //stored bytes in a file can be seeked over
+        if ((m_nInputLeft >= 0) && (nBytes > m_nInputLeft))
+            return false;
+        if (!m_file.seek(m_file.pos() + nBytes))
+            return false;
+        if (m_nInputLeft >= 0)
+            m_nInputLeft -= nBytes;
+        if (m_nOutputLeft >= 0)
+            m_nOutputLeft -= nBytes;
+        return true;
+    }
+
+    std::vector<char> buffer(ARCHIVE_READ_SIZE);
+    while (nBytes > 0) {
+        qint64 nChunk = qMin(nBytes, (qint64)buffer.size());
+        if (Read(&buffer[0], nChunk) != nChunk)
+            return false;
+        nBytes -= nChunk;
+    }
+    return true;
+}
+
+bool CArchiveStream::ReadAll(QByteArray& data)
+{
+    data.clear();
+    std::vector<char> buffer(ARCHIVE_READ_SIZE);
+    for (;;) {
+        qint64 nRead = Read(&buffer[0], buffer.size());
+        if (nRead < 0)
+            return false;
+        if (nRead == 0)
+            return true;
+        data.append(&buffer[0], (int)nRead);
+    }
+}
+
+
+bool CArchive::Open(const QString& strPath)
+{
+    m_strPath = strPath;
+    m_entries.clear();
+    m_index.clear();
+
+    m_nType = GetFileType(strPath);
+    if (m_nType == ARCHIVE_ZIP)
+        return readZipIndex();
+    if ((m_nType == ARCHIVE_TAR) || (m_nType == ARCHIVE_TARGZ))
+        return readTarIndex();
+    return false;
+}
+
+const CArchiveEntry* CArchive::FindEntry(const std::string& strRelativePath) const
+{
+    std::map<std::string, size_t>::const_iterator it = m_index.find(strRelativePath);
+    return (it == m_index.end()) ? NULL : &m_entries[it->second];
+}
+
+std::string CArchive::GetTopFolder() const
+{
+    std::string strTop;
+    for (size_t n=0; n<m_entries.size(); n++)
+    {
+        const std::string& strPath = m_entries[n].m_strPath;
+        size_t nSlash = strPath.find('/', 1);
+        if (nSlash == std::string::npos)
+            return "";  //a file at the top
+        if (strTop == "")
+            strTop = strPath.substr(1, nSlash - 1);
+        else if (strPath.compare(1, nSlash - 1, strTop) != 0)
+            return "";
+    }
+    return strTop;
+}
+
+void CArchive::StripTopFolder()
+{
+    std::string strTop = GetTopFolder();
+    if (strTop == "")
+        return;
+
+    m_index.clear();
+    for (size_t n=0; n<m_entries.size(); n++) {
+        m_entries[n].m_strPath.erase(0, strTop.size() + 1);
+        m_index[m_entries[n].m_strPath] = n;
+    }
+}
+
+bool CArchive::OpenEntry(const CArchiveEntry& entry, CArchiveStream& stream) const
+{
+    if (entry.m_bHeld) {
+        stream.OpenData(entry.m_held);
+        return true;
+    }
+
+    if (m_nType == ARCHIVE_TAR)
+        return stream.Open(m_strPath, entry.m_nOffset, entry.m_nSize, ARCHIVE_STORED, entry.m_nSize);
+
+    if (m_nType == ARCHIVE_TARGZ) {
+        //there is nothing to seek with, so everything before the file is decompressed again
+        return stream.Open(m_strPath, 0, -1, ARCHIVE_GZIPPED, entry.m_nOffset + entry.m_nSize) && stream.Skip(entry.m_nOffset);
+    }
+
+    if ((entry.m_nMethod != 0) && (entry.m_nMethod != Z_DEFLATED))
+        return false;  //another compression method, or encrypted
+
+    //the local header's name and extra field needn't be the same length as the central directory's
+    QFile file(m_strPath);
+    char header[ZIP_LOCALHEADER_SIZE];
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(entry.m_nOffset) ||
+        (file.read(header, ZIP_LOCALHEADER_SIZE) != ZIP_LOCALHEADER_SIZE) || (memcmp(header, "PK\x03\x04", 4) != 0))
+        return false;
+    qint64 nData = entry.m_nOffset + ZIP_LOCALHEADER_SIZE + getLE16(header + 26) + getLE16(header + 28);
+    return stream.Open(m_strPath, nData, entry.m_nCompressedSize, (entry.m_nMethod == Z_DEFLATED) ? ARCHIVE_DEFLATED : ARCHIVE_STORED, entry.m_nSize);
+}
+
+bool CArchive::addEntry(CArchiveEntry& entry, const std::string& strName)
+{
+    //Names are relative, but some archivers start them with "./" or "/". Folders are only
+    //listed for their files.
+    size_t nStart = 0;
+    for (;;) {
+        if (strName.compare(nStart, 2, "./") == 0)
+            nStart += 2;
+        else if (strName.compare(nStart, 1, "/") == 0)
+            nStart++;
+        else
+            break;
+    }
+    if ((nStart >= strName.size()) || (strName[strName.size() - 1] == '/'))
+        return false;
+
+    //a file added to a tar again replaces the earlier copy
+    entry.m_strPath = "/" + strName.substr(nStart);
+    std::map<std::string, size_t>::iterator it = m_index.find(entry.m_strPath);
+    if (it != m_index.end())
+        m_entries[it->second] = entry;
+    else {
+        m_index[entry.m_strPath] = m_entries.size();
+        m_entries.push_back(entry);
+    }
+    return true;
+}
+
+bool CArchive::readZipIndex()
+{
+    //The central directory at the end of the file lists every entry with its sizes and CRC,
+    //so nothing needs decompressing until a file's contents are wanted.
+    QFile file(m_strPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 nFileSize = file.size();
+    qint64 nTail = qMin(nFileSize, (qint64)(ZIP_EOCD_SIZE + ZIP_MAX_COMMENT));
+    if (!file.seek(nFileSize - nTail))
+        return false;
+    QByteArray tail = file.read(nTail);
+    const char *pTail = tail.constData();
+
+    int nEocd = tail.size() - ZIP_EOCD_SIZE;
+    while ((nEocd >= 0) && (memcmp(pTail + nEocd, "PK\x05\x06", 4) != 0))
+        nEocd--;
+    if (nEocd < 0)
+        return false;
+
+    const char *pEocd = pTail + nEocd;
+    quint64 nDirSize = getLE32(pEocd + 12);
+    quint64 nDirOffset = getLE32(pEocd + 16);
+    if ((getLE16(pEocd + 10) == 0xFFFF) || (nDirSize == 0xFFFFFFFF) || (nDirOffset == 0xFFFFFFFF)) {
+        //zip64: the real values are in another record, found through the locator just before this one
+        if ((nEocd < ZIP_LOCATOR64_SIZE) || (memcmp(pEocd - ZIP_LOCATOR64_SIZE, "PK\x06\x07", 4) != 0))
+            return false;
+        char eocd64[ZIP_EOCD64_SIZE];
+        if (!file.seek(getLE64(pEocd - ZIP_LOCATOR64_SIZE + 8)) || (file.read(eocd64, ZIP_EOCD64_SIZE) != ZIP_EOCD64_SIZE) ||
+            (memcmp(eocd64, "PK\x06\x06", 4) != 0))
+            return false;
+        nDirSize = getLE64(eocd64 + 40);
+        nDirOffset = getLE64(eocd64 + 48);
+    }
+
+    if ((nDirOffset + nDirSize > (quint64)nFileSize) || !file.seek(nDirOffset))
+        return false;
+    QByteArray dir = file.read(nDirSize);
+    if ((quint64)dir.size() != nDirSize)
+        return false;
+
+    const char *pDir = dir.constData();
+    const char *pDirEnd = pDir + dir.size();
+    const char *p = pDir;
+    while ((p + ZIP_DIRENTRY_SIZE <= pDirEnd) && (memcmp(p, "PK\x01\x02", 4) == 0))
+    {
+        int nNameLength = getLE16(p + 28);
+        int nExtraLength = getLE16(p + 30);
+        int nCommentLength = getLE16(p + 32);
+        if (p + ZIP_DIRENTRY_SIZE + nNameLength + nExtraLength + nCommentLength > pDirEnd)
+            return false;
+
+        CArchiveEntry entry;
+        quint16 nFlags = getLE16(p + 8);
+        entry.m_nMethod = (nFlags & 1) ? -1 : getLE16(p + 10);  //bit 0 is set for encrypted entries
+        entry.m_nModified = dosTimeToMSecs(getLE16(p + 14), getLE16(p + 12));
+        entry.m_nCrc = getLE32(p + 16);
+        entry.m_bCrc = true;
+        quint32 nCompressedSize = getLE32(p + 20), nSize = getLE32(p + 24), nOffset = getLE32(p + 42);
+        entry.m_nCompressedSize = nCompressedSize;
+        entry.m_nSize = nSize;
+        entry.m_nOffset = nOffset;
+
+        //zip64 sizes and offsets, and unix modified times, which are in UTC and to the second
+        const char *pExtra = p + ZIP_DIRENTRY_SIZE + nNameLength;
+        const char *pExtraEnd = pExtra + nExtraLength;
+        while (pExtra + 4 <= pExtraEnd)
+        {
+            quint16 nId = getLE16(pExtra);
+            int nLength = getLE16(pExtra + 2);
+            const char *pData = pExtra + 4;
+            if (pData + nLength > pExtraEnd)
+                break;
+            if (nId == 0x0001) {
+                int i = 0;
+                if ((nSize == 0xFFFFFFFF) && (i + 8 <= nLength)) {
+                    entry.m_nSize = getLE64(pData + i);
+                    i += 8;
+                }
+                if ((nCompressedSize == 0xFFFFFFFF) && (i + 8 <= nLength)) {
+                    entry.m_nCompressedSize = getLE64(pData + i);
+                    i += 8;
+                }
+                if ((nOffset == 0xFFFFFFFF) && (i + 8 <= nLength))
+                    entry.m_nOffset = getLE64(pData + i);
+            }
+            else if ((nId == 0x5455) && (nLength >= 5) && (pData[0] & 1))
+                entry.m_nModified = (qint64)(qint32)getLE32(pData + 1) * 1000;
+            pExtra = pData + nLength;
+        }
+
+        addEntry(entry, std::string(p + ZIP_DIRENTRY_SIZE, nNameLength));
+        p += ZIP_DIRENTRY_SIZE + nNameLength + nExtraLength + nCommentLength;
+    }
+
+    return true;
+}
+
+bool CArchive::readTarIndex()
+{
+    //A tar is a header block before each file's contents, so the index is every header. In a .tar.gz
+    //the contents go past once whatever happens, so their CRCs are taken and small files are kept.
+    bool bGzipped = (m_nType == ARCHIVE_TARGZ);
+    CArchiveStream stream;
+    if (!stream.Open(m_strPath, 0, -1, bGzipped ? ARCHIVE_GZIPPED : ARCHIVE_STORED))
+        return false;
+
+    qint64 nPos = 0;  //in the tar, after decompression
+    qint64 nHeld = 0;
+    std::string strLongName, strPaxPath;  //from the extra headers some entries are given first
+    qint64 nPaxSize = -1;
+    char header[TAR_BLOCK_SIZE];
+    std::vector<char> buffer(ARCHIVE_READ_SIZE);
+    for (;;)
+    {
+        qint64 nRead = stream.Read(header, TAR_BLOCK_SIZE);
+        if (nRead < 0)
+            return false;
+        if ((nRead < TAR_BLOCK_SIZE) || isZeroBlock(header))
+            break;  //the end, with or without its blocks of zeros
+        if (!isTarHeader(header))
+            return false;
+        nPos += TAR_BLOCK_SIZE;
+
+        char cType = header[156];
+        qint64 nSize = (nPaxSize >= 0) ? nPaxSize : parseTarNumber(header + 124, 12);
+        if (nSize < 0)
+            return false;
+        qint64 nPadded = (nSize + TAR_BLOCK_SIZE - 1) & ~(qint64)(TAR_BLOCK_SIZE - 1);
+
+        if ((cType == 'L') || (cType == 'x') || (cType == 'g')) {
+            //a GNU long name, or POSIX extended attributes, for the entry that follows. A corrupt
+            //size could otherwise ask for gigabytes.
+            if (nSize > TAR_MAX_EXTENDED_SIZE)
+                return false;
+            QByteArray data;
+            data.resize(nSize);
+            if ((stream.Read(data.data(), nSize) != nSize) || !stream.Skip(nPadded - nSize))
+                return false;
+            nPos += nPadded;
+
+            if (cType == 'L')
+                strLongName = tarField(data.constData(), data.size());
+            else if (cType == 'x') {
+                //records of "<length> <key>=<value>\n"
+                int nRecord = 0;
+                while (nRecord < data.size()) {
+                    int nLength = atoi(data.constData() + nRecord);
+                    if (nLength <= 0)
+                        break;
+                    std::string strRecord(data.constData() + nRecord, qMin(nLength, data.size() - nRecord));
+                    size_t nSpace = strRecord.find(' '), nEquals = strRecord.find('=');
+                    if ((nSpace != std::string::npos) && (nEquals != std::string::npos) && (nEquals > nSpace)) {
+                        std::string strKey = strRecord.substr(nSpace + 1, nEquals - nSpace - 1);
+                        std::string strValue = strRecord.substr(nEquals + 1);
+                        if ((strValue != "") && (strValue[strValue.size() - 1] == '\n'))
+                            strValue.erase(strValue.size() - 1);
+                        if (strKey == "path")
+                            strPaxPath = strValue;
+                        else if (strKey == "size")
+                            nPaxSize = strtoll(strValue.c_str(), NULL, 10);
+                    }
+                    nRecord += nLength;
+                }
+            }
+            continue;
+        }
+
+        std::string strName = tarField(header, 100);
+        if ((memcmp(header + 257, "ustar\0", 6) == 0) && header[345])
+            strName = tarField(header + 345, 155) + "/" + strName;
+        if (strLongName != "")
+            strName = strLongName;
+        if (strPaxPath != "")
+            strName = strPaxPath;
+        strLongName = strPaxPath = "";
+        nPaxSize = -1;
+
+        CArchiveEntry entry;
+        entry.m_nSize = nSize;
+        entry.m_nModified = parseTarNumber(header + 136, 12) * 1000;
+        entry.m_nOffset = nPos;
+
+        bool bFile = (cType == '0') || (cType == '\0') || (cType == '7');  //links, folders and devices aren't compared
+        if (bFile && bGzipped) {
+            bool bHold = (nSize <= ARCHIVE_HOLD_MAX_FILE_SIZE) && (nHeld + nSize <= ARCHIVE_HOLD_MAX_BYTES);
+            uLong nCrc = crc32(0, NULL, 0);
+            for (qint64 nLeft = nSize; nLeft > 0; ) {
+                qint64 nChunk = qMin(nLeft, (qint64)buffer.size());
+                if (stream.Read(&buffer[0], nChunk) != nChunk)
+                    return false;
+                nCrc = crc32(nCrc, (const Bytef *)&buffer[0], (uInt)nChunk);
+                if (bHold)
+                    entry.m_held.append(&buffer[0], (int)nChunk);
+                nLeft -= nChunk;
+            }
+            if (!stream.Skip(nPadded - nSize))
+                return false;
+            entry.m_nCrc = nCrc;
+            entry.m_bCrc = true;
+            entry.m_bHeld = bHold;
+            if (bHold)
+                nHeld += nSize;
+        }
+        else if (!stream.Skip(nPadded))
+            return false;
+        nPos += nPadded;
+
+        if (bFile)
+            addEntry(entry, strName);
+    }
+
+    return true;
+}
+
+int CArchive::GetFileType(const QString& strPath)
+{
+    QFile file(strPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return ARCHIVE_NONE;  //also fails for folders
+    char header[TAR_BLOCK_SIZE];
+    qint64 nRead = file.read(header, TAR_BLOCK_SIZE);
+    file.close();
+
+    if ((nRead >= 4) && ((memcmp(header, "PK\x03\x04", 4) == 0) || (memcmp(header, "PK\x05\x06", 4) == 0)))
+        return ARCHIVE_ZIP;
+
+    if ((nRead >= 2) && ((unsigned char)header[0] == 0x1f) && ((unsigned char)header[1] == 0x8b)) {
+        //a tarball if the first block decompresses to a tar header
+        CArchiveStream stream;
+        char block[TAR_BLOCK_SIZE];
+        if (stream.Open(strPath, 0, -1, ARCHIVE_GZIPPED) && (stream.Read(block, TAR_BLOCK_SIZE) == TAR_BLOCK_SIZE) && isTarHeader(block))
+            return ARCHIVE_TARGZ;
+        return ARCHIVE_GZIP;
+    }
+
+    if ((nRead == TAR_BLOCK_SIZE) && isTarHeader(header))
+        return ARCHIVE_TAR;
+
+    return ARCHIVE_NONE;
+}
+
+bool CArchive::IsArchiveFile(const QString& strPath)
+{
+    int nType = GetFileType(strPath);
+    return (nType == ARCHIVE_ZIP) || (nType == ARCHIVE_TAR) || (nType == ARCHIVE_TARGZ);
+}
+
+bool CArchive::splitArchivePath(const QString& strPath, QString& strArchive, std::string& strRelativePath)
+{
+    //walks up the path until it finds something that exists, which must be an archive
+    QString strParent = strPath;
+    for (;;)
+    {
+        int nSlash = strParent.lastIndexOf('/');
+        if (nSlash <= 0)
+            return false;
+        strParent = strParent.left(nSlash);
+
+        QFileInfo info(strParent);
+        if (info.isDir() || (info.isFile() && !IsArchiveFile(strParent)))
+            return false;
+        if (info.isFile()) {
+            strArchive = strParent;
+            strRelativePath = strPath.mid(nSlash).toLocal8Bit().constData();
+            return true;
+        }
+    }
+}
+
+bool CArchive::IsPackedFile(const QString& strPath)
+{
+    if (QFileInfo(strPath).isFile())
+        return GetFileType(strPath) == ARCHIVE_GZIP;
+
+    QString strArchive;
+    std::string strRelativePath;
+    return splitArchivePath(strPath, strArchive, strRelativePath);
+}
+
+bool CArchive::ReadFile(const QString& strPath, QByteArray& data)
+{
+    CArchiveStream stream;
+    QString strArchive;
+    std::string strRelativePath;
+    if (QFileInfo(strPath).isFile() || !splitArchivePath(strPath, strArchive, strRelativePath))
+        return stream.Open(strPath, 0, -1, (GetFileType(strPath) == ARCHIVE_GZIP) ? ARCHIVE_GZIPPED : ARCHIVE_STORED) && stream.ReadAll(data);
+
+    //the folders dialog gives paths without the top folder if the compare left it out
+    CArchive archive;
+    if (!archive.Open(strArchive))
+        return false;
+    const CArchiveEntry* pEntry = archive.FindEntry(strRelativePath);
+    if (!pEntry) {
+        archive.StripTopFolder();
+        pEntry = archive.FindEntry(strRelativePath);
+    }
+    return pEntry && archive.OpenEntry(*pEntry, stream) && stream.ReadAll(data);
+}
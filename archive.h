@@ -0,0 +1,137 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <string>
+#include <vector>
+#include <map>
+
+struct z_stream_s;
+
+
+//File types, from the first bytes of the file rather than its extension
+#define ARCHIVE_NONE    0
+#define ARCHIVE_ZIP     1
+#define ARCHIVE_TAR     2
+#define ARCHIVE_TARGZ   3   //a tar inside gzip, e.g. .tar.gz or .tgz
+#define ARCHIVE_GZIP    4   //a single gzipped file
+
+//How a CArchiveStream's bytes are stored
+#define ARCHIVE_STORED      0
+#define ARCHIVE_DEFLATED    1   //raw deflate, as in a zip
+#define ARCHIVE_GZIPPED     2   //gzip, possibly several members one after another
+
+//Small files of a .tar.gz are kept in memory by the index pass, as getting back to them later means
+//decompressing everything before them again
+#define ARCHIVE_HOLD_MAX_FILE_SIZE  (256 * 1024)
+#define ARCHIVE_HOLD_MAX_BYTES      (64 * 1024 * 1024)
+
+class CArchiveEntry
+{
+public:
+    CArchiveEntry() { m_nSize = -1; m_nModified = 0; m_nCrc = 0; m_bCrc = false; m_nOffset = 0; m_nCompressedSize = -1; m_nMethod = 0; m_bHeld = false; }
+
+    std::string m_strPath;      //relative path, e.g. "/src/main.cpp"
+    qint64 m_nSize;             //uncompressed
+    qint64 m_nModified;         //msecs since epoch
+    quint32 m_nCrc;             //CRC-32 of the contents
+    bool m_bCrc;                //false for a plain tar, which doesn't store one
+    qint64 m_nOffset;           //zip: of the local header. tar: of the contents, in the decompressed stream of a .tar.gz
+    qint64 m_nCompressedSize;   //zip only
+    int m_nMethod;              //zip only: 0 stored, 8 deflated. Anything else can't be read.
+    bool m_bHeld;               //m_held has the contents
+    QByteArray m_held;
+};
+
+
+//Reads the bytes of a file, a range of one or an archive entry, decompressing them as it goes.
+//Nothing is written to disk.
+
+class CArchiveStream
+{
+public:
+    CArchiveStream();
+    ~CArchiveStream();
+
+    //nLength is the number of stored bytes from nOffset, or -1 for the rest of the file.
+    //nSize limits the bytes read out, -1 for no limit.
+    bool Open(const QString& strPath, qint64 nOffset, qint64 nLength, int nStorage, qint64 nSize=-1);
+    void OpenData(const QByteArray& data);  //reads from memory. The data must outlive the stream.
+    void Close();
+
+    qint64 Read(char *pData, qint64 nMax);  //fills pData unless the end is reached. -1 on errors.
+    bool Skip(qint64 nBytes);
+    bool ReadAll(QByteArray& data);
+
+private:
+    qint64 readStored(char *pData, qint64 nMax);
+
+    QFile m_file;
+    const QByteArray* m_pData;
+    qint64 m_nDataPos;
+    int m_nStorage;
+    z_stream_s* m_pStream;
+    std::vector<char> m_input;
+    qint64 m_nInputLeft;  //stored bytes not read from the file yet, -1 for up to the end of it
+    qint64 m_nOutputLeft; //-1 for no limit
+    bool m_bEnd;
+};
+
+
+//A zip or tar file (optionally gzipped) standing in for a folder on either side of a folder compare.
+//Open() reads just the index: the zip central directory, or the tar headers. A .tar.gz has no index,
+//so its headers are found by decompressing it once, which also gives the CRC of each file.
+
+class CArchive
+{
+public:
+    bool Open(const QString& strPath);
+
+    const QString& GetPath() const { return m_strPath; }
+    int GetType() const { return m_nType; }
+    const std::vector<CArchiveEntry>& GetEntries() const { return m_entries; }
+    const CArchiveEntry* FindEntry(const std::string& strRelativePath) const;
+
+    //Release tarballs usually hold a single folder named after the version, e.g. "app-1.2/".
+    //Without it the paths line up with another version's archive, or with a checked out folder.
+    std::string GetTopFolder() const;  //"" unless every file is in the same top level folder
+    void StripTopFolder();
+
+    bool OpenEntry(const CArchiveEntry& entry, CArchiveStream& stream) const;
+
+    static int GetFileType(const QString& strPath);  //ARCHIVE_*
+    static bool IsArchiveFile(const QString& strPath);  //a zip or tar, which can be compared as a folder
+
+    //Reads a whole file, decompressing a gzipped one. A path that goes on through an archive,
+    //e.g. "app-1.2.tar.gz/src/main.cpp" as the folders dialog gives for a row, is read from the archive.
+    static bool IsPackedFile(const QString& strPath);  //true if ReadFile() is needed to read the path's text
+    static bool ReadFile(const QString& strPath, QByteArray& data);
+
+private:
+    bool readZipIndex();
+    bool readTarIndex();
+    bool addEntry(CArchiveEntry& entry, const std::string& strName);
+    static bool splitArchivePath(const QString& strPath, QString& strArchive, std::string& strRelativePath);
+
+    QString m_strPath;
+    int m_nType;
+    std::vector<CArchiveEntry> m_entries;
+    std::map<std::string, size_t> m_index;  //relative path -> entry
+};
+
+#endif // ARCHIVE_H
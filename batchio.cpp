@@ -0,0 +1,364 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "batchio.h"
+#include <QFile>
+#include <QString>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <string.h>
+
+#ifdef XDIFFR_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+
+//the steps of a batch, one io_uring round per step
+#define PHASE_OPEN      0
+#define PHASE_READ      1
+#define PHASE_CLOSE     2
+
+
+static void readOne(CBatchRead& read)
+{
+    //Reads one byte more than expected, so a file that has grown since the scan is noticed
+    QFile file(QString::fromLocal8Bit(read.m_strPath.c_str()));
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    read.m_data.resize(read.m_nSize + 1);
+    qint64 nRead = file.read(&read.m_data[0], read.m_nSize + 1);
+    read.m_bOk = (nRead == read.m_nSize);
+    read.m_data.resize(read.m_bOk ? read.m_nSize : 0);
+}
+
+class CBatchReadTask : public QRunnable
+{
+public:
+    CBatchReadTask(std::vector<CBatchRead>* pReads, QAtomicInt* pNext) { m_pReads = pReads; m_pNext = pNext; }
+
+    virtual void run()
+    {
+        //each worker takes the next unread file until there are none left
+        for (;;) {
+            int n = m_pNext->fetchAndAddOrdered(1);
+            if (n >= (int)m_pReads->size())
+                break;
+            readOne((*m_pReads)[n]);
+        }
+    }
+
+private:
+    std::vector<CBatchRead>* m_pReads;
+    QAtomicInt* m_pNext;
+};
+
+
+CBatchReader::CBatchReader()
+{
+    m_bUringTried = false;
+    m_bUring = false;
+    m_nRingFd = -1;
+    m_pSqRing = m_pCqRing = m_pSqes = NULL;
+    m_nSqRingSize = m_nCqRingSize = m_nSqesSize = 0;
+    m_pSqHead = m_pSqTail = m_pSqMask = m_pSqArray = NULL;
+    m_pCqHead = m_pCqTail = m_pCqMask = NULL;
+    m_pCqes = NULL;
+    m_nDepth = 0;
+    m_nFiles = 0;
+    m_nOps = 0;
+    m_nElapsedUs = 0;
+
+    m_pool.setMaxThreadCount(BATCH_THREADS);
+}
+
+CBatchReader::~CBatchReader()
+{
+    closeUring();
+}
+
+const char *CBatchReader::GetBackendName()
+{
+    return m_bUring ? "io_uring" : "threads";
+}
+
+qint64 CBatchReader::GetIops()
+{
+    return (m_nElapsedUs > 0) ? (m_nOps * 1000000 / m_nElapsedUs) : 0;
+}
+
+void CBatchReader::Read(std::vector<CBatchRead>& reads)
+{
+    if (reads.empty())
+        return;
+
+    if (!m_bUringTried) {
+        m_bUringTried = true;
+        m_bUring = initUring();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (m_bUring)
+        readUring(reads);
+    else
+        readThreads(reads);
+
+    m_nElapsedUs += timer.nsecsElapsed() / 1000;
+    m_nFiles += reads.size();
+    m_nOps += reads.size() * 3;
+}
+
+void CBatchReader::readThreads(std::vector<CBatchRead>& reads)
+{
+    QAtomicInt next(0);
+    int nTasks = qMin((int)reads.size(), BATCH_THREADS);
+    for (int n=0; n<nTasks; n++)
+        m_pool.start(new CBatchReadTask(&reads, &next));
+    m_pool.waitForDone();
+}
+
+#ifdef XDIFFR_IO_URING
+
+//The rings are shared with the kernel, so the indexes need acquire/release ordering
+#define RING_LOAD(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+bool CBatchReader::initUring()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int nFd = syscall(__NR_io_uring_setup, BATCH_QUEUE_DEPTH, &params);
+    if (nFd < 0) {
+        qDebug() << "io_uring not available, using threads";  //e.g. an old kernel or blocked by a sandbox
+        return false;
+    }
+    m_nRingFd = nFd;
+
+    //the open, read and close operations need Linux 5.6 or later
+    size_t nProbeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    std::vector<char> probeBuffer(nProbeSize, 0);
+    struct io_uring_probe* pProbe = (struct io_uring_probe*)&probeBuffer[0];
+    if ((syscall(__NR_io_uring_register, nFd, IORING_REGISTER_PROBE, pProbe, 256) < 0) ||
+        (pProbe->last_op < IORING_OP_CLOSE) ||
+        !(pProbe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) ||
+        !(pProbe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+        !(pProbe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED)) {
+        qDebug() << "io_uring doesn't support file operations, using threads";
+        closeUring();
+        return false;
+    }
+
+    m_nSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_nCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        m_nSqRingSize = m_nCqRingSize = qMax(m_nSqRingSize, m_nCqRingSize);
+
+    m_pSqRing = mmap(NULL, m_nSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, nFd, IORING_OFF_SQ_RING);
+    if (m_pSqRing == MAP_FAILED) {
+        m_pSqRing = NULL;
+        closeUring();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        m_pCqRing = m_pSqRing;
+    else {
+        m_pCqRing = mmap(NULL, m_nCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, nFd, IORING_OFF_CQ_RING);
+        if (m_pCqRing == MAP_FAILED) {
+            m_pCqRing = NULL;
+            closeUring();
+            return false;
+        }
+    }
+    m_nSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_pSqes = mmap(NULL, m_nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, nFd, IORING_OFF_SQES);
+    if (m_pSqes == MAP_FAILED) {
+        m_pSqes = NULL;
+        closeUring();
+        return false;
+    }
+
+    char *pSq = (char *)m_pSqRing;
+    m_pSqHead = (unsigned *)(pSq + params.sq_off.head);
+    m_pSqTail = (unsigned *)(pSq + params.sq_off.tail);
+    m_pSqMask = (unsigned *)(pSq + params.sq_off.ring_mask);
+    m_pSqArray = (unsigned *)(pSq + params.sq_off.array);
+    char *pCq = (char *)m_pCqRing;
+    m_pCqHead = (unsigned *)(pCq + params.cq_off.head);
+    m_pCqTail = (unsigned *)(pCq + params.cq_off.tail);
+    m_pCqMask = (unsigned *)(pCq + params.cq_off.ring_mask);
+    m_pCqes = pCq + params.cq_off.cqes;
+    m_nDepth = params.sq_entries;
+
+    return true;
+}
+
+void CBatchReader::closeUring()
+{
+    if (m_pSqes)
+        munmap(m_pSqes, m_nSqesSize);
+    if (m_pCqRing && (m_pCqRing != m_pSqRing))
+        munmap(m_pCqRing, m_nCqRingSize);
+    if (m_pSqRing)
+        munmap(m_pSqRing, m_nSqRingSize);
+    if (m_nRingFd >= 0)
+        close(m_nRingFd);
+
+    m_pSqRing = m_pCqRing = m_pSqes = NULL;
+    m_nRingFd = -1;
+}
+
+void CBatchReader::readUring(std::vector<CBatchRead>& reads)
+{
+    //All the opens are queued, then all the reads, then all the closes. Reads need the descriptors from
+    //the opens, so the steps can't be linked within the ring.
+    std::vector<int> fds(reads.size(), -1);
+    bool bOk = uringPhase(reads, fds, PHASE_OPEN) && uringPhase(reads, fds, PHASE_READ) && uringPhase(reads, fds, PHASE_CLOSE);
+
+    //After a ring error, the files not marked as read are left to the caller's own compare, and the
+    //files opened here are closed here. Later batches use threads.
+    if (!bOk) {
+        for (size_t n=0; n<fds.size(); n++)
+            if (fds[n] >= 0)
+                close(fds[n]);
+        closeUring();
+        m_bUring = false;
+    }
+}
+
+bool CBatchReader::uringPhase(std::vector<CBatchRead>& reads, std::vector<int>& fds, int nPhase)
+{
+    struct io_uring_sqe* pSqes = (struct io_uring_sqe*)m_pSqes;
+    struct io_uring_cqe* pCqes = (struct io_uring_cqe*)m_pCqes;
+
+    size_t nNext = 0;
+    unsigned nInFlight = 0;  //queued and not yet reaped, whether or not the kernel has taken them yet
+    bool bFailed = false;
+    while (((nNext < reads.size()) && !bFailed) || (nInFlight > 0))
+    {
+        //queue as many operations as the ring has room for
+        unsigned nTail = *m_pSqTail;
+        while ((nNext < reads.size()) && !bFailed && (nInFlight < m_nDepth))
+        {
+            size_t n = nNext++;
+            if ((nPhase != PHASE_OPEN) && (fds[n] < 0))
+                continue;  //didn't open
+
+            unsigned nIndex = nTail & *m_pSqMask;
+            struct io_uring_sqe* pSqe = &pSqes[nIndex];
+            memset(pSqe, 0, sizeof(*pSqe));
+            pSqe->user_data = n;
+            if (nPhase == PHASE_OPEN) {
+                pSqe->opcode = IORING_OP_OPENAT;
+                pSqe->fd = AT_FDCWD;
+                pSqe->addr = (unsigned long)reads[n].m_strPath.c_str();
+                pSqe->open_flags = O_RDONLY | O_CLOEXEC;
+            }
+            else if (nPhase == PHASE_READ) {
+                //one byte more than expected, so a file that has grown since the scan is noticed
+                reads[n].m_data.resize(reads[n].m_nSize + 1);
+                pSqe->opcode = IORING_OP_READ;
+                pSqe->fd = fds[n];
+                pSqe->addr = (unsigned long)&reads[n].m_data[0];
+                pSqe->len = reads[n].m_nSize + 1;
+                pSqe->off = 0;
+            }
+            else {
+                //the descriptor belongs to the close from here on, unless the close is taken back below
+                pSqe->opcode = IORING_OP_CLOSE;
+                pSqe->fd = fds[n];
+                fds[n] = -1;
+            }
+            m_pSqArray[nIndex] = nIndex;
+            nTail++;
+            nInFlight++;
+        }
+        RING_STORE(m_pSqTail, nTail);
+        if (nInFlight == 0)
+            break;
+
+        //Submits everything the kernel hasn't taken yet, including any left by a short submit or EAGAIN
+        //last time, and waits for at least one completion unless there is more to queue and room for it.
+        //After an error it only waits for what was submitted.
+        unsigned nUnsubmitted = nTail - RING_LOAD(m_pSqHead);
+        bool bWait = (nNext >= reads.size()) || bFailed || (nInFlight >= m_nDepth);
+        int nResult = syscall(__NR_io_uring_enter, m_nRingFd, nUnsubmitted, bWait ? 1 : 0, IORING_ENTER_GETEVENTS, NULL, 0);
+        if ((nResult < 0) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+            qDebug() << "io_uring_enter failed" << errno;
+            if (bFailed)
+                return false;  //can't even wait, so whatever is still in flight is lost with the ring
+
+            //what the kernel hasn't taken is taken back, so the next phase doesn't submit it
+            bFailed = true;
+            unsigned nHead = RING_LOAD(m_pSqHead);
+            for (unsigned nSqe=nHead; nSqe!=nTail; nSqe++) {
+                struct io_uring_sqe* pSqe = &pSqes[nSqe & *m_pSqMask];
+                if (nPhase == PHASE_CLOSE)
+                    fds[pSqe->user_data] = pSqe->fd;
+                nInFlight--;
+            }
+            RING_STORE(m_pSqTail, nHead);
+            continue;
+        }
+
+        unsigned nHead = *m_pCqHead;
+        unsigned nCqTail = RING_LOAD(m_pCqTail);
+        for ( ; nHead != nCqTail; nHead++)
+        {
+            struct io_uring_cqe* pCqe = &pCqes[nHead & *m_pCqMask];
+            size_t n = pCqe->user_data;
+            int nRes = pCqe->res;
+            nInFlight--;
+            if (nPhase == PHASE_OPEN)
+                fds[n] = nRes;
+            else if (nPhase == PHASE_READ) {
+                reads[n].m_bOk = (nRes == reads[n].m_nSize);
+                reads[n].m_data.resize(reads[n].m_bOk ? reads[n].m_nSize : 0);
+            }
+        }
+        RING_STORE(m_pCqHead, nHead);
+    }
+
+    return !bFailed;
+}
+
+#else
+
+bool CBatchReader::initUring()
+{
+    return false;
+}
+
+void CBatchReader::closeUring()
+{
+}
+
+void CBatchReader::readUring(std::vector<CBatchRead>& reads)
+{
+    readThreads(reads);
+}
+
+bool CBatchReader::uringPhase(std::vector<CBatchRead>& reads, std::vector<int>& fds, int nPhase)
+{
+    return false;
+}
+
+#endif // XDIFFR_IO_URING
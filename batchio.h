@@ -0,0 +1,86 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef BATCHIO_H
+#define BATCHIO_H
+
+#include <QtGlobal>
+#include <QThreadPool>
+#include <string>
+#include <vector>
+
+
+#define BATCH_QUEUE_DEPTH   64      //most operations in flight at once
+#define BATCH_THREADS       8       //workers used when io_uring isn't available
+
+
+class CBatchRead
+{
+public:
+    CBatchRead() { m_nSize = 0; m_bOk = false; }
+
+    std::string m_strPath;
+    qint64 m_nSize;        //expected size, from the directory scan
+    std::string m_data;    //the contents, if m_bOk
+    bool m_bOk;            //false if the file couldn't be read, or its size has changed since the scan
+};
+
+
+//Reads many small files with as few system calls and waits as possible. The cost of comparing trees
+//of small files is mostly the open, read and close calls made one file at a time, not the bytes read.
+//
+//On Linux (built with XDIFFR_IO_URING) the opens, reads and closes of a whole batch are queued through
+//io_uring, so each step of the batch costs a handful of system calls rather than one per file.
+//Elsewhere, or if the kernel doesn't allow io_uring, a small thread pool reads the files in parallel
+//so their latencies overlap.
+
+class CBatchReader
+{
+public:
+    CBatchReader();
+    ~CBatchReader();
+
+    void Read(std::vector<CBatchRead>& reads);
+
+    const char *GetBackendName();  //"io_uring" or "threads"
+    qint64 GetFileCount() { return m_nFiles; }
+    qint64 GetOpCount() { return m_nOps; }  //opens, reads and closes
+    qint64 GetIops();  //operations per second spent in Read()
+
+private:
+    bool initUring();
+    void closeUring();
+    void readUring(std::vector<CBatchRead>& reads);
+    bool uringPhase(std::vector<CBatchRead>& reads, std::vector<int>& fds, int nPhase);  //false after a ring error
+    void readThreads(std::vector<CBatchRead>& reads);
+
+    bool m_bUringTried;
+    bool m_bUring;
+
+    //io_uring rings, mapped from the kernel
+    int m_nRingFd;
+    void *m_pSqRing, *m_pCqRing, *m_pSqes;
+    size_t m_nSqRingSize, m_nCqRingSize, m_nSqesSize;
+    unsigned *m_pSqHead, *m_pSqTail, *m_pSqMask, *m_pSqArray;
+    unsigned *m_pCqHead, *m_pCqTail, *m_pCqMask;
+    void *m_pCqes;
+    unsigned m_nDepth;
+
+    QThreadPool m_pool;
+
+    qint64 m_nFiles;
+    qint64 m_nOps;
+    qint64 m_nElapsedUs;
+};
+
+#endif // BATCHIO_H
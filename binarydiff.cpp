@@ -0,0 +1,481 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "binarydiff.h"
+#include "merge3.h"
+#include "archive.h"
+#include "gitrepo.h"
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <algorithm>
+#include <string.h>
+
+
+#define COMPARE_BLOCK_BYTES     65536   //the common start and end are compared this much at a time
+#define BINARY_SEGMENT_MIN      (4 << 20)  //smaller middles aren't worth splitting between threads
+#define BINARY_MAX_THREADS      8
+#define BINARY_REFINE_CELLS     (1 << 20)  //changes up to this size are diffed byte by byte
+#define BINARY_SAME_MIN         8       //the shortest run of bytes a byte diff counts as the same
+
+
+//random values for each byte, from a fixed seed so chunk boundaries are the same every run
+class CGearTable
+{
+public:
+    CGearTable()
+    {
+        quint64 nSeed = Q_UINT64_C(0x9E3779B97F4A7C15);
+        for (int n=0; n<256; n++) {
+            //splitmix64
+            quint64 z = (nSeed += Q_UINT64_C(0x9E3779B97F4A7C15));
+            z = (z ^ (z >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+            z = (z ^ (z >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+            m_values[n] = z ^ (z >> 31);
+        }
+    }
+
+    quint64 m_values[256];
+};
+
+static const CGearTable s_gear;
+
+
+//a piece of one file's changed middle, chunked on its own
+class CBinarySegment
+{
+public:
+    int m_nFile;
+    qint64 m_nOffset;
+    qint64 m_nEnd;
+    std::vector<qint64> m_ends;
+    std::vector<quint64> m_hashes;
+};
+
+
+class CBinaryChunkTask : public QRunnable
+{
+public:
+    CBinaryChunkTask(const uchar* pData, CBinarySegment* pSegment) { m_pData = pData; m_pSegment = pSegment; }
+
+    virtual void run()
+    {
+        CBinaryDiff::Chunk(m_pData + m_pSegment->m_nOffset, m_pSegment->m_nEnd - m_pSegment->m_nOffset, m_pSegment->m_ends, m_pSegment->m_hashes);
+    }
+
+private:
+    const uchar* m_pData;
+    CBinarySegment* m_pSegment;
+};
+
+
+static bool rowBeforeGroup(qint64 nRow, const CBinaryRowGroup& group)
+{
+    return nRow < group.m_nFirstRow;
+}
+
+
+CBinaryDiff::CBinaryDiff()
+{
+    m_pData[0] = m_pData[1] = NULL;
+    m_nSize[0] = m_nSize[1] = 0;
+    m_nRows = 0;
+}
+
+bool CBinaryDiff::IsBinary(const QByteArray& start)
+{
+    return memchr(start.constData(), 0, qMin(start.size(), BINARY_SNIFF_BYTES)) != NULL;
+}
+
+void CBinaryDiff::Clear()
+{
+    for (int nFile=0; nFile<2; nFile++) {
+        m_files[nFile].close();  //unmaps it
+        m_unpacked[nFile].clear();
+        m_pData[nFile] = NULL;
+        m_nSize[nFile] = 0;
+    }
+    m_changes.clear();
+    m_rowGroups.clear();
+    m_changeRows.clear();
+    m_nRows = 0;
+}
+
+bool CBinaryDiff::Load(const char *pStrFilePath1, const char *pStrFilePath2)
+{
+    Clear();
+    if (loadFile(0, pStrFilePath1) && loadFile(1, pStrFilePath2))
+        return true;
+    Clear();
+    return false;
+}
+
+bool CBinaryDiff::loadFile(int nFile, const char *pStrFilePath)
+{
+    QString strPath = QString::fromLocal8Bit(pStrFilePath);
+    if (CGitRepo::IsRevisionSpec(strPath) || CArchive::IsPackedFile(strPath)) {
+        bool bRead = CGitRepo::IsRevisionSpec(strPath) ? CGitRepo::ReadFile(strPath, m_unpacked[nFile]) : CArchive::ReadFile(strPath, m_unpacked[nFile]);
+        if (!bRead)
+            return false;
+    }
+    else {
+        QFile& file = m_files[nFile];
+        file.setFileName(strPath);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        m_nSize[nFile] = file.size();
+        if (m_nSize[nFile] > 0) {
+            m_pData[nFile] = file.map(0, m_nSize[nFile]);
+            if (m_pData[nFile])
+                return true;
+            m_unpacked[nFile] = file.readAll();  //e.g. a pipe or a file system that can't map
+        }
+    }
+
+    m_pData[nFile] = (const uchar*)m_unpacked[nFile].constData();
+    m_nSize[nFile] = m_unpacked[nFile].size();
+    return true;
+}
+
+void CBinaryDiff::Compare()
+{
+    m_changes.clear();
+
+    //most of two builds of the same image is usually the same at either end
+    const uchar* pData1 = m_pData[0];
+    const uchar* pData2 = m_pData[1];
+    qint64 nSize = qMin(m_nSize[0], m_nSize[1]);
+    qint64 nPrefix = 0;
+    while ((nPrefix + COMPARE_BLOCK_BYTES <= nSize) && (memcmp(pData1 + nPrefix, pData2 + nPrefix, COMPARE_BLOCK_BYTES) == 0))
+        nPrefix += COMPARE_BLOCK_BYTES;
+    while ((nPrefix < nSize) && (pData1[nPrefix] == pData2[nPrefix]))
+        nPrefix++;
+
+    qint64 nSuffix = 0;
+    nSize -= nPrefix;
+    while ((nSuffix + COMPARE_BLOCK_BYTES <= nSize) &&
+           (memcmp(pData1 + m_nSize[0] - nSuffix - COMPARE_BLOCK_BYTES, pData2 + m_nSize[1] - nSuffix - COMPARE_BLOCK_BYTES, COMPARE_BLOCK_BYTES) == 0))
+        nSuffix += COMPARE_BLOCK_BYTES;
+    while ((nSuffix < nSize) && (pData1[m_nSize[0] - nSuffix - 1] == pData2[m_nSize[1] - nSuffix - 1]))
+        nSuffix++;
+
+    diffGap(nPrefix, m_nSize[0] - nSuffix, nPrefix, m_nSize[1] - nSuffix);
+    layoutRows();
+}
+
+void CBinaryDiff::diffGap(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2)
+{
+    if ((nOffset1 == nEnd1) || (nOffset2 == nEnd2)) {
+        addChange(nOffset1, nEnd1, nOffset2, nEnd2);
+        return;
+    }
+
+    //Each file is cut into segments that are chunked in parallel. A segment's first chunk starts at
+    //the cut rather than where a single pass would have put it, but the rolling hash finds the same
+    //boundaries again within a chunk or two, and the chunks that don't line up hold the same bytes,
+    //so addChange() trims them away.
+    int nThreads = qBound(1, QThread::idealThreadCount(), BINARY_MAX_THREADS);
+    qint64 offsets[2] = { nOffset1, nOffset2 };
+    qint64 ends[2] = { nEnd1, nEnd2 };
+    std::vector<CBinarySegment> segments;
+    for (int nFile=0; nFile<2; nFile++) {
+        qint64 nSegment = qMax((ends[nFile] - offsets[nFile] + nThreads - 1) / nThreads, (qint64)BINARY_SEGMENT_MIN);
+        for (qint64 nStart=offsets[nFile]; nStart<ends[nFile]; nStart+=nSegment) {
+            CBinarySegment segment;
+            segment.m_nFile = nFile;
+            segment.m_nOffset = nStart;
+            segment.m_nEnd = qMin(nStart + nSegment, ends[nFile]);
+            segments.push_back(segment);
+        }
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(nThreads);
+    for (size_t n=0; n<segments.size(); n++)
+        pool.start(new CBinaryChunkTask(m_pData[segments[n].m_nFile], &segments[n]));
+    pool.waitForDone();
+
+    //chunk n of each file is from bounds[n] to bounds[n + 1]
+    std::vector<qint64> bounds[2];
+    std::vector<quint64> hashes[2];
+    bounds[0].push_back(nOffset1);
+    bounds[1].push_back(nOffset2);
+    for (size_t n=0; n<segments.size(); n++) {
+        const CBinarySegment& segment = segments[n];
+        for (size_t nChunk=0; nChunk<segment.m_ends.size(); nChunk++)
+            bounds[segment.m_nFile].push_back(segment.m_nOffset + segment.m_ends[nChunk]);
+        hashes[segment.m_nFile].insert(hashes[segment.m_nFile].end(), segment.m_hashes.begin(), segment.m_hashes.end());
+    }
+    std::vector<qint64>& bounds1 = bounds[0];
+    std::vector<qint64>& bounds2 = bounds[1];
+    int nChunks1 = hashes[0].size(), nChunks2 = hashes[1].size();
+
+    //chunk hashes become tokens, so the chunks can be diffed like lines
+    std::vector<quint64> distinct(hashes[0]);
+    distinct.insert(distinct.end(), hashes[1].begin(), hashes[1].end());
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    std::vector<int> tokens[2];
+    for (int nFile=0; nFile<2; nFile++)
+        for (size_t n=0; n<hashes[nFile].size(); n++)
+            tokens[nFile].push_back(std::lower_bound(distinct.begin(), distinct.end(), hashes[nFile][n]) - distinct.begin());
+
+    std::vector<int> links;
+    CMerge3::Diff(tokens[0], tokens[1], distinct.size(), links);
+
+    //hashes can collide, so linked chunks are checked byte for byte
+    for (int n=0; n<nChunks1; n++) {
+        if (links[n] < 0)
+            continue;
+        qint64 nLength = bounds1[n + 1] - bounds1[n];
+        if ((nLength != bounds2[links[n] + 1] - bounds2[links[n]]) ||
+                (memcmp(m_pData[0] + bounds1[n], m_pData[1] + bounds2[links[n]], nLength) != 0))
+            links[n] = -1;
+    }
+
+    int n1 = 0, n2 = 0;
+    while ((n1 < nChunks1) || (n2 < nChunks2))
+    {
+        if ((n1 < nChunks1) && (links[n1] == n2)) {
+            n1++;
+            n2++;
+            continue;
+        }
+
+        int nNext1 = n1;
+        while ((nNext1 < nChunks1) && (links[nNext1] < 0))
+            nNext1++;
+        int nNext2 = (nNext1 < nChunks1) ? links[nNext1] : nChunks2;
+        addChange(bounds1[n1], bounds1[nNext1], bounds2[n2], bounds2[nNext2]);
+        n1 = nNext1;
+        n2 = nNext2;
+    }
+}
+
+void CBinaryDiff::Chunk(const uchar* pData, qint64 nSize, std::vector<qint64>& ends, std::vector<quint64>& hashes)
+{
+    //the mask takes the hash's top bits, which depend on the last 64 bytes, rather than its bottom bits,
+    //which depend on the last few
+    const quint64 nMask = ((Q_UINT64_C(1) << BINARY_CHUNK_BITS) - 1) << (64 - BINARY_CHUNK_BITS);
+    const quint64* pGear = s_gear.m_values;
+
+    ends.reserve(nSize / (1 << BINARY_CHUNK_BITS) + 1);
+    hashes.reserve(ends.capacity());
+    qint64 nStart = 0;
+    while (nStart < nSize)
+    {
+        qint64 nEnd = qMin(nStart + BINARY_CHUNK_MAX, nSize);
+        qint64 n = qMin(nStart + BINARY_CHUNK_MIN, nEnd);  //a boundary can't be this close, so these bytes aren't hashed
+        //Two bytes a step, which halves the chain of dependent adds. The hash after the first byte of
+        //each pair isn't needed for the next step, so it's checked off that chain.
+        quint64 nHash = 0;
+        bool bBoundary = false;
+        while (!bBoundary && (n + 2 <= nEnd)) {
+            quint64 nHash1 = (nHash << 1) + pGear[pData[n]];
+            nHash = (nHash << 2) + ((pGear[pData[n]] << 1) + pGear[pData[n + 1]]);
+            if ((nHash1 & nMask) == 0) {
+                n++;
+                bBoundary = true;
+            }
+            else {
+                n += 2;
+                bBoundary = ((nHash & nMask) == 0);
+            }
+        }
+        if (!bBoundary && (n < nEnd))
+            n++;  //the odd byte at the end of the data, where the chunk ends anyway
+        ends.push_back(n);
+        hashes.push_back(hashChunk(pData + nStart, n - nStart));
+        nStart = n;
+    }
+}
+
+quint64 CBinaryDiff::hashChunk(const uchar* pData, qint64 nSize)
+{
+    //four independent lanes of 8 bytes, so the multiplies overlap
+    const quint64 nPrime = Q_UINT64_C(0xFF51AFD7ED558CCD);
+    quint64 lanes[4] = { (quint64)nSize, Q_UINT64_C(0x9E3779B97F4A7C15), Q_UINT64_C(0xC2B2AE3D27D4EB4F), Q_UINT64_C(0x165667B19E3779F9) };
+    qint64 n = 0;
+    for ( ; n+32<=nSize; n+=32) {
+        for (int nLane=0; nLane<4; nLane++) {
+            quint64 nWord;
+            memcpy(&nWord, pData + n + nLane * 8, 8);
+            lanes[nLane] = (lanes[nLane] ^ nWord) * nPrime;
+            lanes[nLane] ^= lanes[nLane] >> 32;
+        }
+    }
+
+    quint64 nHash = lanes[0];
+    for (int nLane=1; nLane<4; nLane++)
+        nHash = ((nHash ^ lanes[nLane]) * nPrime) ^ (nHash >> 29);
+    for ( ; n<nSize; n++)
+        nHash = (nHash ^ pData[n]) * Q_UINT64_C(0x100000001B3);
+    return nHash;
+}
+
+void CBinaryDiff::addChange(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2)
+{
+    //a changed run of chunks usually starts and ends with bytes that are the same
+    while ((nOffset1 < nEnd1) && (nOffset2 < nEnd2) && (m_pData[0][nOffset1] == m_pData[1][nOffset2])) {
+        nOffset1++;
+        nOffset2++;
+    }
+    while ((nOffset1 < nEnd1) && (nOffset2 < nEnd2) && (m_pData[0][nEnd1 - 1] == m_pData[1][nEnd2 - 1])) {
+        nEnd1--;
+        nEnd2--;
+    }
+    if ((nOffset1 == nEnd1) && (nOffset2 == nEnd2))
+        return;
+
+    if ((nOffset1 == nEnd1) || (nOffset2 == nEnd2) || ((nEnd1 - nOffset1) * (nEnd2 - nOffset2) > BINARY_REFINE_CELLS)) {
+        pushChange(nOffset1, nEnd1, nOffset2, nEnd2);
+        return;
+    }
+
+    //A small change is diffed byte by byte, e.g. to find an insert and an overwrite in the same chunk.
+    //Any two runs of random bytes have short runs in common, so only longer ones are kept as the same.
+    std::vector<int> tokens1(m_pData[0] + nOffset1, m_pData[0] + nEnd1);
+    std::vector<int> tokens2(m_pData[1] + nOffset2, m_pData[1] + nEnd2);
+    std::vector<int> links;
+    CMerge3::Diff(tokens1, tokens2, 256, links);
+
+    qint64 nChange1 = nOffset1, nChange2 = nOffset2;
+    int nLength1 = tokens1.size();
+    int n = 0;
+    while (n < nLength1)
+    {
+        if (links[n] < 0) {
+            n++;
+            continue;
+        }
+        int nRun = 1;
+        while ((n + nRun < nLength1) && (links[n + nRun] == links[n] + nRun))
+            nRun++;
+        if (nRun >= BINARY_SAME_MIN) {
+            pushChange(nChange1, nOffset1 + n, nChange2, nOffset2 + links[n]);
+            nChange1 = nOffset1 + n + nRun;
+            nChange2 = nOffset2 + links[n] + nRun;
+        }
+        n += nRun;
+    }
+    pushChange(nChange1, nEnd1, nChange2, nEnd2);
+}
+
+void CBinaryDiff::pushChange(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2)
+{
+    if ((nOffset1 == nEnd1) && (nOffset2 == nEnd2))
+        return;
+
+    if (!m_changes.empty()) {
+        CBinaryChange& last = m_changes.back();
+        if ((last.m_nOffset[0] + last.m_nLength[0] == nOffset1) && (last.m_nOffset[1] + last.m_nLength[1] == nOffset2)) {
+            last.m_nLength[0] += nEnd1 - nOffset1;
+            last.m_nLength[1] += nEnd2 - nOffset2;
+            return;
+        }
+    }
+
+    CBinaryChange change;
+    change.m_nOffset[0] = nOffset1;
+    change.m_nOffset[1] = nOffset2;
+    change.m_nLength[0] = nEnd1 - nOffset1;
+    change.m_nLength[1] = nEnd2 - nOffset2;
+    m_changes.push_back(change);
+}
+
+qint64 CBinaryDiff::GetChangedBytes(int nView) const
+{
+    qint64 nBytes = 0;
+    for (size_t n=0; n<m_changes.size(); n++)
+        nBytes += m_changes[n].m_nLength[nView - 1];
+    return nBytes;
+}
+
+void CBinaryDiff::layoutRows()
+{
+    //overwritten bytes stay in an aligned group, and only inserts and deletes break the alignment
+    m_rowGroups.clear();
+    m_changeRows.clear();
+    m_nRows = 0;
+
+    qint64 nOffset1 = 0, nOffset2 = 0;
+    for (size_t n=0; n<m_changes.size(); n++)
+    {
+        const CBinaryChange& change = m_changes[n];
+        if (change.m_nLength[0] == change.m_nLength[1]) {
+            m_changeRows.push_back(m_nRows + (change.m_nOffset[0] - nOffset1) / BINARY_ROW_BYTES);
+            continue;
+        }
+
+        addRowGroup(nOffset1, change.m_nOffset[0], nOffset2, change.m_nOffset[1], true);
+        m_changeRows.push_back(m_nRows);
+        nOffset1 = change.m_nOffset[0] + change.m_nLength[0];
+        nOffset2 = change.m_nOffset[1] + change.m_nLength[1];
+        addRowGroup(change.m_nOffset[0], nOffset1, change.m_nOffset[1], nOffset2, false);
+    }
+    addRowGroup(nOffset1, m_nSize[0], nOffset2, m_nSize[1], true);
+
+    //two changes can start on the same row
+    m_changeRows.erase(std::unique(m_changeRows.begin(), m_changeRows.end()), m_changeRows.end());
+}
+
+void CBinaryDiff::addRowGroup(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2, bool bAligned)
+{
+    qint64 nLength = qMax(nEnd1 - nOffset1, nEnd2 - nOffset2);
+    if (nLength == 0)
+        return;
+
+    CBinaryRowGroup group;
+    group.m_nFirstRow = m_nRows;
+    group.m_nOffset[0] = nOffset1;
+    group.m_nOffset[1] = nOffset2;
+    group.m_nLength[0] = nEnd1 - nOffset1;
+    group.m_nLength[1] = nEnd2 - nOffset2;
+    group.m_bAligned = bAligned;
+    m_rowGroups.push_back(group);
+    m_nRows += (nLength + BINARY_ROW_BYTES - 1) / BINARY_ROW_BYTES;
+}
+
+int CBinaryDiff::GetRow(qint64 nRow, int nView, qint64& nOffset, const uchar*& pBytes, uchar* pStates) const
+{
+    if ((nRow < 0) || (nRow >= m_nRows))
+        return 0;
+
+    const CBinaryRowGroup& group = *(std::upper_bound(m_rowGroups.begin(), m_rowGroups.end(), nRow, rowBeforeGroup) - 1);
+    int nSide = nView - 1;
+    qint64 nStart = (nRow - group.m_nFirstRow) * BINARY_ROW_BYTES;
+    nOffset = group.m_nOffset[nSide] + nStart;
+    int nBytes = (int)qBound(Q_INT64_C(0), group.m_nLength[nSide] - nStart, (qint64)BINARY_ROW_BYTES);
+    pBytes = m_pData[nSide] + nOffset;
+
+    //only the visible rows are asked for, so the bytes of an aligned row are just compared here
+    for (int n=0; n<nBytes; n++) {
+        if (group.m_bAligned)
+            pStates[n] = (m_pData[0][group.m_nOffset[0] + nStart + n] == m_pData[1][group.m_nOffset[1] + nStart + n]) ? BINARY_SAME : BINARY_CHANGED;
+        else
+            pStates[n] = (group.m_nLength[1 - nSide] == 0) ? BINARY_ONLY : BINARY_CHANGED;
+    }
+    return nBytes;
+}
+
+qint64 CBinaryDiff::GetNextChangeRow(qint64 nRow) const
+{
+    std::vector<qint64>::const_iterator it = std::upper_bound(m_changeRows.begin(), m_changeRows.end(), nRow);
+    return (it == m_changeRows.end()) ? -1 : *it;
+}
+
+qint64 CBinaryDiff::GetPreviousChangeRow(qint64 nRow) const
+{
+    std::vector<qint64>::const_iterator it = std::lower_bound(m_changeRows.begin(), m_changeRows.end(), nRow);
+    return (it == m_changeRows.begin()) ? -1 : *(it - 1);
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef BINARYDIFF_H
+#define BINARYDIFF_H
+
+#include <QFile>
+#include <QByteArray>
+#include <vector>
+
+
+#define BINARY_SNIFF_BYTES      8000    //a NUL byte in this many bytes at the start makes a file binary, as in git
+
+//content defined chunks. Boundaries depend only on the bytes just before them, so an insert or
+//delete only changes the chunks around it and the rest still match.
+#define BINARY_CHUNK_MIN        2048
+#define BINARY_CHUNK_BITS       13      //about 8KB on average
+#define BINARY_CHUNK_MAX        65536
+
+#define BINARY_ROW_BYTES        16
+
+//CBinaryRow byte states
+#define BINARY_SAME             0
+#define BINARY_CHANGED          1
+#define BINARY_ONLY             2       //inserted on this side, nothing opposite
+
+
+//A changed byte range. One length can be 0, for bytes only in the other file.
+class CBinaryChange
+{
+public:
+    qint64 m_nOffset[2];  //indexed by view - 1
+    qint64 m_nLength[2];
+};
+
+//Rows of the hex views, laid out in groups. In an aligned group both files advance together, so
+//overwritten bytes show opposite each other; a group for an insert or delete has the longer side's rows.
+class CBinaryRowGroup
+{
+public:
+    qint64 m_nFirstRow;
+    qint64 m_nOffset[2];
+    qint64 m_nLength[2];
+    bool m_bAligned;
+};
+
+
+//Compares two binary files, e.g. firmware images, as changed byte ranges. Plain files are mapped
+//rather than read. The common start and end are skipped first, the rest is cut into content defined
+//chunks with a gear rolling hash, and the chunks are diffed as tokens by the merge's patience diff.
+//The bytes either side of each changed run of chunks are then compared so that the ranges are exact,
+//and a small change is diffed byte by byte.
+//
+//The hex views ask for one row at a time, so only the visible rows are ever formatted.
+
+class CBinaryDiff
+{
+public:
+    CBinaryDiff();
+
+    static bool IsBinary(const QByteArray& start);  //from the first BINARY_SNIFF_BYTES of a file
+    bool Load(const char *pStrFilePath1, const char *pStrFilePath2);
+    void Compare();
+    void Clear();
+
+    const std::vector<CBinaryChange>& GetChanges() const { return m_changes; }
+    qint64 GetSize(int nView) const { return m_nSize[nView - 1]; }
+    qint64 GetChangedBytes(int nView) const;
+
+    qint64 GetRowCount() const { return m_nRows; }
+    int GetRow(qint64 nRow, int nView, qint64& nOffset, const uchar*& pBytes, uchar* pStates) const;  //bytes on this side, up to BINARY_ROW_BYTES
+    qint64 GetNextChangeRow(qint64 nRow) const;  //-1 if none
+    qint64 GetPreviousChangeRow(qint64 nRow) const;
+
+    //Cuts data into chunks, giving each one's end and a hash of its bytes. Safe to call from any thread.
+    static void Chunk(const uchar* pData, qint64 nSize, std::vector<qint64>& ends, std::vector<quint64>& hashes);
+
+private:
+    bool loadFile(int nFile, const char *pStrFilePath);
+    static quint64 hashChunk(const uchar* pData, qint64 nSize);
+    void diffGap(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2);
+    void addChange(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2);
+    void pushChange(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2);
+    void layoutRows();
+    void addRowGroup(qint64 nOffset1, qint64 nEnd1, qint64 nOffset2, qint64 nEnd2, bool bAligned);
+
+    QFile m_files[2];
+    QByteArray m_unpacked[2];  //of a gzipped, archived or git file, which can't be mapped
+    const uchar* m_pData[2];
+    qint64 m_nSize[2];
+
+    std::vector<CBinaryChange> m_changes;
+    std::vector<CBinaryRowGroup> m_rowGroups;
+    std::vector<qint64> m_changeRows;
+    qint64 m_nRows;
+};
+
+#endif // BINARYDIFF_H
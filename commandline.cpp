@@ -0,0 +1,600 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "commandline.h"
+#include "diffdoc.h"
+#include "merge3.h"
+#include "patchwriter.h"
+#include "binarydiff.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <string.h>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#include <fcntl.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+
+//results are buffered for speed, but flushed at least this often so that they appear as they arrive
+#define OUTPUT_FLUSH_MS     200
+
+
+static void printUsage(FILE* pOut)
+{
+    fputs("Usage:\n"
+          "  xdiffr [--single-instance] [<file1> <file2>]\n"
+          "  xdiffr --folders [options] <folder1> <folder2>\n"
+          "  xdiffr --write-manifest [options] <folder> <manifest>\n"
+          "  xdiffr --merge <base> <ours> <theirs> <output>\n"
+          "  xdiffr --patch [--context=N] <file1> <file2> [<output>]\n"
+          "  xdiffr --diff [-u | --unified[=N] | --normal] [--stats] <file1> <file2>\n"
+          "\n"
+          "With --single-instance, a compare is opened in a new window of an xdiffr already\n"
+          "started that way, which saves starting another.\n"
+          "\n"
+          "Either folder of a folder compare can be a manifest written by --write-manifest,\n"
+          "a zip, tar or .tar.gz archive, which is read without extracting it, or a git\n"
+          "revision spec such as HEAD~1: or v1.2:src, read from the current repository.\n"
+          "\n"
+          "Folder compare options:\n"
+          "  --format=tsv|json   output format (default tsv)\n"
+          "  --all               also list files that are the same\n"
+          "  --no-exceptions     don't apply the folder exception strings from the settings\n"
+          "  --ignore-files      skip paths listed in .gitignore and .ignore files\n"
+          "  --no-moves          don't pair up moved and renamed files\n"
+          "  --verify=MODE       how files in both folders are compared:\n"
+          "                        full          whole contents (default)\n"
+          "                        metadata      size and modified time only\n"
+          "                        sampled       size, then a few blocks of each file\n"
+          "                        sampled-full  sampled, then whole contents if the samples match\n"
+          "                      (--no-exceptions and --ignore-files also apply to --write-manifest)\n"
+          "\n"
+          "--merge writes the changes made in ours and theirs since base to output. Where\n"
+          "both changed the same lines differently, the output has all three versions\n"
+          "between conflict markers.\n"
+          "\n"
+          "--patch writes a unified diff of the compare xdiffr shows, to stdout unless an\n"
+          "output file is given. The context and the compare settings (ignored whitespace,\n"
+          "case and masks) are those in the settings, and --context=N overrides the context.\n"
+          "\n"
+          "--diff compares two files without the GUI and prints the differences as diff(1)\n"
+          "does, in its normal format or as a unified diff with N lines of context (default\n"
+          "3). Lines are compared exactly, whatever the settings, and - reads a file from\n"
+          "stdin. --stats adds the load, compare and output times, the compare's passes\n"
+          "and the peak memory to stderr.\n"
+          "\n"
+          "Exit status is 0 if the folders or files are the same, 1 if they differ and 2\n"
+          "on errors.\n"
+          "A merge exits with 1 if it has conflicts.\n", pOut);
+}
+
+static int runFolderCompare(int argc, char *argv[])
+{
+    CFolderCompareWriter::Format format = CFolderCompareWriter::formatTsv;
+    std::string strPath1, strPath2;
+    int nPaths = 0;
+
+    //start from the folders settings, so that results match the folders dialog
+    CDiffDoc doc;
+    bool bShowSame = false;
+    bool bExceptions = doc.getFolderExceptionsEnabled();
+    bool bIgnoreFiles = doc.getFoldersUseIgnoreFiles();
+    bool bDetectMoves = doc.getFoldersDetectMoves();
+    int nVerifyMode = doc.getFoldersVerifyMode();
+
+    for (int n=2; n<argc; n++) {
+        const char *pArg = argv[n];
+        if (strcmp(pArg, "--format=tsv") == 0)
+            format = CFolderCompareWriter::formatTsv;
+        else if (strcmp(pArg, "--format=json") == 0)
+            format = CFolderCompareWriter::formatJson;
+        else if (strcmp(pArg, "--all") == 0)
+            bShowSame = true;
+        else if (strcmp(pArg, "--no-exceptions") == 0)
+            bExceptions = false;
+        else if (strcmp(pArg, "--ignore-files") == 0)
+            bIgnoreFiles = true;
+        else if (strcmp(pArg, "--no-moves") == 0)
+            bDetectMoves = false;
+        else if (strcmp(pArg, "--verify=full") == 0)
+            nVerifyMode = FOLDERS_VERIFY_FULL;
+        else if (strcmp(pArg, "--verify=metadata") == 0)
+            nVerifyMode = FOLDERS_VERIFY_METADATA;
+        else if (strcmp(pArg, "--verify=sampled") == 0)
+            nVerifyMode = FOLDERS_VERIFY_SAMPLED;
+        else if (strcmp(pArg, "--verify=sampled-full") == 0)
+            nVerifyMode = FOLDERS_VERIFY_SAMPLEDFULL;
+        else if ((pArg[0] == '-') && (pArg[1] == '-')) {
+            fprintf(stderr, "xdiffr: unknown option %s\n", pArg);
+            printUsage(stderr);
+            return EXIT_TROUBLE;
+        }
+        else if (nPaths == 0) {
+            strPath1 = pArg;
+            nPaths++;
+        }
+        else if (nPaths == 1) {
+            strPath2 = pArg;
+            nPaths++;
+        }
+        else
+            nPaths++;
+    }
+
+    if (nPaths != 2) {
+        printUsage(stderr);
+        return EXIT_TROUBLE;
+    }
+
+    for (int n=0; n<2; n++) {
+        const std::string& strPath = (n == 0) ? strPath1 : strPath2;
+        QString strQPath = QString::fromLocal8Bit(strPath.c_str());
+        if (!QFileInfo(strQPath).isDir() && !CTreeManifest::IsManifestFile(strQPath) && !CArchive::IsArchiveFile(strQPath) &&
+            !CGitRepo::IsRevisionSpec(strQPath)) {
+            fprintf(stderr, "xdiffr: %s: not a folder, manifest, archive or revision\n", strPath.c_str());
+            return EXIT_TROUBLE;
+        }
+    }
+
+    static char outputBuffer[1 << 20];
+    setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+
+    CFolderCompareWriter writer(stdout, format);
+    CFolderCompare folderCompare(&writer);
+    folderCompare.SetExceptions(bExceptions ? doc.getFolderExceptions() : QStringList());
+    folderCompare.SetUseIgnoreFiles(bIgnoreFiles);
+    folderCompare.SetShowSame(bShowSame);
+    folderCompare.SetDetectMoves(bDetectMoves);
+    folderCompare.SetVerifyMode(nVerifyMode);
+
+    writer.Begin();
+    bool bOk = folderCompare.Compare(strPath1.c_str(), strPath2.c_str(), true);
+    writer.End();
+
+    if (!bOk) {
+        fprintf(stderr, "xdiffr: can't read manifest, archive or revision\n");
+        return EXIT_TROUBLE;
+    }
+
+    fprintf(stderr, "%d files compared, %d differences.\n", folderCompare.GetFileCount(), folderCompare.GetDifferenceCount());
+    if (folderCompare.GetGitObjectCount() > 0)
+        fprintf(stderr, "%d git objects read.\n", folderCompare.GetGitObjectCount());
+    CHashCache* pHashCache = folderCompare.GetHashCache();
+    if (pHashCache->GetHits() + pHashCache->GetMisses() > 0)
+        fprintf(stderr, "%d files hashed, %d hashes from cache.\n", pHashCache->GetMisses(), pHashCache->GetHits());
+    CBatchReader* pBatchReader = folderCompare.GetBatchReader();
+    if (pBatchReader->GetFileCount() > 0)
+        fprintf(stderr, "%lld files read in batches via %s, %lld IOPS.\n", (long long)pBatchReader->GetFileCount(),
+                pBatchReader->GetBackendName(), (long long)pBatchReader->GetIops());
+
+    return (folderCompare.GetDifferenceCount() > 0) ? EXIT_DIFFERENT : EXIT_SAME;
+}
+
+static int runWriteManifest(int argc, char *argv[])
+{
+    CDiffDoc doc;
+    bool bExceptions = doc.getFolderExceptionsEnabled();
+    bool bIgnoreFiles = doc.getFoldersUseIgnoreFiles();
+    std::vector<std::string> paths;
+
+    for (int n=2; n<argc; n++) {
+        const char *pArg = argv[n];
+        if (strcmp(pArg, "--no-exceptions") == 0)
+            bExceptions = false;
+        else if (strcmp(pArg, "--ignore-files") == 0)
+            bIgnoreFiles = true;
+        else if ((pArg[0] == '-') && (pArg[1] == '-')) {
+            fprintf(stderr, "xdiffr: unknown option %s\n", pArg);
+            printUsage(stderr);
+            return EXIT_TROUBLE;
+        }
+        else
+            paths.push_back(pArg);
+    }
+
+    if (paths.size() != 2) {
+        printUsage(stderr);
+        return EXIT_TROUBLE;
+    }
+
+    if (!QFileInfo(QString::fromLocal8Bit(paths[0].c_str())).isDir()) {
+        fprintf(stderr, "xdiffr: %s: not a folder\n", paths[0].c_str());
+        return EXIT_TROUBLE;
+    }
+
+    CFolderCompare folderCompare(NULL);
+    folderCompare.SetExceptions(bExceptions ? doc.getFolderExceptions() : QStringList());
+    folderCompare.SetUseIgnoreFiles(bIgnoreFiles);
+
+    if (!folderCompare.WriteManifest(paths[0].c_str(), paths[1].c_str())) {
+        fprintf(stderr, "xdiffr: %s: can't write manifest\n", paths[1].c_str());
+        return EXIT_TROUBLE;
+    }
+
+    fprintf(stderr, "%d files written to %s.\n", folderCompare.GetFileCount(), paths[1].c_str());
+    return EXIT_SAME;
+}
+
+static int runMerge(int argc, char *argv[])
+{
+    if (argc != 6) {
+        printUsage(stderr);
+        return EXIT_TROUBLE;
+    }
+
+    //the doc loads the three files and holds where the merge goes
+    CDiffDoc doc(false);
+    doc.SetMergePath(argv[5]);
+
+    CMerge3 merge;
+    if (!merge.Load(doc, argv[2], argv[3], argv[4])) {
+        fprintf(stderr, "xdiffr: can't load %s, %s and %s\n", argv[2], argv[3], argv[4]);
+        return EXIT_TROUBLE;
+    }
+    merge.Merge();
+
+    if (!merge.Write(doc.GetMergePath().c_str())) {
+        fprintf(stderr, "xdiffr: %s: can't write merge\n", doc.GetMergePath().c_str());
+        return EXIT_TROUBLE;
+    }
+
+    fprintf(stderr, "%d changes merged, %d conflicts.\n", merge.GetChangeCount(), merge.GetConflictCount());
+    return (merge.GetConflictCount() > 0) ? EXIT_DIFFERENT : EXIT_SAME;
+}
+
+static int runBinaryCompare(const char *pStrPath1, const char *pStrPath2, const char *pStrLabel1, const char *pStrLabel2)
+{
+    //as diff(1) reports binary files
+    CBinaryDiff binaryDiff;
+    if (!binaryDiff.Load(pStrPath1, pStrPath2)) {
+        fprintf(stderr, "xdiffr: can't load %s and %s\n", pStrLabel1, pStrLabel2);
+        return EXIT_TROUBLE;
+    }
+    binaryDiff.Compare();
+    if (binaryDiff.GetChanges().empty())
+        return EXIT_SAME;
+    printf("Binary files %s and %s differ\n", pStrLabel1, pStrLabel2);
+    return EXIT_DIFFERENT;
+}
+
+static int runPatch(int argc, char *argv[])
+{
+    CDiffDoc settings;
+    int nContext = settings.getPatchContext();
+    std::vector<std::string> paths;
+
+    for (int n=2; n<argc; n++) {
+        const char *pArg = argv[n];
+        if (strncmp(pArg, "--context=", 10) == 0) {
+            bool bOk;
+            nContext = QString(pArg + 10).toInt(&bOk);
+            if (!bOk || (nContext < 0)) {
+                fprintf(stderr, "xdiffr: bad context %s\n", pArg + 10);
+                return EXIT_TROUBLE;
+            }
+        }
+        else if ((pArg[0] == '-') && (pArg[1] == '-')) {
+            fprintf(stderr, "xdiffr: unknown option %s\n", pArg);
+            printUsage(stderr);
+            return EXIT_TROUBLE;
+        }
+        else
+            paths.push_back(pArg);
+    }
+
+    if ((paths.size() != 2) && (paths.size() != 3)) {
+        printUsage(stderr);
+        return EXIT_TROUBLE;
+    }
+
+    CDiffDoc doc(false);
+    doc.SetLineFilter(settings.GetLineFilter());
+    doc.SetTimeBudget(0);
+    if (!doc.LoadFiles(paths[0].c_str(), paths[1].c_str())) {
+        if (!doc.IsBinary()) {
+            fprintf(stderr, "xdiffr: can't load %s and %s\n", paths[0].c_str(), paths[1].c_str());
+            return EXIT_TROUBLE;
+        }
+
+        return runBinaryCompare(paths[0].c_str(), paths[1].c_str(), paths[0].c_str(), paths[1].c_str());
+    }
+    doc.Compare();
+
+    const char *pStrOutput = (paths.size() == 3) ? paths[2].c_str() : "-";
+    CPatchWriter writer(&doc, nContext);
+    if (!writer.Write(pStrOutput, paths[0].c_str(), paths[1].c_str())) {
+        fprintf(stderr, "xdiffr: %s: can't write patch\n", pStrOutput);
+        return EXIT_TROUBLE;
+    }
+
+    if (paths.size() == 3)
+        fprintf(stderr, "%d changes in %d hunks written to %s.\n", writer.GetChangeCount(), writer.GetHunkCount(), pStrOutput);
+    return (writer.GetChangeCount() > 0) ? EXIT_DIFFERENT : EXIT_SAME;
+}
+
+//peak resident memory of this process in KB, or -1 where it isn't known
+static qint64 peakMemoryKB()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return -1;
+    return counters.PeakWorkingSetSize / 1024;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024;  //in bytes on OS X
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+static bool copyStdin(QTemporaryFile& file)
+{
+    //the doc loads files by path, and loads them again to compare them as binary, so stdin is kept in a file
+#ifdef Q_OS_WIN
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    QFile in;
+    if (!in.open(stdin, QIODevice::ReadOnly) || !file.open())
+        return false;
+
+    char buffer[64 * 1024];
+    qint64 nRead;
+    while ((nRead = in.read(buffer, sizeof(buffer))) > 0) {
+        if (file.write(buffer, nRead) != nRead)
+            return false;
+    }
+    return (nRead == 0) && file.flush();
+}
+
+static int runDiff(int argc, char *argv[])
+{
+    CPatchWriter::Format format = CPatchWriter::formatNormal;
+    int nContext = PATCH_DEFAULT_CONTEXT;
+    bool bStats = false;
+    std::vector<std::string> paths;
+
+    for (int n=2; n<argc; n++) {
+        const char *pArg = argv[n];
+        if ((strcmp(pArg, "-u") == 0) || (strcmp(pArg, "--unified") == 0))
+            format = CPatchWriter::formatUnified;
+        else if (strncmp(pArg, "--unified=", 10) == 0) {
+            bool bOk;
+            nContext = QString(pArg + 10).toInt(&bOk);
+            if (!bOk || (nContext < 0)) {
+                fprintf(stderr, "xdiffr: bad context %s\n", pArg + 10);
+                return EXIT_TROUBLE;
+            }
+            format = CPatchWriter::formatUnified;
+        }
+        else if (strcmp(pArg, "--normal") == 0)
+            format = CPatchWriter::formatNormal;
+        else if (strcmp(pArg, "--stats") == 0)
+            bStats = true;
+        else if ((pArg[0] == '-') && (pArg[1] != '\0')) {
+            fprintf(stderr, "xdiffr: unknown option %s\n", pArg);
+            printUsage(stderr);
+            return EXIT_TROUBLE;
+        }
+        else
+            paths.push_back(pArg);
+    }
+
+    if (paths.size() != 2) {
+        printUsage(stderr);
+        return EXIT_TROUBLE;
+    }
+
+    //- is stdin, as for diff(1). It is still the name in the output.
+    QTemporaryFile stdinFile;
+    std::string loadPaths[2] = { paths[0], paths[1] };
+    if ((paths[0] == "-") || (paths[1] == "-")) {
+        if (!copyStdin(stdinFile)) {
+            fprintf(stderr, "xdiffr: can't read stdin\n");
+            return EXIT_TROUBLE;
+        }
+        std::string strStdinPath = stdinFile.fileName().toLocal8Bit().constData();
+        for (int n=0; n<2; n++)
+            if (paths[n] == "-")
+                loadPaths[n] = strStdinPath;
+    }
+
+    //lines are compared exactly, whatever the settings, so the output can be checked against diff(1)
+    CDiffDoc doc(false);
+    doc.SetTimeBudget(0);
+    QElapsedTimer timer;
+    timer.start();
+    if (!doc.LoadFiles(loadPaths[0].c_str(), loadPaths[1].c_str())) {
+        if (!doc.IsBinary()) {
+            fprintf(stderr, "xdiffr: can't load %s and %s\n", paths[0].c_str(), paths[1].c_str());
+            return EXIT_TROUBLE;
+        }
+        return runBinaryCompare(loadPaths[0].c_str(), loadPaths[1].c_str(), paths[0].c_str(), paths[1].c_str());
+    }
+    qint64 nLoadMs = timer.restart();
+    doc.Compare();
+    qint64 nCompareMs = timer.restart();
+
+    CPatchWriter writer(&doc, nContext);
+    writer.SetFormat(format);
+    if (!writer.Write("-", paths[0].c_str(), paths[1].c_str())) {
+        fprintf(stderr, "xdiffr: can't write diff\n");
+        return EXIT_TROUBLE;
+    }
+    qint64 nWriteMs = timer.elapsed();
+
+    if (bStats) {
+        fprintf(stderr, "%d and %d lines, %d changes in %d hunks.\n", (int)doc.GetLines(VIEW_LEFT).size(), (int)doc.GetLines(VIEW_RIGHT).size(),
+                writer.GetChangeCount(), writer.GetHunkCount());
+        fprintf(stderr, "Loaded in %lld ms, compared in %lld ms (%d passes), written in %lld ms.\n", (long long)nLoadMs, (long long)nCompareMs,
+                doc.GetComparePasses(), (long long)nWriteMs);
+        qint64 nPeakKB = peakMemoryKB();
+        if (nPeakKB >= 0)
+            fprintf(stderr, "Peak memory %lld KB.\n", (long long)nPeakKB);
+    }
+    return (writer.GetChangeCount() > 0) ? EXIT_DIFFERENT : EXIT_SAME;
+}
+
+bool isCommandLineMode(int argc, char *argv[])
+{
+    if (argc < 2)
+        return false;
+
+    return (strcmp(argv[1], "--folders") == 0) ||
+            (strcmp(argv[1], "--write-manifest") == 0) ||
+            (strcmp(argv[1], "--merge") == 0) ||
+            (strcmp(argv[1], "--patch") == 0) ||
+            (strcmp(argv[1], "--diff") == 0) ||
+            (strcmp(argv[1], "--help") == 0);
+}
+
+int runCommandLine(int argc, char *argv[])
+{
+    if (strcmp(argv[1], "--folders") == 0)
+        return runFolderCompare(argc, argv);
+    if (strcmp(argv[1], "--write-manifest") == 0)
+        return runWriteManifest(argc, argv);
+    if (strcmp(argv[1], "--merge") == 0)
+        return runMerge(argc, argv);
+    if (strcmp(argv[1], "--patch") == 0)
+        return runPatch(argc, argv);
+    if (strcmp(argv[1], "--diff") == 0)
+        return runDiff(argc, argv);
+
+    printUsage(stdout);
+    return EXIT_SAME;
+}
+
+////////////////////////////////////////
+
+
+CFolderCompareWriter::CFolderCompareWriter(FILE* pOut, Format format)
+{
+    m_pOut = pOut;
+    m_format = format;
+    m_nRows = 0;
+    m_nLastFlush = 0;
+}
+
+void CFolderCompareWriter::Begin()
+{
+    if (m_format == formatJson)
+        fputs("[\n", m_pOut);
+    else
+        fputs("path\tstate\tsize1\tsize2\tpath2\tverified\n", m_pOut);
+
+    m_nLastFlush = QDateTime::currentMSecsSinceEpoch();
+}
+
+void CFolderCompareWriter::End()
+{
+    if (m_format == formatJson)
+        fputs((m_nRows > 0) ? "\n]\n" : "]\n", m_pOut);
+
+    fflush(m_pOut);
+}
+
+void CFolderCompareWriter::OnFileCompared(const std::string& strRelativePath, int nState, int nVerified, qint64 nSize1, qint64 nSize2)
+{
+    writeRow(strRelativePath, NULL, nState, nVerified, nSize1, nSize2);
+}
+
+void CFolderCompareWriter::OnFileMoved(const std::string& strRelativePath1, const std::string& strRelativePath2, int nState, int nVerified, qint64 nSize1, qint64 nSize2)
+{
+    writeRow(strRelativePath1, &strRelativePath2, nState, nVerified, nSize1, nSize2);
+}
+
+void CFolderCompareWriter::writeRow(const std::string& strRelativePath, const std::string* pStrRelativePath2, int nState, int nVerified, qint64 nSize1, qint64 nSize2)
+{
+    //path2 is only set for moved files
+    if (m_format == formatJson) {
+        fputs((m_nRows > 0) ? ",\n{\"path\":\"" : "{\"path\":\"", m_pOut);
+        writeEscaped(strRelativePath);
+        fprintf(m_pOut, "\",\"state\":\"%s\",\"size1\":", folderStateName(nState));
+        if (nSize1 >= 0)
+            fprintf(m_pOut, "%lld", (long long)nSize1);
+        else
+            fputs("null", m_pOut);
+        fputs(",\"size2\":", m_pOut);
+        if (nSize2 >= 0)
+            fprintf(m_pOut, "%lld", (long long)nSize2);
+        else
+            fputs("null", m_pOut);
+        if (pStrRelativePath2) {
+            fputs(",\"path2\":\"", m_pOut);
+            writeEscaped(*pStrRelativePath2);
+            fputc('"', m_pOut);
+        }
+        fprintf(m_pOut, ",\"verified\":\"%s\"}", verifiedName(nVerified));
+    }
+    else {
+        //missing sizes are left empty
+        writeEscaped(strRelativePath);
+        fprintf(m_pOut, "\t%s\t", folderStateName(nState));
+        if (nSize1 >= 0)
+            fprintf(m_pOut, "%lld", (long long)nSize1);
+        fputc('\t', m_pOut);
+        if (nSize2 >= 0)
+            fprintf(m_pOut, "%lld", (long long)nSize2);
+        fputc('\t', m_pOut);
+        if (pStrRelativePath2)
+            writeEscaped(*pStrRelativePath2);
+        fprintf(m_pOut, "\t%s\n", verifiedName(nVerified));
+    }
+
+    m_nRows++;
+
+    qint64 nNow = QDateTime::currentMSecsSinceEpoch();
+    if ((nNow - m_nLastFlush) >= OUTPUT_FLUSH_MS) {
+        fflush(m_pOut);
+        m_nLastFlush = nNow;
+    }
+}
+
+void CFolderCompareWriter::writeEscaped(const std::string& str)
+{
+    //JSON string escaping. TSV uses the same backslash escapes so that tabs and newlines can't break up a row.
+    //Paths are in the local 8 bit encoding, and JSON has to be UTF-8, so names that aren't valid in the
+    //local encoding come out with replacement characters. TSV keeps the bytes as they are.
+    QByteArray bytes = (m_format == formatJson) ? QString::fromLocal8Bit(str.c_str(), str.size()).toUtf8() : QByteArray(str.c_str(), str.size());
+    for (int n=0; n<bytes.size(); n++) {
+        unsigned char c = bytes[n];
+        switch (c) {
+        case '"':
+            fputs((m_format == formatJson) ? "\\\"" : "\"", m_pOut);
+            break;
+        case '\\': fputs("\\\\", m_pOut); break;
+        case '\t': fputs("\\t", m_pOut); break;
+        case '\n': fputs("\\n", m_pOut); break;
+        case '\r': fputs("\\r", m_pOut); break;
+        default:
+            if (c < 0x20)
+                fprintf(m_pOut, "\\u%04x", c);
+            else
+                fputc(c, m_pOut);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include <stdio.h>
+#include <string>
+#include "foldercompare.h"
+
+
+//Exit codes of the command line modes. Same meaning as diff(1).
+#define EXIT_SAME           0
+#define EXIT_DIFFERENT      1
+#define EXIT_TROUBLE        2
+
+//Command line modes run without a display. They are selected by the first argument, e.g.
+//  xdiffr --folders [--format=tsv|json] [--all] [--no-exceptions] [--ignore-files] [--no-moves]
+//                  [--verify=full|metadata|sampled|sampled-full] <folder1> <folder2>
+//  xdiffr --write-manifest [--no-exceptions] [--ignore-files] <folder> <manifest>
+//  xdiffr --merge <base> <ours> <theirs> <output>
+//  xdiffr --patch [--context=N] <file1> <file2> [<output>]
+//  xdiffr --diff [-u | --unified[=N] | --normal] [--stats] <file1> <file2>
+bool isCommandLineMode(int argc, char *argv[]);
+int runCommandLine(int argc, char *argv[]);  //needs a QCoreApplication
+
+
+//Writes each folder compare result to stdout as soon as it arrives, as tab separated values or JSON.
+
+class CFolderCompareWriter : public CFolderCompareListener
+{
+public:
+    enum Format { formatTsv, formatJson };
+
+    CFolderCompareWriter(FILE* pOut, Format format);
+
+    void Begin();
+    void End();
+    virtual void OnFileCompared(const std::string& strRelativePath, int nState, int nVerified, qint64 nSize1, qint64 nSize2);
+    virtual void OnFileMoved(const std::string& strRelativePath1, const std::string& strRelativePath2, int nState, int nVerified, qint64 nSize1, qint64 nSize2);
+
+private:
+    void writeRow(const std::string& strRelativePath, const std::string* pStrRelativePath2, int nState, int nVerified, qint64 nSize1, qint64 nSize2);
+    void writeEscaped(const std::string& str);
+
+    FILE* m_pOut;
+    Format m_format;
+    int m_nRows;
+    qint64 m_nLastFlush;
+};
+
+#endif // COMMANDLINE_H
@@ -18,24 +18,93 @@
 #include "QTextStream"
 #include "QtDebug"
 #include <QSettings>
+#include <QFileInfo>
+#include <QDateTime>
 #include "mainwindow.h"
+#include "archive.h"
+#include "gitrepo.h"
+#include "binarydiff.h"
+#include "patchwriter.h"
+#include <QBuffer>
+#include <algorithm>
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
 
 
 const QColor CDiffDoc::CLR_DEFAULT_IDENTICAL = QColor(0,0,0);
 const QColor CDiffDoc::CLR_DEFAULT_DIFFERENT = QColor(0x99,0x00,0x99);
 const QColor CDiffDoc::CLR_DEFAULT_ONLYLEFT  = QColor(0xD0,0x00,0x00);
 const QColor CDiffDoc::CLR_DEFAULT_ONLYRIGHT = QColor(0x00,0x00,0xD0);
+const QColor CDiffDoc::CLR_DEFAULT_MOVED     = QColor(0x00,0x80,0x80);
 
 
-CDiffDoc::CDiffDoc()
+unsigned int hashLine(const std::string& strLine)
+{
+    //FNV-1a
+    unsigned int nHash = 2166136261u;
+    for (size_t n=0; n<strLine.size(); n++) {
+        nHash ^= (unsigned char)strLine[n];
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+void longestIncreasingRun(const std::vector<std::pair<int, int> >& pairs, std::vector<std::pair<int, int> >& run)
+{
+    //longest increasing subsequence of the second lines, by patience sorting in O(n log n).
+    //tails[k] is the pair ending the best run of length k+1 so far, prev[] links each run back.
+    std::vector<int> tails, prev(pairs.size(), -1);
+    for (int n=0; n<(int)pairs.size(); n++)
+    {
+        int nLow = 0, nHigh = tails.size();
+        while (nLow < nHigh) {
+            int nMid = (nLow + nHigh) / 2;
+            if (pairs[tails[nMid]].second < pairs[n].second)
+                nLow = nMid + 1;
+            else
+                nHigh = nMid;
+        }
+        if (nLow > 0)
+            prev[n] = tails[nLow - 1];
+        if (nLow == (int)tails.size())
+            tails.push_back(n);
+        else
+            tails[nLow] = n;
+    }
+
+    run.resize(tails.size());
+    int nRun = tails.size() - 1;
+    for (int n = tails.empty() ? -1 : tails.back(); n >= 0; n = prev[n])
+        run[nRun--] = pairs[n];
+}
+
+
+CDiffDoc::CDiffDoc(bool bInteractive)
 {
     m_bIsCompared = false;
+    m_nComparePasses = 0;
+    m_nLcsCells = LCS_DEFAULT_CELLS;
+    m_nTimeBudget = COMPARE_DEFAULT_BUDGET_MS;
+    m_nPatchContext = PATCH_DEFAULT_CONTEXT;
+    m_bDegraded = false;
+    m_bBinary = false;
+    m_bInteractive = bInteractive;
     m_bShowSelections = true;
     m_bAutoSelect = true;
     m_bExceptionStringsEnabled = true; //remove this, should get it from registry/settings pp
-
-    loadClrSettings();
-    loadFolderExceptions();
+    m_bFoldersShowSame = false;
+    m_bFoldersUseIgnoreFiles = false;
+    m_bFoldersDetectMoves = true;
+    m_nFoldersVerifyMode = 0;
+    m_bFoldersLineStats = false;
+
+    //a doc used for counting changes in a worker thread only needs the compare engine
+    if (bInteractive) {
+        loadClrSettings();
+        loadFolderExceptions();
+        loadCompareSettings();
+    }
 }
 
 CDiffDoc::~CDiffDoc()
@@ -44,53 +113,156 @@ CDiffDoc::~CDiffDoc()
 
 bool CDiffDoc::LoadFile(const char *pStrFilePath, line_array& lines)
 {
+    if (m_bInteractive && m_fileCache.Get(pStrFilePath, lines))
+        return true;
+
+    //gzipped files, and files inside an archive, are decompressed in memory, and a revision spec
+    //such as "HEAD~1:src/main.cpp" is read from git
     QFile file(pStrFilePath);
-    if(!file.open(QIODevice::ReadOnly)) {
-        QMessageBox::information(0, "error", file.errorString());
+    QByteArray unpacked;
+    QBuffer buffer(&unpacked);
+    QIODevice* pDevice = &file;
+    if (CGitRepo::IsRevisionSpec(pStrFilePath)) {
+        if (!CGitRepo::ReadFile(pStrFilePath, unpacked)) {
+            if (m_bInteractive)
+                QMessageBox::information(0, "error", QString("Unable to read ") + pStrFilePath + " from git");
+            return false;
+        }
+        buffer.open(QIODevice::ReadOnly);
+        pDevice = &buffer;
+    }
+    else if (CArchive::IsPackedFile(pStrFilePath)) {
+        if (!CArchive::ReadFile(pStrFilePath, unpacked)) {
+            if (m_bInteractive)
+                QMessageBox::information(0, "error", QString("Unable to decompress ") + pStrFilePath);
+            return false;
+        }
+        buffer.open(QIODevice::ReadOnly);
+        pDevice = &buffer;
+    }
+    else if(!file.open(QIODevice::ReadOnly)) {
+        if (m_bInteractive)
+            QMessageBox::information(0, "error", file.errorString());
+        return false;
+    }
+
+    //a binary file would be split on stray newline bytes into meaningless lines, slowly
+    if (CBinaryDiff::IsBinary(pDevice->peek(BINARY_SNIFF_BYTES))) {
+        m_bBinary = true;
+        pDevice->close();
         return false;
     }
 
     lines.clear();
 
-    QTextStream in(&file);
+    QTextStream in(pDevice);
 
+    //lines are split here rather than by readLine(), which drops the \r of a \r\n and whether the
+    //last line had a newline
     CLine line;
+    QString strText;
+    int nStart = 0;  //of the line not yet ended
     while(!in.atEnd()) {
-        QString strLine = in.readLine();
-        line.m_strLine = strLine.toLocal8Bit().constData();
+        strText.remove(0, nStart);
+        int nScan = strText.size();
+        nStart = 0;
+        strText.append(in.read(LOAD_CHUNK_CHARS));
+
+        int nEnd;
+        while ((nEnd = strText.indexOf(QChar('\n'), nScan)) >= 0) {
+            bool bCR = (nEnd > nStart) && (strText.at(nEnd - 1) == QChar('\r'));
+            line.m_strLine = strText.mid(nStart, nEnd - nStart - (bCR ? 1 : 0)).toLocal8Bit().constData();
+            line.m_nHash = hashLine(line.m_strLine);
+            line.m_nMatchHash = line.m_nHash;
+            line.m_nEol = bCR ? EOL_CRLF : EOL_LF;
+            lines.push_back(line);
+            nStart = nScan = nEnd + 1;
+        }
+    }
+    if (nStart < strText.size()) {
+        line.m_strLine = strText.mid(nStart).toLocal8Bit().constData();
+        line.m_nHash = hashLine(line.m_strLine);
+        line.m_nMatchHash = line.m_nHash;
+        line.m_nEol = EOL_NONE;
         lines.push_back(line);
     }
 
-    file.close();
+    pDevice->close();
+
+    if (m_bInteractive)
+        m_fileCache.Put(pStrFilePath, lines);
 
     return true;
 }
 
 bool CDiffDoc::LoadFiles(const char *pStrFilePath1, const char *pStrFilePath2)
 {
+    m_bBinary = false;
     if (!LoadFile(pStrFilePath1, m_lines1))
         return false;
     if (!LoadFile(pStrFilePath2, m_lines2))
         return false;
 
+    if (m_lineFilter.IsActive()) {
+        m_lineFilter.Apply(m_lines1);
+        m_lineFilter.Apply(m_lines2);
+    }
+
     m_secs1.clear();
     m_secs2.clear();
 
     return true;
 }
 
+void CDiffDoc::SetLines(const line_array& lines1, const line_array& lines2)
+{
+    //the links are from the other doc's compare
+    m_lines1 = lines1;
+    m_lines2 = lines2;
+    for (size_t nLine=0; nLine<m_lines1.size(); nLine++)
+        m_lines1[nLine].m_nLink = -1;
+    for (size_t nLine=0; nLine<m_lines2.size(); nLine++)
+        m_lines2[nLine].m_nLink = -1;
+
+    m_secs1.clear();
+    m_secs2.clear();
+    m_bIsCompared = false;
+}
+
+CCompareOptions CDiffDoc::GetCompareOptions()
+{
+    CCompareOptions options;
+    options.m_lineFilter = m_lineFilter;
+    options.m_nLcsCells = m_nLcsCells;
+    options.m_nTimeBudget = m_nTimeBudget;
+    return options;
+}
+
+void CDiffDoc::SetCompareOptions(const CCompareOptions& options)
+{
+    m_lineFilter = options.m_lineFilter;
+    m_nLcsCells = options.m_nLcsCells;
+    m_nTimeBudget = options.m_nTimeBudget;
+}
+
 void CDiffDoc::Compare()
 {
     bool bChanges = true;
+    bool bRefined = false;
+    m_nComparePasses = 0;
+    m_bDegraded = false;
+    m_nCancelled.fetchAndStoreOrdered(0);
+    m_compareTimer.start();
 
     while (bChanges)
     {
         bChanges = false;
+        m_nComparePasses++;
 
         CSection secWhole1(0, m_lines1.size()-1, &m_lines1);
         CSection secWhole2(0, m_lines2.size()-1, &m_lines2);
 
-        if (SectionMatch(secWhole1, secWhole2))
+        if (!outOfTime() && SectionMatch(secWhole1, secWhole2))
             bChanges = true;
 
         //Temporarily made members, was local vars
@@ -105,16 +277,31 @@ void CDiffDoc::Compare()
         if (MatchSectionLists(secs1, secs2))
             bChanges = true;
 
-        //debugging...
-        qDebug() << "SectionList1:\n";
-        DebugSectionList(secs1);
-        qDebug() << "\n";
-        qDebug() << "SectionList2:\n";
-        DebugSectionList(secs2);
-        qDebug() << "\n";
+        //debugging... compiled out by default, as dumping thousands of sections a pass would eat the time budget
+#ifdef XDIFFR_DEBUG_COMPARE
+        if (m_bInteractive) {
+            qDebug() << "SectionList1:\n";
+            DebugSectionList(secs1);
+            qDebug() << "\n";
+            qDebug() << "SectionList2:\n";
+            DebugSectionList(secs2);
+            qDebug() << "\n";
+        }
+#endif
+
+        //once the anchors run out, what is left gets one LCS refinement, and passes go on in case
+        //its links leave smaller sections with unique lines
+        if (!bChanges && !bRefined && !outOfTime()) {
+            bRefined = true;
+            if (refineSectionLists(secs1, secs2))
+                bChanges = true;
+        }
 
-        if (!bChanges) //last time in loop
+        if (!bChanges) { //last time in loop
+            if (!isCancelled())
+                detectMoves(secs1, secs2);
             SetFinalSectionLists(secs1, secs2);
+        }
 
     }
 
@@ -124,38 +311,121 @@ void CDiffDoc::Compare()
     m_bIsCompared = true;
 }
 
+void CDiffDoc::Adopt(CDiffDoc& doc)
+{
+    //Swapping keeps the lines where they are in memory, but the sections still point at the other
+    //doc's line arrays, so they are pointed at this doc's.
+    m_lines1.swap(doc.m_lines1);
+    m_lines2.swap(doc.m_lines2);
+    m_secs1.swap(doc.m_secs1);
+    m_secs2.swap(doc.m_secs2);
+    for (int nSection=0; nSection<m_secs1.size(); nSection++)
+        m_secs1[nSection].m_pLines = &m_lines1;
+    for (int nSection=0; nSection<m_secs2.size(); nSection++)
+        m_secs2[nSection].m_pLines = &m_lines2;
+    for (int nSection=0; nSection<doc.m_secs1.size(); nSection++)
+        doc.m_secs1[nSection].m_pLines = &doc.m_lines1;
+    for (int nSection=0; nSection<doc.m_secs2.size(); nSection++)
+        doc.m_secs2[nSection].m_pLines = &doc.m_lines2;
+
+    m_bIsCompared = doc.m_bIsCompared;
+    m_bDegraded = doc.m_bDegraded;
+    m_nComparePasses = doc.m_nComparePasses;
+    doc.m_bIsCompared = false;
+}
+
+void CDiffDoc::GetChangeCounts(int& nAdded, int& nRemoved, int& nSections)
+{
+    //Lines in left only sections were removed and lines in right only sections were added.
+    //A left section linked to a right one is a single change, so only unlinked right sections add to the count.
+    nAdded = nRemoved = nSections = 0;
+
+    for (int nSection=0; nSection<m_secs1.size(); nSection++)
+    {
+        const CSection& sec = m_secs1[nSection];
+        if (sec.m_nState == STATE_SAME)
+            continue;
+        nRemoved += sec.m_nLastLine - sec.m_nFirstLine + 1;
+        nSections++;
+    }
+
+    for (int nSection=0; nSection<m_secs2.size(); nSection++)
+    {
+        const CSection& sec = m_secs2[nSection];
+        if (sec.m_nState == STATE_SAME)
+            continue;
+        nAdded += sec.m_nLastLine - sec.m_nFirstLine + 1;
+        if (sec.m_nLink < 0)
+            nSections++;
+    }
+
+    //MatchSectionLists() doesn't link the sections of two wholly different files, but it is still one change
+    if ((m_secs1.size() == 1) && (m_secs2.size() == 1) && (nSections == 2))
+        nSections = 1;
+}
+
 bool CDiffDoc::SectionMatch(CSection& section1, CSection& section2)
 {
-    CLineMap map1, map2;
+    std::vector<std::pair<int, int> > anchors;
+    findAnchors(section1, section2, anchors);
+
     bool bLinked = false;
+    for (size_t n=0; n<anchors.size(); n++)
+    {
+        if (ExpandAnchor(anchors[n].first, anchors[n].second))
+            bLinked = true;
+    }
 
+    return (bLinked);
+}
+
+void CDiffDoc::findAnchors(CSection& section1, CSection& section2, std::vector<std::pair<int, int> >& anchors)
+{
+    //Lines unique to both sections are candidate anchors. Linking them in left file order would let an
+    //early one from a moved block cross the ones after it, so only the longest run of candidates in the
+    //same order in both files is kept, as in patience diff. Candidates that would cross a link made by
+    //an earlier pass are dropped too, so a moved block is left to show as removed and added.
+    CLineMap map1, map2;
     map1.MakeMap(section1);
     map2.MakeMap(section2);
 
-//	map1.DebugMap();
+    int nSize1 = section1.m_nLastLine - section1.m_nFirstLine + 1;
+    std::vector<int> nextLinks(nSize1 > 0 ? nSize1 : 0);  //for each left line, the link of the next linked line below it
+    int nNextLink = m_lines2.size();
+    for (int nLine=section1.m_nLastLine; nLine >= section1.m_nFirstLine; nLine--)
+    {
+        nextLinks[nLine - section1.m_nFirstLine] = nNextLink;
+        if (m_lines1[nLine].m_nLink >= 0)
+            nNextLink = m_lines1[nLine].m_nLink;
+    }
 
+    std::vector<std::pair<int, int> > candidates;  //left line, right line
+    int nPrevLink = -1;
     for (int nLine=section1.m_nFirstLine; nLine <= section1.m_nLastLine; nLine++)
     {
-        if ((m_lines1[nLine].m_nLink < 0) &&
-            (map1.GetLine(m_lines1[nLine].m_strLine.c_str()) >= 0) &&
-            (map2.GetLine(m_lines1[nLine].m_strLine.c_str()) >= 0))
-        {
-            int nLine2 = map2.GetLine(m_lines1[nLine].m_strLine.c_str());
-
-            if (m_lines2[nLine2].m_nLink >=0)
-                continue;
-
-            if (ExpandAnchor(nLine, nLine2))
-                bLinked = true;
+        if (m_lines1[nLine].m_nLink >= 0) {
+            nPrevLink = m_lines1[nLine].m_nLink;
+            continue;
         }
+        if (map1.GetLine(m_lines1[nLine]) < 0)
+            continue;
+        int nLine2 = map2.GetLine(m_lines1[nLine]);
+        if ((nLine2 > nPrevLink) && (nLine2 < nextLinks[nLine - section1.m_nFirstLine]))
+            candidates.push_back(std::make_pair(nLine, nLine2));
     }
 
-    return (bLinked);
+    longestIncreasingRun(candidates, anchors);
+}
+
+bool CDiffDoc::linesMatch(int nLine1, int nLine2)
+{
+    //filtered lines match on their match text, while the views still show the original lines
+    return (m_lines1[nLine1].m_nMatchHash == m_lines2[nLine2].m_nMatchHash) && (m_lines1[nLine1].GetMatchText() == m_lines2[nLine2].GetMatchText());
 }
 
 bool CDiffDoc::LineLink(int nLine1, int nLine2)
 {
-    if (m_lines1[nLine1].m_strLine == m_lines2[nLine2].m_strLine)
+    if (linesMatch(nLine1, nLine2))
     {
         m_lines1[nLine1].m_nLink = nLine2;
         m_lines2[nLine2].m_nLink = nLine1;
@@ -234,21 +504,22 @@ bool CDiffDoc::MatchSectionLists(section_list& secs1, section_list& secs2)
 {
     bool bLinked = false;
 
-    //link same sections
+    //link same sections, looking them up by first line as a refined compare can leave thousands
     int nSection, nSection2, nLink;
+    std::map<int, int> sectionsByLine2;
+    for (nSection2=0; nSection2<secs2.size(); nSection2++)
+        sectionsByLine2[secs2[nSection2].m_nFirstLine] = nSection2;
     for (nSection=0; nSection<secs1.size(); nSection++)
     {
         if (secs1[nSection].m_nState == STATE_SAME)
         {
             nLink = m_lines1[secs1[nSection].m_nFirstLine].m_nLink;
-            for (nSection2=0; nSection2<secs2.size(); nSection2++)
+            std::map<int, int>::iterator it = sectionsByLine2.find(nLink);
+            if (it != sectionsByLine2.end())
             {
-                if (nLink == secs2[nSection2].m_nFirstLine)
-                {
-                    secs1[nSection].m_nLink = nSection2;
-                    secs2[nSection2].m_nLink = nSection;
-                }
-
+                nSection2 = it->second;
+                secs1[nSection].m_nLink = nSection2;
+                secs2[nSection2].m_nLink = nSection;
             }
         }
     }
@@ -282,7 +553,7 @@ bool CDiffDoc::MatchSectionLists(section_list& secs1, section_list& secs2)
             secs2[nOtherSection].m_nLink = nSection;
 
             //addition for build 14, thorough diffing
-            if (SectionMatch(secs1[nSection], secs2[nOtherSection]))
+            if (!outOfTime() && SectionMatch(secs1[nSection], secs2[nOtherSection]))
                 bLinked = true;
         }
         else   //only in left file (ie. deleted section)
@@ -308,6 +579,304 @@ bool CDiffDoc::MatchSectionLists(section_list& secs1, section_list& secs2)
     return bLinked;
 }
 
+bool CDiffDoc::refineSectionLists(section_list& secs1, section_list& secs2)
+{
+    //MatchSectionLists() doesn't link the sections of two wholly different files
+    if ((secs1.size() == 1) && (secs2.size() == 1) && (secs1[0].m_nState != STATE_SAME) && (secs2[0].m_nState != STATE_SAME))
+        return bandedMatch(secs1[0], secs2[0]);
+
+    //smallest pairs first, so running out of time leaves the biggest unrefined
+    std::vector<std::pair<qint64, int> > pairs;  //cells, section
+    for (int nSection=0; nSection<secs1.size(); nSection++)
+    {
+        const CSection& sec = secs1[nSection];
+        if ((sec.m_nState == STATE_SAME) || (sec.m_nLink < 0))
+            continue;
+        const CSection& sec2 = secs2[sec.m_nLink];
+        qint64 nCells = (qint64)(sec.m_nLastLine - sec.m_nFirstLine + 1) * (sec2.m_nLastLine - sec2.m_nFirstLine + 1);
+        pairs.push_back(std::make_pair(nCells, nSection));
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    bool bLinked = false;
+    for (size_t n=0; (n<pairs.size()) && !outOfTime(); n++)
+    {
+        const CSection& sec = secs1[pairs[n].second];
+        if (bandedMatch(sec, secs2[sec.m_nLink]))
+            bLinked = true;
+    }
+
+    return bLinked;
+}
+
+bool CDiffDoc::outOfTime()
+{
+    if (!m_bDegraded && (isCancelled() || ((m_nTimeBudget > 0) && (m_compareTimer.elapsed() > m_nTimeBudget))))
+        m_bDegraded = true;
+    return m_bDegraded;
+}
+
+bool CDiffDoc::bandedMatch(const CSection& section1, const CSection& section2)
+{
+    //Longest common subsequence of two corresponding sections, counting only paths within
+    //LCS_BAND_MARGIN diagonals of the ones joining the sections' corners. Cell (i, j) is the first i
+    //lines of section1 against the first j of section2, and is kept at d = j - i - nMinDiag of its row.
+    int nLines1 = section1.m_nLastLine - section1.m_nFirstLine + 1;
+    int nLines2 = section2.m_nLastLine - section2.m_nFirstLine + 1;
+    int nMinDiag = qMax(qMin(0, nLines2 - nLines1) - LCS_BAND_MARGIN, -nLines1);
+    int nMaxDiag = qMin(qMax(0, nLines2 - nLines1) + LCS_BAND_MARGIN, nLines2);
+    int nWidth = nMaxDiag - nMinDiag + 1;
+    if ((qint64)nLines1 * nWidth > m_nLcsCells)
+        return false;
+
+    enum { FROM_DIAG, FROM_UP, FROM_LEFT };
+    std::vector<unsigned char> from((size_t)nLines1 * nWidth);
+
+    //two rows of lengths, offset by one so the cells either side of the band read as -1 (unreachable)
+    std::vector<int> prev(nWidth + 2, -1), cur(nWidth + 2, -1);
+    for (int j=0; j<=nMaxDiag; j++)
+        prev[j - nMinDiag + 1] = 0;
+
+    for (int i=1; i<=nLines1; i++)
+    {
+        std::fill(cur.begin(), cur.end(), -1);
+        int nFirst = qMax(0, i + nMinDiag), nLast = qMin(nLines2, i + nMaxDiag);
+        for (int j=nFirst; j<=nLast; j++)
+        {
+            int d = j - i - nMinDiag;
+            unsigned char& nFrom = from[(size_t)(i - 1) * nWidth + d];
+            if (j == 0) {
+                cur[d + 1] = 0;
+                nFrom = FROM_UP;
+            }
+            else if ((prev[d + 1] >= 0) && linesMatch(section1.m_nFirstLine + i - 1, section2.m_nFirstLine + j - 1)) {
+                cur[d + 1] = prev[d + 1] + 1;
+                nFrom = FROM_DIAG;
+            }
+            else if (prev[d + 2] >= cur[d]) {
+                cur[d + 1] = prev[d + 2];
+                nFrom = FROM_UP;
+            }
+            else {
+                cur[d + 1] = cur[d];
+                nFrom = FROM_LEFT;
+            }
+        }
+        prev.swap(cur);
+    }
+
+    if (prev[nLines2 - nLines1 - nMinDiag + 1] <= 0)
+        return false;
+
+    //back from the far corner, linking the lines on the way
+    int i = nLines1, j = nLines2;
+    while ((i > 0) && (j > 0))
+    {
+        unsigned char nFrom = from[(size_t)(i - 1) * nWidth + (j - i - nMinDiag)];
+        if (nFrom == FROM_DIAG) {
+            LineLink(section1.m_nFirstLine + i - 1, section2.m_nFirstLine + j - 1);
+            i--;
+            j--;
+        }
+        else if (nFrom == FROM_UP)
+            i--;
+        else
+            j--;
+    }
+
+    return true;
+}
+
+void CDiffDoc::detectMoves(section_list& secs1, section_list& secs2)
+{
+    //Every run of MOVE_MIN_LINES lines in the right file's changed sections is hashed, and the runs of
+    //the left file's changed sections are looked up among them. A run found elsewhere in the file is
+    //extended as far as the lines keep matching, and becomes a moved section at both ends.
+    std::vector<std::pair<unsigned int, int> > runs2;  //hash, first line
+    std::vector<int> sectionsOf2(m_lines2.size(), -1);
+    std::vector<unsigned int> hashes;
+    for (int nSection=0; nSection<secs2.size(); nSection++)
+    {
+        const CSection& sec = secs2[nSection];
+        if (sec.m_nState == STATE_SAME)
+            continue;
+        for (int nLine=sec.m_nFirstLine; nLine<=sec.m_nLastLine; nLine++)
+            sectionsOf2[nLine] = nSection;
+        hashRuns(m_lines2, sec, hashes);
+        for (size_t n=0; n<hashes.size(); n++)
+            runs2.push_back(std::make_pair(hashes[n], sec.m_nFirstLine + (int)n));
+    }
+    if (runs2.empty())
+        return;
+    std::sort(runs2.begin(), runs2.end());
+
+    std::vector<bool> moved2(m_lines2.size(), false);
+    std::vector<std::pair<int, int> > moved1;  //first and last lines
+    std::vector<int> movedTo;                  //first line in the right file, for each of moved1
+    for (int nSection=0; nSection<secs1.size(); nSection++)
+    {
+        const CSection& sec = secs1[nSection];
+        if (sec.m_nState == STATE_SAME)
+            continue;
+        hashRuns(m_lines1, sec, hashes);
+
+        int nLine = sec.m_nFirstLine;
+        while (nLine - sec.m_nFirstLine < (int)hashes.size())
+        {
+            int nLine2 = -1;
+            std::vector<std::pair<unsigned int, int> >::iterator it = std::lower_bound(runs2.begin(), runs2.end(), std::make_pair(hashes[nLine - sec.m_nFirstLine], -1));
+            for (int nCandidate=0; (nCandidate < MOVE_MAX_CANDIDATES) && (it != runs2.end()) && (it->first == hashes[nLine - sec.m_nFirstLine]); nCandidate++, ++it)
+            {
+                //lines at the same place in both files weren't moved, they just weren't matched
+                if (sectionsOf2[it->second] == sec.m_nLink)
+                    continue;
+                bool bMatch = true;
+                for (int n=0; bMatch && (n < MOVE_MIN_LINES); n++)
+                    bMatch = !moved2[it->second + n] && linesMatch(nLine + n, it->second + n);
+                if (bMatch) {
+                    nLine2 = it->second;
+                    break;
+                }
+            }
+            if (nLine2 < 0) {
+                nLine++;
+                continue;
+            }
+
+            int nLast2 = secs2[sectionsOf2[nLine2]].m_nLastLine;
+            int nLength = MOVE_MIN_LINES;
+            while ((nLine + nLength <= sec.m_nLastLine) && (nLine2 + nLength <= nLast2) && !moved2[nLine2 + nLength] && linesMatch(nLine + nLength, nLine2 + nLength))
+                nLength++;
+            for (int n=0; n<nLength; n++)
+                moved2[nLine2 + n] = true;
+            moved1.push_back(std::make_pair(nLine, nLine + nLength - 1));
+            movedTo.push_back(nLine2);
+            nLine += nLength;
+        }
+    }
+    if (moved1.empty())
+        return;
+
+    //the right ends in line order, remembering which move each is
+    std::vector<std::pair<int, int> > order2;  //first line, move
+    for (size_t nMove=0; nMove<moved1.size(); nMove++)
+        order2.push_back(std::make_pair(movedTo[nMove], (int)nMove));
+    std::sort(order2.begin(), order2.end());
+    std::vector<std::pair<int, int> > moved2Lines;
+    for (size_t n=0; n<order2.size(); n++)
+        moved2Lines.push_back(std::make_pair(order2[n].first, order2[n].first + moved1[order2[n].second].second - moved1[order2[n].second].first));
+
+    std::vector<int> firstPieces1, firstPieces2, movedPieces1, movedPieces2;
+    splitMovedSections(secs1, moved1, firstPieces1, movedPieces1);
+    splitMovedSections(secs2, moved2Lines, firstPieces2, movedPieces2);
+
+    //the pieces still have the links of the sections they were split from
+    relinkPieces(secs1, secs2, firstPieces1, firstPieces2);
+    relinkPieces(secs2, secs1, firstPieces2, firstPieces1);
+    for (size_t n=0; n<order2.size(); n++)
+    {
+        int nSection1 = movedPieces1[order2[n].second], nSection2 = movedPieces2[n];
+        secs1[nSection1].m_nMoveLink = nSection2;
+        secs2[nSection2].m_nMoveLink = nSection1;
+    }
+}
+
+void CDiffDoc::hashRuns(const line_array& lines, const CSection& section, std::vector<unsigned int>& hashes)
+{
+    //rolling polynomial hash of the match hashes of each run of MOVE_MIN_LINES lines in the section
+    const unsigned int nBase = 16777619u;
+    unsigned int nOutFactor = 1;  //nBase to the power of MOVE_MIN_LINES-1, for taking out the run's first line
+    for (int n=1; n<MOVE_MIN_LINES; n++)
+        nOutFactor *= nBase;
+
+    hashes.clear();
+    unsigned int nHash = 0;
+    for (int nLine=section.m_nFirstLine; nLine<=section.m_nLastLine; nLine++)
+    {
+        int nRunStart = nLine - MOVE_MIN_LINES + 1;
+        if (nRunStart > section.m_nFirstLine)
+            nHash -= lines[nRunStart - 1].m_nMatchHash * nOutFactor;
+        nHash = nHash * nBase + lines[nLine].m_nMatchHash;
+        if (nRunStart >= section.m_nFirstLine)
+            hashes.push_back(nHash);
+    }
+}
+
+void CDiffDoc::splitMovedSections(section_list& secs, const std::vector<std::pair<int, int> >& moved, std::vector<int>& firstPieces, std::vector<int>& movedPieces)
+{
+    //Splits the sections holding the moved runs (first and last lines, in line order) into pieces. For each
+    //old section, firstPieces is the index of its first piece, with one more entry for the end of the list.
+    section_list split;
+    firstPieces.resize(secs.size() + 1);
+    movedPieces.resize(moved.size());
+    size_t nMove = 0;
+    for (int nSection=0; nSection<secs.size(); nSection++)
+    {
+        const CSection& sec = secs[nSection];
+        firstPieces[nSection] = split.size();
+
+        int nLine = sec.m_nFirstLine;
+        for ( ; (nMove < moved.size()) && (moved[nMove].first <= sec.m_nLastLine); nMove++)
+        {
+            CSection piece = sec;
+            if (moved[nMove].first > nLine) {
+                piece.m_nFirstLine = nLine;
+                piece.m_nLastLine = moved[nMove].first - 1;
+                split.push_back(piece);
+            }
+            piece.m_nFirstLine = moved[nMove].first;
+            piece.m_nLastLine = moved[nMove].second;
+            piece.m_nState |= STATE_MOVED;
+            movedPieces[nMove] = split.size();
+            split.push_back(piece);
+            nLine = moved[nMove].second + 1;
+        }
+        if (nLine <= sec.m_nLastLine) {
+            CSection piece = sec;
+            piece.m_nFirstLine = nLine;
+            split.push_back(piece);
+        }
+    }
+    firstPieces[secs.size()] = split.size();
+    secs.swap(split);
+}
+
+void CDiffDoc::relinkPieces(section_list& secs, const section_list& otherSecs, const std::vector<int>& firstPieces, const std::vector<int>& otherFirstPieces)
+{
+    //Each piece of a split section is linked to its own counterpart among the other section's pieces: the
+    //pieces that weren't moved pair up in order, and the rest, and the last pieces, link to the last piece,
+    //so whatever follows the section lines up with whatever follows the other. Moved pieces are paired
+    //by m_nMoveLink. Links to sections that weren't split just follow the new numbering.
+    for (size_t nOld=0; nOld+1<firstPieces.size(); nOld++)
+    {
+        int nFirst = firstPieces[nOld], nEnd = firstPieces[nOld + 1];
+        int nUnmoved = 0;
+        for (int nPiece=nFirst; nPiece<nEnd; nPiece++)
+        {
+            CSection& sec = secs[nPiece];
+            if ((sec.m_nCorrespond >= 0) && (sec.m_nCorrespond < (int)otherFirstPieces.size()))
+                sec.m_nCorrespond = otherFirstPieces[sec.m_nCorrespond];
+            if ((sec.m_nLink < 0) || (sec.m_nLink + 1 >= (int)otherFirstPieces.size()))
+                continue;
+
+            int nOtherFirst = otherFirstPieces[sec.m_nLink], nOtherEnd = otherFirstPieces[sec.m_nLink + 1];
+            int nLink = nOtherEnd - 1;
+            if (!(sec.m_nState & STATE_MOVED) && (nPiece < nEnd - 1)) {
+                int nOtherUnmoved = 0;
+                for (int nOther=nOtherFirst; nOther<nOtherEnd - 1; nOther++) {
+                    if (!(otherSecs[nOther].m_nState & STATE_MOVED) && (nOtherUnmoved++ == nUnmoved)) {
+                        nLink = nOther;
+                        break;
+                    }
+                }
+            }
+            if (!(sec.m_nState & STATE_MOVED))
+                nUnmoved++;
+            sec.m_nLink = nLink;
+        }
+    }
+}
+
 int CDiffDoc::FindEndOfMatched(line_array& lines, int nStart)
 {
     Q_ASSERT(lines[nStart].m_nLink > -1);
@@ -370,12 +939,19 @@ void CDiffDoc::saveClrSetting(const char *pStrSettingName, const QColor& clr)
     settings.endGroup();
 }
 
+void CDiffDoc::ReloadSettings()
+{
+    loadFolderExceptions();
+    loadCompareSettings();
+}
+
 void CDiffDoc::loadClrSettings()
 {
     QSettings settings(ORG_NAME, APP_NAME);
 
     settings.beginGroup("colours");
     m_clrIdentical.setRgba(settings.value("identical", CLR_DEFAULT_IDENTICAL.rgba()).toUInt());
+    m_clrMoved.setRgba(settings.value("moved", CLR_DEFAULT_MOVED.rgba()).toUInt());
     settings.endGroup();
 }
 
@@ -392,6 +968,41 @@ void CDiffDoc::loadFolderExceptions()
     m_listExceptions = settings.value("folderExceptions", defaultList).toStringList();
 
     m_bFoldersShowSame = settings.value("foldersShowSame", false).toBool();
+    m_bFoldersUseIgnoreFiles = settings.value("foldersUseIgnoreFiles", false).toBool();
+    m_bFoldersDetectMoves = settings.value("foldersDetectMoves", true).toBool();
+    m_nFoldersVerifyMode = settings.value("foldersVerifyMode", 0).toInt();
+    m_bFoldersLineStats = settings.value("foldersLineStats", false).toBool();
+}
+
+void CDiffDoc::loadCompareSettings()
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    m_lineFilter.SetFlags(settings.value("compareIgnoreFlags", 0).toInt());
+    m_lineFilter.SetMasks(settings.value("compareMasks").toStringList());
+    m_nLcsCells = settings.value("compareLcsCells", LCS_DEFAULT_CELLS).toInt();
+    m_nTimeBudget = settings.value("compareTimeBudget", COMPARE_DEFAULT_BUDGET_MS).toInt();
+    m_nPatchContext = settings.value("patchContext", PATCH_DEFAULT_CONTEXT).toInt();
+}
+
+void CDiffDoc::setCompareIgnoreFlags(int nFlags)
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue("compareIgnoreFlags", nFlags);
+    m_lineFilter.SetFlags(nFlags);
+}
+
+void CDiffDoc::setCompareMasks(const QStringList& list)
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue("compareMasks", list);
+    m_lineFilter.SetMasks(list);
+}
+
+void CDiffDoc::setPatchContext(int nLines)
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue("patchContext", nLines);
+    m_nPatchContext = nLines;
 }
 
 void CDiffDoc::saveFolderExceptions(const QStringList& list)
@@ -415,48 +1026,182 @@ void CDiffDoc::setFoldersShowSame(bool bShow)
     m_bFoldersShowSame = bShow;
 }
 
+void CDiffDoc::setFoldersUseIgnoreFiles(bool bUse)
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue("foldersUseIgnoreFiles", bUse);
+    m_bFoldersUseIgnoreFiles = bUse;
+}
+
+void CDiffDoc::setFoldersDetectMoves(bool bDetect)
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue("foldersDetectMoves", bDetect);
+    m_bFoldersDetectMoves = bDetect;
+}
+
+void CDiffDoc::setFoldersVerifyMode(int nMode)
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue("foldersVerifyMode", nMode);
+    m_nFoldersVerifyMode = nMode;
+}
+
+void CDiffDoc::setFoldersLineStats(bool bCount)
+{
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue("foldersLineStats", bCount);
+    m_bFoldersLineStats = bCount;
+}
+
 ////////////////// CLineMap /////////////////////////
 
-int CLineMap::GetLine(const char *pStrLine)
+int CLineMap::GetLine(const CLine& line)
 {
-    std::map<std::string, int>::iterator it = m_map.find(pStrLine);
-    if (it == m_map.end())
+    if (m_buckets.empty())
         return MI_NOTFOUND;
 
-    return it->second;
+    size_t nBucket = bucketOf(line.m_nMatchHash);
+    while (m_buckets[nBucket].first >= 0) {
+        const CLine& other = m_pLines->at(m_buckets[nBucket].first);
+        if ((other.m_nMatchHash == line.m_nMatchHash) && (other.GetMatchText() == line.GetMatchText()))
+            return m_buckets[nBucket].second;
+        nBucket = (nBucket + 1) & (m_buckets.size() - 1);
+    }
+    return MI_NOTFOUND;
 }
 
-void CLineMap::AddItem(const char *pStrLine, int nLine)
+void CLineMap::addItem(int nLine)
 {
-    std::map<std::string, int>::iterator it = m_map.find(pStrLine);
-    if (it == m_map.end())
-        m_map[pStrLine] = nLine;
-    else
-        m_map[pStrLine] = MI_NOTUNIQUE;
+    const CLine& line = m_pLines->at(nLine);
+    size_t nBucket = bucketOf(line.m_nMatchHash);
+    while (m_buckets[nBucket].first >= 0) {
+        const CLine& other = m_pLines->at(m_buckets[nBucket].first);
+        if ((other.m_nMatchHash == line.m_nMatchHash) && (other.GetMatchText() == line.GetMatchText())) {
+            m_buckets[nBucket].second = MI_NOTUNIQUE;
+            return;
+        }
+        nBucket = (nBucket + 1) & (m_buckets.size() - 1);
+    }
+    m_buckets[nBucket] = std::make_pair(nLine, nLine);
 }
 
 void CLineMap::MakeMap(CSection& section)
 {
-    m_map.clear();
+    m_pLines = section.m_pLines;
 
-    line_array* pLines = section.m_pLines;
+    //at most half full, so probe runs stay short
+    size_t nLines = section.m_nLastLine >= section.m_nFirstLine ? section.m_nLastLine - section.m_nFirstLine + 1 : 0;
+    size_t nBuckets = 16;
+    while (nBuckets < nLines * 2)
+        nBuckets <<= 1;
+    m_buckets.assign(nBuckets, std::make_pair(-1, -1));
 
     for (int nLine = section.m_nFirstLine; nLine <= section.m_nLastLine; nLine++)
     {
-        CLine& line = pLines->at(nLine);
-
         //only add if line is not matched yet
-        if (line.m_nLink == -1)
-            AddItem(line.m_strLine.c_str(), nLine);
+        if (m_pLines->at(nLine).m_nLink == -1)
+            addItem(nLine);
     }
 }
 
 void CLineMap::DebugMap()
 {
-    std::map<std::string, int>::iterator it = m_map.begin();
-    for ( ; it != m_map.end(); ++it) {
-        qDebug() << it->second << " " << it->first.c_str();
+    for (size_t n = 0; n < m_buckets.size(); n++) {
+        if (m_buckets[n].first >= 0)
+            qDebug() << m_buckets[n].second << " " << m_pLines->at(m_buckets[n].first).GetMatchText().c_str();
     }
 }
 
 
+
+////////////////// CLoadedFileCache /////////////////////////
+
+bool CLoadedFileCache::Get(const char *pStrFilePath, line_array& lines)
+{
+    std::map<std::string, CCachedFile>::iterator it = m_files.find(pStrFilePath);
+    if (it == m_files.end()) {
+        m_nMisses++;
+        return false;
+    }
+
+    CCachedFile& cached = it->second;
+    qint64 nInode, nSize, nModified;
+    if (!getFileState(pStrFilePath, nInode, nSize, nModified) ||
+        (nInode != cached.m_nInode) || (nSize != cached.m_nSize) || (nModified != cached.m_nModified)) {
+        //changed, or replaced by another file of the same name
+        m_nBytes -= cached.m_nBytes;
+        m_files.erase(it);
+        m_nMisses++;
+        return false;
+    }
+
+    lines = cached.m_lines;
+    cached.m_nLastUsed = ++m_nUseCount;
+    m_nHits++;
+    return true;
+}
+
+void CLoadedFileCache::Put(const char *pStrFilePath, const line_array& lines)
+{
+    qint64 nInode, nSize, nModified;
+    if (!getFileState(pStrFilePath, nInode, nSize, nModified))
+        return;
+
+    qint64 nBytes = 0;
+    for (size_t nLine=0; nLine<lines.size(); nLine++)
+        nBytes += sizeof(CLine) + lines[nLine].m_strLine.size();
+    if (nBytes > FILECACHE_MAX_BYTES / 2)
+        return;  //too big to be worth pushing everything else out
+
+    std::map<std::string, CCachedFile>::iterator it = m_files.find(pStrFilePath);
+    if (it != m_files.end()) {
+        m_nBytes -= it->second.m_nBytes;
+        m_files.erase(it);
+    }
+    evict(nBytes);
+
+    CCachedFile& cached = m_files[pStrFilePath];
+    cached.m_nInode = nInode;
+    cached.m_nSize = nSize;
+    cached.m_nModified = nModified;
+    cached.m_lines = lines;
+    for (size_t nLine=0; nLine<cached.m_lines.size(); nLine++)
+        cached.m_lines[nLine].m_nLink = -1;
+    cached.m_nBytes = nBytes;
+    cached.m_nLastUsed = ++m_nUseCount;
+    m_nBytes += nBytes;
+}
+
+void CLoadedFileCache::evict(qint64 nBytesNeeded)
+{
+    //only a handful of files fit, so a scan for the least recently used is cheap enough
+    while (!m_files.empty() && (m_nBytes + nBytesNeeded > FILECACHE_MAX_BYTES))
+    {
+        std::map<std::string, CCachedFile>::iterator itOldest = m_files.begin();
+        std::map<std::string, CCachedFile>::iterator it = m_files.begin();
+        for ( ; it != m_files.end(); ++it)
+            if (it->second.m_nLastUsed < itOldest->second.m_nLastUsed)
+                itOldest = it;
+        m_nBytes -= itOldest->second.m_nBytes;
+        m_files.erase(itOldest);
+    }
+}
+
+bool CLoadedFileCache::getFileState(const char *pStrFilePath, qint64& nInode, qint64& nSize, qint64& nModified)
+{
+    QFileInfo info(pStrFilePath);
+    if (!info.isFile())
+        return false;
+    nSize = info.size();
+    nModified = info.lastModified().toMSecsSinceEpoch();
+
+    //the inode catches a file replaced by another with the same size and time, e.g. by a checkout
+    nInode = 0;
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (stat(pStrFilePath, &st) == 0)
+        nInode = st.st_ino;
+#endif
+    return true;
+}
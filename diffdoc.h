@@ -17,43 +17,124 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <QtGlobal>
 #include <QColor>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include "linefilter.h"
 
 
 #define STATE_SAME			1
 #define STATE_LEFTONLY		2
 #define STATE_RIGHTONLY		4
 #define STATE_SELECTED		8
+#define STATE_MOVED         16   //with STATE_LEFTONLY or STATE_RIGHTONLY. m_nMoveLink is the other end.
 
 //MAP ITEM defines
 #define MI_NOTUNIQUE		-1   //ie has more than one entry
 #define MI_NOTFOUND			-2
 
+//Final refinement of section pairs the unique line anchors leave unmatched, e.g. runs of "}" or
+//repeated log lines, with an LCS confined to a band of diagonals around the pair's straight path
+#define LCS_BAND_MARGIN     32         //diagonals either side of the path
+#define LCS_DEFAULT_CELLS   4000000    //pairs with bigger bands are left as they are. Each cell costs a byte.
+
+//Past its time budget a compare stops looking for more anchors and refining, and makes the sections
+//from the links it has. The result is still a valid compare, just one that may show more changes.
+#define COMPARE_DEFAULT_BUDGET_MS   2000   //the "compareTimeBudget" setting. 0 for no limit.
+
+//Moved blocks are found among the lines left unmatched once the compare is done
+#define MOVE_MIN_LINES          4    //shorter runs repeat by chance too often, e.g. a "}" and a blank line
+#define MOVE_MAX_CANDIDATES     16   //places a run's hash is checked at, so a very common run can't make the pass quadratic
+
 #define VIEW_LEFT           1
 #define VIEW_RIGHT          2
 
 
+unsigned int hashLine(const std::string& strLine);
+
+//Of line pairs (line1, line2) in order of line1, the longest run also in order of line2, as the anchors
+//of a patience diff. Lines must be unique on each side.
+void longestIncreasingRun(const std::vector<std::pair<int, int> >& pairs, std::vector<std::pair<int, int> >& run);
+
+//how a line ended in its file, which the compare ignores but a patch has to keep
+#define EOL_LF      0
+#define EOL_CRLF    1
+#define EOL_NONE    2   //the file's last line, with no newline after it
+
 class CLine
 {
 public:
     std::string m_strLine;
+    unsigned int m_nHash;  //of m_strLine, so most unequal lines are told apart without comparing strings
+    std::string m_strMatch;  //what the compare matches on, if a CLineFilter changed the line
+    bool m_bFiltered;        //m_strMatch is set
+    unsigned char m_nEol;    //EOL_
+    unsigned int m_nMatchHash;  //of the match text
     int m_nLink;
 
-    CLine() {m_strLine=""; m_nLink = -1;}
+    CLine() {m_strLine=""; m_nHash=0; m_bFiltered=false; m_nEol=EOL_LF; m_nMatchHash=0; m_nLink = -1;}
 
-    CLine(const CLine& l) {m_strLine=l.m_strLine; m_nLink=l.m_nLink;}
+    CLine(const CLine& l) {m_strLine=l.m_strLine; m_nHash=l.m_nHash; m_strMatch=l.m_strMatch; m_bFiltered=l.m_bFiltered; m_nEol=l.m_nEol; m_nMatchHash=l.m_nMatchHash; m_nLink=l.m_nLink;}
 
     const CLine& operator =(const CLine& l)
     {
         m_strLine  = l.m_strLine;
+        m_nHash = l.m_nHash;
+        m_strMatch = l.m_strMatch;
+        m_bFiltered = l.m_bFiltered;
+        m_nEol = l.m_nEol;
+        m_nMatchHash = l.m_nMatchHash;
         m_nLink = l.m_nLink;
         return *this;
     }
+
+    const std::string& GetMatchText() const { return m_bFiltered ? m_strMatch : m_strLine; }
 };
 
 typedef std::vector<CLine> line_array;
 
 
+#define LOAD_CHUNK_CHARS        (64 * 1024)  //read at a time, then split into lines
+#define FILECACHE_MAX_BYTES     (64 * 1024 * 1024)  //roughly, counting line text and per line overhead
+
+//Keeps recently loaded files as lines, so comparing A with B and then A with C, or comparing the
+//same files again, only reads the files that have changed. A file is reused while its path, inode,
+//size and modified time are unchanged. The least recently used files are dropped to stay in budget.
+class CLoadedFileCache
+{
+public:
+    CLoadedFileCache() { m_nBytes = 0; m_nUseCount = 0; m_nHits = m_nMisses = 0; }
+
+    bool Get(const char *pStrFilePath, line_array& lines);  //false if not cached, or the file has changed
+    void Put(const char *pStrFilePath, const line_array& lines);  //after a load. Links are cleared.
+
+    int GetHits() { return m_nHits; }
+    int GetMisses() { return m_nMisses; }
+
+private:
+    class CCachedFile
+    {
+    public:
+        qint64 m_nInode;
+        qint64 m_nSize;
+        qint64 m_nModified;
+        line_array m_lines;
+        qint64 m_nBytes;
+        qint64 m_nLastUsed;
+    };
+
+    static bool getFileState(const char *pStrFilePath, qint64& nInode, qint64& nSize, qint64& nModified);
+    void evict(qint64 nBytesNeeded);
+
+    std::map<std::string, CCachedFile> m_files;  //key=path
+    qint64 m_nBytes;
+    qint64 m_nUseCount;
+    int m_nHits;
+    int m_nMisses;
+};
+
+
 class CSection
 {
 public:
@@ -64,11 +145,12 @@ public:
 
     int m_nLink;
     int m_nCorrespond;
+    int m_nMoveLink;  //section in the other file a STATE_MOVED section was moved to or from
 
     int m_nState;
 
 
-    CSection() {m_pLines=NULL;m_nFirstLine=m_nLastLine=m_nLink=m_nCorrespond=-1; m_nState=0;}
+    CSection() {m_pLines=NULL;m_nFirstLine=m_nLastLine=m_nLink=m_nCorrespond=m_nMoveLink=-1; m_nState=0;}
 
     CSection(int nFirst, int nLast, line_array* pLines)
     {
@@ -76,7 +158,7 @@ public:
         m_nFirstLine = nFirst;
         m_nLastLine = nLast;
 
-        m_nLink=m_nCorrespond=-1; m_nState=0;
+        m_nLink=m_nCorrespond=m_nMoveLink=-1; m_nState=0;
     }
 
     const CSection& operator =(const CSection& s)
@@ -86,6 +168,7 @@ public:
         m_nLastLine = s.m_nLastLine;
         m_nLink = s.m_nLink;
         m_nCorrespond = s.m_nCorrespond;
+        m_nMoveLink = s.m_nMoveLink;
         m_nState = s.m_nState;
         return *this;
     }
@@ -97,14 +180,35 @@ typedef std::vector<CSection> section_list;
 class CLineMap
 {
 public:
-    void AddItem(const char *pStrLine, int nLine);
+    CLineMap() { m_pLines = NULL; }
 
-    int GetLine(const char *pStrLine);
+    int GetLine(const CLine& line);
     void MakeMap(CSection& section);
     void DebugMap();
 
 private:
-    std::map<std::string, int> m_map;  //key=lineString; value=lineNumber
+    void addItem(int nLine);
+    size_t bucketOf(unsigned int nHash) const { return nHash & (m_buckets.size() - 1); }
+
+    //open addressing on the match hash; first=first line with the text (-1 for an empty bucket), second=lineNumber or MI_NOTUNIQUE
+    std::vector<std::pair<int, int> > m_buckets;
+    line_array* m_pLines;
+};
+
+
+//What a compare's result depends on besides the two files, so that a doc compared away from the UI,
+//e.g. in the background, gives what the main window's doc would.
+class CCompareOptions
+{
+public:
+    CCompareOptions() { m_nLcsCells = LCS_DEFAULT_CELLS; m_nTimeBudget = COMPARE_DEFAULT_BUDGET_MS; }
+
+    CLineFilter m_lineFilter;
+    int m_nLcsCells;
+    int m_nTimeBudget;  //msecs, 0 for no limit
+
+    bool operator ==(const CCompareOptions& options) const { return (m_lineFilter == options.m_lineFilter) && (m_nLcsCells == options.m_nLcsCells) && (m_nTimeBudget == options.m_nTimeBudget); }
+    bool operator !=(const CCompareOptions& options) const { return !(*this == options); }
 };
 
 
@@ -115,15 +219,35 @@ private:
     line_array m_lines2;
     section_list m_secs1, m_secs2, m_secsMerged;
     bool m_bIsCompared;
+    int m_nComparePasses;
+    int m_nLcsCells;  //the "compareLcsCells" setting
+    int m_nTimeBudget;  //msecs
+    int m_nPatchContext;  //lines each side of a change in an exported patch
+    bool m_bDegraded;
+    QAtomicInt m_nCancelled;  //set by Cancel() from another thread
+    bool m_bBinary;
+    QElapsedTimer m_compareTimer;
+    bool m_bInteractive;  //false for a doc used away from the UI: no settings, message boxes, debug output or file cache
+    CLoadedFileCache m_fileCache;
+    CLineFilter m_lineFilter;
 
-    bool LoadFile(const char *pStrFilePath, line_array& lines);
     bool LineLink(int nLine1, int nLine2);
+    bool linesMatch(int nLine1, int nLine2);
     bool ExpandAnchor(int nLine1, int nLine2);
     bool SectionMatch(CSection& section1, CSection& section2);
+    void findAnchors(CSection& section1, CSection& section2, std::vector<std::pair<int, int> >& anchors);
     int FindEndOfUnmatched(line_array& lines, int nStart);
     int FindEndOfMatched(line_array& lines, int nStart);
     void MakeSectionList(section_list& secs1, bool bLeft, line_array& lines);
     bool MatchSectionLists(section_list& secs1, section_list& secs2);
+    bool refineSectionLists(section_list& secs1, section_list& secs2);
+    bool bandedMatch(const CSection& section1, const CSection& section2);
+    bool outOfTime();
+    bool isCancelled() {return m_nCancelled.fetchAndAddOrdered(0) != 0;}
+    void detectMoves(section_list& secs1, section_list& secs2);
+    void hashRuns(const line_array& lines, const CSection& section, std::vector<unsigned int>& hashes);
+    void splitMovedSections(section_list& secs, const std::vector<std::pair<int, int> >& moved, std::vector<int>& firstPieces, std::vector<int>& movedPieces);
+    void relinkPieces(section_list& secs, const section_list& otherSecs, const std::vector<int>& firstPieces, const std::vector<int>& otherFirstPieces);
     void AutoSelectSections();
     void SetFinalSectionLists(section_list& secs1, section_list& secs2);
 
@@ -132,43 +256,68 @@ private:
     void saveClrSetting(const char *pStrSettingName, const QColor& clr);
     void loadClrSettings();
     void loadFolderExceptions();
+    void loadCompareSettings();
 
     //view options -
     bool m_bShowSelections;
     bool m_bAutoSelect;
     std::string m_strMergePath;
     bool m_bFoldersShowSame;
+    bool m_bFoldersUseIgnoreFiles;
+    bool m_bFoldersDetectMoves;
+    int m_nFoldersVerifyMode;
+    bool m_bFoldersLineStats;
     bool m_bExceptionStringsEnabled;
     int m_nBigLine1, m_nBigLine2;
-    QColor m_clrIdentical, m_clrDifferent, m_clrOnlyLeft, m_clrOnlyRight;
+    QColor m_clrIdentical, m_clrDifferent, m_clrOnlyLeft, m_clrOnlyRight, m_clrMoved;
     QStringList m_listExceptions;
 
 public:
-    CDiffDoc();
+    CDiffDoc(bool bInteractive=true);
     virtual ~CDiffDoc();
+    void ReloadSettings();  //all but the colours, e.g. after another window's doc saved them
 
     //main compare interface:
     bool IsCompared() {return m_bIsCompared;}
+    int GetComparePasses() {return m_nComparePasses;}  //of the last Compare()
+    bool IsDegraded() {return m_bDegraded;}  //true if the last Compare() ran out of time or was cancelled
+    void SetTimeBudget(int nMsecs) {m_nTimeBudget = nMsecs;}  //for the next Compare(). 0 for no limit.
+    void Cancel() {m_nCancelled.fetchAndStoreOrdered(1);}  //from another thread, to finish the Compare() running now early
+    bool LoadFile(const char *pStrFilePath, line_array& lines);  //unfiltered, e.g. for a three-way merge. False for a binary file.
+    const std::string& GetMergePath() {return m_strMergePath;}  //where a three-way merge of files this doc loaded is written
+    void SetMergePath(const char *pStrPath) {m_strMergePath = pStrPath;}
+    bool IsBinary() {return m_bBinary;}  //true if the last LoadFiles() failed on a binary file, which needs a CBinaryDiff
     bool LoadFiles(const char *pStrFilePath1, const char *pStrFilePath2);
+    void SetLines(const line_array& lines1, const line_array& lines2);  //instead of LoadFiles(), to compare again lines already loaded and filtered
     void Compare();
+    void Adopt(CDiffDoc& doc);  //takes the loaded and compared files of another doc, e.g. one compared in the background
 
     line_array& GetLines(int nView) {if (nView==1) return m_lines1;return m_lines2;}
     section_list& GetSecs(int nView) { return (nView==1) ? m_secs1 : m_secs2;}
+    void GetChangeCounts(int& nAdded, int& nRemoved, int& nSections);  //after Compare()
+    CLoadedFileCache* GetFileCache() { return &m_fileCache; }
+    const CLineFilter& GetLineFilter() { return m_lineFilter; }
+    void SetLineFilter(const CLineFilter& filter) { m_lineFilter = filter; }  //for the next LoadFiles(), e.g. of a worker's doc
+    CCompareOptions GetCompareOptions();
+    void SetCompareOptions(const CCompareOptions& options);  //all of another doc's, e.g. before a worker's doc loads
 
     //Colours
     QColor getClrIdentical() { return m_clrIdentical.isValid() ? m_clrIdentical : CLR_DEFAULT_IDENTICAL; }
     QColor getClrDifferent() { return m_clrDifferent.isValid() ? m_clrDifferent : CLR_DEFAULT_DIFFERENT; }
     QColor getClrOnlyLeft() { return m_clrOnlyLeft.isValid() ? m_clrOnlyLeft : CLR_DEFAULT_ONLYLEFT; }
     QColor getClrOnlyRight() { return m_clrOnlyRight.isValid() ? m_clrOnlyRight : CLR_DEFAULT_ONLYRIGHT; }
+    QColor getClrMoved() { return m_clrMoved.isValid() ? m_clrMoved : CLR_DEFAULT_MOVED; }
     void setClrIdentical(const QColor& clr) { m_clrIdentical = clr; saveClrSetting("identical", clr); }
     void setClrDifferent(const QColor& clr) { m_clrDifferent = clr; }
     void setClrOnlyLeft(const QColor& clr) { m_clrOnlyLeft = clr; }
     void setClrOnlyRight(const QColor& clr) { m_clrOnlyRight = clr; }
+    void setClrMoved(const QColor& clr) { m_clrMoved = clr; saveClrSetting("moved", clr); }
 
     static const QColor CLR_DEFAULT_IDENTICAL;
     static const QColor CLR_DEFAULT_DIFFERENT;
     static const QColor CLR_DEFAULT_ONLYLEFT;
     static const QColor CLR_DEFAULT_ONLYRIGHT;
+    static const QColor CLR_DEFAULT_MOVED;
 
     //folder exceptions
     QStringList getFolderExceptions() { return m_listExceptions; }
@@ -177,6 +326,22 @@ public:
     void setFolderExceptionsEnabled(bool bEnabled);
     bool getFoldersShowSame() { return m_bFoldersShowSame; }
     void setFoldersShowSame(bool bShow);
+    bool getFoldersUseIgnoreFiles() { return m_bFoldersUseIgnoreFiles; }
+    void setFoldersUseIgnoreFiles(bool bUse);
+    bool getFoldersDetectMoves() { return m_bFoldersDetectMoves; }
+    void setFoldersDetectMoves(bool bDetect);
+    int getFoldersVerifyMode() { return m_nFoldersVerifyMode; }  //FOLDERS_VERIFY_*
+    void setFoldersVerifyMode(int nMode);
+    bool getFoldersLineStats() { return m_bFoldersLineStats; }
+    void setFoldersLineStats(bool bCount);
+
+    //file compare options
+    int getCompareIgnoreFlags() { return m_lineFilter.GetFlags(); }  //LINEFILTER_IGNORE_*
+    void setCompareIgnoreFlags(int nFlags);
+    QStringList getCompareMasks() { return m_lineFilter.GetMasks(); }  //regular expressions cut out of lines before matching
+    void setCompareMasks(const QStringList& list);
+    int getPatchContext() { return m_nPatchContext; }
+    void setPatchContext(int nLines);
 
 };
 
@@ -0,0 +1,204 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "diffprefetcher.h"
+#include "diffdoc.h"
+#include <QFileInfo>
+#include <QDateTime>
+#include <QString>
+#include <QRunnable>
+#include <QThread>
+#include <QMutexLocker>
+#include <algorithm>
+
+
+class CPrefetchTask : public QRunnable
+{
+public:
+    CPrefetchTask(CDiffPrefetcher* pPrefetcher) { m_pPrefetcher = pPrefetcher; }
+
+    virtual void run()
+    {
+        //speculative work, so it gives way to everything else
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+
+        CPrefetchPair pair;
+        CCompareOptions options;
+        while (m_pPrefetcher->takeWaiting(pair, options))
+            m_pPrefetcher->finishPair(pair, CDiffPrefetcher::compare(pair, options));
+    }
+
+private:
+    CDiffPrefetcher* m_pPrefetcher;
+};
+
+
+CDiffPrefetcher::CDiffPrefetcher()
+{
+    m_nWorkers = 0;
+    m_pool.setMaxThreadCount(PREFETCH_THREADS);
+}
+
+CDiffPrefetcher::~CDiffPrefetcher()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_waiting.clear();
+    }
+    m_pool.waitForDone();
+    Clear();
+}
+
+void CDiffPrefetcher::Prefetch(const std::vector<CPrefetchPair>& pairs, const CCompareOptions& options)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (options != m_options) {
+        for (std::list<CPrefetched>::iterator it = m_cache.begin(); it != m_cache.end(); ++it)
+            delete it->m_pDoc;
+        m_cache.clear();
+        m_options = options;
+    }
+    m_waiting.clear();
+    for (size_t n=0; n<pairs.size(); n++)
+        if (!isInFlight(pairs[n]) && (findCached(pairs[n]) == m_cache.end()))
+            m_waiting.push_back(pairs[n]);
+
+    while ((m_nWorkers < PREFETCH_THREADS) && (m_nWorkers < (int)m_waiting.size())) {
+        m_nWorkers++;
+        m_pool.start(new CPrefetchTask(this));
+    }
+}
+
+bool CDiffPrefetcher::Take(const char *pStrPath1, const char *pStrPath2, CDiffDoc& doc)
+{
+    CPrefetchPair pair;
+    pair.m_strPath1 = pStrPath1;
+    pair.m_strPath2 = pStrPath2;
+
+    CPrefetched prefetched;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_waiting.erase(std::remove(m_waiting.begin(), m_waiting.end(), pair), m_waiting.end());
+
+        //Waiting here would hold up the GUI for as long as the rest of the compare takes, which for a big
+        //pair is no better than not prefetching it, so the caller compares it itself
+        if (isInFlight(pair))
+            return false;
+
+        std::list<CPrefetched>::iterator it = findCached(pair);
+        if (it == m_cache.end())
+            return false;
+        prefetched = *it;
+        m_cache.erase(it);
+    }
+
+    //a compare made before the compare options changed doesn't count either
+    qint64 nSize1, nSize2, nModified1, nModified2;
+    bool bCurrent = (prefetched.m_pDoc->GetCompareOptions() == doc.GetCompareOptions()) && getFileState(pair.m_strPath1, nSize1, nModified1) && getFileState(pair.m_strPath2, nSize2, nModified2) &&
+                    (nSize1 == prefetched.m_nSize1) && (nSize2 == prefetched.m_nSize2) &&
+                    (nModified1 == prefetched.m_nModified1) && (nModified2 == prefetched.m_nModified2);
+    if (bCurrent)
+        doc.Adopt(*prefetched.m_pDoc);
+
+    delete prefetched.m_pDoc;
+    return bCurrent;
+}
+
+void CDiffPrefetcher::Clear()
+{
+    //pairs being compared now still finish into the cache, and Take() checks them as usual
+    QMutexLocker locker(&m_mutex);
+    m_waiting.clear();
+    for (std::list<CPrefetched>::iterator it = m_cache.begin(); it != m_cache.end(); ++it)
+        delete it->m_pDoc;
+    m_cache.clear();
+}
+
+bool CDiffPrefetcher::takeWaiting(CPrefetchPair& pair, CCompareOptions& options)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_waiting.empty()) {
+        m_nWorkers--;
+        return false;
+    }
+
+    pair = m_waiting.front();
+    m_waiting.pop_front();
+    options = m_options;
+    m_inFlight.push_back(pair);
+    return true;
+}
+
+void CDiffPrefetcher::finishPair(const CPrefetchPair& pair, CPrefetched* pPrefetched)
+{
+    QMutexLocker locker(&m_mutex);
+    m_inFlight.erase(std::find(m_inFlight.begin(), m_inFlight.end(), pair));
+
+    if (pPrefetched) {
+        m_cache.push_front(*pPrefetched);
+        delete pPrefetched;
+        while (m_cache.size() > PREFETCH_CACHE_SIZE) {
+            delete m_cache.back().m_pDoc;
+            m_cache.pop_back();
+        }
+    }
+}
+
+bool CDiffPrefetcher::isInFlight(const CPrefetchPair& pair)
+{
+    return std::find(m_inFlight.begin(), m_inFlight.end(), pair) != m_inFlight.end();
+}
+
+std::list<CPrefetched>::iterator CDiffPrefetcher::findCached(const CPrefetchPair& pair)
+{
+    std::list<CPrefetched>::iterator it = m_cache.begin();
+    for ( ; it != m_cache.end(); ++it)
+        if (it->m_pair == pair)
+            break;
+    return it;
+}
+
+bool CDiffPrefetcher::getFileState(const std::string& strPath, qint64& nSize, qint64& nModified)
+{
+    QFileInfo info(QString::fromLocal8Bit(strPath.c_str()));
+    if (!info.isFile())
+        return false;
+    nSize = info.size();
+    nModified = info.lastModified().toMSecsSinceEpoch();
+    return true;
+}
+
+CPrefetched* CDiffPrefetcher::compare(const CPrefetchPair& pair, const CCompareOptions& options)
+{
+    //runs on a worker. Returns NULL if the pair can't or shouldn't be prefetched.
+    CPrefetched* pPrefetched = new CPrefetched;
+    pPrefetched->m_pair = pair;
+    pPrefetched->m_pDoc = NULL;
+    if (!getFileState(pair.m_strPath1, pPrefetched->m_nSize1, pPrefetched->m_nModified1) ||
+        !getFileState(pair.m_strPath2, pPrefetched->m_nSize2, pPrefetched->m_nModified2) ||
+        (pPrefetched->m_nSize1 > PREFETCH_MAX_FILE_SIZE) || (pPrefetched->m_nSize2 > PREFETCH_MAX_FILE_SIZE)) {
+        delete pPrefetched;
+        return NULL;
+    }
+
+    pPrefetched->m_pDoc = new CDiffDoc(false);
+    pPrefetched->m_pDoc->SetCompareOptions(options);
+    if (!pPrefetched->m_pDoc->LoadFiles(pair.m_strPath1.c_str(), pair.m_strPath2.c_str())) {
+        delete pPrefetched->m_pDoc;
+        delete pPrefetched;
+        return NULL;
+    }
+    pPrefetched->m_pDoc->Compare();
+    return pPrefetched;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef DIFFPREFETCHER_H
+#define DIFFPREFETCHER_H
+
+#include <QtGlobal>
+#include <QThreadPool>
+#include <QMutex>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include "diffdoc.h"
+
+
+#define PREFETCH_CACHE_SIZE         6   //compared pairs kept, most recently finished first
+#define PREFETCH_THREADS            2
+#define PREFETCH_MAX_FILE_SIZE      (4 * 1024 * 1024)  //bigger files are left to be compared when opened
+
+
+class CPrefetchPair
+{
+public:
+    std::string m_strPath1;
+    std::string m_strPath2;
+
+    bool operator ==(const CPrefetchPair& pair) const { return (m_strPath1 == pair.m_strPath1) && (m_strPath2 == pair.m_strPath2); }
+};
+
+class CPrefetched
+{
+public:
+    CPrefetchPair m_pair;
+    qint64 m_nSize1, m_nSize2;          //as they were when loaded, so a changed file isn't shown stale
+    qint64 m_nModified1, m_nModified2;
+    CDiffDoc* m_pDoc;
+};
+
+
+//Compares file pairs in the background before they are asked for, e.g. the next few different files
+//below the selected row of the folders dialog, so that opening one of them is instant.
+//
+//Prefetch() replaces the pairs still waiting, as only the latest guess of what is opened next matters.
+//Finished compares are kept in a small cache, and Take() hands one over to the main window's doc.
+
+class CDiffPrefetcher
+{
+    friend class CPrefetchTask;
+public:
+    CDiffPrefetcher();
+    ~CDiffPrefetcher();
+
+    void Prefetch(const std::vector<CPrefetchPair>& pairs, const CCompareOptions& options);  //options as the main window's doc has them
+
+    //Moves a prefetched compare of the two files into doc. Returns false if it wasn't prefetched, is still
+    //being compared, was compared with other options than doc has, or either file has changed since.
+    bool Take(const char *pStrPath1, const char *pStrPath2, CDiffDoc& doc);
+
+    void Clear();  //drops waiting pairs and the cache, e.g. when the folders being compared change
+
+private:
+    bool takeWaiting(CPrefetchPair& pair, CCompareOptions& options);  //for the workers. false when there is nothing left to do.
+    void finishPair(const CPrefetchPair& pair, CPrefetched* pPrefetched);
+    bool isInFlight(const CPrefetchPair& pair);
+    std::list<CPrefetched>::iterator findCached(const CPrefetchPair& pair);
+    static bool getFileState(const std::string& strPath, qint64& nSize, qint64& nModified);
+    static CPrefetched* compare(const CPrefetchPair& pair, const CCompareOptions& options);
+
+    QMutex m_mutex;  //guards the members below
+    std::deque<CPrefetchPair> m_waiting;
+    std::vector<CPrefetchPair> m_inFlight;
+    std::list<CPrefetched> m_cache;
+    CCompareOptions m_options;
+    int m_nWorkers;
+    QThreadPool m_pool;
+};
+
+#endif // DIFFPREFETCHER_H
@@ -0,0 +1,329 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "exceptionmatcher.h"
+#include <string.h>
+#include <queue>
+
+
+CExceptionMatcher::CExceptionMatcher()
+{
+    m_bEmpty = true;
+    memset(m_charClass, 0, sizeof(m_charClass));
+    m_nClasses = 1;
+    m_transitions.assign(1, 0);
+    m_accept.assign(1, 0);
+}
+
+bool CExceptionMatcher::IsGlob(const std::string& strPattern)
+{
+    return strPattern.find_first_of("*?[") != std::string::npos;
+}
+
+void CExceptionMatcher::Compile(const std::vector<std::string>& exceptions)
+{
+    std::vector<std::string> substrings;
+    m_componentGlobs.clear();
+    m_pathGlobs.clear();
+
+    for (size_t n=0; n<exceptions.size(); n++)
+    {
+        const std::string& strExc = exceptions[n];
+        if (strExc.empty())
+            continue;  //an empty string would exclude everything
+        if (!IsGlob(strExc))
+            substrings.push_back(strExc);
+        else if (strExc.find('/') == std::string::npos)
+            m_componentGlobs.push_back(strExc);
+        else
+            m_pathGlobs.push_back(strExc);
+    }
+
+    m_bEmpty = substrings.empty() && m_componentGlobs.empty() && m_pathGlobs.empty();
+
+    //compress the alphabet to the characters that are actually used
+    memset(m_charClass, 0, sizeof(m_charClass));
+    m_nClasses = 1;
+    for (size_t n=0; n<substrings.size(); n++)
+    {
+        for (size_t i=0; i<substrings[n].size(); i++)
+        {
+            unsigned char c = substrings[n][i];
+            if (m_charClass[c] == 0)
+                m_charClass[c] = m_nClasses++;
+        }
+    }
+
+    //build the trie (-1 = no child)
+    std::vector<int> trie(m_nClasses, -1);
+    m_accept.assign(1, 0);
+    for (size_t n=0; n<substrings.size(); n++)
+    {
+        int nState = 0;
+        for (size_t i=0; i<substrings[n].size(); i++)
+        {
+            int nClass = m_charClass[(unsigned char)substrings[n][i]];
+            int& nChild = trie[nState*m_nClasses + nClass];
+            if (nChild == -1)
+            {
+                nChild = m_accept.size();
+                m_accept.push_back(0);
+                trie.resize(trie.size() + m_nClasses, -1);
+            }
+            nState = trie[nState*m_nClasses + nClass];
+        }
+        m_accept[nState] = 1;
+    }
+
+    //breadth first pass to add failure links, turning the trie into a full DFA
+    int nStates = m_accept.size();
+    std::vector<int> fail(nStates, 0);
+    m_transitions.assign(nStates*m_nClasses, 0);
+    std::queue<int> queue;
+    for (int nClass=1; nClass<m_nClasses; nClass++)
+    {
+        int nChild = trie[nClass];
+        if (nChild != -1)
+        {
+            m_transitions[nClass] = nChild;
+            queue.push(nChild);
+        }
+    }
+    while (!queue.empty())
+    {
+        int nState = queue.front();
+        queue.pop();
+        if (m_accept[fail[nState]])
+            m_accept[nState] = 1;
+
+        for (int nClass=1; nClass<m_nClasses; nClass++)
+        {
+            int nChild = trie[nState*m_nClasses + nClass];
+            int nFallback = m_transitions[fail[nState]*m_nClasses + nClass];
+            if (nChild == -1)
+                m_transitions[nState*m_nClasses + nClass] = nFallback;
+            else
+            {
+                fail[nChild] = nFallback;
+                m_transitions[nState*m_nClasses + nClass] = nChild;
+                queue.push(nChild);
+            }
+        }
+    }
+}
+
+bool CExceptionMatcher::MatchesFile(const std::string& strRelativePath) const
+{
+    if (m_bEmpty)
+        return false;
+
+    const char *pStr = strRelativePath.c_str();
+    const char *pStrEnd = pStr + strRelativePath.size();
+
+    return MatchesSubstring(pStr, pStrEnd) ||
+            MatchesComponentGlobs(pStr, pStrEnd) ||
+            MatchesPathGlobs(pStr, pStrEnd);
+}
+
+bool CExceptionMatcher::MatchesDirectory(const std::string& strRelativePath) const
+{
+    if (m_bEmpty)
+        return false;
+
+    //Every file below this directory has a relative path starting with "<dir>/", so if a plain exception
+    //is found in that prefix then it would match all of them and we can skip the whole directory.
+    std::string strPrefix = strRelativePath + "/";
+    const char *pStr = strPrefix.c_str();
+    const char *pStrEnd = pStr + strPrefix.size();
+
+    return MatchesSubstring(pStr, pStrEnd) ||
+            MatchesComponentGlobs(pStr, pStrEnd-1) ||
+            MatchesPathGlobs(pStr, pStrEnd-1);
+}
+
+bool CExceptionMatcher::MatchesSubstring(const char *pStr, const char *pStrEnd) const
+{
+    if (m_nClasses == 1)
+        return false;
+
+    int nState = 0;
+    for ( ; pStr != pStrEnd; ++pStr)
+    {
+        nState = m_transitions[nState*m_nClasses + m_charClass[(unsigned char)*pStr]];
+        if (m_accept[nState])
+            return true;
+    }
+    return false;
+}
+
+bool CExceptionMatcher::MatchesComponentGlobs(const char *pStr, const char *pStrEnd) const
+{
+    if (m_componentGlobs.empty())
+        return false;
+
+    const char *pComponent = pStr;
+    for (const char *p = pStr; ; ++p)
+    {
+        if ((p == pStrEnd) || (*p == '/'))
+        {
+            if (p != pComponent)
+            {
+                for (size_t n=0; n<m_componentGlobs.size(); n++)
+                {
+                    const std::string& strGlob = m_componentGlobs[n];
+                    if (GlobMatch(strGlob.c_str(), strGlob.c_str()+strGlob.size(), pComponent, p))
+                        return true;
+                }
+            }
+            if (p == pStrEnd)
+                break;
+            pComponent = p+1;
+        }
+    }
+    return false;
+}
+
+bool CExceptionMatcher::MatchesPathGlobs(const char *pStr, const char *pStrEnd) const
+{
+    for (size_t n=0; n<m_pathGlobs.size(); n++)
+    {
+        const std::string& strGlob = m_pathGlobs[n];
+        if (GlobMatch(strGlob.c_str(), strGlob.c_str()+strGlob.size(), pStr, pStrEnd))
+            return true;
+    }
+    return false;
+}
+
+//Matches one character against a [...] set. pPat points just after the '['. Returns the position after
+//the closing ']', or NULL if the set isn't terminated (in which case the '[' is treated literally).
+static const char *matchCharSet(const char *pPat, const char *pPatEnd, char c, bool& bMatched)
+{
+    bool bNegate = false;
+    if ((pPat != pPatEnd) && ((*pPat == '!') || (*pPat == '^')))
+    {
+        bNegate = true;
+        ++pPat;
+    }
+
+    bMatched = false;
+    bool bFirst = true;
+    while ((pPat != pPatEnd) && ((*pPat != ']') || bFirst))
+    {
+        char cLow = *pPat;
+        char cHigh = cLow;
+        if (((pPat+2) < pPatEnd) && (pPat[1] == '-') && (pPat[2] != ']'))
+        {
+            cHigh = pPat[2];
+            pPat += 2;
+        }
+        if ((c >= cLow) && (c <= cHigh))
+            bMatched = true;
+        ++pPat;
+        bFirst = false;
+    }
+    if (pPat == pPatEnd)
+        return NULL;
+
+    if (bNegate)
+        bMatched = !bMatched;
+    return pPat+1;
+}
+
+bool CExceptionMatcher::GlobMatch(const char *pPat, const char *pPatEnd, const char *pStr, const char *pStrEnd)
+{
+    //Iterative matcher with single star backtracking. "**" is handled by recursion because it may cross '/'.
+    const char *pStarPat = NULL;
+    const char *pStarStr = NULL;
+
+    while (pStr != pStrEnd)
+    {
+        if (pPat != pPatEnd)
+        {
+            if (*pPat == '*')
+            {
+                if (((pPat+1) != pPatEnd) && (pPat[1] == '*'))
+                {
+                    const char *pRest = pPat+2;
+                    if ((pRest != pPatEnd) && (*pRest == '/'))
+                    {
+                        //"**/" also matches zero directories
+                        if (GlobMatch(pRest+1, pPatEnd, pStr, pStrEnd))
+                            return true;
+                    }
+                    for (const char *p = pStr; ; ++p)
+                    {
+                        if (GlobMatch(pRest, pPatEnd, p, pStrEnd))
+                            return true;
+                        if (p == pStrEnd)
+                            return false;
+                    }
+                }
+                pStarPat = ++pPat;
+                pStarStr = pStr;
+                continue;
+            }
+            if ((*pPat == '?') && (*pStr != '/'))
+            {
+                ++pPat;
+                ++pStr;
+                continue;
+            }
+            if (*pPat == '[')
+            {
+                bool bMatched;
+                const char *pNext = matchCharSet(pPat+1, pPatEnd, *pStr, bMatched);
+                if (pNext && bMatched && (*pStr != '/'))
+                {
+                    pPat = pNext;
+                    ++pStr;
+                    continue;
+                }
+                if (!pNext && (*pStr == '['))
+                {
+                    ++pPat;
+                    ++pStr;
+                    continue;
+                }
+            }
+            else if ((*pPat == '\\') && ((pPat+1) != pPatEnd))
+            {
+                if (pPat[1] == *pStr)  //escaped literal character
+                {
+                    pPat += 2;
+                    ++pStr;
+                    continue;
+                }
+            }
+            else if ((*pPat != '?') && (*pPat == *pStr))
+            {
+                ++pPat;
+                ++pStr;
+                continue;
+            }
+        }
+
+        //mismatch, so let the last single star swallow one more character (but never a '/')
+        if (pStarPat && (*pStarStr != '/'))
+        {
+            pPat = pStarPat;
+            pStr = ++pStarStr;
+            continue;
+        }
+        return false;
+    }
+
+    while ((pPat != pPatEnd) && (*pPat == '*'))
+        ++pPat;
+
+    return pPat == pPatEnd;
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef EXCEPTIONMATCHER_H
+#define EXCEPTIONMATCHER_H
+
+#include <string>
+#include <vector>
+
+
+//Matches relative paths against the folder exception strings. The exceptions are compiled once per
+//folder compare instead of being looked up and converted for every file.
+//
+//Plain exceptions keep their original meaning (the relative path contains the string anywhere) and are
+//all matched in a single pass with an Aho-Corasick automaton.
+//Exceptions containing any of * ? [ are globs:
+//  - a glob without a '/' is matched against each file or directory name, e.g. "*.obj" or "node_modules"
+//  - a glob with a '/' is matched against the whole relative path, e.g. "/build/*.log".
+//    '*' and '?' don't cross '/' but "**" does, e.g. "**/generated/*.cpp".
+//Relative paths always start with a '/', e.g. "/src/Debug/main.obj".
+
+class CExceptionMatcher
+{
+public:
+    CExceptionMatcher();
+
+    void Compile(const std::vector<std::string>& exceptions);
+    bool IsEmpty() const { return m_bEmpty; }
+
+    bool MatchesFile(const std::string& strRelativePath) const;
+    bool MatchesDirectory(const std::string& strRelativePath) const; //directory path without a trailing '/'
+
+    static bool IsGlob(const std::string& strPattern);
+    static bool GlobMatch(const char *pPat, const char *pPatEnd, const char *pStr, const char *pStrEnd);
+
+private:
+    bool MatchesSubstring(const char *pStr, const char *pStrEnd) const;
+    bool MatchesComponentGlobs(const char *pStr, const char *pStrEnd) const;
+    bool MatchesPathGlobs(const char *pStr, const char *pStrEnd) const;
+
+    bool m_bEmpty;
+
+    //Aho-Corasick automaton for the plain exceptions, stored as a full DFA over compressed character classes.
+    //Class 0 is every character that doesn't appear in any exception, which always leads back to the root.
+    int m_charClass[256];
+    int m_nClasses;
+    std::vector<int> m_transitions;  //[state*m_nClasses + class] = next state
+    std::vector<char> m_accept;      //true if any exception ends in this state (including via failure links)
+
+    std::vector<std::string> m_componentGlobs;
+    std::vector<std::string> m_pathGlobs;
+};
+
+#endif // EXCEPTIONMATCHER_H
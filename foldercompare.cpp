@@ -0,0 +1,1405 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "foldercompare.h"
+#include "diffdoc.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QDateTime>
+#include <QStringList>
+#include <QDebug>
+#include <QCryptographicHash>
+#include <string.h>
+#include <list>
+#include <algorithm>
+
+
+#define PROGRESS_INTERVAL_MS    100  //how often the listener hears about progress
+#define CANCEL_CHECK_LINES      4096 //lines between cancel checks within a file, so big files can be aborted
+#define SAMPLE_BLOCKS           8    //blocks read from each file by the sampled verify modes
+#define SAMPLE_BLOCK_SIZE       4096
+#define BATCH_FILES             128  //files in both folders read together by CBatchReader
+#define BATCH_MAX_FILE_SIZE     65536  //bigger files are read one at a time, so a batch stays under 16MB
+#define ARCHIVE_COMPARE_SIZE    65536  //bytes compared at a time when a side is in an archive
+
+//compareStreams() results
+#define STREAMS_SAME        0
+#define STREAMS_DIFFERENT   1
+#define STREAMS_ERROR1      2   //the first stream couldn't be read
+#define STREAMS_ERROR2      3
+#define STREAMS_CANCELLED   4
+
+
+//text lookup for FolderItem states
+static const char *g_stateLookup[] = {"The same", "Only in folder1", "Only in folder2",
+                                      "Different - 1 is more recent", "Different - 2 is more recent",
+                                      "Different - same modified time", "Moved", "Moved and changed"};
+
+static const char *g_stateNames[] = {"THESAME", "ONLYIN1", "ONLYIN2", "1MORERECENT", "2MORERECENT", "DIFFERENT",
+                                     "MOVED", "MOVEDCHANGED"};
+
+static const char *g_verifiedLookup[] = {"", "Size and time", "Sampled", "Full"};
+static const char *g_verifiedNames[] = {"none", "metadata", "sampled", "full"};
+
+const char *folderStateText(int nState)
+{
+    Q_ASSERT((nState >= 0) && (nState < FI_STATE_COUNT));
+    return g_stateLookup[nState];
+}
+
+const char *folderStateName(int nState)
+{
+    Q_ASSERT((nState >= 0) && (nState < FI_STATE_COUNT));
+    return g_stateNames[nState];
+}
+
+const char *verifiedText(int nVerified)
+{
+    Q_ASSERT((nVerified >= 0) && (nVerified < VERIFIED_COUNT));
+    return g_verifiedLookup[nVerified];
+}
+
+const char *verifiedName(int nVerified)
+{
+    Q_ASSERT((nVerified >= 0) && (nVerified < VERIFIED_COUNT));
+    return g_verifiedNames[nVerified];
+}
+
+
+CFolderCompare::CFolderCompare(CFolderCompareListener* pListener) :
+    m_moveDetector(&m_hashCache)
+{
+    m_pListener = pListener;
+    m_bUseIgnoreFiles = false;
+    m_bShowSame = false;
+    m_bDetectMoves = false;
+    m_nVerifyMode = FOLDERS_VERIFY_FULL;
+    m_pArchive1 = m_pArchive2 = NULL;
+    m_pGit = NULL;
+    m_nFiles = 0;
+    m_nDifferences = 0;
+    m_nGitObjects = 0;
+    m_bCancelled = false;
+    m_nPhaseStart = 0;
+    m_nLastProgress = 0;
+    startProgress();
+}
+
+void CFolderCompare::LoadOptions(CDiffDoc* pDoc)
+{
+    if (pDoc->getFolderExceptionsEnabled())
+        SetExceptions(pDoc->getFolderExceptions());
+    else
+        SetExceptions(QStringList());
+
+    m_bUseIgnoreFiles = pDoc->getFoldersUseIgnoreFiles();
+    m_bShowSame = pDoc->getFoldersShowSame();
+    m_bDetectMoves = pDoc->getFoldersDetectMoves();
+    m_nVerifyMode = pDoc->getFoldersVerifyMode();
+    if ((m_nVerifyMode < 0) || (m_nVerifyMode >= FOLDERS_VERIFY_COUNT))
+        m_nVerifyMode = FOLDERS_VERIFY_FULL;
+}
+
+void CFolderCompare::SetExceptions(const QStringList& exceptions)
+{
+    std::vector<std::string> list;
+    for (int n=0; n<exceptions.size(); n++)
+        list.push_back(exceptions.at(n).toLocal8Bit().constData());
+
+    m_exceptions.Compile(list);
+}
+
+static bool hasFolder(const char *pStrPath, const std::string& strFolder, const CTreeManifest* pManifest, const CArchive* pArchive)
+{
+    //whether the top of a folder, manifest or archive has the named folder
+    std::string strPrefix = "/" + strFolder + "/";
+    if (pManifest) {
+        const std::vector<CManifestEntry>& entries = pManifest->GetEntries();
+        for (size_t n=0; n<entries.size(); n++)
+            if (entries[n].m_strPath.compare(0, strPrefix.size(), strPrefix) == 0)
+                return true;
+        return false;
+    }
+    if (pArchive) {
+        const std::vector<CArchiveEntry>& entries = pArchive->GetEntries();
+        for (size_t n=0; n<entries.size(); n++)
+            if (entries[n].m_strPath.compare(0, strPrefix.size(), strPrefix) == 0)
+                return true;
+        return false;
+    }
+    return QFileInfo(QString::fromLocal8Bit(pStrPath) + "/" + QString::fromLocal8Bit(strFolder.c_str())).isDir();
+}
+
+bool CFolderCompare::resolveTree(CGitRepo& repo, const char *pStrSpec, std::string& strTree, qint64& nTime)
+{
+    //git doesn't keep files' times, so every file of a revision gets its commit's time
+    QString strSpec = QString::fromLocal8Bit(pStrSpec);
+    std::string strType;
+    qint64 nSize;
+    if (!repo.GetObjectInfo(CGitRepo::NormalizeSpec(strSpec), strTree, strType, nSize) || (strType != "tree"))
+        return false;
+
+    std::string strRevision, strPath;
+    CGitRepo::SplitSpec(strSpec, strRevision, strPath);
+    nTime = repo.GetCommitTime(strRevision);
+    return true;
+}
+
+bool CFolderCompare::Compare(const char *pStrPath1, const char *pStrPath2, bool bStreaming)
+{
+    m_nFiles = 0;
+    m_nDifferences = 0;
+    m_nGitObjects = 0;
+    startProgress();
+
+    CDiffDirectoryNode ddn(this, "");
+
+    bool bGit1 = CGitRepo::IsRevisionSpec(QString::fromLocal8Bit(pStrPath1));
+    bool bGit2 = CGitRepo::IsRevisionSpec(QString::fromLocal8Bit(pStrPath2));
+    bool bManifest1 = !bGit1 && CTreeManifest::IsManifestFile(pStrPath1);
+    bool bManifest2 = !bGit2 && CTreeManifest::IsManifestFile(pStrPath2);
+    bool bArchive1 = !bGit1 && !bManifest1 && CArchive::IsArchiveFile(pStrPath1);
+    bool bArchive2 = !bGit2 && !bManifest2 && CArchive::IsArchiveFile(pStrPath2);
+    if (bManifest1 || bManifest2 || bArchive1 || bArchive2 || bGit1 || bGit2) {
+        //the manifest, archive and git entries are referenced by the tree, so they must outlive the compare
+        CTreeManifest manifest1, manifest2;
+        CArchive archive1, archive2;
+        CGitRepo repo;
+        std::deque<CGitEntry> gitEntries;
+        std::string strTree1, strTree2;
+        qint64 nTime1 = 0, nTime2 = 0;
+        if ((bManifest1 && !manifest1.Read(pStrPath1)) || (bManifest2 && !manifest2.Read(pStrPath2)) ||
+            (bArchive1 && !archive1.Open(pStrPath1)) || (bArchive2 && !archive2.Open(pStrPath2)) ||
+            (bGit1 && !resolveTree(repo, pStrPath1, strTree1, nTime1)) || (bGit2 && !resolveTree(repo, pStrPath2, strTree2, nTime2)))
+            return false;
+
+        //an archive's single top folder, e.g. "app-1.2", is left out unless the other side has it too
+        bool bStrip1 = bArchive1 && (archive1.GetTopFolder() != "") &&
+                !hasFolder(pStrPath2, archive1.GetTopFolder(), bManifest2 ? &manifest2 : NULL, bArchive2 ? &archive2 : NULL);
+        bool bStrip2 = bArchive2 && (archive2.GetTopFolder() != "") &&
+                !hasFolder(pStrPath1, archive2.GetTopFolder(), bManifest1 ? &manifest1 : NULL, bArchive1 ? &archive1 : NULL);
+        if (bStrip1)
+            archive1.StripTopFolder();
+        if (bStrip2)
+            archive2.StripTopFolder();
+
+        CIgnoreLevel ignoreRoot1(NULL, ""), ignoreRoot2(NULL, "");
+        if (bGit1 || bGit2)
+            ddn.AddGitTrees(repo, strTree1, strTree2, nTime1, nTime2, gitEntries);
+        if (bManifest1)
+            ddn.AddManifest(manifest1, true);
+        else if (bArchive1)
+            ddn.AddArchive(archive1, true);
+        else if (!bGit1)
+            ddn.ParseDirectory(pStrPath1, true, m_bUseIgnoreFiles ? &ignoreRoot1 : NULL);
+        if (bManifest2)
+            ddn.AddManifest(manifest2, false);
+        else if (bArchive2)
+            ddn.AddArchive(archive2, false);
+        else if (!bGit2)
+            ddn.ParseDirectory(pStrPath2, false, m_bUseIgnoreFiles ? &ignoreRoot2 : NULL);
+
+        m_pArchive1 = bArchive1 ? &archive1 : NULL;
+        m_pArchive2 = bArchive2 ? &archive2 : NULL;
+        m_pGit = (bGit1 || bGit2) ? &repo : NULL;
+        startComparePhase(ddn, true);
+        ddn.DoCompare();
+        finishCompare();
+        m_nGitObjects = repo.GetObjectsRead();
+        m_pArchive1 = m_pArchive2 = NULL;
+        m_pGit = NULL;
+        return true;
+    }
+
+    if (!bStreaming) {
+        ddn.ReadDirectoryTree(pStrPath1, pStrPath2);
+        startComparePhase(ddn, true);
+        ddn.DoCompare();
+        finishCompare();
+        return true;
+    }
+
+    //each side is scanned with the ignore files found in its own tree
+    CIgnoreLevel ignoreRoot(NULL, "");
+    ddn.m_strLeftPath = pStrPath1;
+    ddn.m_strRightPath = pStrPath2;
+    ddn.ScanAndCompare(m_bUseIgnoreFiles ? &ignoreRoot : NULL, m_bUseIgnoreFiles ? &ignoreRoot : NULL);
+    finishCompare();
+    return true;
+}
+
+void CFolderCompare::CompareEntries(const char *pStrPath1, const char *pStrPath2, const std::vector<std::string>& relativePaths)
+{
+    m_nFiles = 0;
+    m_nDifferences = 0;
+    startProgress();
+
+    std::vector<std::string> sorted = relativePaths;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::vector<CDiffFileNode> files(sorted.size());  //CompareFiles() points into it
+    std::vector<CFileToCompare> toCompare;
+    for (size_t n=0; n<sorted.size(); n++)
+    {
+        const std::string& strRelativePath = sorted[n];
+        std::string strPath1 = std::string(pStrPath1) + strRelativePath;
+        std::string strPath2 = std::string(pStrPath2) + strRelativePath;
+        QFileInfo info1(QString::fromLocal8Bit(strPath1.c_str())), info2(QString::fromLocal8Bit(strPath2.c_str()));
+        bool bLeft = info1.isFile() && !isExcluded(pStrPath1, strRelativePath);
+        bool bRight = info2.isFile() && !isExcluded(pStrPath2, strRelativePath);
+        if (!bLeft && !bRight)
+            continue;
+
+        CDiffFileNode& file = files[n];
+        file.m_strFilename = strRelativePath.substr(strRelativePath.rfind('/') + 1);
+        file.m_inFile = bLeft ? (bRight ? CDiffFileNode::both : CDiffFileNode::left) : CDiffFileNode::right;
+        if (bLeft) {
+            file.m_nSize1 = info1.size();
+            file.m_nModified1 = info1.lastModified().toMSecsSinceEpoch();
+        }
+        if (bRight) {
+            file.m_nSize2 = info2.size();
+            file.m_nModified2 = info2.lastModified().toMSecsSinceEpoch();
+        }
+
+        CFileToCompare entry;
+        entry.m_pFile = &file;
+        entry.m_strPath1 = bLeft ? strPath1 : "";
+        entry.m_strPath2 = bRight ? strPath2 : "";
+        entry.m_strRelativePath = strRelativePath;
+        toCompare.push_back(entry);
+    }
+
+    m_progress.m_nFilesTotal = toCompare.size();
+    CompareFiles(toCompare);
+    finishCompare();
+}
+
+bool CFolderCompare::isExcluded(const std::string& strRoot, const std::string& strRelativePath)
+{
+    //Makes the checks ParseDirectory() would make on the way down to the file: exceptions, then the
+    //ignore files of each folder from the root down, each folder checked against its parent's patterns.
+    //std::list keeps each level where it is, as the next one points at it.
+    std::list<CIgnoreLevel> levels;
+    const CIgnoreLevel* pIgnore = NULL;
+    size_t nSlash = 0;
+    for (;;)
+    {
+        std::string strDir = strRelativePath.substr(0, nSlash);  //"" for the root, then "/a", "/a/b"...
+        if (nSlash > 0) {
+            std::string strDirname = strDir.substr(strDir.rfind('/') + 1);
+            if (!m_exceptions.IsEmpty() && m_exceptions.MatchesDirectory(strDir))
+                return true;
+            if (m_bUseIgnoreFiles && ((strDirname == ".git") || pIgnore->IsIgnored(strDir, true)))
+                return true;
+        }
+        if (m_bUseIgnoreFiles) {
+            levels.push_back(CIgnoreLevel(pIgnore, strDir));
+            CDiffDirectoryNode::readIgnoreFiles(QString::fromLocal8Bit((strRoot + strDir).c_str()), levels.back());
+            pIgnore = &levels.back();
+        }
+
+        nSlash = strRelativePath.find('/', nSlash + 1);
+        if (nSlash == std::string::npos)
+            break;
+    }
+
+    if (!m_exceptions.IsEmpty() && m_exceptions.MatchesFile(strRelativePath))
+        return true;
+    std::string strFilename = strRelativePath.substr(strRelativePath.rfind('/') + 1);
+    return m_bUseIgnoreFiles && ((strFilename == ".git") || pIgnore->IsIgnored(strRelativePath, false));
+}
+
+bool CFolderCompare::WriteManifest(const char *pStrFolder, const char *pStrFile)
+{
+    m_nFiles = 0;
+    m_nDifferences = 0;
+    startProgress();
+
+    CDiffDirectoryNode ddn(this, "");
+    CIgnoreLevel ignoreRoot(NULL, "");
+    if (!ddn.ParseDirectory(pStrFolder, true, m_bUseIgnoreFiles ? &ignoreRoot : NULL))
+        return false;
+
+    startComparePhase(ddn, false);
+    CTreeManifest manifest;
+    bool bComplete = ddn.addToManifest(manifest);
+    m_hashCache.Save();  //keeps what was hashed, even if cancelled
+    m_nFiles = manifest.GetEntries().size();
+
+    return bComplete && manifest.Write(pStrFile);
+}
+
+void CFolderCompare::startProgress()
+{
+    m_bCancelled = false;
+    m_progress.m_nFilesScanned = 0;
+    m_progress.m_nFilesDone = 0;
+    m_progress.m_nFilesTotal = -1;
+    m_progress.m_nBytesDone = 0;
+    m_progress.m_nBytesTotal = -1;
+    m_progress.m_nElapsed = 0;
+    m_timer.start();
+    m_nPhaseStart = 0;
+    m_nLastProgress = 0;
+}
+
+void CFolderCompare::startComparePhase(CDiffDirectoryNode& ddn, bool bBothOnly)
+{
+    //the whole tree has been read, so the amount of work left is known
+    int nFiles = 0;
+    qint64 nBytes = 0;
+    ddn.countWork(nFiles, nBytes, bBothOnly);
+    m_progress.m_nFilesTotal = nFiles;
+    m_progress.m_nBytesTotal = nBytes;
+    m_nPhaseStart = m_timer.elapsed();
+    reportProgress();
+}
+
+void CFolderCompare::finishCompare()
+{
+    reportMoves();
+    m_hashCache.Save();
+    reportProgress();
+}
+
+bool CFolderCompare::Progress(int nScanned)
+{
+    m_progress.m_nFilesScanned += nScanned;
+
+    qint64 nNow = m_timer.elapsed();
+    if ((nNow - m_nLastProgress) >= PROGRESS_INTERVAL_MS)
+        reportProgress();
+
+    return !m_bCancelled;
+}
+
+bool CFolderCompare::FileDone(qint64 nBytes)
+{
+    m_progress.m_nFilesDone++;
+    m_progress.m_nBytesDone += nBytes;
+    return Progress();
+}
+
+void CFolderCompare::reportProgress()
+{
+    m_nLastProgress = m_timer.elapsed();
+    m_progress.m_nElapsed = m_nLastProgress - m_nPhaseStart;
+    if (m_pListener)
+        m_pListener->OnProgress(m_progress);
+}
+
+void CFolderCompare::CompareFile(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath)
+{
+    //Use qt file classes to read the two files and compare their contents.
+    //Files matching an exception string have already been left out by CDiffDirectoryNode.
+
+    //files in an archive or a git revision would have to be read to find moves, so they are reported as they are
+    if (m_bDetectMoves && !m_pArchive1 && !m_pArchive2 && !m_pGit && (file.m_inFile != CDiffFileNode::both)) {
+        addMoveCandidate(file, pStrPath1, pStrPath2, strRelativePath);
+        return;
+    }
+
+    if (file.m_pGit1 || file.m_pGit2) {
+        compareGit(file, pStrPath1, pStrPath2, strRelativePath);
+        return;
+    }
+
+    if (file.m_pArchived1 || file.m_pArchived2) {
+        compareArchived(file, pStrPath1, pStrPath2, strRelativePath);
+        return;
+    }
+
+    if (file.m_pEntry1 || file.m_pEntry2) {
+        compareHashes(file, pStrPath1, pStrPath2, strRelativePath);
+        return;
+    }
+
+    if ((m_nVerifyMode != FOLDERS_VERIFY_FULL) && (file.m_inFile == CDiffFileNode::both)) {
+        if (compareQuick(file, pStrPath1, pStrPath2, strRelativePath))
+            return;
+    }
+
+    //open files
+    QFile file1(pStrPath1);
+    if (!file1.open(QIODevice::ReadOnly)) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE);
+        return;
+    }
+    QFile file2(pStrPath2);
+    if (!file2.open(QIODevice::ReadOnly)) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE);
+        return;
+    }
+
+    //read files and compare contents
+    QTextStream in1(&file1);
+    QTextStream in2(&file2);
+    bool bDifferent = false;
+    int nLines = 0;
+    while (!in1.atEnd() && !in2.atEnd()) {
+        QString line1 = in1.readLine();
+        QString line2 = in2.readLine();
+        if (line1 != line2) {
+            bDifferent = true;
+            break;
+        }
+        if ((++nLines % CANCEL_CHECK_LINES == 0) && !Progress())
+            return;  //cancelled part way through, so there is no result for this file
+    }
+    if (!in1.atEnd() || !in2.atEnd())
+        bDifferent = true;  //one file has more lines
+
+    addResult(file, strRelativePath, bDifferent ? getDifferentState(file) : FI_STATE_THESAME, VERIFIED_FULL);
+}
+
+void CFolderCompare::CompareFiles(const std::vector<CFileToCompare>& files)
+{
+    //runs of batchable files go to compareBatch(), so results keep the folder's order
+    size_t n = 0;
+    while ((n < files.size()) && !m_bCancelled)
+    {
+        if (!isBatchable(*files[n].m_pFile)) {
+            CompareFile(*files[n].m_pFile, files[n].m_strPath1.c_str(), files[n].m_strPath2.c_str(), files[n].m_strRelativePath);
+            n++;
+            continue;
+        }
+
+        size_t nEnd = n + 1;
+        while ((nEnd < files.size()) && (nEnd - n < BATCH_FILES) && isBatchable(*files[nEnd].m_pFile))
+            nEnd++;
+        compareBatch(files, n, nEnd);
+        n = nEnd;
+    }
+}
+
+bool CFolderCompare::isBatchable(const CDiffFileNode& file)
+{
+    //Small files in both folders that would be read whole anyway. Manifests are compared by hash,
+    //metadata mode reads nothing, and the sampled modes decide different sizes without reading.
+    if ((file.m_inFile != CDiffFileNode::both) || file.m_pEntry1 || file.m_pEntry2 || file.m_pArchived1 || file.m_pArchived2 ||
+        file.m_pGit1 || file.m_pGit2)
+        return false;
+    if (m_nVerifyMode == FOLDERS_VERIFY_METADATA)
+        return false;
+    if ((m_nVerifyMode != FOLDERS_VERIFY_FULL) && (file.m_nSize1 != file.m_nSize2))
+        return false;
+    return (file.m_nSize1 <= BATCH_MAX_FILE_SIZE) && (file.m_nSize2 <= BATCH_MAX_FILE_SIZE);
+}
+
+void CFolderCompare::compareBatch(const std::vector<CFileToCompare>& files, size_t nStart, size_t nEnd)
+{
+    //reads both sides of the files in one go, then compares them in memory
+    std::vector<CBatchRead> reads(2 * (nEnd - nStart));
+    for (size_t n=nStart; n<nEnd; n++) {
+        CBatchRead& read1 = reads[2 * (n - nStart)];
+        CBatchRead& read2 = reads[2 * (n - nStart) + 1];
+        read1.m_strPath = files[n].m_strPath1;
+        read1.m_nSize = files[n].m_pFile->m_nSize1;
+        read2.m_strPath = files[n].m_strPath2;
+        read2.m_nSize = files[n].m_pFile->m_nSize2;
+    }
+    m_batchReader.Read(reads);
+
+    for (size_t n=nStart; (n<nEnd) && !m_bCancelled; n++)
+    {
+        const CFileToCompare& toCompare = files[n];
+        const CDiffFileNode& file = *toCompare.m_pFile;
+        const CBatchRead& read1 = reads[2 * (n - nStart)];
+        const CBatchRead& read2 = reads[2 * (n - nStart) + 1];
+        if (!read1.m_bOk || !read2.m_bOk) {
+            //unreadable, or changed since the scan, so leave it to the usual compare
+            CompareFile(file, toCompare.m_strPath1.c_str(), toCompare.m_strPath2.c_str(), toCompare.m_strRelativePath);
+            continue;
+        }
+
+        bool bSame;
+        if (m_nVerifyMode == FOLDERS_VERIFY_SAMPLED)
+            bSame = (read1.m_data == read2.m_data);  //sampled compares bytes, and the whole file is here anyway
+        else
+            bSame = compareLines(read1.m_data, read2.m_data);  //sampled-full gives the full compare's answer
+        addResult(file, toCompare.m_strRelativePath, bSame ? FI_STATE_THESAME : getDifferentState(file), VERIFIED_FULL);
+    }
+}
+
+bool CFolderCompare::compareLines(const std::string& data1, const std::string& data2)
+{
+    //Same answer as the QTextStream compare in CompareFile(): lines are compared without their
+    //"\n" or "\r\n" endings, and a missing newline at the end of the file doesn't count.
+    size_t nPos1 = 0, nPos2 = 0;
+    size_t nSize1 = data1.size(), nSize2 = data2.size();
+    while ((nPos1 < nSize1) && (nPos2 < nSize2))
+    {
+        size_t nEnd1 = data1.find('\n', nPos1);
+        size_t nEnd2 = data2.find('\n', nPos2);
+        size_t nNext1 = (nEnd1 == std::string::npos) ? nSize1 : nEnd1 + 1;
+        size_t nNext2 = (nEnd2 == std::string::npos) ? nSize2 : nEnd2 + 1;
+        if (nEnd1 == std::string::npos)
+            nEnd1 = nSize1;
+        if (nEnd2 == std::string::npos)
+            nEnd2 = nSize2;
+        if ((nEnd1 > nPos1) && (data1[nEnd1 - 1] == '\r') && (nEnd1 < nSize1))
+            nEnd1--;
+        if ((nEnd2 > nPos2) && (data2[nEnd2 - 1] == '\r') && (nEnd2 < nSize2))
+            nEnd2--;
+
+        if ((nEnd1 - nPos1 != nEnd2 - nPos2) || (data1.compare(nPos1, nEnd1 - nPos1, data2, nPos2, nEnd2 - nPos2) != 0))
+            return false;
+        nPos1 = nNext1;
+        nPos2 = nNext2;
+    }
+
+    return (nPos1 >= nSize1) && (nPos2 >= nSize2);
+}
+
+bool CFolderCompare::compareQuick(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath)
+{
+    //Returns true if the file was decided without a full compare.
+    //Files of different sizes are taken as different without reading them. Unlike the full compare
+    //this counts line ending differences, which is the price of not reading the files. sampled-full
+    //promises the full compare's answer, so there a file with a \r near its start goes on to the full
+    //compare, in case the sizes differ only by its line endings, and so does a sample mismatch in a
+    //block with a \r.
+    if (file.m_nSize1 != file.m_nSize2) {
+        if ((m_nVerifyMode == FOLDERS_VERIFY_SAMPLEDFULL) && (startsWithCR(pStrPath1) || startsWithCR(pStrPath2)))
+            return false;
+        addResult(file, strRelativePath, getDifferentState(file), VERIFIED_METADATA);
+        return true;
+    }
+
+    if (m_nVerifyMode == FOLDERS_VERIFY_METADATA) {
+        //same size and modified time is taken as the same
+        addResult(file, strRelativePath, (file.m_nModified1 == file.m_nModified2) ? FI_STATE_THESAME : getDifferentState(file), VERIFIED_METADATA);
+        return true;
+    }
+
+    bool bWhole = false, bCR = false;
+    int nSame = compareSamples(pStrPath1, pStrPath2, file.m_nSize1, bWhole, bCR);
+    if (nSame < 0)
+        return false;  //leave read errors to the full compare
+    if ((nSame == 0) && bCR && (m_nVerifyMode == FOLDERS_VERIFY_SAMPLEDFULL))
+        return false;  //the blocks may differ only by where their line endings are
+    if (nSame == 0) {
+        addResult(file, strRelativePath, getDifferentState(file), VERIFIED_SAMPLED);
+        return true;
+    }
+    if (bWhole) {
+        addResult(file, strRelativePath, FI_STATE_THESAME, VERIFIED_FULL);  //small enough that the samples covered everything
+        return true;
+    }
+    if (m_nVerifyMode == FOLDERS_VERIFY_SAMPLED) {
+        addResult(file, strRelativePath, FI_STATE_THESAME, VERIFIED_SAMPLED);
+        return true;
+    }
+
+    return false;  //FOLDERS_VERIFY_SAMPLEDFULL: the samples match, so go on to a full compare
+}
+
+bool CFolderCompare::startsWithCR(const char *pStrPath)
+{
+    //True if the first sample block has a \r, or the file can't be read and so needs the full compare to report it.
+    //Only the first block is read, so a file whose first \r comes after it is still decided by its size.
+    QFile file(pStrPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return true;
+    QByteArray block = file.read(SAMPLE_BLOCK_SIZE);
+    return block.contains('\r');
+}
+
+int CFolderCompare::compareSamples(const char *pStrPath1, const char *pStrPath2, qint64 nSize, bool& bWhole, bool& bCR)
+{
+    //Compares SAMPLE_BLOCKS blocks of both files: the first, the last and the rest evenly spaced
+    //between them. Most edits change the size, the header or the tail, or shift everything after them.
+    //Returns 1 if the samples match, 0 if they don't and -1 if a file can't be read. On a mismatch
+    //bCR says whether either block has a \r.
+    QFile file1(pStrPath1), file2(pStrPath2);
+    if (!file1.open(QIODevice::ReadOnly) || !file2.open(QIODevice::ReadOnly))
+        return -1;
+
+    bWhole = (nSize <= (qint64)SAMPLE_BLOCKS * SAMPLE_BLOCK_SIZE);
+
+    QByteArray block1, block2;
+    block1.resize(SAMPLE_BLOCK_SIZE);
+    block2.resize(SAMPLE_BLOCK_SIZE);
+    int nBlocks = bWhole ? (int)((nSize + SAMPLE_BLOCK_SIZE - 1) / SAMPLE_BLOCK_SIZE) : SAMPLE_BLOCKS;
+    for (int n=0; n<nBlocks; n++)
+    {
+        qint64 nPos = bWhole ? (qint64)n * SAMPLE_BLOCK_SIZE : (nSize - SAMPLE_BLOCK_SIZE) * n / (SAMPLE_BLOCKS - 1);
+        qint64 nLen = qMin((qint64)SAMPLE_BLOCK_SIZE, nSize - nPos);
+        if (!file1.seek(nPos) || !file2.seek(nPos))
+            return -1;
+        if ((file1.read(block1.data(), nLen) != nLen) || (file2.read(block2.data(), nLen) != nLen))
+            return -1;
+        if (memcmp(block1.constData(), block2.constData(), nLen) != 0) {
+            bCR = (memchr(block1.constData(), '\r', nLen) != NULL) || (memchr(block2.constData(), '\r', nLen) != NULL);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void CFolderCompare::compareHashes(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath)
+{
+    //At least one side is a manifest, so the contents are compared by hash. Files of different sizes
+    //can't be the same, so only files with matching sizes need a hash of the live side.
+    if (file.m_inFile == CDiffFileNode::left) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE);
+        return;
+    }
+    if (file.m_inFile == CDiffFileNode::right) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE);
+        return;
+    }
+
+    if (file.m_nSize1 != file.m_nSize2) {
+        addResult(file, strRelativePath, getDifferentState(file), VERIFIED_METADATA);
+        return;
+    }
+    if (m_nVerifyMode == FOLDERS_VERIFY_METADATA) {
+        addResult(file, strRelativePath, (file.m_nModified1 == file.m_nModified2) ? FI_STATE_THESAME : getDifferentState(file), VERIFIED_METADATA);
+        return;
+    }
+
+    //a manifest has no blocks to sample, so the sampled modes use the hashes as well
+    bool bDifferent = false;
+    {
+        QByteArray hash1, hash2;
+        if (!getHash(file.m_pEntry1, pStrPath1, file.m_nSize1, file.m_nModified1, hash1)) {
+            addResult(file, strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE);
+            return;
+        }
+        if (!getHash(file.m_pEntry2, pStrPath2, file.m_nSize2, file.m_nModified2, hash2)) {
+            addResult(file, strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE);
+            return;
+        }
+        bDifferent = (hash1 != hash2);
+    }
+
+    addResult(file, strRelativePath, bDifferent ? getDifferentState(file) : FI_STATE_THESAME, VERIFIED_FULL);
+}
+
+bool CFolderCompare::getHash(const CManifestEntry* pEntry, const char *pStrPath, qint64 nSize, qint64 nModified, QByteArray& hash)
+{
+    if (pEntry) {
+        hash = pEntry->m_hash;
+        return true;
+    }
+
+    //a live file is only read if the hash cache doesn't have it with the same size and modified time
+    return m_hashCache.GetFileHash(pStrPath, nSize, nModified, hash);
+}
+
+void CFolderCompare::compareArchived(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath)
+{
+    //At least one side is in an archive. As with manifests the contents are compared byte for byte.
+    //Zips and .tar.gz indexes have a CRC of every file, so two archives mostly differ without decompressing anything.
+    if (file.m_inFile == CDiffFileNode::left) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE);
+        return;
+    }
+    if (file.m_inFile == CDiffFileNode::right) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE);
+        return;
+    }
+
+    if (file.m_nSize1 != file.m_nSize2) {
+        addResult(file, strRelativePath, getDifferentState(file), VERIFIED_METADATA);
+        return;
+    }
+    if (m_nVerifyMode == FOLDERS_VERIFY_METADATA) {
+        addResult(file, strRelativePath, (file.m_nModified1 == file.m_nModified2) ? FI_STATE_THESAME : getDifferentState(file), VERIFIED_METADATA);
+        return;
+    }
+
+    const CArchiveEntry* pArchived1 = file.m_pArchived1;
+    const CArchiveEntry* pArchived2 = file.m_pArchived2;
+    if (pArchived1 && pArchived2 && pArchived1->m_bCrc && pArchived2->m_bCrc) {
+        if (pArchived1->m_nCrc != pArchived2->m_nCrc) {
+            addResult(file, strRelativePath, getDifferentState(file), VERIFIED_FULL);
+            return;
+        }
+        if (m_nVerifyMode == FOLDERS_VERIFY_SAMPLED) {
+            addResult(file, strRelativePath, FI_STATE_THESAME, VERIFIED_SAMPLED);  //the CRCs stand in for samples
+            return;
+        }
+    }
+
+    if (file.m_pEntry1 || file.m_pEntry2) {
+        //the other side is a manifest, which only has a hash to compare with
+        bool bLeftArchived = (pArchived1 != NULL);
+        CArchiveStream stream;
+        QByteArray hash;
+        if (!openSide(file, bLeftArchived, bLeftArchived ? pStrPath1 : pStrPath2, stream) || !hashStream(stream, hash)) {
+            addResult(file, strRelativePath, bLeftArchived ? FI_STATE_ONLYIN2 : FI_STATE_ONLYIN1, VERIFIED_NONE);
+            return;
+        }
+        const QByteArray& manifestHash = bLeftArchived ? file.m_pEntry2->m_hash : file.m_pEntry1->m_hash;
+        addResult(file, strRelativePath, (hash != manifestHash) ? getDifferentState(file) : FI_STATE_THESAME, VERIFIED_FULL);
+        return;
+    }
+
+    CArchiveStream stream1, stream2;
+    if (!openSide(file, true, pStrPath1, stream1)) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE);
+        return;
+    }
+    if (!openSide(file, false, pStrPath2, stream2)) {
+        addResult(file, strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE);
+        return;
+    }
+
+    int nResult = compareStreams(stream1, stream2, strRelativePath);
+    if (nResult == STREAMS_CANCELLED)
+        return;  //cancelled part way through, so there is no result for this file
+    if (nResult == STREAMS_ERROR1)
+        addResult(file, strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE);
+    else if (nResult == STREAMS_ERROR2)
+        addResult(file, strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE);
+    else
+        addResult(file, strRelativePath, (nResult == STREAMS_DIFFERENT) ? getDifferentState(file) : FI_STATE_THESAME, VERIFIED_FULL);
+}
+
+int CFolderCompare::compareStreams(CArchiveStream& stream1, CArchiveStream& stream2, const std::string& strRelativePath)
+{
+    std::vector<char> buffer1(ARCHIVE_COMPARE_SIZE), buffer2(ARCHIVE_COMPARE_SIZE);
+    for (;;)
+    {
+        qint64 nRead1 = stream1.Read(&buffer1[0], ARCHIVE_COMPARE_SIZE);
+        qint64 nRead2 = stream2.Read(&buffer2[0], ARCHIVE_COMPARE_SIZE);
+        if ((nRead1 < 0) || (nRead2 < 0)) {
+            qDebug() << "Can't read" << strRelativePath.c_str();
+            return (nRead1 < 0) ? STREAMS_ERROR1 : STREAMS_ERROR2;
+        }
+        if ((nRead1 != nRead2) || (memcmp(&buffer1[0], &buffer2[0], nRead1) != 0))
+            return STREAMS_DIFFERENT;
+        if (nRead1 == 0)
+            return STREAMS_SAME;
+        if (!Progress())
+            return STREAMS_CANCELLED;
+    }
+}
+
+qint64 CFolderCompare::getGitSize(const CDiffFileNode& file, bool bLeft)
+{
+    //asked for only when needed, as most files of two revisions are decided by their object IDs alone
+    const CGitEntry* pGit = bLeft ? file.m_pGit1 : file.m_pGit2;
+    if (!pGit)
+        return bLeft ? file.m_nSize1 : file.m_nSize2;
+
+    std::string strOid, strType;
+    qint64 nSize;
+    if (!m_pGit->GetObjectInfo(pGit->m_strOid, strOid, strType, nSize))
+        return -1;
+    return nSize;
+}
+
+void CFolderCompare::compareGit(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath)
+{
+    //At least one side is a git revision. Object IDs are hashes of the contents, so files of two revisions
+    //are compared without reading either, and a live file is hashed the way git would hash it rather than
+    //reading the blob. As with manifests, line ending differences count, except that a live file with
+    //\r\n where its blob has \n is the same, as the line compare of two live folders would find it.
+    if (file.m_inFile == CDiffFileNode::left) {
+        addResult(strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE, getGitSize(file, true), -1);
+        return;
+    }
+    if (file.m_inFile == CDiffFileNode::right) {
+        addResult(strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE, -1, getGitSize(file, false));
+        return;
+    }
+
+    if (file.m_pGit1 && file.m_pGit2) {
+        bool bSame = (file.m_pGit1->m_strOid == file.m_pGit2->m_strOid);
+        if (bSame && !m_bShowSame)
+            addResult(strRelativePath, FI_STATE_THESAME, VERIFIED_FULL, 0, 0);  //not shown, so its size isn't needed
+        else
+            addResult(strRelativePath, bSame ? FI_STATE_THESAME : getDifferentState(file), VERIFIED_FULL, getGitSize(file, true), getGitSize(file, false));
+        return;
+    }
+
+    bool bLeftGit = (file.m_pGit1 != NULL);
+    qint64 nSize1 = getGitSize(file, true);
+    qint64 nSize2 = getGitSize(file, false);
+    if ((nSize1 < 0) || (nSize2 < 0)) {
+        addResult(strRelativePath, (nSize1 < 0) ? FI_STATE_ONLYIN2 : FI_STATE_ONLYIN1, VERIFIED_NONE, nSize1, nSize2);
+        return;
+    }
+
+    //a checkout with core.autocrlf is bigger than its blobs, so only a bigger live file is hashed again
+    //with its \r\n as \n
+    const std::string& strOid = bLeftGit ? file.m_pGit1->m_strOid : file.m_pGit2->m_strOid;
+    bool bOtherLive = bLeftGit ? !(file.m_pEntry2 || file.m_pArchived2) : !(file.m_pEntry1 || file.m_pArchived1);
+    QString strLivePath = QString::fromLocal8Bit(bLeftGit ? pStrPath2 : pStrPath1);
+    std::string strLiveOid;
+    if (bOtherLive && ((bLeftGit ? nSize2 : nSize1) > (bLeftGit ? nSize1 : nSize2)) &&
+        CGitRepo::HashFile(strLivePath, strOid.size(), strLiveOid, true) && (strLiveOid == strOid)) {
+        addResult(strRelativePath, FI_STATE_THESAME, VERIFIED_FULL, nSize1, nSize2);
+        return;
+    }
+    if (nSize1 != nSize2) {
+        addResult(strRelativePath, getDifferentState(file), VERIFIED_METADATA, nSize1, nSize2);
+        return;
+    }
+
+    if (bOtherLive && CGitRepo::HashFile(strLivePath, strOid.size(), strLiveOid)) {
+        addResult(strRelativePath, (strLiveOid == strOid) ? FI_STATE_THESAME : getDifferentState(file), VERIFIED_FULL, nSize1, nSize2);
+        return;
+    }
+
+    //a manifest or archive on the other side, or a live file that couldn't be hashed: the blob is read
+    std::string strType;
+    QByteArray blob;
+    if (!m_pGit->ReadObject(strOid, strType, blob)) {
+        addResult(strRelativePath, bLeftGit ? FI_STATE_ONLYIN2 : FI_STATE_ONLYIN1, VERIFIED_NONE, nSize1, nSize2);
+        return;
+    }
+    CArchiveStream gitStream, otherStream;
+    gitStream.OpenData(blob);
+
+    if (file.m_pEntry1 || file.m_pEntry2) {
+        QByteArray hash;
+        hashStream(gitStream, hash);
+        const QByteArray& manifestHash = bLeftGit ? file.m_pEntry2->m_hash : file.m_pEntry1->m_hash;
+        addResult(strRelativePath, (hash != manifestHash) ? getDifferentState(file) : FI_STATE_THESAME, VERIFIED_FULL, nSize1, nSize2);
+        return;
+    }
+
+    if (!openSide(file, !bLeftGit, bLeftGit ? pStrPath2 : pStrPath1, otherStream)) {
+        addResult(strRelativePath, bLeftGit ? FI_STATE_ONLYIN1 : FI_STATE_ONLYIN2, VERIFIED_NONE, nSize1, nSize2);
+        return;
+    }
+    int nResult = bLeftGit ? compareStreams(gitStream, otherStream, strRelativePath) : compareStreams(otherStream, gitStream, strRelativePath);
+    if (nResult == STREAMS_CANCELLED)
+        return;
+    if ((nResult == STREAMS_ERROR1) || (nResult == STREAMS_ERROR2))
+        addResult(strRelativePath, (nResult == STREAMS_ERROR1) ? FI_STATE_ONLYIN2 : FI_STATE_ONLYIN1, VERIFIED_NONE, nSize1, nSize2);
+    else
+        addResult(strRelativePath, (nResult == STREAMS_DIFFERENT) ? getDifferentState(file) : FI_STATE_THESAME, VERIFIED_FULL, nSize1, nSize2);
+}
+
+bool CFolderCompare::openSide(const CDiffFileNode& file, bool bLeft, const char *pStrPath, CArchiveStream& stream)
+{
+    const CArchiveEntry* pArchived = bLeft ? file.m_pArchived1 : file.m_pArchived2;
+    if (pArchived)
+        return (bLeft ? m_pArchive1 : m_pArchive2)->OpenEntry(*pArchived, stream);
+    return stream.Open(QString::fromLocal8Bit(pStrPath), 0, -1, ARCHIVE_STORED);
+}
+
+bool CFolderCompare::hashStream(CArchiveStream& stream, QByteArray& hash)
+{
+    //the same MD5 a manifest holds
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    std::vector<char> buffer(ARCHIVE_COMPARE_SIZE);
+    for (;;) {
+        qint64 nRead = stream.Read(&buffer[0], buffer.size());
+        if (nRead < 0)
+            return false;
+        if (nRead == 0)
+            break;
+        md5.addData(&buffer[0], (int)nRead);
+    }
+    hash = md5.result();
+    return true;
+}
+
+int CFolderCompare::getDifferentState(const CDiffFileNode& file)
+{
+    //files are different, so find out which is more recent
+    if (file.m_nModified1 > file.m_nModified2)
+        return FI_STATE_1MORERECENT;
+    else if (file.m_nModified2 > file.m_nModified1)
+        return FI_STATE_2MORERECENT;
+    else
+        return FI_STATE_ERROR; //files are different but modified at exactly the same time
+}
+
+void CFolderCompare::addMoveCandidate(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath)
+{
+    bool bLeft = (file.m_inFile == CDiffFileNode::left);
+
+    CMoveCandidate candidate;
+    candidate.m_strPath = bLeft ? pStrPath1 : pStrPath2;
+    candidate.m_strRelativePath = strRelativePath;
+    candidate.m_nSize = bLeft ? file.m_nSize1 : file.m_nSize2;
+    candidate.m_nModified = bLeft ? file.m_nModified1 : file.m_nModified2;
+    candidate.m_pEntry = bLeft ? file.m_pEntry1 : file.m_pEntry2;
+    m_moveDetector.Add(candidate, bLeft);
+}
+
+void CFolderCompare::reportMoves()
+{
+    //pairs up the files that are only in one folder, then reports the moves and whatever is left over.
+    //A cancelled compare skips the pairing, so the held back files are reported as they are.
+    if (m_moveDetector.IsEmpty())
+        return;
+
+    if (!m_bCancelled)
+        m_moveDetector.Detect();
+
+    const std::vector<CMoveCandidate>& left = m_moveDetector.GetLeft();
+    const std::vector<CMoveCandidate>& right = m_moveDetector.GetRight();
+    const std::vector<CMove>& moves = m_moveDetector.GetMoves();
+    for (size_t n=0; n<moves.size(); n++) {
+        const CMoveCandidate& file1 = left[moves[n].m_nLeft];
+        const CMoveCandidate& file2 = right[moves[n].m_nRight];
+        m_nFiles++;
+        m_nDifferences++;
+        //exact moves are matched by content hash, similar ones by a sampled fingerprint
+        if (moves[n].m_bExact)
+            m_pListener->OnFileMoved(file1.m_strRelativePath, file2.m_strRelativePath, FI_STATE_MOVED, VERIFIED_FULL, file1.m_nSize, file2.m_nSize);
+        else
+            m_pListener->OnFileMoved(file1.m_strRelativePath, file2.m_strRelativePath, FI_STATE_MOVEDCHANGED, VERIFIED_SAMPLED, file1.m_nSize, file2.m_nSize);
+    }
+
+    for (size_t n=0; n<left.size(); n++)
+        if (!m_moveDetector.IsLeftMoved(n))
+            addResult(left[n].m_strRelativePath, FI_STATE_ONLYIN1, VERIFIED_NONE, left[n].m_nSize, -1);
+    for (size_t n=0; n<right.size(); n++)
+        if (!m_moveDetector.IsRightMoved(n))
+            addResult(right[n].m_strRelativePath, FI_STATE_ONLYIN2, VERIFIED_NONE, -1, right[n].m_nSize);
+
+    m_moveDetector.Clear();
+}
+
+void CFolderCompare::addResult(const CDiffFileNode& file, const std::string& strRelativePath, int nState, int nVerified)
+{
+    addResult(strRelativePath, nState, nVerified, file.m_nSize1, file.m_nSize2);
+}
+
+void CFolderCompare::addResult(const std::string& strRelativePath, int nState, int nVerified, qint64 nSize1, qint64 nSize2)
+{
+    if ((nSize1 >= 0) && (nSize2 >= 0))
+        FileDone(nSize1 + nSize2);
+
+    m_nFiles++;
+    if (nState == FI_STATE_THESAME) {
+        if (!m_bShowSame)
+            return;
+    }
+    else
+        m_nDifferences++;
+
+    m_pListener->OnFileCompared(strRelativePath, nState, nVerified, nSize1, nSize2);
+}
+
+////////////////////////////////////////
+
+
+bool CDiffDirectoryNode::ReadDirectoryTree(const char *pStrPath1, const char *pStrPath2)
+{
+    //each side is scanned with the ignore files found in its own tree
+    CIgnoreLevel ignoreRoot1(NULL, ""), ignoreRoot2(NULL, "");
+    bool bUseIgnoreFiles = m_pCompare->GetUseIgnoreFiles();
+    ParseDirectory(pStrPath1, true, bUseIgnoreFiles ? &ignoreRoot1 : NULL);
+    ParseDirectory(pStrPath2, false, bUseIgnoreFiles ? &ignoreRoot2 : NULL);
+    return true;
+}
+
+void CDiffDirectoryNode::readIgnoreFiles(const QString& strPath, CIgnoreLevel& level)
+{
+    //.ignore is read last so that its patterns take precedence over .gitignore in the same folder
+    const char *ignoreFiles[] = {".gitignore", ".ignore"};
+    for (int n=0; n<2; n++) {
+        QFile file(combinePaths(strPath, ignoreFiles[n]));
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        QByteArray data = file.readAll();
+        level.AddPatterns(data.constData(), data.size());
+    }
+}
+
+bool CDiffDirectoryNode::ParseDirectory(const char *pStrPath, bool bLeft, CIgnoreLevel* pIgnore, bool bRecursive)
+{
+//	using namespace boost::filesystem;
+
+//	if (!exists(pStrPath))
+//		return false;
+    QDir dir(pStrPath);
+    if (!dir.exists())
+        return false;
+
+    if (bLeft)
+        m_strLeftPath = pStrPath;
+    else
+        m_strRightPath = pStrPath;
+
+    //Patterns from this folder's ignore files apply to everything below it. Ignored entries are never
+    //added to the tree, so ignored folders are not opened at all.
+    if (pIgnore)
+        readIgnoreFiles(pStrPath, *pIgnore);
+
+    const CExceptionMatcher* pExceptions = m_pCompare->GetExceptions();
+
+    QFileInfoList list = dir.entryInfoList(QDir::Files|QDir::Dirs|QDir::NoDotAndDotDot, QDir::DirsFirst);
+    for (int i=0; i<list.size(); ++i) {
+//	directory_iterator end ;
+//	for( directory_iterator it(pStrPath) ; it != end ; ++it )
+//	{
+        if (!m_pCompare->Progress(1))
+            return false;
+        QFileInfo fileInfo = list.at(i);
+        std::string strPath = fileInfo.filePath().toLocal8Bit().constData();
+        std::string strFilename = fileInfo.fileName().toLocal8Bit().constData();
+//		std::string strPath = it->path().string();
+//		std::string strFilename = it->path().filename().string();
+//		if (is_directory(*it))
+        std::string strRelativePath = m_strRelativePath + "/" + strFilename;
+        if (pIgnore && ((strFilename == ".git") || pIgnore->IsIgnored(strRelativePath, fileInfo.isDir())))
+            continue;
+        if (fileInfo.isDir())
+        {
+            std::map<std::string, CDiffDirectoryNode>::iterator itFind = m_mapDirectories.find(strFilename);
+            if (itFind == m_mapDirectories.end())
+            { //not found, so let's create a new entry
+                //excluded directories are never read, so none of their files need checking individually
+                if (pExceptions && pExceptions->MatchesDirectory(strRelativePath))
+                    continue;
+                itFind = m_mapDirectories.insert(std::make_pair(strFilename, CDiffDirectoryNode(m_pCompare, strRelativePath))).first;
+            }
+            //if the directory node already exists then this must be a right item
+
+            CDiffDirectoryNode& child = itFind->second;
+            if (bRecursive)
+            {
+                CIgnoreLevel ignoreChild(pIgnore, strRelativePath);
+                child.ParseDirectory(strPath.c_str(), bLeft, pIgnore ? &ignoreChild : NULL);
+            }
+            else if (bLeft)
+                child.m_strLeftPath = strPath;  //ScanAndCompare() will read it later
+            else
+                child.m_strRightPath = strPath;
+        }
+        else
+        {
+            if (pExceptions && pExceptions->MatchesFile(strRelativePath))
+                continue;
+
+            CDiffFileNode& file = addFile(strFilename, bLeft);
+            if (bLeft) {
+                file.m_nSize1 = fileInfo.size();
+                file.m_nModified1 = fileInfo.lastModified().toMSecsSinceEpoch();
+            }
+            else {
+                file.m_nSize2 = fileInfo.size();
+                file.m_nModified2 = fileInfo.lastModified().toMSecsSinceEpoch();
+            }
+        }
+    }
+    return true;
+}
+
+CDiffFileNode& CDiffDirectoryNode::addFile(const std::string& strFilename, bool bLeft)
+{
+    std::map<std::string, CDiffFileNode>::iterator itFind = m_mapFiles.find(strFilename);
+    if (itFind == m_mapFiles.end())
+    {
+        CDiffFileNode file;
+        file.m_strFilename = strFilename;
+        file.m_inFile = bLeft ? CDiffFileNode::left : CDiffFileNode::right;
+        itFind = m_mapFiles.insert(std::make_pair(strFilename, file)).first;
+    }
+    else
+        itFind->second.m_inFile = CDiffFileNode::both;  //if there is already an entry then it must have been for left and this must be right, so we have both.
+
+    return itFind->second;
+}
+
+CDiffFileNode* CDiffDirectoryNode::addTreeFile(const std::string& strPath, bool bLeft)
+{
+    //builds the same tree that ParseDirectory() would, from a relative path
+    const CExceptionMatcher* pExceptions = m_pCompare->GetExceptions();
+    CDiffDirectoryNode* pNode = this;
+    size_t nStart = 1;  //relative paths start with a '/'
+    size_t nSlash;
+    while ((nSlash = strPath.find('/', nStart)) != std::string::npos)
+    {
+        std::string strDirname = strPath.substr(nStart, nSlash - nStart);
+        std::map<std::string, CDiffDirectoryNode>::iterator itFind = pNode->m_mapDirectories.find(strDirname);
+        if (itFind == pNode->m_mapDirectories.end())
+        {
+            std::string strRelativePath = strPath.substr(0, nSlash);
+            if (pExceptions && pExceptions->MatchesDirectory(strRelativePath))
+                return NULL;
+            itFind = pNode->m_mapDirectories.insert(std::make_pair(strDirname, CDiffDirectoryNode(m_pCompare, strRelativePath))).first;
+        }
+        pNode = &itFind->second;
+        nStart = nSlash + 1;
+    }
+
+    if (pExceptions && pExceptions->MatchesFile(strPath))
+        return NULL;
+
+    return &pNode->addFile(strPath.substr(nStart), bLeft);
+}
+
+void CDiffDirectoryNode::AddManifest(const CTreeManifest& manifest, bool bLeft)
+{
+    const std::vector<CManifestEntry>& entries = manifest.GetEntries();
+    for (size_t n=0; n<entries.size(); n++)
+    {
+        const CManifestEntry& entry = entries[n];
+        CDiffFileNode* pFile = addTreeFile(entry.m_strPath, bLeft);
+        if (!pFile)
+            continue;
+
+        if (bLeft) {
+            pFile->m_nSize1 = entry.m_nSize;
+            pFile->m_nModified1 = entry.m_nModified;
+            pFile->m_pEntry1 = &entry;
+        }
+        else {
+            pFile->m_nSize2 = entry.m_nSize;
+            pFile->m_nModified2 = entry.m_nModified;
+            pFile->m_pEntry2 = &entry;
+        }
+    }
+}
+
+void CDiffDirectoryNode::AddArchive(const CArchive& archive, bool bLeft)
+{
+    const std::vector<CArchiveEntry>& entries = archive.GetEntries();
+    for (size_t n=0; n<entries.size(); n++)
+    {
+        const CArchiveEntry& entry = entries[n];
+        CDiffFileNode* pFile = addTreeFile(entry.m_strPath, bLeft);
+        if (!pFile)
+            continue;
+
+        if (bLeft) {
+            pFile->m_nSize1 = entry.m_nSize;
+            pFile->m_nModified1 = entry.m_nModified;
+            pFile->m_pArchived1 = &entry;
+        }
+        else {
+            pFile->m_nSize2 = entry.m_nSize;
+            pFile->m_nModified2 = entry.m_nModified;
+            pFile->m_pArchived2 = &entry;
+        }
+    }
+}
+
+void CDiffDirectoryNode::AddGitTrees(CGitRepo& repo, const std::string& strTree1, const std::string& strTree2, qint64 nTime1, qint64 nTime2, std::deque<CGitEntry>& entries)
+{
+    //Both revisions are walked together, one folder at a time. Ignore files aren't applied, as a revision
+    //only has what was committed.
+    std::vector<CGitTreeEntry> tree1, tree2;
+    if (!strTree1.empty())
+        repo.ReadTree(strTree1, tree1);
+    if (!strTree2.empty())
+        repo.ReadTree(strTree2, tree2);
+
+    const CExceptionMatcher* pExceptions = m_pCompare->GetExceptions();
+    std::map<std::string, std::pair<std::string, std::string> > folders;  //name -> tree of each side
+    for (int nSide=0; nSide<2; nSide++)
+    {
+        bool bLeft = (nSide == 0);
+        const std::vector<CGitTreeEntry>& tree = bLeft ? tree1 : tree2;
+        for (size_t n=0; n<tree.size(); n++)
+        {
+            const CGitTreeEntry& treeEntry = tree[n];
+            std::string strRelativePath = m_strRelativePath + "/" + treeEntry.m_strName;
+            if (treeEntry.m_bTree) {
+                if (pExceptions && pExceptions->MatchesDirectory(strRelativePath))
+                    continue;
+                std::pair<std::string, std::string>& sides = folders[treeEntry.m_strName];
+                (bLeft ? sides.first : sides.second) = treeEntry.m_strOid;
+                continue;
+            }
+            if (pExceptions && pExceptions->MatchesFile(strRelativePath))
+                continue;
+
+            entries.push_back(CGitEntry());
+            CGitEntry& entry = entries.back();
+            entry.m_strOid = treeEntry.m_strOid;
+            entry.m_nModified = bLeft ? nTime1 : nTime2;
+
+            CDiffFileNode& file = addFile(treeEntry.m_strName, bLeft);
+            if (bLeft) {
+                file.m_nSize1 = 0;
+                file.m_nModified1 = nTime1;
+                file.m_pGit1 = &entry;
+            }
+            else {
+                file.m_nSize2 = 0;
+                file.m_nModified2 = nTime2;
+                file.m_pGit2 = &entry;
+            }
+        }
+    }
+
+    //a folder with the same tree on both sides has the same files all the way down
+    std::map<std::string, std::pair<std::string, std::string> >::iterator it = folders.begin();
+    for ( ; it != folders.end(); ++it)
+    {
+        if ((it->second.first == it->second.second) && !m_pCompare->GetShowSame())
+            continue;
+
+        std::map<std::string, CDiffDirectoryNode>::iterator itFind = m_mapDirectories.find(it->first);
+        if (itFind == m_mapDirectories.end())
+            itFind = m_mapDirectories.insert(std::make_pair(it->first, CDiffDirectoryNode(m_pCompare, m_strRelativePath + "/" + it->first))).first;
+        itFind->second.AddGitTrees(repo, it->second.first, it->second.second, nTime1, nTime2, entries);
+    }
+}
+
+bool CDiffDirectoryNode::addToManifest(CTreeManifest& manifest)
+{
+    CHashCache* pHashCache = m_pCompare->GetHashCache();
+
+    std::map<std::string, CDiffFileNode>::iterator itFile = m_mapFiles.begin();
+    for ( ; itFile != m_mapFiles.end(); ++itFile)
+    {
+        const CDiffFileNode& file = itFile->second;
+        std::string strPath = combinePaths(m_strLeftPath.c_str(), file.m_strFilename.c_str()).toLocal8Bit().constData();
+
+        CManifestEntry entry;
+        entry.m_strPath = m_strRelativePath + "/" + file.m_strFilename;
+        entry.m_nSize = file.m_nSize1;
+        entry.m_nModified = file.m_nModified1;
+        if (!pHashCache->GetFileHash(strPath, file.m_nSize1, file.m_nModified1, entry.m_hash))
+            qDebug() << "Can't read" << strPath.c_str();
+        else
+            manifest.AddEntry(entry);
+
+        if (!m_pCompare->FileDone(file.m_nSize1))
+            return false;
+    }
+
+    std::map<std::string, CDiffDirectoryNode>::iterator itDir = m_mapDirectories.begin();
+    for ( ; itDir != m_mapDirectories.end(); ++itDir)
+        if (!itDir->second.addToManifest(manifest))
+            return false;
+
+    return true;
+}
+
+void CDiffDirectoryNode::countWork(int& nFiles, qint64& nBytes, bool bBothOnly)
+{
+    std::map<std::string, CDiffFileNode>::iterator itFile = m_mapFiles.begin();
+    for ( ; itFile != m_mapFiles.end(); ++itFile)
+    {
+        const CDiffFileNode& file = itFile->second;
+        if (bBothOnly && (file.m_inFile != CDiffFileNode::both))
+            continue;
+        nFiles++;
+        nBytes += qMax(file.m_nSize1, (qint64)0) + qMax(file.m_nSize2, (qint64)0);
+    }
+
+    std::map<std::string, CDiffDirectoryNode>::iterator itDir = m_mapDirectories.begin();
+    for ( ; itDir != m_mapDirectories.end(); ++itDir)
+        itDir->second.countWork(nFiles, nBytes, bBothOnly);
+}
+
+void CDiffDirectoryNode::compareFiles()
+{
+    //the files are handed over together, so that small ones can be read in batches
+    std::vector<CFileToCompare> files;
+    files.reserve(m_mapFiles.size());
+
+    std::map<std::string, CDiffFileNode>::iterator itFile = m_mapFiles.begin();
+    for ( ; itFile != m_mapFiles.end(); ++itFile)
+    {
+        std::string strLeftFile = itFile->second.m_strFilename;
+        std::string strLeftPath = "";
+        if ((strLeftFile != "") && (m_strLeftPath != "") && (itFile->second.m_inFile != CDiffFileNode::right)) {
+            strLeftPath = m_strLeftPath;
+            //XDUtil::CombinePaths(strLeftPath, strLeftFile.c_str());
+            strLeftPath = combinePaths(strLeftPath.c_str(),strLeftFile.c_str()).toLocal8Bit().constData();
+        }
+
+        std::string strRightFile = itFile->second.m_strFilename;
+        std::string strRightPath = "";
+        if ((strRightFile != "") && (m_strRightPath != "") && (itFile->second.m_inFile != CDiffFileNode::left)) {
+            strRightPath = m_strRightPath;
+            //XDUtil::CombinePaths(strRightPath, strRightFile.c_str());
+            strRightPath = combinePaths(strRightPath.c_str(),strRightFile.c_str()).toLocal8Bit().constData();
+        }
+
+        CFileToCompare toCompare;
+        toCompare.m_pFile = &itFile->second;
+        toCompare.m_strPath1 = strLeftPath;
+        toCompare.m_strPath2 = strRightPath;
+        toCompare.m_strRelativePath = m_strRelativePath + "/" + itFile->second.m_strFilename;
+        files.push_back(toCompare);
+    }
+
+    m_pCompare->CompareFiles(files);  //does file compares and updates UI
+}
+
+bool CDiffDirectoryNode::DoCompare()
+{
+    //compare all files in this directory and then call DoCompare() for each sub-directory
+
+    //files
+    compareFiles();
+
+    //directories
+    std::map<std::string, CDiffDirectoryNode>::iterator itDir = m_mapDirectories.begin();
+    for ( ; (itDir != m_mapDirectories.end()) && !m_pCompare->IsCancelled(); ++itDir)
+    {
+        itDir->second.DoCompare();
+    }
+
+    return false;
+}
+
+bool CDiffDirectoryNode::ScanAndCompare(CIgnoreLevel* pIgnoreParent1, CIgnoreLevel* pIgnoreParent2)
+{
+    //Same results and order as ReadDirectoryTree() followed by DoCompare(), but only one folder of each
+    //side is held at a time. Ignore levels live on this stack frame while the sub-directories are compared.
+    CIgnoreLevel ignore1(pIgnoreParent1, m_strRelativePath), ignore2(pIgnoreParent2, m_strRelativePath);
+    CIgnoreLevel* pIgnore1 = pIgnoreParent1 ? &ignore1 : NULL;
+    CIgnoreLevel* pIgnore2 = pIgnoreParent2 ? &ignore2 : NULL;
+
+    std::string strLeftPath = m_strLeftPath, strRightPath = m_strRightPath;
+    m_strLeftPath = m_strRightPath = "";
+    if (strLeftPath != "")
+        ParseDirectory(strLeftPath.c_str(), true, pIgnore1, false);
+    if (strRightPath != "")
+        ParseDirectory(strRightPath.c_str(), false, pIgnore2, false);
+
+    compareFiles();
+    m_mapFiles.clear();
+
+    while (!m_mapDirectories.empty() && !m_pCompare->IsCancelled())
+    {
+        std::map<std::string, CDiffDirectoryNode>::iterator itDir = m_mapDirectories.begin();
+        itDir->second.ScanAndCompare(pIgnore1, pIgnore2);
+        m_mapDirectories.erase(itDir);
+    }
+
+    return false;
+}
+
+QString CDiffDirectoryNode::combinePaths(const QString& strPath1, const QString& strPath2)
+{
+//    qDebug() << "combinePaths" << strPath1 << strPath2;
+    return QDir::cleanPath(strPath1 + QDir::separator() + strPath2);
+/*
+    if (strPath1.endsWith(QDir::separator())) {
+        if (strPath2.startsWith(QDir::separator()))
+            return strPath1 + strPath2.right(strPath2.size()-1);
+        else
+            return strPath1 + strPath2;
+    }
+    else {
+        if (strPath2.startsWith(QDir::separator()))
+            return strPath1 + strPath2;
+        else
+            return strPath1 + QDir::separator() + strPath2;
+    }
+*/
+}
@@ -0,0 +1,264 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef FOLDERCOMPARE_H
+#define FOLDERCOMPARE_H
+
+#include <QString>
+#include <QElapsedTimer>
+#include <string>
+#include <map>
+#include <deque>
+#include "exceptionmatcher.h"
+#include "ignorerules.h"
+#include "treemanifest.h"
+#include "movedetector.h"
+#include "batchio.h"
+#include "archive.h"
+#include "gitrepo.h"
+
+class CDiffDoc;
+class QStringList;
+
+
+//FolderItem states (used in the folders dialog table and the command line output)
+#define FI_STATE_THESAME		0
+#define FI_STATE_ONLYIN1		1
+#define FI_STATE_ONLYIN2		2
+#define FI_STATE_1MORERECENT	3
+#define FI_STATE_2MORERECENT	4
+#define FI_STATE_ERROR			5   //different, but both have the same modified time
+#define FI_STATE_MOVED			6   //only in each folder under a different path, with the same contents
+#define FI_STATE_MOVEDCHANGED	7   //only in each folder under a different path, with similar contents
+#define FI_STATE_COUNT			8
+
+const char *folderStateText(int nState);  //e.g. "Only in folder1"
+const char *folderStateName(int nState);  //e.g. "ONLYIN1" for machine readable output
+
+//How files in both folders are compared
+#define FOLDERS_VERIFY_FULL         0   //whole contents
+#define FOLDERS_VERIFY_METADATA     1   //size and modified time only, nothing is read
+#define FOLDERS_VERIFY_SAMPLED      2   //size, then a few blocks from the start, end and middle
+#define FOLDERS_VERIFY_SAMPLEDFULL  3   //as sampled, then whole contents if the samples match
+#define FOLDERS_VERIFY_COUNT        4
+
+//How strongly a result was checked, from the cheapest check that decided it
+#define VERIFIED_NONE       0   //only in one folder
+#define VERIFIED_METADATA   1
+#define VERIFIED_SAMPLED    2
+#define VERIFIED_FULL       3   //whole contents or content hashes
+#define VERIFIED_COUNT      4
+
+const char *verifiedText(int nVerified);  //e.g. "Sampled"
+const char *verifiedName(int nVerified);  //e.g. "sampled" for machine readable output
+
+
+class CFolderCompareProgress
+{
+public:
+    int m_nFilesScanned;   //folder entries read so far
+    int m_nFilesDone;      //files in both folders compared so far
+    int m_nFilesTotal;     //-1 while scanning, and when streaming as the total is never known
+    qint64 m_nBytesDone;
+    qint64 m_nBytesTotal;  //-1 while scanning, and when streaming
+    qint64 m_nElapsed;     //msecs since the compare phase started, or since the scan started while scanning
+};
+
+
+//Receives the result of each file compare as soon as it is known
+class CFolderCompareListener
+{
+public:
+    virtual ~CFolderCompareListener() {}
+    //called every so often while scanning and comparing. CFolderCompare::Cancel() can be called from here.
+    virtual void OnProgress(const CFolderCompareProgress& progress) {}
+    virtual void OnFileCompared(const std::string& strRelativePath, int nState, int nVerified, qint64 nSize1, qint64 nSize2) = 0;
+    //a file that was moved or renamed. These arrive after all the other results.
+    virtual void OnFileMoved(const std::string& strRelativePath1, const std::string& strRelativePath2, int nState, int nVerified, qint64 nSize1, qint64 nSize2) = 0;
+};
+
+
+//I'm going to use a tree structre to represent the directories being compared.
+//CDirectoryNode will contain a map of child CDirectoryNode elements and
+//a map of files: CFileNode - which will have an enum for inLeft, inRight, inBoth.
+
+class CDiffFileNode
+{
+public:
+    CDiffFileNode() { m_nSize1 = m_nSize2 = -1; m_nModified1 = m_nModified2 = 0; m_pEntry1 = m_pEntry2 = NULL; m_pArchived1 = m_pArchived2 = NULL; m_pGit1 = m_pGit2 = NULL; }
+
+    std::string m_strFilename;
+    enum InFile { left, right, both };
+    InFile m_inFile;
+    qint64 m_nSize1, m_nSize2;          //-1 if not on that side
+    qint64 m_nModified1, m_nModified2;  //msecs since epoch. Taken from the directory scan, so no extra stat per file is needed.
+    const CManifestEntry* m_pEntry1;    //set if that side comes from a manifest rather than a folder
+    const CManifestEntry* m_pEntry2;
+    const CArchiveEntry* m_pArchived1;  //set if that side comes from an archive
+    const CArchiveEntry* m_pArchived2;
+    const CGitEntry* m_pGit1;           //set if that side comes from a git revision. Its size isn't known until compared.
+    const CGitEntry* m_pGit2;
+};
+
+//a file of a folder, with its full paths, waiting to be compared
+class CFileToCompare
+{
+public:
+    const CDiffFileNode* m_pFile;
+    std::string m_strPath1;  //empty if not in folder1
+    std::string m_strPath2;
+    std::string m_strRelativePath;
+};
+
+class CFolderCompare;
+
+class CDiffDirectoryNode
+{
+    friend class CFolderCompare;
+public:
+    CDiffDirectoryNode() { m_pCompare = NULL; }
+    CDiffDirectoryNode(CFolderCompare* pCompare, const std::string& strRelativePath)
+        { m_pCompare = pCompare; m_strRelativePath = strRelativePath; }
+    bool ReadDirectoryTree(const char *pStrPath1, const char *pStrPath2);  //creates internal tree structures, so we know which files to compare
+    bool DoCompare();  //compares all the files that appear in both paths and updates the UI with the compare state
+    bool ScanAndCompare(CIgnoreLevel* pIgnoreParent1, CIgnoreLevel* pIgnoreParent2);  //reads and compares one folder at a time, releasing each one when done. Recursive.
+    void AddManifest(const CTreeManifest& manifest, bool bLeft);  //adds the manifest's files to the tree in place of a folder
+    void AddArchive(const CArchive& archive, bool bLeft);  //likewise for an archive's files
+    //Likewise for the trees of git revisions, walked together. strTree is "" for a side that isn't a revision.
+    //Folders with the same tree on both sides aren't read. The entries are kept in a deque, which the files point into.
+    void AddGitTrees(CGitRepo& repo, const std::string& strTree1, const std::string& strTree2, qint64 nTime1, qint64 nTime2, std::deque<CGitEntry>& entries);
+private:
+    CDiffFileNode& addFile(const std::string& strFilename, bool bLeft);
+    CDiffFileNode* addTreeFile(const std::string& strPath, bool bLeft);  //adds a file and its folders by relative path. NULL if excluded.
+    void countWork(int& nFiles, qint64& nBytes, bool bBothOnly);  //files and bytes still to be read, for the progress estimate. Recursive.
+    bool addToManifest(CTreeManifest& manifest);  //hashes the left side files of the tree. Recursive.
+    bool ParseDirectory(const char *pStrPath, bool bLeft, CIgnoreLevel* pIgnore, bool bRecursive=true);  //walks through the directory structure creating a tree of CDiffDirectoryNodes and CDiffFileNodes. Recursive.
+    static void readIgnoreFiles(const QString& strPath, CIgnoreLevel& level);
+    void compareFiles();
+    static QString combinePaths(const QString& strPath1, const QString& strPath2);
+private:
+    std::map<std::string, CDiffDirectoryNode> m_mapDirectories;
+    std::map<std::string, CDiffFileNode> m_mapFiles;
+    std::string m_strLeftPath;
+    std::string m_strRightPath;
+    std::string m_strRelativePath;  //e.g. "/src/gui" ("" for the root node)
+    CFolderCompare* m_pCompare;
+};
+
+
+//Compares two folder trees and reports each file's state to a listener.
+//Used by the folders dialog and by the command line folder compare, so both give the same results.
+
+class CFolderCompare
+{
+public:
+    CFolderCompare(CFolderCompareListener* pListener);
+
+    void LoadOptions(CDiffDoc* pDoc);  //takes the options from the folders settings
+    void SetExceptions(const QStringList& exceptions);  //empty list disables exceptions
+    void SetUseIgnoreFiles(bool bUse) { m_bUseIgnoreFiles = bUse; }
+    void SetShowSame(bool bShow) { m_bShowSame = bShow; }
+    void SetDetectMoves(bool bDetect) { m_bDetectMoves = bDetect; }  //files only in one folder are held back until the end
+    void SetVerifyMode(int nMode) { m_nVerifyMode = nMode; }  //FOLDERS_VERIFY_*
+
+    //bStreaming reads and compares one folder at a time instead of reading the whole tree first.
+    //Results start straight away and memory use doesn't grow with the size of the tree.
+    //Either path can be a manifest file written by WriteManifest(), a zip, tar or .tar.gz archive, or a git
+    //revision spec such as "HEAD~1:" or "v1.2:src", in which case the whole tree is read first.
+    //Returns false if a manifest, archive or revision can't be read.
+    bool Compare(const char *pStrPath1, const char *pStrPath2, bool bStreaming=false);
+
+    //Compares just the given files again, e.g. ones a watch has seen change since a Compare() of the same folders.
+    //Each file is reported as Compare() would, or not at all if it is no longer in either folder or is now excluded.
+    //Relative paths of folders are skipped, so the caller expands them to the files it knows of.
+    void CompareEntries(const char *pStrPath1, const char *pStrPath2, const std::vector<std::string>& relativePaths);
+
+    //writes a manifest of the folder, applying the exceptions and ignore files the same way as Compare()
+    bool WriteManifest(const char *pStrFolder, const char *pStrFile);
+
+    //Stops a compare that is in progress, e.g. from OnProgress() or an event handler it lets run.
+    //The results reported so far are kept, and files held back for move detection are reported as they are.
+    void Cancel() { m_bCancelled = true; }
+    bool IsCancelled() { return m_bCancelled; }
+
+    //Called while walking and comparing: counts scanned entries and finished files, reports progress
+    //now and then, and returns false once the compare has been cancelled.
+    bool Progress(int nScanned=0);
+    bool FileDone(qint64 nBytes);
+
+    void CompareFile(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath);
+    //Compares the files of one folder. Small files in both folders are read in batches, the rest one at a time.
+    //Results are reported in the same order either way.
+    void CompareFiles(const std::vector<CFileToCompare>& files);
+
+    const CExceptionMatcher* GetExceptions() { return m_exceptions.IsEmpty() ? NULL : &m_exceptions; }
+    bool GetUseIgnoreFiles() { return m_bUseIgnoreFiles; }
+    bool GetShowSame() { return m_bShowSame; }
+    int GetFileCount() { return m_nFiles; }
+    int GetDifferenceCount() { return m_nDifferences; }
+    int GetGitObjectCount() { return m_nGitObjects; }  //blobs and trees read by the last compare of a git revision
+    CHashCache* GetHashCache() { return &m_hashCache; }
+    CBatchReader* GetBatchReader() { return &m_batchReader; }
+
+private:
+    void addResult(const CDiffFileNode& file, const std::string& strRelativePath, int nState, int nVerified);
+    void addResult(const std::string& strRelativePath, int nState, int nVerified, qint64 nSize1, qint64 nSize2);
+    bool compareQuick(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath);
+    int compareSamples(const char *pStrPath1, const char *pStrPath2, qint64 nSize, bool& bWhole, bool& bCR);
+    static bool startsWithCR(const char *pStrPath);
+    void addMoveCandidate(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath);
+    void reportMoves();
+    void startProgress();
+    void startComparePhase(CDiffDirectoryNode& ddn, bool bBothOnly);
+    void finishCompare();
+    void reportProgress();
+    void compareHashes(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath);
+    bool getHash(const CManifestEntry* pEntry, const char *pStrPath, qint64 nSize, qint64 nModified, QByteArray& hash);
+    void compareArchived(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath);
+    bool openSide(const CDiffFileNode& file, bool bLeft, const char *pStrPath, CArchiveStream& stream);
+    bool hashStream(CArchiveStream& stream, QByteArray& hash);
+    int compareStreams(CArchiveStream& stream1, CArchiveStream& stream2, const std::string& strRelativePath);
+    bool resolveTree(CGitRepo& repo, const char *pStrSpec, std::string& strTree, qint64& nTime);
+    void compareGit(const CDiffFileNode& file, const char *pStrPath1, const char *pStrPath2, const std::string& strRelativePath);
+    qint64 getGitSize(const CDiffFileNode& file, bool bLeft);
+    int getDifferentState(const CDiffFileNode& file);
+    bool isBatchable(const CDiffFileNode& file);
+    bool isExcluded(const std::string& strRoot, const std::string& strRelativePath);
+    void compareBatch(const std::vector<CFileToCompare>& files, size_t nStart, size_t nEnd);
+    bool compareLines(const std::string& data1, const std::string& data2);
+
+    CFolderCompareListener* m_pListener;
+    CExceptionMatcher m_exceptions;
+    bool m_bUseIgnoreFiles;
+    bool m_bShowSame;
+    bool m_bDetectMoves;
+    int m_nVerifyMode;
+    CHashCache m_hashCache;
+    CMoveDetector m_moveDetector;
+    CBatchReader m_batchReader;
+    const CArchive* m_pArchive1;  //the archive of each side during a compare, NULL for folders and manifests
+    const CArchive* m_pArchive2;
+    CGitRepo* m_pGit;  //set during a compare of a git revision
+
+    int m_nFiles;
+    int m_nDifferences;
+    int m_nGitObjects;
+
+    bool m_bCancelled;
+    CFolderCompareProgress m_progress;
+    QElapsedTimer m_timer;
+    qint64 m_nPhaseStart;
+    qint64 m_nLastProgress;
+};
+
+#endif // FOLDERCOMPARE_H
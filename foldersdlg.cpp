@@ -22,6 +22,7 @@
 #include <QHeaderView>
 #include <QLabel>
 #include <QDir>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QDateTime>
 #include <QSettings>
@@ -29,6 +30,9 @@
 #include <QFileDialog>
 #include <QDebug>
 #include <QCoreApplication>
+#include <QMenu>
+#include <QCheckBox>
+#include <QTime>
 
 
 #define FINDOTHER_END		-1
@@ -39,27 +43,34 @@
 #define FOLDERSSTATE_READY		0
 #define FOLDERSSTATE_COMPARING	1
 #define FOLDERSSTATE_DONE		2
+#define FOLDERSSTATE_ABORTED	3
 
 //text lookup for states
 static char *stateLookup[] = {"Select your two folders and press Go.",
-                              "Comparing...", "Done."};
+                              "Comparing...", "Done.", "Aborted. Showing the results found so far."};
 
-//FolderItem states (used in the table widget)
-#define FI_STATE_THESAME		0
-#define FI_STATE_ONLYIN1		1
-#define FI_STATE_ONLYIN2		2
-#define FI_STATE_1MORERECENT	3
-#define FI_STATE_2MORERECENT	4
-#define FI_STATE_ERROR			5
+//table columns
+#define COLUMN_PATH         0
+#define COLUMN_STATE        1
+#define COLUMN_VERIFIED     2
+#define COLUMN_ADDED        3
+#define COLUMN_REMOVED      4
+#define COLUMN_SECTIONS     5
+#define COLUMN_COUNT        6
 
-//text lookup for FolderItem states
-static char *g_stateLookup[] = {"The same", "Only in folder1", "Only in folder2",
-                                "Different - 1 is more recent", "Different - 2 is more recent"};
+#define LINESTATS_WAIT_MS   100  //how often the table is updated while changed lines are counted
+#define PREFETCH_ROWS       4    //different files compared in the background, from the current row down
 
 #define GOBTNLABEL_GO		"Go"
 #define GOBTNLABEL_ABORT	"Abort"
 
 
+static bool isFolderFile(const QString& strPath)
+{
+    //a manifest, archive or git revision standing in for a folder
+    return CTreeManifest::IsManifestFile(strPath) || CArchive::IsArchiveFile(strPath) || CGitRepo::IsRevisionSpec(strPath);
+}
+
 
 FoldersDlg::FoldersDlg(MainWindow* pMainWnd, QWidget *parent, Qt::WindowFlags f) :
     QDialog(parent, f)
@@ -72,6 +83,12 @@ FoldersDlg::FoldersDlg(MainWindow* pMainWnd, QWidget *parent, Qt::WindowFlags f)
     setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
 
     m_bComparing = false;
+    m_pFolderCompare = NULL;
+    m_pLineStats = NULL;
+    m_bUpdating = false;
+
+    m_pWatcher = new CFolderWatcher(this);
+    connect(m_pWatcher, SIGNAL(changed(QStringList)), this, SLOT(onWatchedChanged(QStringList)));
 
     m_pMainWnd = pMainWnd;
 
@@ -93,8 +110,8 @@ void FoldersDlg::createControls()
     QPushButton* pBtnPath2 = new QPushButton("...");
     pBtnPath2->setMaximumWidth(16);
     m_pTable = new QTableWidget();
-    m_pTable->setColumnCount(2);
-    m_pTable->setHorizontalHeaderLabels(QStringList() << "Relative path" << "State");
+    m_pTable->setColumnCount(COLUMN_COUNT);
+    m_pTable->setHorizontalHeaderLabels(QStringList() << "Relative path" << "State" << "Verified" << "Added" << "Removed" << "Sections");
     QVBoxLayout* vlayout = new QVBoxLayout(this);
     QHBoxLayout* layoutTopRow = new QHBoxLayout(this);
     QHBoxLayout* layoutStatusRow = new QHBoxLayout(this);
@@ -107,12 +124,27 @@ void FoldersDlg::createControls()
     layoutTopRow->addWidget(m_pComboPath2,1);
     layoutTopRow->addWidget(pBtnPath2);
 
+    QString strPathTip = "A folder, or a manifest file saved with Save Manifest";
+    m_pComboPath1->setToolTip(strPathTip);
+    m_pComboPath2->setToolTip(strPathTip);
+
+    QPushButton* pBtnManifest = new QPushButton("Save Manifest");
+    QMenu* pMenuManifest = new QMenu(this);
+    pMenuManifest->addAction("Of Folder 1...", this, SLOT(onSaveManifest1()));
+    pMenuManifest->addAction("Of Folder 2...", this, SLOT(onSaveManifest2()));
+    pBtnManifest->setMenu(pMenuManifest);
+
+    m_pCheckWatch = new QCheckBox("Watch");
+    m_pCheckWatch->setToolTip("Keep the results up to date as files change, comparing only the files that changed");
+
     m_pStatusText = new QLabel("Done.");
     m_pStatusCount = new QLabel("0 Objects.");
     m_pStatusCount->setMaximumWidth(100);
     m_pStatusCount->setAlignment(Qt::AlignRight);
     layoutStatusRow->addWidget(m_pStatusText);
     layoutStatusRow->addWidget(m_pStatusCount);
+    layoutStatusRow->addWidget(m_pCheckWatch);
+    layoutStatusRow->addWidget(pBtnManifest);
 
     vlayout->addLayout(layoutTopRow);
     vlayout->addWidget(m_pTable);
@@ -122,6 +154,10 @@ void FoldersDlg::createControls()
 
     m_pTable->setColumnWidth(0,360);
     m_pTable->setColumnWidth(1,160);
+    m_pTable->setColumnWidth(2,90);
+    m_pTable->setColumnWidth(COLUMN_ADDED,60);
+    m_pTable->setColumnWidth(COLUMN_REMOVED,60);
+    m_pTable->setColumnWidth(COLUMN_SECTIONS,60);
     m_pTable->verticalHeader()->setDefaultSectionSize(18);  //the default vertical size of the rows is quite big, so lets make it a bit smaller.
     m_pTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
     m_pTable->setSelectionBehavior(QAbstractItemView::SelectRows);
@@ -130,6 +166,8 @@ void FoldersDlg::createControls()
     connect(pBtnPath2,SIGNAL(pressed()),this,SLOT(onBtnPath2Pressed()));
     connect(m_pBtnGo,SIGNAL(pressed()),this,SLOT(onBtnGoPressed()));
     connect(m_pTable, SIGNAL(cellDoubleClicked(int,int)), this, SLOT(tableItemDblClicked(int,int)));
+    connect(m_pTable, SIGNAL(currentCellChanged(int,int,int,int)), this, SLOT(tableCurrentCellChanged(int,int,int,int)));
+    connect(m_pCheckWatch, SIGNAL(stateChanged(int)), this, SLOT(onClickCheckWatch(int)));
 }
 
 void FoldersDlg::onBtnPath1Pressed()
@@ -168,7 +206,14 @@ void FoldersDlg::onBtnPath2Pressed()
 
 void FoldersDlg::onBtnGoPressed()
 {
-    //TODO: check if a compare is already in progress. If so, then cancel it.
+    //the button is Abort while comparing. Pressing it is handled inside the running compare's event processing.
+    if (m_bComparing) {
+        if (m_pFolderCompare)
+            m_pFolderCompare->Cancel();
+        if (m_pLineStats)
+            m_pLineStats->Cancel();
+        return;
+    }
 
     if ((getStrFolder1() == "") || (getStrFolder2() == "")) {
         QMessageBox::information(this, APP_NAME, "Paths must be selected before comparing.");
@@ -182,19 +227,109 @@ void FoldersDlg::onBtnGoPressed()
     m_pBtnGo->setText(GOBTNLABEL_GO);
 }
 
+void FoldersDlg::onSaveManifest1()
+{
+    saveManifest(m_pComboPath1);
+}
+
+void FoldersDlg::onSaveManifest2()
+{
+    saveManifest(m_pComboPath2);
+}
+
+void FoldersDlg::saveManifest(QComboBox* pComboPath)
+{
+    QString strFolder = pComboPath->currentText();
+    if (!QFileInfo(strFolder).isDir()) {
+        QMessageBox::information(this, APP_NAME, "A folder must be selected before saving its manifest.");
+        return;
+    }
+
+    QString strFile = QFileDialog::getSaveFileName(this, "Save Manifest", QDir(strFolder).dirName() + MANIFEST_EXTENSION,
+                                                   "Manifests (*" MANIFEST_EXTENSION ");;All files (*)");
+    if (strFile == "")
+        return;
+
+    if (m_bComparing)
+        return;
+
+    setStatus(FOLDERSSTATE_COMPARING);
+    m_pBtnGo->setText(GOBTNLABEL_ABORT);
+    QCoreApplication::processEvents(); //update UI
+
+    //uses the same exceptions and ignore files as a compare, so the manifest matches what a compare would see
+    CFolderCompare folderCompare(this);
+    folderCompare.LoadOptions(m_pMainWnd->getDoc());
+    m_bComparing = true;
+    m_pFolderCompare = &folderCompare;
+    bool bOk = folderCompare.WriteManifest(strFolder.toLocal8Bit().constData(), strFile.toLocal8Bit().constData());
+    m_pFolderCompare = NULL;
+    m_bComparing = false;
+
+    m_pBtnGo->setText(GOBTNLABEL_GO);
+
+    if (folderCompare.IsCancelled())
+        setStatus(FOLDERSSTATE_ABORTED);
+    else {
+        setStatus(FOLDERSSTATE_DONE);
+        if (!bOk)
+            QMessageBox::warning(this, APP_NAME, "Unable to write manifest " + strFile);
+    }
+}
+
 void FoldersDlg::tableItemDblClicked(int row, int column)
 {
-    //Show in main window and perform a compare.
-    std::string strRelativePath = m_pTable->item(row, 0)->text().toLocal8Bit().constData();
-    std::string strPath1 = getStrFolder1();
-    strPath1 += strRelativePath;
-    std::string strPath2 = getStrFolder2();
-    strPath2 += strRelativePath;
+    //Show in main window and perform a compare. Moved files have a different relative path on each side.
+    if (CTreeManifest::IsManifestFile(m_pComboPath1->currentText()) || CTreeManifest::IsManifestFile(m_pComboPath2->currentText())) {
+        QMessageBox::information(this, APP_NAME, "Files can't be viewed when a folder is a manifest, as it only holds their hashes.");
+        return;
+    }
 
+    std::string strPath1, strPath2;
+    getRowPaths(row, strPath1, strPath2);
     m_pMainWnd->setFileCombosAndDoCompare(strPath1.c_str(), strPath2.c_str());
 }
 
-void FoldersDlg::addTableRow(const char *pStrRelativePath, const char *pStrState)
+void FoldersDlg::getRowPaths(int row, std::string& strPath1, std::string& strPath2)
+{
+    QTableWidgetItem* pItem = m_pTable->item(row, COLUMN_PATH);
+    std::string strRelativePath = pItem->text().toLocal8Bit().constData();
+    std::string strRelativePath1 = strRelativePath, strRelativePath2 = strRelativePath;
+    if (pItem->data(Qt::UserRole).isValid()) {
+        strRelativePath1 = pItem->data(Qt::UserRole).toString().toLocal8Bit().constData();
+        strRelativePath2 = pItem->data(Qt::UserRole + 1).toString().toLocal8Bit().constData();
+    }
+    strPath1 = getStrFolder1();
+    strPath1 += strRelativePath1;
+    strPath2 = getStrFolder2();
+    strPath2 += strRelativePath2;
+}
+
+void FoldersDlg::tableCurrentCellChanged(int row, int column, int previousRow, int previousColumn)
+{
+    //Guesses that the next few different files will be opened, and has them compared in the background.
+    //Rows for one side only have nothing to compare.
+    if (m_bComparing || (row < 0) || (row == previousRow))
+        return;
+    if (isFolderFile(m_pComboPath1->currentText()) || isFolderFile(m_pComboPath2->currentText()))
+        return;
+
+    std::vector<CPrefetchPair> pairs;
+    for (int nRow=row; (nRow<m_pTable->rowCount()) && ((int)pairs.size() < PREFETCH_ROWS); nRow++)
+    {
+        int nState = m_pTable->item(nRow, COLUMN_STATE)->data(Qt::UserRole).toInt();
+        if ((nState != FI_STATE_1MORERECENT) && (nState != FI_STATE_2MORERECENT) && (nState != FI_STATE_ERROR) && (nState != FI_STATE_MOVEDCHANGED))
+            continue;
+
+        CPrefetchPair pair;
+        getRowPaths(nRow, pair.m_strPath1, pair.m_strPath2);
+        pairs.push_back(pair);
+    }
+
+    m_pMainWnd->getPrefetcher()->Prefetch(pairs, m_pMainWnd->getDoc()->GetCompareOptions());
+}
+
+void FoldersDlg::addTableRow(const char *pStrRelativePath, const char *pStrState, const char *pStrVerified)
 {
     int row = m_pTable->rowCount();
     m_pTable->insertRow(row);
@@ -202,6 +337,8 @@ void FoldersDlg::addTableRow(const char *pStrRelativePath, const char *pStrState
     m_pTable->setItem(row, 0, newItemPath);
     QTableWidgetItem *newItemState = new QTableWidgetItem(pStrState);
     m_pTable->setItem(row, 1, newItemState);
+    QTableWidgetItem *newItemVerified = new QTableWidgetItem(pStrVerified);
+    m_pTable->setItem(row, 2, newItemVerified);
 
 //    m_pTable->repaint();  //This seems to cause a lock up. Find another way to refresh the list
 
@@ -212,14 +349,31 @@ void FoldersDlg::addTableRow(const char *pStrRelativePath, const char *pStrState
     }
 }
 
-void FoldersDlg::addTableRow(const char *pStrRelativePath, int nState)
+void FoldersDlg::addTableRow(const char *pStrRelativePath, int nState, int nVerified)
+{
+    addTableRow(pStrRelativePath, folderStateText(nState), verifiedText(nVerified));
+    m_pTable->item(m_pTable->rowCount() - 1, COLUMN_STATE)->setData(Qt::UserRole, nState);  //for prefetching
+}
+
+void FoldersDlg::setTableRow(int row, const char *pStrRelativePath, int nState, int nVerified)
 {
-    addTableRow(pStrRelativePath, g_stateLookup[nState]);
+    //replacing the items also drops the old row's move paths and line counts
+    m_pTable->setItem(row, COLUMN_PATH, new QTableWidgetItem(pStrRelativePath));
+    QTableWidgetItem *pItemState = new QTableWidgetItem(folderStateText(nState));
+    pItemState->setData(Qt::UserRole, nState);
+    m_pTable->setItem(row, COLUMN_STATE, pItemState);
+    m_pTable->setItem(row, COLUMN_VERIFIED, new QTableWidgetItem(verifiedText(nVerified)));
+    for (int nColumn=COLUMN_ADDED; nColumn<=COLUMN_SECTIONS; nColumn++)
+        m_pTable->setItem(row, nColumn, new QTableWidgetItem(""));
 }
 
 void FoldersDlg::doCompare()
 {
     m_pTable->setRowCount(0);  //clear all existing rows
+    m_pMainWnd->getPrefetcher()->Clear();
+    m_pWatcher->Stop();
+    m_strWatchPath1 = m_strWatchPath2 = "";
+    m_pendingChanges.clear();
 
     setStatus(FOLDERSSTATE_COMPARING);
     QCoreApplication::processEvents(); //update UI
@@ -227,16 +381,24 @@ void FoldersDlg::doCompare()
     std::string strPath1 = m_pComboPath1->currentText().toLocal8Bit().constData();
     std::string strPath2 = m_pComboPath2->currentText().toLocal8Bit().constData();
 
-    compareFolders(strPath1.c_str(), strPath2.c_str());
+    bool bComplete = compareFolders(strPath1.c_str(), strPath2.c_str());
 
-    setStatus(FOLDERSSTATE_DONE);
+    setStatus(bComplete ? FOLDERSSTATE_DONE : FOLDERSSTATE_ABORTED);
+    if (bComplete && (m_strIoSummary != ""))
+        m_pStatusText->setText(m_pStatusText->text() + " " + m_strIoSummary);
 
     updateCount();
 
+    //manifests and archives aren't watched, and only complete results can be kept up to date
+    if (bComplete && !isFolderFile(strPath1.c_str()) && !isFolderFile(strPath2.c_str())) {
+        m_strWatchPath1 = strPath1;
+        m_strWatchPath2 = strPath2;
+        if (m_pCheckWatch->isChecked())
+            startWatching();
+    }
+
     m_pMainWnd->addPathComboTextToDropdown(m_pComboPath1);
     m_pMainWnd->addPathComboTextToDropdown(m_pComboPath2);
-
-    //TODO: set go button back to Go. Check for app exit.
 }
 
 void FoldersDlg::updateCount()
@@ -251,114 +413,279 @@ void FoldersDlg::setStatus(int nState)
     m_pStatusText->setText(stateLookup[nState]);
 }
 
-void FoldersDlg::compareFolders(const char *pStrPath1, const char *pStrPath2)
+bool FoldersDlg::compareFolders(const char *pStrPath1, const char *pStrPath2)
 {
 //	DeletePathLists();
 
     m_bComparing = true;
 
-    CDiffDirectoryNode ddn(this);
-    ddn.ReadDirectoryTree(pStrPath1, pStrPath2);
-    ddn.DoCompare();
+    //Changed lines are counted once the compare is done, so the compare isn't slowed down.
+    //Manifests only hold hashes, so there are no lines to count, and archives would be decompressed again.
+    CDiffDoc* pDoc = m_pMainWnd->getDoc();
+    CLineStatsRunner lineStats;
+    lineStats.SetLineFilter(pDoc->GetLineFilter());
+    bool bLineStats = pDoc->getFoldersLineStats() && !isFolderFile(pStrPath1) && !isFolderFile(pStrPath2);
+    m_lineStatsRows.clear();
+    m_strComparePath1 = pStrPath1;
+    m_strComparePath2 = pStrPath2;
+    m_pLineStats = bLineStats ? &lineStats : NULL;
+    for (int nColumn=COLUMN_ADDED; nColumn<=COLUMN_SECTIONS; nColumn++)
+        m_pTable->setColumnHidden(nColumn, !bLineStats);
+
+    CFolderCompare folderCompare(this);
+    folderCompare.LoadOptions(pDoc);
+    m_pFolderCompare = &folderCompare;
+    folderCompare.Compare(pStrPath1, pStrPath2);
+    m_pFolderCompare = NULL;
+
+    bool bComplete = !folderCompare.IsCancelled();
+    if (bComplete && bLineStats)
+        bComplete = countLineStats();
+    m_pLineStats = NULL;
+
+    CBatchReader* pBatchReader = folderCompare.GetBatchReader();
+    m_strIoSummary = "";
+    if (pBatchReader->GetFileCount() > 0)
+        m_strIoSummary = QString("%1 small files read via %2, %3 IOPS.").arg(pBatchReader->GetFileCount())
+                .arg(pBatchReader->GetBackendName()).arg(pBatchReader->GetIops());
 
     m_bComparing = false;
+
+    return bComplete;
 }
 
-void FoldersDlg::compareFile(const char *pStrPath1, const char *pStrPath2)
+bool FoldersDlg::countLineStats()
 {
-    //Use qt file classes to read the two files and compare their contents.
-    //Then add an entry to the table widget.
-
-    //work out relative path
-    std::string strRelativePath;
-    if (strcmp(pStrPath1, "") != 0)
+    //the workers count in the background while this keeps the table and the Abort button going
+    if (m_pLineStats->GetCount() == 0)
+        return true;
+
+    m_pLineStats->Start();
+    int nDone = 0;
+    std::vector<int> finished;
+    for (;;)
     {
-        strRelativePath = pStrPath1;
-        std::string strFolder1 = getStrFolder1();
-        strRelativePath = strRelativePath.substr(strFolder1.length());
-    }
-    else if (strcmp(pStrPath2, "") != 0)
-    {
-        strRelativePath = pStrPath2;
-        std::string strFolder2 = getStrFolder2();
-        strRelativePath = strRelativePath.substr(strFolder2.length());
+        bool bAllDone = m_pLineStats->Wait(LINESTATS_WAIT_MS);
+        m_pLineStats->TakeFinished(finished);
+        for (size_t n=0; n<finished.size(); n++)
+            setLineStatsCells(m_lineStatsRows[finished[n]], m_pLineStats->GetStats(finished[n]));
+        nDone += finished.size();
+        if (bAllDone)
+            break;
+
+        m_pStatusText->setText(QString("Counting changed lines... %1 of %2 files").arg(nDone).arg(m_pLineStats->GetCount()));
+        QCoreApplication::processEvents();
     }
-    else
-    {
-        Q_ASSERT(0);
-        return;  //something has gone wrong - both paths seem to be empty
+
+    return (nDone == m_pLineStats->GetCount());
+}
+
+void FoldersDlg::setLineStatsCells(int nRow, const CLineStats& stats)
+{
+    if (stats.m_nResult != LINESTATS_OK) {
+        const char *pStrReason = (stats.m_nResult == LINESTATS_BINARY) ? "Binary" : ((stats.m_nResult == LINESTATS_TOOBIG) ? "Too big" : "Unreadable");
+        m_pTable->setItem(nRow, COLUMN_ADDED, new QTableWidgetItem(pStrReason));
+        return;
     }
 
-//    qDebug() << strRelativePath.c_str();
+    m_pTable->setItem(nRow, COLUMN_ADDED, new QTableWidgetItem(QString("+%1").arg(stats.m_nAdded)));
+    m_pTable->setItem(nRow, COLUMN_REMOVED, new QTableWidgetItem(QString("-%1").arg(stats.m_nRemoved)));
+    m_pTable->setItem(nRow, COLUMN_SECTIONS, new QTableWidgetItem(QString::number(stats.m_nSections)));
+}
 
-    //check if relative path contains any exception strings
-    if (doesPathContainAnException(strRelativePath.c_str()))
+void FoldersDlg::addLineStats(const std::string& strRelativePath1, const std::string& strRelativePath2, int nState)
+{
+    //queues the row just added, if it is a file in both folders with different contents
+    if (!m_pLineStats)
+        return;
+    if ((nState != FI_STATE_1MORERECENT) && (nState != FI_STATE_2MORERECENT) && (nState != FI_STATE_ERROR) && (nState != FI_STATE_MOVEDCHANGED))
         return;
 
-    //open files
-    QFile file1(pStrPath1);
-    if (!file1.open(QIODevice::ReadOnly)) {
-        addTableRow(strRelativePath.c_str(), FI_STATE_ONLYIN2);
+    m_pLineStats->Add(m_strComparePath1 + strRelativePath1, m_strComparePath2 + strRelativePath2);
+    m_lineStatsRows.push_back(m_pTable->rowCount() - 1);
+}
+
+void FoldersDlg::OnProgress(const CFolderCompareProgress& progress)
+{
+    QString strStatus;
+    if (progress.m_nFilesTotal < 0) {
+        strStatus = QString("Scanning... %1 files and folders").arg(progress.m_nFilesScanned);
+    }
+    else {
+        //the estimate is by bytes, as a few big files can take longer than thousands of small ones
+        int nPercent = (progress.m_nBytesTotal > 0) ? (int)(progress.m_nBytesDone * 100 / progress.m_nBytesTotal) : 100;
+        strStatus = QString("Comparing... %1% (%2 of %3 files)").arg(nPercent).arg(progress.m_nFilesDone).arg(progress.m_nFilesTotal);
+
+        if ((progress.m_nElapsed >= 1000) && (progress.m_nFilesDone > 0)) {
+            double dSeconds = progress.m_nElapsed / 1000.0;
+            double dBytesPerSec = progress.m_nBytesDone / dSeconds;
+            strStatus += QString(", %1 MB/s, %2 files/s").arg(dBytesPerSec / (1024 * 1024), 0, 'f', 1).arg((int)(progress.m_nFilesDone / dSeconds));
+
+            if (dBytesPerSec > 0) {
+                qint64 nLeft = (qint64)((progress.m_nBytesTotal - progress.m_nBytesDone) / dBytesPerSec);
+                strStatus += QString(", %1:%2:%3 left").arg(nLeft / 3600).arg((nLeft / 60) % 60, 2, 10, QChar('0')).arg(nLeft % 60, 2, 10, QChar('0'));
+            }
+        }
+    }
+    m_pStatusText->setText(strStatus);
+    updateCount();
+
+    //lets the Abort button and window events through while the compare runs
+    QCoreApplication::processEvents();
+}
+
+void FoldersDlg::OnFileCompared(const std::string& strRelativePath, int nState, int nVerified, qint64 nSize1, qint64 nSize2)
+{
+    int nRow = m_bUpdating ? takeUpdateRow(strRelativePath) : -1;
+    if (nRow >= 0) {
+        setTableRow(nRow, strRelativePath.c_str(), nState, nVerified);
         return;
     }
-    QFile file2(pStrPath2);
-    if (!file2.open(QIODevice::ReadOnly)) {
-        addTableRow(strRelativePath.c_str(), FI_STATE_ONLYIN1);
+
+    addTableRow(strRelativePath.c_str(), nState, nVerified);
+    addLineStats(strRelativePath, strRelativePath, nState);
+}
+
+void FoldersDlg::OnFileMoved(const std::string& strRelativePath1, const std::string& strRelativePath2, int nState, int nVerified, qint64 nSize1, qint64 nSize2)
+{
+    std::string strText = strRelativePath1 + " -> " + strRelativePath2;
+    int nRow = m_bUpdating ? takeUpdateRow(strRelativePath1) : -1;
+    if (nRow < 0 && m_bUpdating)
+        nRow = takeUpdateRow(strRelativePath2);
+    if (nRow >= 0)
+        setTableRow(nRow, strText.c_str(), nState, nVerified);
+    else {
+        addTableRow(strText.c_str(), nState, nVerified);
+        nRow = m_pTable->rowCount() - 1;
+    }
+
+    //keep both paths for double clicking
+    QTableWidgetItem* pItem = m_pTable->item(nRow, COLUMN_PATH);
+    pItem->setData(Qt::UserRole, QString::fromLocal8Bit(strRelativePath1.c_str()));
+    pItem->setData(Qt::UserRole + 1, QString::fromLocal8Bit(strRelativePath2.c_str()));
+
+    addLineStats(strRelativePath1, strRelativePath2, nState);
+}
+
+void FoldersDlg::onClickCheckWatch(int n)
+{
+    if (n == 0)
+        m_pWatcher->Stop();
+    else if ((m_strWatchPath1 != "") && !m_bComparing)
+        startWatching();
+}
+
+void FoldersDlg::startWatching()
+{
+    m_pWatcher->Start(QString::fromLocal8Bit(m_strWatchPath1.c_str()), QString::fromLocal8Bit(m_strWatchPath2.c_str()));
+    m_pStatusText->setText(m_pWatcher->IsPolling() ? "Done. Checking for changes every few seconds." : "Done. Watching for changes.");
+}
+
+void FoldersDlg::onWatchedChanged(const QStringList& relativePaths)
+{
+    //A change during a compare waits for it to finish. Updates can be reported while one is running,
+    //so they are picked up in a loop.
+    m_pendingChanges << relativePaths;
+    if (m_bComparing || !m_pWatcher->IsWatching())
         return;
+
+    while (!m_pendingChanges.isEmpty() && m_pWatcher->IsWatching())
+    {
+        QStringList changes = m_pendingChanges;
+        m_pendingChanges.clear();
+        if (changes.contains("")) {
+            //events were lost, so only a full compare can be trusted
+            m_pBtnGo->setText(GOBTNLABEL_ABORT);
+            doCompare();
+            m_pBtnGo->setText(GOBTNLABEL_GO);
+            return;
+        }
+        updateEntries(changes);
     }
+}
 
-    //read files and compare contents
-    QTextStream in1(&file1);
-    QTextStream in2(&file2);
-    QString line1, line2;
-    bool bDifferent = false;
-    while (!in1.atEnd() && !in2.atEnd()) {
-        QString line1 = in1.readLine();
-        QString line2 = in2.readLine();
-        if (line1 != line2) {
-            bDifferent = true;
-            break;
+void FoldersDlg::updateEntries(const QStringList& relativePaths)
+{
+    //Finds the rows of the changed paths, including the files of a changed folder and the other
+    //half of a move, then compares just those paths and updates their rows where they are.
+    std::map<std::string, int> rows;
+    for (int nRow=0; nRow<m_pTable->rowCount(); nRow++) {
+        QTableWidgetItem* pItem = m_pTable->item(nRow, COLUMN_PATH);
+        if (pItem->data(Qt::UserRole).isValid()) {
+            rows[pItem->data(Qt::UserRole).toString().toLocal8Bit().constData()] = nRow;
+            rows[pItem->data(Qt::UserRole + 1).toString().toLocal8Bit().constData()] = nRow;
         }
+        else
+            rows[pItem->text().toLocal8Bit().constData()] = nRow;
     }
 
-    bool bShowSameSetting = MainWindow::getInstance()->getDoc()->getFoldersShowSame();
-    if (!bDifferent) {
-        if (bShowSameSetting)
-            addTableRow(strRelativePath.c_str(), FI_STATE_THESAME);
-        return;
+    std::set<std::string> touched;
+    for (int n=0; n<relativePaths.size(); n++) {
+        std::string strRelativePath = relativePaths.at(n).toLocal8Bit().constData();
+        touched.insert(strRelativePath);
+        std::string strPrefix = strRelativePath + "/";
+        std::map<std::string, int>::iterator it = rows.lower_bound(strPrefix);
+        for ( ; (it != rows.end()) && (it->first.compare(0, strPrefix.size(), strPrefix) == 0); ++it)
+            touched.insert(it->first);
     }
 
-    //files are different, so find out which is more recent
-    QFileInfo info1(pStrPath1);
-    QFileInfo info2(pStrPath2);
-    QDateTime dt1 = info1.lastModified();
-    QDateTime dt2 = info2.lastModified();
-    int nState;
-    if (dt1 > dt2)
-        nState = FI_STATE_1MORERECENT;
-    else if (dt2 > dt1)
-        nState = FI_STATE_2MORERECENT;
-    else
-        nState = FI_STATE_ERROR; //this should never happen (files are different but created at exactly the same time!)
-
-    addTableRow(strRelativePath.c_str(), nState);
-}
-
-bool FoldersDlg::doesPathContainAnException(const std::string& strPath)
-{
-    //first check if exceptions are enabled
-    CDiffDoc* doc = MainWindow::getInstance()->getDoc();
-    if (!doc->getFolderExceptionsEnabled())
-        return false;
-
-    //go through each exception checking if our relative path (strPath) contains any of them.
-    QStringList exceptions = doc->getFolderExceptions();
-    for (int n=0; n<exceptions.size(); n++) {
-        if (strPath.find(exceptions.at(n).toLocal8Bit().constData()) != std::string::npos)
-            return true;
+    m_updateRows.clear();
+    m_updatedRows.clear();
+    std::set<int> touchedRows;
+    for (std::set<std::string>::iterator it = touched.begin(); it != touched.end(); ++it) {
+        std::map<std::string, int>::iterator itRow = rows.find(*it);
+        if (itRow != rows.end()) {
+            m_updateRows[itRow->first] = itRow->second;
+            touchedRows.insert(itRow->second);
+        }
     }
+    for (std::map<std::string, int>::iterator it = rows.begin(); it != rows.end(); ++it)
+        if (touchedRows.count(it->second) && !m_updateRows.count(it->first)) {
+            m_updateRows[it->first] = it->second;  //the other half of a move
+            touched.insert(it->first);
+        }
+
+    m_bComparing = true;
+    m_bUpdating = true;
+    m_pBtnGo->setText(GOBTNLABEL_ABORT);
+
+    CFolderCompare folderCompare(this);
+    folderCompare.LoadOptions(m_pMainWnd->getDoc());
+    m_pFolderCompare = &folderCompare;
+    folderCompare.CompareEntries(m_strWatchPath1.c_str(), m_strWatchPath2.c_str(), std::vector<std::string>(touched.begin(), touched.end()));
+    m_pFolderCompare = NULL;
+
+    m_pBtnGo->setText(GOBTNLABEL_GO);
+    m_bUpdating = false;
+    m_bComparing = false;
+
+    if (folderCompare.IsCancelled()) {
+        //the rows not compared yet keep their old results, but can't be trusted any more
+        m_pWatcher->Stop();
+        m_pCheckWatch->setChecked(false);
+        setStatus(FOLDERSSTATE_ABORTED);
+        return;
+    }
+
+    //rows of files that are now the same (and hidden), excluded or gone. Removed from the bottom up,
+    //so the rows still to remove keep their numbers.
+    for (std::set<int>::reverse_iterator it = touchedRows.rbegin(); it != touchedRows.rend(); ++it)
+        if (!m_updatedRows.count(*it))
+            m_pTable->removeRow(*it);
+
+    updateCount();
+    m_pStatusText->setText(QString("Watching for changes. %1 files compared again at %2.").arg(touched.size()).arg(QTime::currentTime().toString()));
+}
+
+int FoldersDlg::takeUpdateRow(const std::string& strRelativePath)
+{
+    //each row is reused once. The other half of a split up move gets a new row.
+    std::map<std::string, int>::iterator it = m_updateRows.find(strRelativePath);
+    if ((it == m_updateRows.end()) || m_updatedRows.count(it->second))
+        return -1;
 
-    return false;
+    m_updatedRows.insert(it->second);
+    return it->second;
 }
 
 std::string FoldersDlg::getStrFolder1()
@@ -399,129 +726,12 @@ void FoldersDlg::writeSettings()
 
 void FoldersDlg::closeEvent(QCloseEvent *event)
 {
+    if (m_pFolderCompare)
+        m_pFolderCompare->Cancel();
+    if (m_pLineStats)
+        m_pLineStats->Cancel();
+    m_pWatcher->Stop();
+
     writeSettings();
     event->accept();
 }
-
-////////////////////////////////////////
-
-
-bool CDiffDirectoryNode::ReadDirectoryTree(const char *pStrPath1, const char *pStrPath2)
-{
-    ParseDirectory(pStrPath1, true);
-    ParseDirectory(pStrPath2, false);
-    return true;
-}
-
-bool CDiffDirectoryNode::ParseDirectory(const char *pStrPath, bool bLeft)
-{
-//	using namespace boost::filesystem;
-
-//	if (!exists(pStrPath))
-//		return false;
-    QDir dir(pStrPath);
-    if (!dir.exists())
-        return false;
-
-    if (bLeft)
-        m_strLeftPath = pStrPath;
-    else
-        m_strRightPath = pStrPath;
-
-    QFileInfoList list = dir.entryInfoList(QDir::Files|QDir::Dirs|QDir::NoDotAndDotDot, QDir::DirsFirst);
-    for (int i=0; i<list.size(); ++i) {
-//	directory_iterator end ;
-//	for( directory_iterator it(pStrPath) ; it != end ; ++it )
-//	{
-        QFileInfo fileInfo = list.at(i);
-        std::string strPath = fileInfo.filePath().toLocal8Bit().constData();
-        std::string strFilename = fileInfo.fileName().toLocal8Bit().constData();
-//		std::string strPath = it->path().string();
-//		std::string strFilename = it->path().filename().string();
-//		if (is_directory(*it))
-        if (fileInfo.isDir())
-        {
-            std::map<std::string, CDiffDirectoryNode>::iterator itFind = m_mapDirectories.find(strFilename);
-            if (itFind != m_mapDirectories.end())
-                itFind->second.ParseDirectory(strPath.c_str(), bLeft); //directory node already exists, so this must be a right item
-            else
-            { //not found, so let's create a new entry and continue parsing inside that
-                m_mapDirectories[strFilename] = CDiffDirectoryNode(m_pFoldersDlg);
-                m_mapDirectories[strFilename].ParseDirectory(strPath.c_str(), bLeft);
-            }
-        }
-        else
-        {
-            std::map<std::string, CDiffFileNode>::iterator itFind = m_mapFiles.find(strFilename);
-            if (itFind != m_mapFiles.end())
-                itFind->second.m_inFile = CDiffFileNode::both;  //if there is already an entry then it must have been for left and this must be right, so we have both.
-            else
-            {
-                CDiffFileNode file;
-                file.m_strFilename = strFilename;
-                file.m_inFile = bLeft ? CDiffFileNode::left : CDiffFileNode::right;
-                m_mapFiles[strFilename] = file;
-            }
-        }
-    }
-    return true;
-}
-
-bool CDiffDirectoryNode::DoCompare()
-{
-    //compare all files in this directory and then call DoCompare() for each sub-directory
-
-    //files
-    std::map<std::string, CDiffFileNode>::iterator itFile = m_mapFiles.begin();
-    for ( ; itFile != m_mapFiles.end(); ++itFile)
-    {
-        std::string strLeftFile = itFile->second.m_strFilename;
-        std::string strLeftPath = "";
-        if ((strLeftFile != "") && (m_strLeftPath != "")) {
-            strLeftPath = m_strLeftPath;
-            //XDUtil::CombinePaths(strLeftPath, strLeftFile.c_str());
-            strLeftPath = combinePaths(strLeftPath.c_str(),strLeftFile.c_str()).toLocal8Bit().constData();
-        }
-
-        std::string strRightFile = itFile->second.m_strFilename;
-        std::string strRightPath = "";
-        if ((strRightFile != "") && (m_strRightPath != "")) {
-            strRightPath = m_strRightPath;
-            //XDUtil::CombinePaths(strRightPath, strRightFile.c_str());
-            strRightPath = combinePaths(strRightPath.c_str(),strRightFile.c_str()).toLocal8Bit().constData();
-        }
-
-        m_pFoldersDlg->compareFile(strLeftPath.c_str(), strRightPath.c_str());  //does file compare and updates UI
-    }
-
-    //directories
-    std::map<std::string, CDiffDirectoryNode>::iterator itDir = m_mapDirectories.begin();
-    for ( ; itDir != m_mapDirectories.end(); ++itDir)
-    {
-        itDir->second.DoCompare();
-    }
-
-    return false;
-}
-
-QString CDiffDirectoryNode::combinePaths(const QString& strPath1, const QString& strPath2)
-{
-//    qDebug() << "combinePaths" << strPath1 << strPath2;
-    return QDir::cleanPath(strPath1 + QDir::separator() + strPath2);
-/*
-    if (strPath1.endsWith(QDir::separator())) {
-        if (strPath2.startsWith(QDir::separator()))
-            return strPath1 + strPath2.right(strPath2.size()-1);
-        else
-            return strPath1 + strPath2;
-    }
-    else {
-        if (strPath2.startsWith(QDir::separator()))
-            return strPath1 + strPath2;
-        else
-            return strPath1 + QDir::separator() + strPath2;
-    }
-*/
-}
-
-
@@ -16,20 +16,27 @@
 
 #include <QDialog>
 #include <map>
+#include <set>
+#include "foldercompare.h"
+#include "linestats.h"
+#include "folderwatcher.h"
 
 class QTableWidget;
 class QLabel;
 class QComboBox;
+class QCheckBox;
 class MainWindow;
 
 
-class FoldersDlg : public QDialog
+class FoldersDlg : public QDialog, public CFolderCompareListener
 {
     Q_OBJECT
 public:
     explicit FoldersDlg(MainWindow* pMainWnd, QWidget *parent = 0, Qt::WindowFlags f=0);
     
-    void compareFile(const char *pStrPath1, const char *pStrPath2); //compares individual file. Called from CDiffDirectoryNode. Adds entry to table widget.
+    virtual void OnFileCompared(const std::string& strRelativePath, int nState, int nVerified, qint64 nSize1, qint64 nSize2); //called by CFolderCompare for each file. Adds entry to table widget.
+    virtual void OnFileMoved(const std::string& strRelativePath1, const std::string& strRelativePath2, int nState, int nVerified, qint64 nSize1, qint64 nSize2);
+    virtual void OnProgress(const CFolderCompareProgress& progress);  //updates the status row and keeps the UI responsive, so Abort can be pressed
 
 signals:
     
@@ -37,7 +44,12 @@ public slots:
     void onBtnPath1Pressed();
     void onBtnPath2Pressed();
     void onBtnGoPressed();
+    void onSaveManifest1();
+    void onSaveManifest2();
     void tableItemDblClicked(int row, int column);
+    void tableCurrentCellChanged(int row, int column, int previousRow, int previousColumn);
+    void onClickCheckWatch(int n);
+    void onWatchedChanged(const QStringList& relativePaths);
 
 private:
     QTableWidget* m_pTable;
@@ -46,21 +58,44 @@ private:
     QComboBox* m_pComboPath1;
     QComboBox* m_pComboPath2;
     QPushButton* m_pBtnGo;
+    QCheckBox* m_pCheckWatch;
 
     MainWindow* m_pMainWnd;
     bool m_bComparing;
+    CFolderCompare* m_pFolderCompare;  //the compare in progress, NULL if none
+    QString m_strIoSummary;  //how the last compare read its small files, shown when done
+    CLineStatsRunner* m_pLineStats;  //collects the different files while comparing if changed lines are counted, otherwise NULL
+    std::vector<int> m_lineStatsRows;  //table row of each of m_pLineStats' pairs
+    std::string m_strComparePath1, m_strComparePath2;  //the folders of the compare in progress
+
+    //watch mode: after a compare, changed files are compared again and their rows updated in place
+    CFolderWatcher* m_pWatcher;
+    std::string m_strWatchPath1, m_strWatchPath2;  //the folders of the last complete compare, "" if none
+    QStringList m_pendingChanges;  //changes reported while a compare was running
+    bool m_bUpdating;
+    std::map<std::string, int> m_updateRows;  //relative path -> row, of the rows being compared again
+    std::set<int> m_updatedRows;
 
     //overrides
     void closeEvent(QCloseEvent *event);
 
-    void addTableRow(const char *pStrRelativePath, const char *pStrState);
-    void addTableRow(const char *pStrRelativePath, int nState);
+    void addTableRow(const char *pStrRelativePath, const char *pStrState, const char *pStrVerified);
+    void addTableRow(const char *pStrRelativePath, int nState, int nVerified);
+    void setTableRow(int row, const char *pStrRelativePath, int nState, int nVerified);
+    int takeUpdateRow(const std::string& strRelativePath);  //the row to update in place, or -1 to add one
+    void updateEntries(const QStringList& relativePaths);
+    void startWatching();
+    void addLineStats(const std::string& strRelativePath1, const std::string& strRelativePath2, int nState);
+    bool countLineStats();  //returns false if aborted
+    void setLineStatsCells(int nRow, const CLineStats& stats);
     void createControls();
+    void getRowPaths(int row, std::string& strPath1, std::string& strPath2);
     void setStatus(int nState);
     void updateCount();
 
     void doCompare();
-    void compareFolders(const char *pStrPath1, const char *pStrPath2);
+    bool compareFolders(const char *pStrPath1, const char *pStrPath2);  //returns false if aborted
+    void saveManifest(QComboBox* pComboPath);
 
     std::string getStrFolder1();
     std::string getStrFolder2();
@@ -68,39 +103,6 @@ private:
     void readSettings();
     void writeSettings();
 
-    bool doesPathContainAnException(const std::string& strPath);
-
-};
-
-
-//I'm going to use a tree structre to represent the directories being compared.
-//CDirectoryNode will contain a map of child CDirectoryNode elements and
-//a map of files: CFileNode - which will have an enum for inLeft, inRight, inBoth.
-
-class CDiffFileNode
-{
-public:
-    std::string m_strFilename;
-    enum InFile { left, right, both };
-    InFile m_inFile;
-};
-
-class CDiffDirectoryNode
-{
-public:
-    CDiffDirectoryNode() { m_pFoldersDlg = NULL; }
-    CDiffDirectoryNode(FoldersDlg* pFoldersDlg) { m_pFoldersDlg = pFoldersDlg; }
-    bool ReadDirectoryTree(const char *pStrPath1, const char *pStrPath2);  //creates internal tree structures, so we know which files to compare
-    bool DoCompare();  //compares all the files that appear in both paths and updates the UI with the compare state
-private:
-    bool ParseDirectory(const char *pStrPath, bool bLeft);  //walks through the directory structure creating a tree of CDiffDirectoryNodes and CDiffFileNodes. Recursive.
-    QString combinePaths(const QString& strPath1, const QString& strPath2);
-private:
-    std::map<std::string, CDiffDirectoryNode> m_mapDirectories;
-    std::map<std::string, CDiffFileNode> m_mapFiles;
-    std::string m_strLeftPath;
-    std::string m_strRightPath;
-    FoldersDlg* m_pFoldersDlg;
 };
 
 
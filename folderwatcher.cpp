@@ -0,0 +1,363 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "folderwatcher.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSocketNotifier>
+#include <QRunnable>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QDebug>
+#include <limits.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define WATCH_EVENTS    (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO)
+#endif
+
+
+class CPollScanTask : public QRunnable
+{
+public:
+    CPollScanTask(CFolderWatcher* pWatcher, int nGeneration)
+    {
+        m_pWatcher = pWatcher;
+        m_nGeneration = nGeneration;
+        m_strRoot[0] = pWatcher->m_strRoot[0];
+        m_strRoot[1] = pWatcher->m_strRoot[1];
+    }
+
+    virtual void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        std::map<std::string, CPollEntry> entries[2];
+        for (int nSide=0; nSide<2; nSide++)
+            CFolderWatcher::scanTree(m_strRoot[nSide], "", entries[nSide]);
+        m_pWatcher->finishScan(m_nGeneration, entries, timer.elapsed());
+    }
+
+private:
+    CFolderWatcher* m_pWatcher;
+    int m_nGeneration;
+    std::string m_strRoot[2];
+};
+
+
+CFolderWatcher::CFolderWatcher(QObject *parent) :
+    QObject(parent)
+{
+    m_bWatching = false;
+    m_nInotifyFd = -1;
+    m_pNotifier = NULL;
+    m_bHaveSnapshot = false;
+    m_nPollGeneration = 0;
+    m_nScannedGeneration = -1;
+    m_nScanMs = 0;
+    m_pollPool.setMaxThreadCount(1);
+
+    m_settleTimer.setSingleShot(true);
+    m_settleTimer.setInterval(WATCH_SETTLE_MS);
+    connect(&m_settleTimer, SIGNAL(timeout()), this, SLOT(onSettleTimer()));
+    m_pollTimer.setSingleShot(true);  //restarted once each scan is done
+    connect(&m_pollTimer, SIGNAL(timeout()), this, SLOT(onPollTimer()));
+}
+
+CFolderWatcher::~CFolderWatcher()
+{
+    Stop();
+    m_pollPool.waitForDone();  //the scan calls back into this
+}
+
+void CFolderWatcher::Start(const QString& strPath1, const QString& strPath2)
+{
+    Stop();
+
+    m_strRoot[0] = strPath1.toLocal8Bit().constData();
+    m_strRoot[1] = strPath2.toLocal8Bit().constData();
+    m_bWatching = true;
+
+    if (!startInotify())
+        startPolling();
+}
+
+void CFolderWatcher::Stop()
+{
+    stopInotify();
+    m_pollTimer.stop();
+    m_snapshot[0].clear();
+    m_snapshot[1].clear();
+    m_bHaveSnapshot = false;
+    {
+        QMutexLocker locker(&m_pollMutex);
+        m_nPollGeneration++;
+        m_nScannedGeneration = -1;
+        m_scanned[0].clear();
+        m_scanned[1].clear();
+    }
+    m_settleTimer.stop();
+    m_touched.clear();
+    m_bWatching = false;
+}
+
+void CFolderWatcher::touch(const std::string& strRelativePath)
+{
+    //the timer isn't restarted by later changes, so a steady stream of them is still reported
+    m_touched.insert(strRelativePath);
+    if (!m_settleTimer.isActive())
+        m_settleTimer.start();
+}
+
+void CFolderWatcher::onSettleTimer()
+{
+    QStringList relativePaths;
+    std::set<std::string>::iterator it = m_touched.begin();
+    for ( ; it != m_touched.end(); ++it)
+        relativePaths << QString::fromLocal8Bit(it->c_str());
+    m_touched.clear();
+
+    emit changed(relativePaths);
+}
+
+#ifdef Q_OS_LINUX
+
+bool CFolderWatcher::startInotify()
+{
+    m_nInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_nInotifyFd < 0)
+        return false;
+
+    for (int nSide=0; nSide<2; nSide++) {
+        if (!addWatches(nSide, "", false)) {
+            qDebug() << "Out of inotify watches, polling the folders instead";
+            stopInotify();
+            return false;
+        }
+    }
+
+    m_pNotifier = new QSocketNotifier(m_nInotifyFd, QSocketNotifier::Read, this);
+    connect(m_pNotifier, SIGNAL(activated(int)), this, SLOT(onInotifyActivated()));
+    return true;
+}
+
+void CFolderWatcher::stopInotify()
+{
+    delete m_pNotifier;
+    m_pNotifier = NULL;
+    if (m_nInotifyFd >= 0)
+        close(m_nInotifyFd);
+    m_nInotifyFd = -1;
+    m_watches.clear();
+}
+
+bool CFolderWatcher::addWatches(int nSide, const std::string& strRelativeDir, bool bTouchFiles)
+{
+    //bTouchFiles reports the files of a folder that has just appeared, as they may have been
+    //created before its watch was
+    std::string strPath = m_strRoot[nSide] + strRelativeDir;
+    int nWatch = inotify_add_watch(m_nInotifyFd, strPath.c_str(), WATCH_EVENTS | IN_ONLYDIR);
+    if (nWatch < 0)
+        return (errno != ENOSPC) && (errno != ENOMEM);  //a folder that has gone, or can't be read, is left alone
+    m_watches[nWatch] = std::make_pair(nSide, strRelativeDir);
+
+    QDir dir(QString::fromLocal8Bit(strPath.c_str()));
+    QFileInfoList list = dir.entryInfoList(QDir::Files|QDir::Dirs|QDir::NoDotAndDotDot);
+    for (int i=0; i<list.size(); ++i) {
+        const QFileInfo& fileInfo = list.at(i);
+        std::string strRelativePath = strRelativeDir + "/" + fileInfo.fileName().toLocal8Bit().constData();
+        if (fileInfo.isDir()) {
+            if (!addWatches(nSide, strRelativePath, bTouchFiles))
+                return false;
+        }
+        else if (bTouchFiles)
+            touch(strRelativePath);
+    }
+    return true;
+}
+
+void CFolderWatcher::removeWatches(int nSide, const std::string& strRelativeDir)
+{
+    //a folder moved elsewhere keeps its watches, which would report its new contents under the old path
+    std::string strPrefix = strRelativeDir + "/";
+    std::map<int, std::pair<int, std::string> >::iterator it = m_watches.begin();
+    while (it != m_watches.end())
+    {
+        const std::string& strDir = it->second.second;
+        if ((it->second.first == nSide) && ((strDir == strRelativeDir) || (strDir.compare(0, strPrefix.size(), strPrefix) == 0))) {
+            inotify_rm_watch(m_nInotifyFd, it->first);
+            m_watches.erase(it++);
+        }
+        else
+            ++it;
+    }
+}
+
+void CFolderWatcher::onInotifyActivated()
+{
+    quint64 buffer[8192];  //aligned for inotify_event
+    for (;;)
+    {
+        ssize_t nRead = read(m_nInotifyFd, buffer, sizeof(buffer));
+        if (nRead <= 0)
+            break;  //EAGAIN once the queue is empty
+
+        char *pEnd = (char *)buffer + nRead;
+        for (char *p = (char *)buffer; p < pEnd; )
+        {
+            struct inotify_event* pEvent = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + pEvent->len;
+
+            if (pEvent->mask & IN_Q_OVERFLOW) {
+                touch("");  //events were dropped, so nothing can be trusted
+                continue;
+            }
+            std::map<int, std::pair<int, std::string> >::iterator it = m_watches.find(pEvent->wd);
+            if (it == m_watches.end())
+                continue;
+            if (pEvent->mask & IN_IGNORED) {
+                m_watches.erase(it);  //its folder was deleted
+                continue;
+            }
+            if (pEvent->len == 0)
+                continue;
+
+            int nSide = it->second.first;
+            std::string strRelativePath = it->second.second + "/" + pEvent->name;
+            if (!(pEvent->mask & IN_ISDIR))
+                touch(strRelativePath);
+            else if (pEvent->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (!addWatches(nSide, strRelativePath, true)) {
+                    qDebug() << "Out of inotify watches, polling the folders instead";
+                    stopInotify();
+                    startPolling();
+                    touch("");
+                    return;
+                }
+            }
+            else if (pEvent->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                removeWatches(nSide, strRelativePath);
+                touch(strRelativePath);
+            }
+        }
+    }
+}
+
+#else
+
+bool CFolderWatcher::startInotify()
+{
+    return false;
+}
+
+void CFolderWatcher::stopInotify()
+{
+}
+
+bool CFolderWatcher::addWatches(int nSide, const std::string& strRelativeDir, bool bTouchFiles)
+{
+    return false;
+}
+
+void CFolderWatcher::removeWatches(int nSide, const std::string& strRelativeDir)
+{
+}
+
+void CFolderWatcher::onInotifyActivated()
+{
+}
+
+#endif // Q_OS_LINUX
+
+void CFolderWatcher::startPolling()
+{
+    //the first scan only takes the snapshot that later ones are compared with
+    m_bHaveSnapshot = false;
+    onPollTimer();
+}
+
+void CFolderWatcher::onPollTimer()
+{
+    //the trees are scanned on the worker, as a big tree can take seconds
+    QMutexLocker locker(&m_pollMutex);
+    m_pollPool.start(new CPollScanTask(this, m_nPollGeneration));
+}
+
+void CFolderWatcher::finishScan(int nGeneration, std::map<std::string, CPollEntry> entries[2], qint64 nScanMs)
+{
+    QMutexLocker locker(&m_pollMutex);
+    if (nGeneration != m_nPollGeneration)
+        return;
+    m_scanned[0].swap(entries[0]);
+    m_scanned[1].swap(entries[1]);
+    m_nScannedGeneration = nGeneration;
+    m_nScanMs = nScanMs;
+    QMetaObject::invokeMethod(this, "onPollScanned", Qt::QueuedConnection);
+}
+
+void CFolderWatcher::onPollScanned()
+{
+    std::map<std::string, CPollEntry> entries[2];
+    qint64 nScanMs;
+    {
+        QMutexLocker locker(&m_pollMutex);
+        if ((m_nScannedGeneration < 0) || (m_nScannedGeneration != m_nPollGeneration))
+            return;
+        entries[0].swap(m_scanned[0]);
+        entries[1].swap(m_scanned[1]);
+        m_nScannedGeneration = -1;
+        nScanMs = m_nScanMs;
+    }
+
+    //only sizes and modified times are compared, so no file is read
+    for (int nSide=0; nSide<2 && m_bHaveSnapshot; nSide++)
+    {
+        std::map<std::string, CPollEntry>& previous = m_snapshot[nSide];
+        std::map<std::string, CPollEntry>::iterator it = entries[nSide].begin();
+        for ( ; it != entries[nSide].end(); ++it) {
+            std::map<std::string, CPollEntry>::iterator itFind = previous.find(it->first);
+            if ((itFind == previous.end()) || (itFind->second != it->second))
+                touch(it->first);
+        }
+        for (it = previous.begin(); it != previous.end(); ++it)
+            if (entries[nSide].find(it->first) == entries[nSide].end())
+                touch(it->first);
+    }
+    m_snapshot[0].swap(entries[0]);
+    m_snapshot[1].swap(entries[1]);
+    m_bHaveSnapshot = true;
+
+    //a slow scan is spaced out, so polling never keeps the disk busy
+    m_pollTimer.start((int)qMin(qMax((qint64)WATCH_POLL_INTERVAL_MS, nScanMs * WATCH_POLL_BACKOFF), (qint64)INT_MAX));
+}
+
+void CFolderWatcher::scanTree(const std::string& strRoot, const std::string& strRelativeDir, std::map<std::string, CPollEntry>& entries)
+{
+    QDir dir(QString::fromLocal8Bit((strRoot + strRelativeDir).c_str()));
+    QFileInfoList list = dir.entryInfoList(QDir::Files|QDir::Dirs|QDir::NoDotAndDotDot);
+    for (int i=0; i<list.size(); ++i) {
+        const QFileInfo& fileInfo = list.at(i);
+        std::string strRelativePath = strRelativeDir + "/" + fileInfo.fileName().toLocal8Bit().constData();
+        if (fileInfo.isDir())
+            scanTree(strRoot, strRelativePath, entries);
+        else {
+            CPollEntry& entry = entries[strRelativePath];
+            entry.m_nSize = fileInfo.size();
+            entry.m_nModified = fileInfo.lastModified().toMSecsSinceEpoch();
+        }
+    }
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QThreadPool>
+#include <QMutex>
+#include <string>
+#include <map>
+#include <set>
+
+class QSocketNotifier;
+
+
+#define WATCH_SETTLE_MS         300   //changes are gathered this long before they are reported
+#define WATCH_POLL_INTERVAL_MS  2000  //how often the trees are rescanned when they can't be watched
+#define WATCH_POLL_BACKOFF      10    //at most, or the gap between scans is this many times the last scan's time
+
+
+class CPollEntry
+{
+public:
+    qint64 m_nSize;
+    qint64 m_nModified;
+
+    bool operator !=(const CPollEntry& entry) const { return (m_nSize != entry.m_nSize) || (m_nModified != entry.m_nModified); }
+};
+
+
+//Watches both folders of a compare and reports the relative paths of what changes, so only those
+//entries need comparing again.
+//
+//On Linux every folder of both trees gets an inotify watch. If the watch limit
+//(fs.inotify.max_user_watches) runs out, or elsewhere, the trees' sizes and modified times are
+//polled instead, which costs a scan of the folders every few seconds but reads no files. The scan
+//runs on a worker thread, and big trees that are slow to scan are scanned less often.
+//
+//changed() gives relative paths of files, and of folders that were deleted or moved away, whose
+//files the receiver knows better than the watcher does. An empty path means events were lost
+//and everything should be compared again.
+
+class CFolderWatcher : public QObject
+{
+    Q_OBJECT
+    friend class CPollScanTask;
+public:
+    explicit CFolderWatcher(QObject *parent = 0);
+    ~CFolderWatcher();
+
+    void Start(const QString& strPath1, const QString& strPath2);
+    void Stop();
+    bool IsWatching() { return m_bWatching; }
+    bool IsPolling() { return m_bWatching && (m_nInotifyFd < 0); }
+
+signals:
+    void changed(const QStringList& relativePaths);
+
+private slots:
+    void onInotifyActivated();
+    void onPollTimer();
+    void onPollScanned();
+    void onSettleTimer();
+
+private:
+    bool startInotify();
+    void stopInotify();
+    bool addWatches(int nSide, const std::string& strRelativeDir, bool bTouchFiles);  //recursive. false if out of watches.
+    void removeWatches(int nSide, const std::string& strRelativeDir);
+    void startPolling();
+    void finishScan(int nGeneration, std::map<std::string, CPollEntry> entries[2], qint64 nScanMs);  //called by the worker
+    static void scanTree(const std::string& strRoot, const std::string& strRelativeDir, std::map<std::string, CPollEntry>& entries);
+    void touch(const std::string& strRelativePath);
+
+    bool m_bWatching;
+    std::string m_strRoot[2];
+
+    int m_nInotifyFd;  //-1 when polling
+    QSocketNotifier* m_pNotifier;
+    std::map<int, std::pair<int, std::string> > m_watches;  //watch descriptor -> side and relative folder
+
+    QTimer m_pollTimer;
+    QThreadPool m_pollPool;  //one thread, so scans never overlap
+    std::map<std::string, CPollEntry> m_snapshot[2];  //files of each side, when polling
+    bool m_bHaveSnapshot;
+    QMutex m_pollMutex;  //guards the members below, which the worker sets
+    int m_nPollGeneration;  //bumped by Stop(), so a scan of trees no longer watched is dropped
+    int m_nScannedGeneration;  //of m_scanned, -1 when none is waiting
+    std::map<std::string, CPollEntry> m_scanned[2];
+    qint64 m_nScanMs;
+
+    QTimer m_settleTimer;
+    std::set<std::string> m_touched;
+};
+
+#endif // FOLDERWATCHER_H
@@ -0,0 +1,295 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "gitrepo.h"
+#include <QProcess>
+#include <QStringList>
+#include <QFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+CGitRepo::CGitRepo()
+{
+    m_pBatch = NULL;
+    m_pBatchCheck = NULL;
+    m_nOidLength = 40;
+    m_nObjectsRead = 0;
+}
+
+CGitRepo::~CGitRepo()
+{
+    //git exits once its input is closed
+    QProcess* processes[2] = { m_pBatch, m_pBatchCheck };
+    for (int n=0; n<2; n++) {
+        if (processes[n]) {
+            processes[n]->closeWriteChannel();
+            if (!processes[n]->waitForFinished(GIT_TIMEOUT_MS))
+                processes[n]->kill();
+            delete processes[n];
+        }
+    }
+}
+
+bool CGitRepo::start(QProcess*& pProcess, const char *pStrBatch)
+{
+    if (pProcess)
+        return pProcess->state() == QProcess::Running;
+
+    pProcess = new QProcess;
+    pProcess->start("git", QStringList() << "cat-file" << pStrBatch);
+    return pProcess->waitForStarted(GIT_TIMEOUT_MS);
+}
+
+bool CGitRepo::readLine(QProcess* pProcess, QByteArray& line)
+{
+    QByteArray& buffer = (pProcess == m_pBatch) ? m_buffer : m_bufferCheck;
+    for (;;)
+    {
+        int nNewline = buffer.indexOf('\n');
+        if (nNewline >= 0) {
+            line = buffer.left(nNewline);
+            buffer.remove(0, nNewline + 1);
+            return true;
+        }
+        if ((pProcess->bytesAvailable() == 0) && !pProcess->waitForReadyRead(GIT_TIMEOUT_MS))
+            return false;
+        buffer.append(pProcess->readAll());
+    }
+}
+
+bool CGitRepo::readBytes(QProcess* pProcess, qint64 nBytes, QByteArray& data)
+{
+    QByteArray& buffer = (pProcess == m_pBatch) ? m_buffer : m_bufferCheck;
+    while (buffer.size() < nBytes) {
+        if ((pProcess->bytesAvailable() == 0) && !pProcess->waitForReadyRead(GIT_TIMEOUT_MS))
+            return false;
+        buffer.append(pProcess->readAll());
+    }
+    if (buffer.size() == nBytes) {
+        data.clear();
+        data.swap(buffer);
+    }
+    else {
+        data = buffer.left(nBytes);
+        buffer.remove(0, nBytes);
+    }
+    return true;
+}
+
+bool CGitRepo::request(QProcess* pProcess, const std::string& strName, std::string& strOid, std::string& strType, qint64& nSize)
+{
+    //git answers "<oid> <type> <size>", or "<name> missing" for a name it can't find
+    if (strName.empty() || (strName.find('\n') != std::string::npos))
+        return false;
+    std::string strRequest = strName + "\n";
+    if (pProcess->write(strRequest.c_str(), strRequest.size()) != (qint64)strRequest.size())
+        return false;
+    pProcess->waitForBytesWritten(GIT_TIMEOUT_MS);
+
+    QByteArray line;
+    if (!readLine(pProcess, line))
+        return false;
+    std::string strLine(line.constData(), line.size());
+    size_t nSpace1 = strLine.find(' ');
+    size_t nSpace2 = (nSpace1 == std::string::npos) ? std::string::npos : strLine.find(' ', nSpace1 + 1);
+    if (nSpace2 == std::string::npos)
+        return false;
+
+    strType = strLine.substr(nSpace1 + 1, nSpace2 - nSpace1 - 1);
+    if ((strType != "blob") && (strType != "tree") && (strType != "commit") && (strType != "tag"))
+        return false;  //"missing" or "ambiguous", after a name with a space in it
+    strOid = strLine.substr(0, nSpace1);
+    nSize = strtoll(strLine.c_str() + nSpace2 + 1, NULL, 10);
+    m_nOidLength = strOid.size();
+    return true;
+}
+
+bool CGitRepo::GetObjectInfo(const std::string& strName, std::string& strOid, std::string& strType, qint64& nSize)
+{
+    if (!start(m_pBatchCheck, "--batch-check"))
+        return false;
+    return request(m_pBatchCheck, strName, strOid, strType, nSize);
+}
+
+bool CGitRepo::ReadObject(const std::string& strName, std::string& strType, QByteArray& data)
+{
+    if (!start(m_pBatch, "--batch"))
+        return false;
+
+    std::string strOid;
+    qint64 nSize;
+    if (!request(m_pBatch, strName, strOid, strType, nSize))
+        return false;
+    if (!readBytes(m_pBatch, nSize + 1, data))  //the contents, then a newline
+        return false;
+    data.chop(1);
+    m_nObjectsRead++;
+    return true;
+}
+
+bool CGitRepo::ReadTree(const std::string& strName, std::vector<CGitTreeEntry>& entries)
+{
+    //a tree is a list of "<mode> <name>\0" followed by the entry's object ID in binary
+    std::string strType;
+    QByteArray data;
+    if (!ReadObject(strName, strType, data) || (strType != "tree"))
+        return false;
+
+    int nOidBytes = m_nOidLength / 2;
+    const char *p = data.constData();
+    const char *pEnd = p + data.size();
+    while (p < pEnd)
+    {
+        const char *pSpace = (const char *)memchr(p, ' ', pEnd - p);
+        const char *pNul = pSpace ? (const char *)memchr(pSpace, '\0', pEnd - pSpace) : NULL;
+        if (!pNul || (pEnd - (pNul + 1) < nOidBytes))
+            return false;
+
+        std::string strMode(p, pSpace - p);
+        CGitTreeEntry entry;
+        entry.m_strName.assign(pSpace + 1, pNul - pSpace - 1);
+        entry.m_strOid = QByteArray(pNul + 1, nOidBytes).toHex().constData();
+        entry.m_bTree = (strMode == "40000");
+        p = pNul + 1 + nOidBytes;
+
+        if (strMode == "160000")
+            continue;  //a submodule, whose commit is in another repository
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+qint64 CGitRepo::GetCommitTime(const std::string& strRevision)
+{
+    //the committer line ends "<email> <secs since epoch> <timezone>"
+    std::string strType;
+    QByteArray data;
+    if (strRevision.empty() || !ReadObject(strRevision + "^{commit}", strType, data) || (strType != "commit"))
+        return 0;
+
+    std::string strCommit(data.constData(), data.size());
+    size_t nStart = (strCommit.compare(0, 10, "committer ") == 0) ? 0 : strCommit.find("\ncommitter ");
+    if (nStart == std::string::npos)
+        return 0;
+    size_t nEnd = strCommit.find('\n', nStart + 1);
+    size_t nEmail = strCommit.rfind('>', nEnd);
+    if ((nEmail == std::string::npos) || (nEmail < nStart))
+        return 0;
+    return strtoll(strCommit.c_str() + nEmail + 1, NULL, 10) * 1000;
+}
+
+bool CGitRepo::IsRevisionSpec(const QString& strPath)
+{
+    //a colon at index 1 is a drive letter, and a real file with a colon in its name wins
+    int nColon = strPath.indexOf(':');
+    if (nColon <= 1)
+        return false;
+    return !QFileInfo(strPath).exists();
+}
+
+void CGitRepo::SplitSpec(const QString& strSpec, std::string& strRevision, std::string& strPath)
+{
+    int nColon = strSpec.indexOf(':');
+    strRevision = strSpec.left(nColon).toLocal8Bit().constData();
+    strPath = strSpec.mid(nColon + 1).toLocal8Bit().constData();
+    while (!strPath.empty() && ((strPath[0] == '/') || (strPath[0] == '\\')))
+        strPath.erase(0, 1);
+}
+
+std::string CGitRepo::NormalizeSpec(const QString& strSpec)
+{
+    std::string strRevision, strPath;
+    SplitSpec(strSpec, strRevision, strPath);
+    return strRevision + ":" + strPath;
+}
+
+bool CGitRepo::ReadFile(const QString& strSpec, QByteArray& data)
+{
+    CGitRepo repo;
+    std::string strType;
+    return repo.ReadObject(NormalizeSpec(strSpec), strType, data) && (strType == "blob");
+}
+
+static bool readContents(QFile& file, bool bCRLFAsLF, QCryptographicHash* pHash, qint64& nSize)
+{
+    //From the start of the file, hashes its contents, or with no hash just counts them. With bCRLFAsLF a
+    //\r at the end of a read is held back until the next byte shows whether a \n follows it.
+    if (!file.seek(0))
+        return false;
+    std::vector<char> buffer(1024 * 1024), converted;
+    converted.reserve(buffer.size() + 1);
+    bool bPendingCR = false;
+    nSize = 0;
+    for (;;) {
+        qint64 nRead = file.read(&buffer[0], buffer.size());
+        if (nRead < 0)
+            return false;
+        if (nRead == 0)
+            break;
+        const char *pData = &buffer[0];
+        if (bCRLFAsLF) {
+            converted.clear();
+            for (qint64 n=0; n<nRead; n++) {
+                if (bPendingCR && (buffer[n] != '\n'))
+                    converted.push_back('\r');
+                bPendingCR = (buffer[n] == '\r');
+                if (!bPendingCR)
+                    converted.push_back(buffer[n]);
+            }
+            pData = converted.empty() ? "" : &converted[0];
+            nRead = converted.size();
+        }
+        if (pHash)
+            pHash->addData(pData, nRead);
+        nSize += nRead;
+    }
+    if (bPendingCR) {
+        if (pHash)
+            pHash->addData("\r", 1);
+        nSize++;
+    }
+    return true;
+}
+
+bool CGitRepo::HashFile(const QString& strPath, int nOidLength, std::string& strOid, bool bCRLFAsLF)
+{
+    //git hashes "blob <size>\0" followed by the contents
+#if QT_VERSION >= 0x050000
+    QCryptographicHash::Algorithm algorithm = (nOidLength == 64) ? QCryptographicHash::Sha256 : QCryptographicHash::Sha1;
+#else
+    if (nOidLength != 40)
+        return false;  //no SHA-256 before Qt 5, so the blob is read instead
+    QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha1;
+#endif
+    QFile file(strPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    //the header needs the size after conversion, which takes a pass of its own
+    qint64 nSize = file.size();
+    if (bCRLFAsLF && !readContents(file, true, NULL, nSize))
+        return false;
+
+    QCryptographicHash hash(algorithm);
+    char header[32];
+    int nHeader = sprintf(header, "blob %lld", (long long)nSize);
+    hash.addData(header, nHeader + 1);
+    if (!readContents(file, bCRLFAsLF, &hash, nSize))
+        return false;
+    strOid = hash.result().toHex().constData();
+    return true;
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef GITREPO_H
+#define GITREPO_H
+
+#include <QString>
+#include <QByteArray>
+#include <string>
+#include <vector>
+
+class QProcess;
+
+
+#define GIT_TIMEOUT_MS  30000  //for git to answer a request, e.g. while it reads a big pack
+
+
+//a file or folder of a git tree object
+class CGitTreeEntry
+{
+public:
+    std::string m_strName;
+    std::string m_strOid;  //object ID, in hex
+    bool m_bTree;
+};
+
+//a file of a revision on one side of a folder compare
+class CGitEntry
+{
+public:
+    std::string m_strOid;
+    qint64 m_nModified;  //the commit's time, as git doesn't keep files' times
+};
+
+
+//Reads objects from the git repository of the current folder through two long running git processes:
+//"git cat-file --batch" for contents and "git cat-file --batch-check" for types and sizes. Objects are
+//asked for one at a time by name, e.g. "HEAD~1:src/main.cpp" or an object ID, so nothing is checked out.
+//
+//Revision specs ("<rev>:<path>") are accepted wherever a file or folder path is, e.g. "HEAD~3:" and
+//"HEAD:" for the whole trees of two commits, or "v1.2:src/main.cpp" for a file.
+
+class CGitRepo
+{
+public:
+    CGitRepo();
+    ~CGitRepo();
+
+    //The object's type ("blob", "tree" or "commit") and size, without reading it. False if there is no such object.
+    bool GetObjectInfo(const std::string& strName, std::string& strOid, std::string& strType, qint64& nSize);
+    bool ReadObject(const std::string& strName, std::string& strType, QByteArray& data);
+    bool ReadTree(const std::string& strName, std::vector<CGitTreeEntry>& entries);  //submodules are left out
+    qint64 GetCommitTime(const std::string& strRevision);  //msecs since epoch, 0 if it isn't a commit
+
+    int GetObjectsRead() { return m_nObjectsRead; }  //contents read, not counting GetObjectInfo()
+
+    static bool IsRevisionSpec(const QString& strPath);
+    static void SplitSpec(const QString& strSpec, std::string& strRevision, std::string& strPath);
+    static std::string NormalizeSpec(const QString& strSpec);  //e.g. "HEAD:/src" to "HEAD:src", as git wants it
+    static bool ReadFile(const QString& strSpec, QByteArray& data);  //a blob, for a file compare
+
+    //The object ID git would give a file's contents, to compare a live file with a blob without reading the blob.
+    //With bCRLFAsLF each \r\n counts as \n, as git stores a file checked out with core.autocrlf.
+    static bool HashFile(const QString& strPath, int nOidLength, std::string& strOid, bool bCRLFAsLF = false);
+
+private:
+    bool start(QProcess*& pProcess, const char *pStrBatch);
+    bool request(QProcess* pProcess, const std::string& strName, std::string& strOid, std::string& strType, qint64& nSize);
+    bool readLine(QProcess* pProcess, QByteArray& line);
+    bool readBytes(QProcess* pProcess, qint64 nBytes, QByteArray& data);
+
+    QProcess* m_pBatch;
+    QProcess* m_pBatchCheck;
+    QByteArray m_buffer;   //read from m_pBatch but not used yet
+    QByteArray m_bufferCheck;
+    int m_nOidLength;  //hex digits of an object ID: 40 for SHA-1, 64 for SHA-256
+    int m_nObjectsRead;
+};
+
+#endif // GITREPO_H
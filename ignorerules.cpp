@@ -0,0 +1,120 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "ignorerules.h"
+#include "exceptionmatcher.h"
+
+
+CIgnoreLevel::CIgnoreLevel(const CIgnoreLevel* pParent, const std::string& strBase)
+{
+    m_pParent = pParent;
+    m_strBase = strBase;
+}
+
+void CIgnoreLevel::AddPatterns(const char *pData, size_t nSize)
+{
+    const char *pEnd = pData + nSize;
+    const char *pLine = pData;
+
+    while (pLine < pEnd)
+    {
+        const char *pLineEnd = pLine;
+        while ((pLineEnd < pEnd) && (*pLineEnd != '\n'))
+            ++pLineEnd;
+
+        std::string strLine(pLine, pLineEnd);
+        pLine = pLineEnd + 1;
+
+        if (!strLine.empty() && (strLine[strLine.size()-1] == '\r'))
+            strLine.erase(strLine.size()-1);
+
+        //trailing spaces are ignored unless they are escaped with a backslash
+        while (!strLine.empty() && (strLine[strLine.size()-1] == ' ') &&
+               ((strLine.size() < 2) || (strLine[strLine.size()-2] != '\\')))
+            strLine.erase(strLine.size()-1);
+
+        if (strLine.empty() || (strLine[0] == '#'))
+            continue;
+
+        CIgnorePattern pattern;
+        pattern.m_bNegate = false;
+        pattern.m_bDirOnly = false;
+
+        if (strLine[0] == '!')
+        {
+            pattern.m_bNegate = true;
+            strLine.erase(0, 1);
+        }
+        else if ((strLine[0] == '\\') && (strLine.size() > 1) && ((strLine[1] == '!') || (strLine[1] == '#')))
+            strLine.erase(0, 1);
+
+        if (!strLine.empty() && (strLine[strLine.size()-1] == '/'))
+        {
+            pattern.m_bDirOnly = true;
+            strLine.erase(strLine.size()-1);
+        }
+
+        //a slash at the start or in the middle anchors the pattern to this folder
+        pattern.m_bAnchored = (strLine.find('/') != std::string::npos);
+        if (!strLine.empty() && (strLine[0] == '/'))
+            strLine.erase(0, 1);
+
+        if (strLine.empty())
+            continue;
+
+        pattern.m_strPattern = strLine;  //any remaining backslash escapes are handled by GlobMatch()
+
+        m_patterns.push_back(pattern);
+    }
+}
+
+int CIgnoreLevel::Match(const std::string& strRelativePath, bool bDir) const
+{
+    //path relative to the folder of the ignore files, without a leading '/'
+    const char *pPath = strRelativePath.c_str() + m_strBase.size() + 1;
+    const char *pPathEnd = strRelativePath.c_str() + strRelativePath.size();
+
+    const char *pName = pPathEnd;
+    while ((pName != pPath) && (pName[-1] != '/'))
+        --pName;
+
+    for (int n=m_patterns.size()-1; n>=0; n--)
+    {
+        const CIgnorePattern& pattern = m_patterns[n];
+        if (pattern.m_bDirOnly && !bDir)
+            continue;
+
+        const char *pPat = pattern.m_strPattern.c_str();
+        const char *pPatEnd = pPat + pattern.m_strPattern.size();
+        bool bMatched = pattern.m_bAnchored ?
+                    CExceptionMatcher::GlobMatch(pPat, pPatEnd, pPath, pPathEnd) :
+                    CExceptionMatcher::GlobMatch(pPat, pPatEnd, pName, pPathEnd);
+        if (bMatched)
+            return pattern.m_bNegate ? 0 : 1;
+    }
+
+    return -1;
+}
+
+bool CIgnoreLevel::IsIgnored(const std::string& strRelativePath, bool bDir) const
+{
+    //Deeper ignore files take precedence over the ones in parent folders. Paths inside an ignored
+    //folder never get here, because the scan doesn't descend into it (as with git, they can't be re-included).
+    for (const CIgnoreLevel* pLevel = this; pLevel != NULL; pLevel = pLevel->m_pParent)
+    {
+        int nMatch = pLevel->Match(strRelativePath, bDir);
+        if (nMatch != -1)
+            return (nMatch == 1);
+    }
+    return false;
+}
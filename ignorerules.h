@@ -0,0 +1,56 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef IGNORERULES_H
+#define IGNORERULES_H
+
+#include <string>
+#include <vector>
+
+
+class CIgnorePattern
+{
+public:
+    std::string m_strPattern;
+    bool m_bNegate;    //"!pattern" re-includes a path
+    bool m_bDirOnly;   //"pattern/" only matches directories
+    bool m_bAnchored;  //pattern contains a '/', so it is matched against the path relative to the ignore file's folder
+};
+
+
+//The patterns read from the .gitignore and .ignore files of one folder while scanning a tree.
+//Levels are chained to their parent folder's level, giving git's layering: the deepest level
+//with a matching pattern decides, and within a level the last matching pattern wins.
+//A level only lives for as long as the scan is inside its folder.
+
+class CIgnoreLevel
+{
+public:
+    CIgnoreLevel(const CIgnoreLevel* pParent, const std::string& strBase);
+
+    void AddPatterns(const char *pData, size_t nSize);  //parses the contents of an ignore file
+    bool IsEmpty() const { return m_patterns.empty(); }
+
+    //strRelativePath is relative to the compare root with a leading '/', e.g. "/src/build"
+    bool IsIgnored(const std::string& strRelativePath, bool bDir) const;
+
+private:
+    //returns 1 for ignored, 0 for re-included (negated) or -1 if no pattern in this level matched
+    int Match(const std::string& strRelativePath, bool bDir) const;
+
+    const CIgnoreLevel* m_pParent;
+    std::string m_strBase;  //relative path of the folder containing the ignore files ("" for the root)
+    std::vector<CIgnorePattern> m_patterns;
+};
+
+#endif // IGNORERULES_H
@@ -0,0 +1,135 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "linefilter.h"
+#include "diffdoc.h"
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <QDebug>
+
+
+class CLineFilterTask : public QRunnable
+{
+public:
+    CLineFilterTask(const CLineFilter* pFilter, std::vector<CLine>* pLines, size_t nStart, size_t nEnd, const std::vector<QRegExp>& masks)
+        { m_pFilter = pFilter; m_pLines = pLines; m_nStart = nStart; m_nEnd = nEnd; m_masks = masks; }
+
+    virtual void run()
+    {
+        m_pFilter->ApplyRange(*m_pLines, m_nStart, m_nEnd, m_masks);
+    }
+
+private:
+    const CLineFilter* m_pFilter;
+    std::vector<CLine>* m_pLines;
+    size_t m_nStart, m_nEnd;  //each task has its own lines, so nothing is shared but the filter's settings
+    std::vector<QRegExp> m_masks;
+};
+
+
+void CLineFilter::SetMasks(const QStringList& patterns)
+{
+    m_maskPatterns = patterns;
+    m_masks.clear();
+    for (int n=0; n<patterns.size(); n++) {
+        QRegExp mask(patterns.at(n));
+        if (mask.isValid() && !patterns.at(n).isEmpty())
+            m_masks.push_back(mask);
+        else
+            qDebug() << "Skipping invalid mask" << patterns.at(n);
+    }
+}
+
+void CLineFilter::Apply(std::vector<CLine>& lines) const
+{
+    //a big log is split into one range of lines per thread
+    int nThreads = qBound(1, QThread::idealThreadCount(), LINEFILTER_MAX_THREADS);
+    if ((lines.size() < LINEFILTER_PARALLEL_LINES) || (nThreads == 1)) {
+        std::vector<QRegExp> masks = m_masks;
+        ApplyRange(lines, 0, lines.size(), masks);
+        return;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(nThreads);
+    size_t nChunk = (lines.size() + nThreads - 1) / nThreads;
+    for (size_t nStart=0; nStart<lines.size(); nStart+=nChunk)
+        pool.start(new CLineFilterTask(this, &lines, nStart, qMin(nStart + nChunk, lines.size()), m_masks));
+    pool.waitForDone();
+}
+
+void CLineFilter::ApplyRange(std::vector<CLine>& lines, size_t nStart, size_t nEnd, std::vector<QRegExp>& masks) const
+{
+    bool bActive = IsActive();
+    for (size_t nLine=nStart; nLine<nEnd; nLine++)
+    {
+        CLine& line = lines[nLine];
+        line.m_bFiltered = bActive && filterLine(line.m_strLine, line.m_strMatch, masks);
+        if (!line.m_bFiltered)
+            line.m_strMatch.clear();
+        line.m_nMatchHash = line.m_bFiltered ? hashLine(line.m_strMatch) : line.m_nHash;
+    }
+}
+
+bool CLineFilter::filterLine(const std::string& strLine, std::string& strMatch, std::vector<QRegExp>& masks) const
+{
+    //masked spans are cut out first, so the options below apply to what is left
+    const std::string* pText = &strLine;
+    std::string strMasked;
+    if (!masks.empty())
+    {
+        QString strQLine = QString::fromLocal8Bit(strLine.c_str(), strLine.size());
+        bool bMasked = false;
+        for (size_t nMask=0; nMask<masks.size(); nMask++) {
+            int nPos = 0;
+            while ((nPos = masks[nMask].indexIn(strQLine, nPos)) >= 0) {
+                int nLength = masks[nMask].matchedLength();
+                if (nLength == 0) {
+                    nPos++;
+                    continue;
+                }
+                strQLine.remove(nPos, nLength);
+                bMasked = true;
+            }
+        }
+        if (bMasked) {
+            strMasked = strQLine.toLocal8Bit().constData();
+            pText = &strMasked;
+        }
+    }
+
+    //most lines of most files are left as they are, so nothing is copied until a byte changes
+    const std::string& strText = *pText;
+    size_t nEnd = strText.size();
+    if (m_nFlags & LINEFILTER_IGNORE_EOL)
+        while ((nEnd > 0) && (strText[nEnd - 1] == '\r'))
+            nEnd--;
+
+    bool bChanged = (pText != &strLine) || (nEnd != strText.size());
+    if (bChanged)
+        strMatch.clear();
+    for (size_t n=0; n<nEnd; n++)
+    {
+        char c = strText[n];
+        bool bDrop = (m_nFlags & LINEFILTER_IGNORE_WHITESPACE) && ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\v') || (c == '\f'));
+        char cMatch = ((m_nFlags & LINEFILTER_IGNORE_CASE) && (c >= 'A') && (c <= 'Z')) ? (c - 'A' + 'a') : c;
+        if (!bChanged && (bDrop || (cMatch != c))) {
+            bChanged = true;
+            strMatch.assign(strText, 0, n);
+        }
+        if (bChanged && !bDrop)
+            strMatch += cMatch;
+    }
+    return bChanged;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef LINEFILTER_H
+#define LINEFILTER_H
+
+#include <QStringList>
+#include <QRegExp>
+#include <string>
+#include <vector>
+
+class CLine;
+
+
+//What a file compare ignores (flags)
+#define LINEFILTER_IGNORE_WHITESPACE    1   //all spaces and tabs, so reindented or reformatted lines still match
+#define LINEFILTER_IGNORE_CASE          2   //ASCII letters only
+#define LINEFILTER_IGNORE_EOL           4   //a '\r' left at the end of a line, e.g. by "\r\r\n" or a mix of endings
+
+#define LINEFILTER_PARALLEL_LINES   50000  //files with fewer lines are filtered on the calling thread
+#define LINEFILTER_MAX_THREADS      8
+
+
+//Gives each loaded line the text the compare engine matches on. The lines keep their original text for
+//the views, and the match text is only stored for lines it changes, so the filter costs one pass over
+//the lines at load time rather than anything per comparison.
+//
+//Masks are regular expressions whose matches are cut out of the match text first, e.g. timestamps,
+//GUIDs or pointer values, so lines that differ only there still line up. QRegExp isn't safe to share
+//between threads, so each worker of a big file has its own copies.
+
+class CLineFilter
+{
+public:
+    CLineFilter() { m_nFlags = 0; }
+
+    int GetFlags() const { return m_nFlags; }
+    void SetFlags(int nFlags) { m_nFlags = nFlags; }
+    const QStringList& GetMasks() const { return m_maskPatterns; }
+    void SetMasks(const QStringList& patterns);  //compiled here, once. Invalid patterns are skipped.
+    bool IsActive() const { return (m_nFlags != 0) || !m_masks.empty(); }
+
+    void Apply(std::vector<CLine>& lines) const;  //after loading. Lines come from the file cache unfiltered.
+    void ApplyRange(std::vector<CLine>& lines, size_t nStart, size_t nEnd, std::vector<QRegExp>& masks) const;
+
+    bool operator ==(const CLineFilter& filter) const { return (m_nFlags == filter.m_nFlags) && (m_maskPatterns == filter.m_maskPatterns); }
+    bool operator !=(const CLineFilter& filter) const { return !(*this == filter); }
+
+private:
+    bool filterLine(const std::string& strLine, std::string& strMatch, std::vector<QRegExp>& masks) const;  //false if the line is unchanged
+
+    int m_nFlags;
+    QStringList m_maskPatterns;
+    std::vector<QRegExp> m_masks;
+};
+
+#endif // LINEFILTER_H
@@ -0,0 +1,151 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "linestats.h"
+#include "diffdoc.h"
+#include "binarydiff.h"
+#include <QFile>
+#include <QString>
+#include <QRunnable>
+#include <QThread>
+#include <QMutexLocker>
+
+
+void CLineStats::Count(const char *pStrPath1, const char *pStrPath2, const CLineFilter& filter, CLineStats& stats)
+{
+    qint64 nSize1 = 0, nSize2 = 0;
+    stats.m_nResult = LINESTATS_OK;
+    stats.m_nAdded = stats.m_nRemoved = stats.m_nSections = 0;
+
+    //both files are checked before either is loaded, so a big or binary file costs one small read
+    if (isBinary(pStrPath1, nSize1) || isBinary(pStrPath2, nSize2))
+        stats.m_nResult = LINESTATS_BINARY;
+    if ((nSize1 < 0) || (nSize2 < 0))
+        stats.m_nResult = LINESTATS_ERROR;
+    else if ((nSize1 > LINESTATS_MAX_FILE_SIZE) || (nSize2 > LINESTATS_MAX_FILE_SIZE))
+        stats.m_nResult = LINESTATS_TOOBIG;
+    if (stats.m_nResult != LINESTATS_OK)
+        return;
+
+    CDiffDoc doc(false);
+    doc.SetLineFilter(filter);
+    if (!doc.LoadFiles(pStrPath1, pStrPath2)) {
+        stats.m_nResult = LINESTATS_ERROR;
+        return;
+    }
+    doc.Compare();
+    doc.GetChangeCounts(stats.m_nAdded, stats.m_nRemoved, stats.m_nSections);
+}
+
+bool CLineStats::isBinary(const char *pStrPath, qint64& nSize)
+{
+    //nSize is -1 if the file can't be opened
+    QFile file(pStrPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        nSize = -1;
+        return false;
+    }
+    nSize = file.size();
+
+    //the same test the file compare makes when it loads the file
+    return CBinaryDiff::IsBinary(file.peek(BINARY_SNIFF_BYTES));
+}
+
+////////////////////////////////////////
+
+
+class CLineStatsTask : public QRunnable
+{
+public:
+    CLineStatsTask(CLineStatsRunner* pRunner) { m_pRunner = pRunner; }
+
+    virtual void run()
+    {
+        int n;
+        while ((n = m_pRunner->takePair()) >= 0) {
+            CLineStatsRunner::CPair& pair = m_pRunner->m_pairs[n];
+            CLineStats::Count(pair.m_strPath1.c_str(), pair.m_strPath2.c_str(), m_pRunner->m_filter, pair.m_stats);
+            m_pRunner->finishPair(n);
+        }
+    }
+
+private:
+    CLineStatsRunner* m_pRunner;
+};
+
+
+CLineStatsRunner::CLineStatsRunner()
+{
+    m_bStarted = false;
+    m_nNext = 0;
+    m_bCancelled = false;
+    m_pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount(), LINESTATS_MAX_THREADS));
+}
+
+CLineStatsRunner::~CLineStatsRunner()
+{
+    Cancel();
+    m_pool.waitForDone();
+}
+
+int CLineStatsRunner::Add(const std::string& strPath1, const std::string& strPath2)
+{
+    Q_ASSERT(!m_bStarted);  //the workers index into m_pairs, so it can't grow once they are running
+
+    CPair pair;
+    pair.m_strPath1 = strPath1;
+    pair.m_strPath2 = strPath2;
+    m_pairs.push_back(pair);
+    return m_pairs.size() - 1;
+}
+
+void CLineStatsRunner::Start()
+{
+    m_bStarted = true;
+    int nTasks = qMin((int)m_pairs.size(), m_pool.maxThreadCount());
+    for (int n=0; n<nTasks; n++)
+        m_pool.start(new CLineStatsTask(this));
+}
+
+bool CLineStatsRunner::Wait(int nMsecs)
+{
+    return m_pool.waitForDone(nMsecs);
+}
+
+void CLineStatsRunner::TakeFinished(std::vector<int>& finished)
+{
+    QMutexLocker locker(&m_mutex);
+    finished.swap(m_finished);
+    m_finished.clear();
+}
+
+void CLineStatsRunner::Cancel()
+{
+    //pairs already being counted are finished, the rest are never started
+    QMutexLocker locker(&m_mutex);
+    m_bCancelled = true;
+}
+
+int CLineStatsRunner::takePair()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_bCancelled || (m_nNext >= (int)m_pairs.size()))
+        return -1;
+    return m_nNext++;
+}
+
+void CLineStatsRunner::finishPair(int n)
+{
+    QMutexLocker locker(&m_mutex);
+    m_finished.push_back(n);
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef LINESTATS_H
+#define LINESTATS_H
+
+#include <QtGlobal>
+#include <QThreadPool>
+#include <QMutex>
+#include <string>
+#include <vector>
+#include "linefilter.h"
+
+
+//CLineStats results
+#define LINESTATS_OK        0
+#define LINESTATS_BINARY    1   //a NUL byte near the start of either file
+#define LINESTATS_TOOBIG    2   //skipped to keep each worker's memory bounded
+#define LINESTATS_ERROR     3   //couldn't be read
+
+#define LINESTATS_MAX_FILE_SIZE     (8 * 1024 * 1024)  //per file. A loaded line costs a few times its length.
+#define LINESTATS_MAX_THREADS       8
+
+class CLineStats
+{
+public:
+    CLineStats() { m_nResult = LINESTATS_ERROR; m_nAdded = m_nRemoved = m_nSections = 0; }
+
+    int m_nResult;
+    int m_nAdded;     //lines only in file2
+    int m_nRemoved;   //lines only in file1
+    int m_nSections;  //changed sections, as the main window would show them
+
+    //Runs the line diff engine over two files. Safe to call from any thread.
+    static void Count(const char *pStrPath1, const char *pStrPath2, const CLineFilter& filter, CLineStats& stats);
+
+private:
+    static bool isBinary(const char *pStrPath, qint64& nSize);
+};
+
+
+//Counts the changes of many file pairs in parallel, e.g. the different files of a folder compare.
+//Pairs are added, then Start() hands them to a few workers. Each worker holds one pair at a time,
+//so memory use is bounded by the number of workers rather than the number of pairs.
+
+class CLineStatsRunner
+{
+    friend class CLineStatsTask;
+public:
+    CLineStatsRunner();
+    ~CLineStatsRunner();  //cancels and waits for the workers
+
+    int Add(const std::string& strPath1, const std::string& strPath2);  //returns the pair's index
+    int GetCount() { return m_pairs.size(); }
+    void SetLineFilter(const CLineFilter& filter) { m_filter = filter; }  //before Start(), so the counts match the file compare
+    void Start();
+
+    bool Wait(int nMsecs);  //true once every pair is done, or the workers have stopped after Cancel()
+    void TakeFinished(std::vector<int>& finished);  //indexes of the pairs done since the last call
+    const CLineStats& GetStats(int n) { return m_pairs[n].m_stats; }
+    void Cancel();
+
+private:
+    class CPair
+    {
+    public:
+        std::string m_strPath1;
+        std::string m_strPath2;
+        CLineStats m_stats;
+    };
+
+    int takePair();  //-1 when there are none left
+    void finishPair(int n);
+
+    std::vector<CPair> m_pairs;
+    CLineFilter m_filter;
+    bool m_bStarted;
+    QMutex m_mutex;  //guards the members below
+    int m_nNext;
+    bool m_bCancelled;
+    std::vector<int> m_finished;
+    QThreadPool m_pool;
+};
+
+#endif // LINESTATS_H
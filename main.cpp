@@ -12,23 +12,62 @@
 // GNU General Public License for more details.
 
 #include "mainwindow.h"
+#include "commandline.h"
+#include "singleinstance.h"
+#include "gitrepo.h"
 #include <QApplication>
+#include <QFileInfo>
+#include <QDateTime>
 #include <QDebug>
+#include <string.h>
 
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
+    qint64 nLaunchTime = QDateTime::currentMSecsSinceEpoch();
+
+    //command line modes run without a display, so they only get a core application
+    if (isCommandLineMode(argc, argv)) {
+        QCoreApplication a(argc, argv);
+        return runCommandLine(argc, argv);
+    }
+
+    bool bSingleInstance = (argc > 1) && (strcmp(argv[1], "--single-instance") == 0);
+    int nFirstPath = bSingleInstance ? 2 : 1;
 
     std::string strPath1, strPath2;
     bool bDoCompare = false;
-    if (argc == 3) {
-        strPath1 = argv[1];
-        strPath2 = argv[2];
+    if (argc == nFirstPath + 2) {
+        strPath1 = argv[nFirstPath];
+        strPath2 = argv[nFirstPath + 1];
         bDoCompare = true;
     }
 
+    //A running instance is tried before anything else is set up, as skipping that is the point.
+    //Revision specs are read from the current folder's repository, which the running instance may not be in.
+    if (bSingleInstance)
+    {
+        QCoreApplication a(argc, argv);
+        QString strQPath1 = QString::fromLocal8Bit(strPath1.c_str());
+        QString strQPath2 = QString::fromLocal8Bit(strPath2.c_str());
+        if (!CGitRepo::IsRevisionSpec(strQPath1) && !CGitRepo::IsRevisionSpec(strQPath2)) {
+            if (bDoCompare) {
+                strQPath1 = QFileInfo(strQPath1).absoluteFilePath();
+                strQPath2 = QFileInfo(strQPath2).absoluteFilePath();
+            }
+            if (CSingleInstance::ForwardCompare(strQPath1, strQPath2, nLaunchTime))
+                return 0;
+        }
+    }
+
+    QApplication a(argc, argv);
+
+    CSingleInstance instance;
+    if (bSingleInstance && !instance.Listen())
+        qDebug() << "Another instance is starting, so this one won't take compares";
+
     MainWindow w;
+    w.setLaunchTime(nLaunchTime);
     w.show();
 
     if (bDoCompare)
@@ -21,7 +21,14 @@
 #include <QPainter>
 #include <QDebug>
 #include <QScrollBar>
+#include <QApplication>
+#include <QDateTime>
+#include <QPushButton>
+#include <QRunnable>
+#include <QElapsedTimer>
 #include "foldersdlg.h"
+#include "qhexdiffview.h"
+#include "patchwriter.h"
 #include <QFileDialog>
 #include <QStringList>
 #include <aboutdlg.h>
@@ -31,6 +38,24 @@
 
 MainWindow* MainWindow::m_pInstance = NULL;
 
+
+class CRefineTask : public QRunnable
+{
+public:
+    CRefineTask(MainWindow* pWnd, CDiffDoc* pDoc) { m_pWnd = pWnd; m_pDoc = pDoc; }
+
+    virtual void run()
+    {
+        m_pDoc->Compare();
+        QMetaObject::invokeMethod(m_pWnd, "onRefineFinished", Qt::QueuedConnection);
+    }
+
+private:
+    MainWindow* m_pWnd;
+    CDiffDoc* m_pDoc;
+};
+
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
@@ -42,9 +67,28 @@ MainWindow::MainWindow(QWidget *parent) :
 
     m_pInstance = this;
     m_pFoldersDlg = NULL;
+    m_nLaunchTime = 0;
+    m_pRefineDoc = NULL;
+    m_nCompareCount = m_nRefineCompare = 0;
+    m_refinePool.setMaxThreadCount(1);
 
     readSettings();
 
+    m_bBinaryMode = false;
+    m_pHexView1 = new QHexDiffView(this);
+    m_pHexView2 = new QHexDiffView(this);
+    m_pHexView1->init(&m_binaryDiff, &m_diffDoc, VIEW_LEFT);
+    m_pHexView2->init(&m_binaryDiff, &m_diffDoc, VIEW_RIGHT);
+    ui->verticalLayout->addWidget(m_pHexView1);
+    ui->verticalLayout_2->addWidget(m_pHexView2);
+    m_pHexView1->hide();
+    m_pHexView2->hide();
+
+    m_pBtnRefine = new QPushButton(tr("Refine Fully"));
+    m_pBtnRefine->hide();
+    connect(m_pBtnRefine, SIGNAL(released()), this, SLOT(onClickRefineFully()));
+    ui->statusBar->addPermanentWidget(m_pBtnRefine);
+
     connect(ui->pushButtonBrowse1,SIGNAL(pressed()),this,SLOT(onBtnPath1Pressed()));
     connect(ui->pushButtonBrowse2,SIGNAL(pressed()),this,SLOT(onBtnPath2Pressed()));
 
@@ -58,9 +102,30 @@ MainWindow* MainWindow::getInstance()
 
 MainWindow::~MainWindow()
 {
+    if (m_pRefineDoc)
+        m_pRefineDoc->Cancel();
+    m_refinePool.waitForDone();
+    delete m_pRefineDoc;
+
+    if (m_pInstance == this) {
+        m_pInstance = NULL;
+        QWidgetList widgets = QApplication::topLevelWidgets();
+        for (int n=0; n<widgets.size(); n++) {
+            MainWindow* pWnd = qobject_cast<MainWindow*>(widgets.at(n));
+            if (pWnd && (pWnd != this))
+                m_pInstance = pWnd;
+        }
+    }
     delete ui;
 }
 
+void MainWindow::changeEvent(QEvent *event)
+{
+    if ((event->type() == QEvent::ActivationChange) && isActiveWindow())
+        m_pInstance = this;
+    QMainWindow::changeEvent(event);
+}
+
 void MainWindow::setStatusBarMsg(const char *pStrText)
 {
     ui->statusBar->showMessage(pStrText);
@@ -85,8 +150,20 @@ void MainWindow::doFileCompare()
 
     setStatusBarMsg("Busy comparing...");
 
-    m_diffDoc.LoadFiles(strPath1.c_str(), strPath2.c_str());
-    m_diffDoc.Compare();
+    m_nCompareCount++;
+    m_pBtnRefine->hide();
+    if (m_pRefineDoc)
+        m_pRefineDoc->Cancel();  //of an earlier compare
+
+    bool bPrefetched = m_prefetcher.Take(strPath1.c_str(), strPath2.c_str(), m_diffDoc);
+    if (!bPrefetched && !m_diffDoc.LoadFiles(strPath1.c_str(), strPath2.c_str()) && m_diffDoc.IsBinary()) {
+        doBinaryCompare(strPath1, strPath2);
+        return;
+    }
+    emit filesLoaded();
+    if (!bPrefetched)
+        m_diffDoc.Compare();
+    setBinaryMode(false);
     LoadDocsIntoEditControls();
 
     addPathComboTextToDropdown(ui->comboBoxPath1);
@@ -95,11 +172,105 @@ void MainWindow::doFileCompare()
     ui->textEditDiff1->scrollToLine(0);
     ui->textEditDiff2->scrollToLine(0);
 
-    setStatusBarMsg("Done compare");
+    CLoadedFileCache* pFileCache = m_diffDoc.GetFileCache();
+    int nLoads = pFileCache->GetHits() + pFileCache->GetMisses();
+    QString strStatus = bPrefetched ? "Done compare (compared in the background)" : "Done compare";
+    if (nLoads > 0)
+        strStatus += QString(". File cache: %1 of %2 loads reused (%3%)").arg(pFileCache->GetHits()).arg(nLoads).arg(pFileCache->GetHits() * 100 / nLoads);
+    if (m_diffDoc.IsDegraded()) {
+        strStatus += ". Ran out of time, so some changes may be shown bigger than they are";
+        m_pBtnRefine->setEnabled(m_pRefineDoc == NULL);
+        m_pBtnRefine->show();
+    }
+    setStatusBarMsg(strStatus.toLocal8Bit().constData());
 
     repaint();  //to show outline bars
 }
 
+void MainWindow::doBinaryCompare(const std::string& strPath1, const std::string& strPath2)
+{
+    setStatusBarMsg("Busy comparing binary files...");
+
+    bool bLoaded = m_binaryDiff.Load(strPath1.c_str(), strPath2.c_str());
+    emit filesLoaded();
+    if (!bLoaded) {
+        QMessageBox::information(this, APP_NAME, "Unable to read the files.");
+        setStatusBarMsg("");
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    m_binaryDiff.Compare();
+    qint64 nMsecs = timer.elapsed();
+
+    setBinaryMode(true);
+    m_pHexView1->reset();
+    m_pHexView2->reset();
+
+    addPathComboTextToDropdown(ui->comboBoxPath1);
+    addPathComboTextToDropdown(ui->comboBoxPath2);
+
+    qint64 nBytes = m_binaryDiff.GetSize(VIEW_LEFT) + m_binaryDiff.GetSize(VIEW_RIGHT);
+    QString strStatus = QString("Done binary compare: %1 changed ranges, %2 bytes changed on the left and %3 on the right")
+            .arg(m_binaryDiff.GetChanges().size()).arg(m_binaryDiff.GetChangedBytes(VIEW_LEFT)).arg(m_binaryDiff.GetChangedBytes(VIEW_RIGHT));
+    if (nMsecs > 0)
+        strStatus += QString(" (%1 MB/s)").arg(nBytes * 1000.0 / nMsecs / (1024 * 1024), 0, 'f', 1);
+    setStatusBarMsg(strStatus.toLocal8Bit().constData());
+
+    repaint();
+}
+
+void MainWindow::setBinaryMode(bool bBinary)
+{
+    m_bBinaryMode = bBinary;
+    ui->textEditDiff1->setVisible(!bBinary);
+    ui->textEditDiff2->setVisible(!bBinary);
+    m_pHexView1->setVisible(bBinary);
+    m_pHexView2->setVisible(bBinary);
+    if (!bBinary)
+        m_binaryDiff.Clear();  //unmaps the files
+}
+
+void MainWindow::onClickRefineFully()
+{
+    if (m_pRefineDoc)
+        return;
+
+    //the lines on screen, as the options they were compared with filtered them, rather than the files
+    //again, which may have changed since
+    m_pRefineDoc = new CDiffDoc(false);
+    m_pRefineDoc->SetCompareOptions(m_diffDoc.GetCompareOptions());
+    m_pRefineDoc->SetTimeBudget(0);
+    m_pRefineDoc->SetLines(m_diffDoc.GetLines(VIEW_LEFT), m_diffDoc.GetLines(VIEW_RIGHT));
+    m_nRefineCompare = m_nCompareCount;
+    m_pBtnRefine->setEnabled(false);
+    setStatusBarMsg("Refining the compare in the background...");
+
+    m_refinePool.start(new CRefineTask(this, m_pRefineDoc));
+}
+
+void MainWindow::onRefineFinished()
+{
+    CDiffDoc* pDoc = m_pRefineDoc;
+    m_pRefineDoc = NULL;
+
+    if ((m_nRefineCompare == m_nCompareCount) && pDoc->IsCompared() && !pDoc->IsDegraded()) {
+        m_diffDoc.Adopt(*pDoc);
+        LoadDocsIntoEditControls();
+        m_pBtnRefine->hide();
+        setStatusBarMsg("Done refining the compare");
+        repaint();
+    }
+    else {
+        m_pBtnRefine->setEnabled(true);  //in case the compare shown now ran out of time too
+        if (m_nRefineCompare == m_nCompareCount)
+            setStatusBarMsg("Unable to refine the compare");
+    }
+
+    delete pDoc;
+}
+
 //run from folders compare dialog
 void MainWindow::setFileCombosAndDoCompare(const char *pStrPath1, const char *pStrPath2)
 {
@@ -187,7 +358,9 @@ void MainWindow::LoadDocIntoEditControl(int nView, QDiffTextEdit* diffEdit)
             //first set the text colour. Can be Identical, Different, OnlyInLeft, OnlyInRight
             QColor clr;
             if (bDifferent) {
-                if (secs[nSec].m_nLink != -1)
+                if (secs[nSec].m_nState & STATE_MOVED)
+                    clr = m_diffDoc.getClrMoved();
+                else if (secs[nSec].m_nLink != -1)
                     clr =  m_diffDoc.getClrDifferent();
                 else
                     clr = (nView == VIEW_LEFT) ? m_diffDoc.getClrOnlyLeft() : m_diffDoc.getClrOnlyRight();
@@ -280,7 +453,17 @@ void MainWindow::closeEvent(QCloseEvent *event)
 
 void MainWindow::paintEvent(QPaintEvent *)
 {
-    if (!m_diffDoc.IsCompared())
+    if (m_nLaunchTime) {
+        //shown after the compare's own status, so it can be checked without a debugger attached
+        qint64 nMsecs = QDateTime::currentMSecsSinceEpoch() - m_nLaunchTime;
+        m_nLaunchTime = 0;
+        qDebug() << "First paint" << nMsecs << "ms after launch";
+        QString strStatus = ui->statusBar->currentMessage();
+        strStatus += QString(strStatus.isEmpty() ? "Shown %1 ms after launch" : ". Shown %1 ms after launch").arg(nMsecs);
+        setStatusBarMsg(strStatus.toLocal8Bit().constData());
+    }
+
+    if (m_bBinaryMode || !m_diffDoc.IsCompared())
         return;
 
     drawOutline(VIEW_LEFT);
@@ -335,7 +518,7 @@ void MainWindow::drawOutline(int nView)
 
 void MainWindow::mousePressEvent(QMouseEvent *event)
 {
-     if (event->button() == Qt::LeftButton) {
+     if ((event->button() == Qt::LeftButton) && !m_bBinaryMode) {
          QPoint point = event->pos();
          handleClickInOutline(VIEW_LEFT, point);
          handleClickInOutline(VIEW_RIGHT, point);
@@ -376,6 +559,15 @@ void MainWindow::handleClickInOutline(int nView, QPoint posClick)
 
 void MainWindow::onClickPreviousChange()
 {
+    if (m_bBinaryMode) {
+        qint64 nRow = m_binaryDiff.GetPreviousChangeRow(m_pHexView1->getMidRow());
+        if (nRow != -1)
+            m_pHexView1->scrollToRow(nRow);
+        else
+            QMessageBox::information(this, APP_NAME, "No more changes.");
+        return;
+    }
+
     QDiffTextEdit* pDiffEdit1 = ui->textEditDiff1;
 
     QWidget* pFocus =  QApplication::focusWidget();
@@ -397,6 +589,15 @@ void MainWindow::onClickPreviousChange()
 
 void MainWindow::onClickNextChange()
 {
+    if (m_bBinaryMode) {
+        qint64 nRow = m_binaryDiff.GetNextChangeRow(m_pHexView1->getMidRow());
+        if (nRow != -1)
+            m_pHexView1->scrollToRow(nRow);
+        else
+            QMessageBox::information(this, APP_NAME, "No more changes.");
+        return;
+    }
+
     QDiffTextEdit* pDiffEdit1 = ui->textEditDiff1;
 
     QWidget* pFocus =  QApplication::focusWidget();
@@ -416,6 +617,33 @@ void MainWindow::onClickNextChange()
 
 }
 
+void MainWindow::onClickExportPatch()
+{
+    if (m_bBinaryMode || !m_diffDoc.IsCompared()) {
+        QMessageBox::information(this, APP_NAME, "Compare two text files before exporting a patch.");
+        return;
+    }
+
+    QString strPath = QFileDialog::getSaveFileName(this, "Export patch", QString(), "Patches (*.patch *.diff);;All files (*)");
+    if (strPath.isEmpty())
+        return;
+
+    //the paths last compared are at the top of the dropdowns
+    std::string strLabel1 = ui->comboBoxPath1->itemText(0).toLocal8Bit().constData();
+    std::string strLabel2 = ui->comboBoxPath2->itemText(0).toLocal8Bit().constData();
+
+    QElapsedTimer timer;
+    timer.start();
+    CPatchWriter writer(&m_diffDoc, m_diffDoc.getPatchContext());
+    if (!writer.Write(strPath.toLocal8Bit().constData(), strLabel1.c_str(), strLabel2.c_str())) {
+        QMessageBox::information(this, APP_NAME, "Unable to write " + strPath);
+        return;
+    }
+
+    QString strStatus = QString("Exported %1 changes in %2 hunks in %3 ms").arg(writer.GetChangeCount()).arg(writer.GetHunkCount()).arg(timer.elapsed());
+    setStatusBarMsg(strStatus.toLocal8Bit().constData());
+}
+
 void MainWindow::onBtnPath1Pressed()
 {
     QString strPath = ui->comboBoxPath1->currentText();
@@ -451,5 +679,40 @@ void MainWindow::onClickSettings()
 {
     SettingsDlg dlg;
     dlg.exec();
+
+    //The dialog changes the active window's doc, so the other windows, e.g. those opened through
+    //--single-instance, catch up once it closes.
+    MainWindow* pActive = getInstance();
+    QWidgetList widgets = QApplication::topLevelWidgets();
+    for (int n=0; n<widgets.size(); n++) {
+        MainWindow* pWnd = qobject_cast<MainWindow*>(widgets.at(n));
+        if (pWnd && (pWnd != pActive))
+            pWnd->applySettings(*pActive->getDoc());
+    }
+}
+
+void MainWindow::applySettings(CDiffDoc& doc)
+{
+    //Everything but the colours has been saved, so it is read back. Only the identical colour is saved,
+    //so the colours are copied.
+    CCompareOptions options = m_diffDoc.GetCompareOptions();
+    m_diffDoc.ReloadSettings();
+    m_diffDoc.setClrDifferent(doc.getClrDifferent());
+    m_diffDoc.setClrOnlyLeft(doc.getClrOnlyLeft());
+    m_diffDoc.setClrOnlyRight(doc.getClrOnlyRight());
+    m_diffDoc.setClrMoved(doc.getClrMoved());
+    m_diffDoc.setClrIdentical(doc.getClrIdentical());
+
+    if (m_bBinaryMode) {
+        m_pHexView1->viewport()->update();
+        m_pHexView2->viewport()->update();
+    }
+    else if (m_diffDoc.IsCompared()) {
+        if (m_diffDoc.GetCompareOptions() != options)
+            doFileCompare();
+        else
+            LoadDocsIntoEditControls();
+        repaint();
+    }
 }
 
@@ -15,8 +15,11 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QThreadPool>
 
 #include "diffdoc.h"
+#include "diffprefetcher.h"
+#include "binarydiff.h"
 
 
 //Used for settings
@@ -25,9 +28,11 @@
 
 
 class QDiffTextEdit;
+class QHexDiffView;
 class QSettings;
 class QComboBox;
 class FoldersDlg;
+class QPushButton;
 
 
 namespace Ui {
@@ -42,17 +47,23 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
-    static MainWindow* getInstance();
+    static MainWindow* getInstance();  //the active main window, as there is one per compare with --single-instance
     QDiffTextEdit* getDiffEdit(int nView);
+    QHexDiffView* getHexView(int nView) { return (nView == VIEW_LEFT) ? m_pHexView1 : m_pHexView2; }
     CDiffDoc* getDoc() { return &m_diffDoc; }
+    CDiffPrefetcher* getPrefetcher() { return &m_prefetcher; }
 
     void setFileCombosAndDoCompare(const char *pStrPath1, const char *pStrPath2);
+    void applySettings(CDiffDoc& doc);  //after the settings dialog changed another window's doc
+    void setLaunchTime(qint64 nMsecs) { m_nLaunchTime = nMsecs; }  //shows the time from launch to the first paint in the status bar
 
     //used in main diff window and folders dialog
     void writeSettingsPathsCombo(QSettings* pSettings, const QComboBox* pCombo, const QString& strSettingName);
     void readSettingsPathsCombo(QSettings* pSettings, QComboBox* pCombo, const QString& strSettingName);
     void addPathComboTextToDropdown(QComboBox* pCombo);
 
+signals:
+    void filesLoaded();  //by a compare, before the files are compared and laid out
 
 public slots:
     void actionCompare_triggered();
@@ -60,23 +71,44 @@ public slots:
     void onFoldersDlgDestroyed();
     void onClickPreviousChange();
     void onClickNextChange();
+    void onClickExportPatch();
     void onBtnPath1Pressed();
     void onBtnPath2Pressed();
     void onClickAbout();
     void onClickSettings();
+    void onClickRefineFully();
+    void onRefineFinished();
 
 private:
     Ui::MainWindow *ui;
     CDiffDoc m_diffDoc;
+    CDiffPrefetcher m_prefetcher;  //compares the files likely to be opened next from the folders dialog
     static MainWindow* m_pInstance;
     FoldersDlg* m_pFoldersDlg;
+    qint64 m_nLaunchTime;  //msecs since epoch, 0 once the first paint has been timed
+
+    //a compare that ran out of time can be done again without a time budget in the background
+    QPushButton* m_pBtnRefine;
+    QThreadPool m_refinePool;
+    CDiffDoc* m_pRefineDoc;  //while refining
+    int m_nCompareCount;   //so a refine that finishes after another compare is dropped
+    int m_nRefineCompare;
+
+    //binary files are compared as byte ranges and shown in hex views in place of the text views
+    CBinaryDiff m_binaryDiff;
+    QHexDiffView* m_pHexView1;
+    QHexDiffView* m_pHexView2;
+    bool m_bBinaryMode;
 
     //overrides
     void closeEvent(QCloseEvent *event);
+    void changeEvent(QEvent *event);
     void paintEvent (QPaintEvent * event);
     void mousePressEvent(QMouseEvent * event);
 
     void doFileCompare();
+    void doBinaryCompare(const std::string& strPath1, const std::string& strPath2);
+    void setBinaryMode(bool bBinary);
 
     void LoadDocsIntoEditControls();
     void LoadDocIntoEditControl(int nView, QDiffTextEdit* diffEdit);
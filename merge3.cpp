@@ -0,0 +1,365 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "merge3.h"
+#include <QFile>
+#include <QString>
+#include <QThreadPool>
+#include <QRunnable>
+
+
+class CMergeDiffTask : public QRunnable
+{
+public:
+    CMergeDiffTask(const std::vector<int>* pTokens1, const std::vector<int>* pTokens2, int nTokens, std::vector<int>* pLinks)
+        { m_pTokens1 = pTokens1; m_pTokens2 = pTokens2; m_nTokens = nTokens; m_pLinks = pLinks; }
+
+    virtual void run()
+    {
+        CMerge3::Diff(*m_pTokens1, *m_pTokens2, m_nTokens, *m_pLinks);
+    }
+
+private:
+    const std::vector<int>* m_pTokens1;
+    const std::vector<int>* m_pTokens2;
+    int m_nTokens;
+    std::vector<int>* m_pLinks;
+};
+
+
+CMerge3::CMerge3()
+{
+    m_nTokens = 0;
+    m_nChanges = 0;
+    m_nConflicts = 0;
+    for (int nFile=0; nFile<3; nFile++)
+        m_pStrEol[nFile] = "\n";
+}
+
+bool CMerge3::Load(CDiffDoc& loader, const char *pStrBase, const char *pStrOurs, const char *pStrTheirs)
+{
+    //the doc reads the files, so gzipped files and revision specs work here too
+    const char *paths[3] = { pStrBase, pStrOurs, pStrTheirs };
+    for (int nFile=0; nFile<3; nFile++) {
+        if (!loader.LoadFile(paths[nFile], m_lines[nFile]))
+            return false;
+        m_strPaths[nFile] = paths[nFile];
+        m_pStrEol[nFile] = fileEol(m_lines[nFile]);
+    }
+
+    intern();
+    m_chunks.clear();
+    return true;
+}
+
+void CMerge3::intern()
+{
+    //open addressing on the lines' hashes, with at least twice as many buckets as lines
+    size_t nLines = m_lines[fileBase].size() + m_lines[fileOurs].size() + m_lines[fileTheirs].size();
+    size_t nBuckets = 1024;
+    while (nBuckets < nLines * 2)
+        nBuckets <<= 1;
+    std::vector<int> buckets(nBuckets, -1);
+    std::vector<const CLine*> tokenLines;  //the first line with each token
+
+    for (int nFile=0; nFile<3; nFile++)
+    {
+        const line_array& lines = m_lines[nFile];
+        std::vector<int>& tokens = m_tokens[nFile];
+        tokens.resize(lines.size());
+        for (size_t nLine=0; nLine<lines.size(); nLine++)
+        {
+            const CLine& line = lines[nLine];
+            size_t nBucket = line.m_nHash & (nBuckets - 1);
+            while (buckets[nBucket] >= 0) {
+                const CLine* pTokenLine = tokenLines[buckets[nBucket]];
+                if ((pTokenLine->m_nHash == line.m_nHash) && (pTokenLine->m_nEol == line.m_nEol) && (pTokenLine->m_strLine == line.m_strLine))
+                    break;
+                nBucket = (nBucket + 1) & (nBuckets - 1);
+            }
+            if (buckets[nBucket] < 0) {
+                buckets[nBucket] = tokenLines.size();
+                tokenLines.push_back(&line);
+            }
+            tokens[nLine] = buckets[nBucket];
+        }
+    }
+
+    m_nTokens = tokenLines.size();
+}
+
+void CMerge3::Merge()
+{
+    //theirs is diffed on a worker while ours is diffed here
+    std::vector<int> linksOurs, linksTheirs;
+    QThreadPool pool;
+    pool.start(new CMergeDiffTask(&m_tokens[fileBase], &m_tokens[fileTheirs], m_nTokens, &linksTheirs));
+    Diff(m_tokens[fileBase], m_tokens[fileOurs], m_nTokens, linksOurs);
+    pool.waitForDone();
+
+    buildChunks(linksOurs, linksTheirs);
+}
+
+void CMerge3::Diff(const std::vector<int>& tokens1, const std::vector<int>& tokens2, int nTokens, std::vector<int>& links)
+{
+    links.assign(tokens1.size(), -1);
+
+    //per token counts in the gap being anchored, cleared again after each gap
+    std::vector<int> counts1(nTokens, 0), counts2(nTokens, 0), lines2(nTokens, -1);
+
+    //gaps still to be anchored, as first and end lines in each file. A stack rather than recursion,
+    //as a big file can have a gap inside a gap many times over.
+    std::vector<int> gaps;
+    gaps.push_back(0);
+    gaps.push_back(tokens1.size());
+    gaps.push_back(0);
+    gaps.push_back(tokens2.size());
+
+    std::vector<std::pair<int, int> > candidates, anchors;
+    while (!gaps.empty())
+    {
+        int nEnd2 = gaps.back(); gaps.pop_back();
+        int nFirst2 = gaps.back(); gaps.pop_back();
+        int nEnd1 = gaps.back(); gaps.pop_back();
+        int nFirst1 = gaps.back(); gaps.pop_back();
+
+        //the same lines at either end
+        while ((nFirst1 < nEnd1) && (nFirst2 < nEnd2) && (tokens1[nFirst1] == tokens2[nFirst2]))
+            links[nFirst1++] = nFirst2++;
+        while ((nFirst1 < nEnd1) && (nFirst2 < nEnd2) && (tokens1[nEnd1 - 1] == tokens2[nEnd2 - 1]))
+            links[--nEnd1] = --nEnd2;
+        if ((nFirst1 == nEnd1) || (nFirst2 == nEnd2))
+            continue;
+
+        for (int n=nFirst1; n<nEnd1; n++)
+            counts1[tokens1[n]]++;
+        for (int n=nFirst2; n<nEnd2; n++) {
+            counts2[tokens2[n]]++;
+            lines2[tokens2[n]] = n;
+        }
+        candidates.clear();
+        for (int n=nFirst1; n<nEnd1; n++)
+            if ((counts1[tokens1[n]] == 1) && (counts2[tokens1[n]] == 1))
+                candidates.push_back(std::make_pair(n, lines2[tokens1[n]]));
+        for (int n=nFirst1; n<nEnd1; n++)
+            counts1[tokens1[n]] = 0;
+        for (int n=nFirst2; n<nEnd2; n++)
+            counts2[tokens2[n]] = 0;
+
+        longestIncreasingRun(candidates, anchors);
+        if (anchors.empty()) {
+            if ((qint64)(nEnd1 - nFirst1) * (nEnd2 - nFirst2) <= MERGE_LCS_CELLS)
+                lcs(tokens1, tokens2, nFirst1, nEnd1, nFirst2, nEnd2, links);
+            continue;
+        }
+
+        //the anchors are linked, and the gaps between them anchored in turn
+        int nGapFirst1 = nFirst1, nGapFirst2 = nFirst2;
+        for (size_t n=0; n<=anchors.size(); n++)
+        {
+            int nGapEnd1 = (n < anchors.size()) ? anchors[n].first : nEnd1;
+            int nGapEnd2 = (n < anchors.size()) ? anchors[n].second : nEnd2;
+            if ((nGapFirst1 < nGapEnd1) && (nGapFirst2 < nGapEnd2)) {
+                gaps.push_back(nGapFirst1);
+                gaps.push_back(nGapEnd1);
+                gaps.push_back(nGapFirst2);
+                gaps.push_back(nGapEnd2);
+            }
+            if (n < anchors.size()) {
+                links[anchors[n].first] = anchors[n].second;
+                nGapFirst1 = anchors[n].first + 1;
+                nGapFirst2 = anchors[n].second + 1;
+            }
+        }
+    }
+}
+
+void CMerge3::lcs(const std::vector<int>& tokens1, const std::vector<int>& tokens2, int nFirst1, int nEnd1, int nFirst2, int nEnd2, std::vector<int>& links)
+{
+    //full table of a small gap, with a byte per cell for the way back
+    enum { FROM_DIAG, FROM_UP, FROM_LEFT };
+    int nLines1 = nEnd1 - nFirst1, nLines2 = nEnd2 - nFirst2;
+    std::vector<unsigned char> from((size_t)nLines1 * nLines2);
+    std::vector<int> prev(nLines2 + 1, 0), cur(nLines2 + 1, 0);
+
+    for (int i=1; i<=nLines1; i++)
+    {
+        for (int j=1; j<=nLines2; j++)
+        {
+            unsigned char& nFrom = from[(size_t)(i - 1) * nLines2 + (j - 1)];
+            if (tokens1[nFirst1 + i - 1] == tokens2[nFirst2 + j - 1]) {
+                cur[j] = prev[j - 1] + 1;
+                nFrom = FROM_DIAG;
+            }
+            else if (prev[j] >= cur[j - 1]) {
+                cur[j] = prev[j];
+                nFrom = FROM_UP;
+            }
+            else {
+                cur[j] = cur[j - 1];
+                nFrom = FROM_LEFT;
+            }
+        }
+        prev.swap(cur);
+    }
+
+    int i = nLines1, j = nLines2;
+    while ((i > 0) && (j > 0))
+    {
+        unsigned char nFrom = from[(size_t)(i - 1) * nLines2 + (j - 1)];
+        if (nFrom == FROM_DIAG) {
+            links[nFirst1 + i - 1] = nFirst2 + j - 1;
+            i--;
+            j--;
+        }
+        else if (nFrom == FROM_UP)
+            i--;
+        else
+            j--;
+    }
+}
+
+void CMerge3::buildChunks(const std::vector<int>& linksOurs, const std::vector<int>& linksTheirs)
+{
+    //Base lines linked in both diffs are the same in all three files. Between two such lines is one
+    //change, taken from whichever side made it, or a conflict if both sides changed it differently.
+    m_chunks.clear();
+    m_nChanges = m_nConflicts = 0;
+
+    int nBaseLines = m_tokens[fileBase].size(), nOursLines = m_tokens[fileOurs].size(), nTheirsLines = m_tokens[fileTheirs].size();
+    int nBase = 0, nOurs = 0, nTheirs = 0;
+    while ((nBase < nBaseLines) || (nOurs < nOursLines) || (nTheirs < nTheirsLines))
+    {
+        if ((nBase < nBaseLines) && (linksOurs[nBase] == nOurs) && (linksTheirs[nBase] == nTheirs)) {
+            addChunk(MERGE_SAME, nBase, nBase + 1, nOurs, nOurs + 1, nTheirs, nTheirs + 1);
+            nBase++;
+            nOurs++;
+            nTheirs++;
+            continue;
+        }
+
+        int nBaseEnd = nBase;
+        while ((nBaseEnd < nBaseLines) && ((linksOurs[nBaseEnd] < 0) || (linksTheirs[nBaseEnd] < 0)))
+            nBaseEnd++;
+        int nOursEnd = (nBaseEnd < nBaseLines) ? linksOurs[nBaseEnd] : nOursLines;
+        int nTheirsEnd = (nBaseEnd < nBaseLines) ? linksTheirs[nBaseEnd] : nTheirsLines;
+
+        int nState;
+        if (sameTokens(fileBase, nBase, nBaseEnd, fileOurs, nOurs, nOursEnd))
+            nState = MERGE_THEIRS;
+        else if (sameTokens(fileBase, nBase, nBaseEnd, fileTheirs, nTheirs, nTheirsEnd))
+            nState = MERGE_OURS;
+        else if (sameTokens(fileOurs, nOurs, nOursEnd, fileTheirs, nTheirs, nTheirsEnd))
+            nState = MERGE_BOTH;
+        else
+            nState = MERGE_CONFLICT;
+        addChunk(nState, nBase, nBaseEnd, nOurs, nOursEnd, nTheirs, nTheirsEnd);
+
+        nBase = nBaseEnd;
+        nOurs = nOursEnd;
+        nTheirs = nTheirsEnd;
+    }
+}
+
+void CMerge3::addChunk(int nState, int nBase, int nBaseEnd, int nOurs, int nOursEnd, int nTheirs, int nTheirsEnd)
+{
+    //runs of same lines make one chunk
+    if ((nState == MERGE_SAME) && !m_chunks.empty() && (m_chunks.back().m_nState == MERGE_SAME)) {
+        CMergeChunk& chunk = m_chunks.back();
+        chunk.m_nCount[fileBase] += nBaseEnd - nBase;
+        chunk.m_nCount[fileOurs] += nOursEnd - nOurs;
+        chunk.m_nCount[fileTheirs] += nTheirsEnd - nTheirs;
+        return;
+    }
+
+    CMergeChunk chunk;
+    chunk.m_nState = nState;
+    chunk.m_nFirst[fileBase] = nBase;
+    chunk.m_nFirst[fileOurs] = nOurs;
+    chunk.m_nFirst[fileTheirs] = nTheirs;
+    chunk.m_nCount[fileBase] = nBaseEnd - nBase;
+    chunk.m_nCount[fileOurs] = nOursEnd - nOurs;
+    chunk.m_nCount[fileTheirs] = nTheirsEnd - nTheirs;
+    m_chunks.push_back(chunk);
+
+    if (nState == MERGE_CONFLICT)
+        m_nConflicts++;
+    else if (nState != MERGE_SAME)
+        m_nChanges++;
+}
+
+bool CMerge3::sameTokens(File file1, int nFirst1, int nEnd1, File file2, int nFirst2, int nEnd2) const
+{
+    if ((nEnd1 - nFirst1) != (nEnd2 - nFirst2))
+        return false;
+    for (int n=0; n<nEnd1-nFirst1; n++)
+        if (m_tokens[file1][nFirst1 + n] != m_tokens[file2][nFirst2 + n])
+            return false;
+    return true;
+}
+
+void CMerge3::appendLines(QByteArray& buf, const line_array& lines, int nFirst, int nCount, const char *pStrEolNone)
+{
+    //pStrEolNone ends a last line that had no newline, for one a conflict marker follows
+    for (int nLine=nFirst; nLine<nFirst+nCount; nLine++) {
+        buf.append(lines[nLine].m_strLine.c_str(), lines[nLine].m_strLine.size());
+        if (lines[nLine].m_nEol == EOL_CRLF)
+            buf.append("\r\n");
+        else if (lines[nLine].m_nEol == EOL_NONE)
+            buf.append(pStrEolNone);
+        else
+            buf.append('\n');
+    }
+}
+
+const char* CMerge3::fileEol(const line_array& lines)
+{
+    //taken from the first line, as a file's lines mostly end the same way
+    return (!lines.empty() && (lines[0].m_nEol == EOL_CRLF)) ? "\r\n" : "\n";
+}
+
+bool CMerge3::Write(const char *pStrPath) const
+{
+    QFile file(QString::fromLocal8Bit(pStrPath));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QByteArray buf;
+    buf.reserve(MERGE_WRITE_BUFFER + 4096);
+    for (size_t nChunk=0; nChunk<m_chunks.size(); nChunk++)
+    {
+        const CMergeChunk& chunk = m_chunks[nChunk];
+        if (chunk.m_nState == MERGE_CONFLICT) {
+            //git's diff3 conflict style, so merge tools and editors pick the markers up
+            buf.append("<<<<<<< ").append(m_strPaths[fileOurs].c_str()).append(m_pStrEol[fileOurs]);
+            appendLines(buf, m_lines[fileOurs], chunk.m_nFirst[fileOurs], chunk.m_nCount[fileOurs], m_pStrEol[fileOurs]);
+            buf.append("||||||| ").append(m_strPaths[fileBase].c_str()).append(m_pStrEol[fileBase]);
+            appendLines(buf, m_lines[fileBase], chunk.m_nFirst[fileBase], chunk.m_nCount[fileBase], m_pStrEol[fileBase]);
+            buf.append("=======").append(m_pStrEol[fileTheirs]);
+            appendLines(buf, m_lines[fileTheirs], chunk.m_nFirst[fileTheirs], chunk.m_nCount[fileTheirs], m_pStrEol[fileTheirs]);
+            buf.append(">>>>>>> ").append(m_strPaths[fileTheirs].c_str()).append(m_pStrEol[fileTheirs]);
+        }
+        else {
+            File file = (chunk.m_nState == MERGE_THEIRS) ? fileTheirs : fileOurs;
+            appendLines(buf, m_lines[file], chunk.m_nFirst[file], chunk.m_nCount[file], "");
+        }
+
+        if (buf.size() >= MERGE_WRITE_BUFFER) {
+            if (file.write(buf) != buf.size())
+                return false;
+            buf.clear();
+        }
+    }
+
+    return file.write(buf) == buf.size();
+}
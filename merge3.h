@@ -0,0 +1,91 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef MERGE3_H
+#define MERGE3_H
+
+#include <QByteArray>
+#include <string>
+#include <vector>
+#include "diffdoc.h"
+
+
+//CMergeChunk states
+#define MERGE_SAME          0   //unchanged on both sides
+#define MERGE_OURS          1   //changed in ours only, so ours is taken
+#define MERGE_THEIRS        2   //changed in theirs only, so theirs is taken
+#define MERGE_BOTH          3   //the same change on both sides
+#define MERGE_CONFLICT      4   //different changes on each side, written between conflict markers
+
+#define MERGE_LCS_CELLS     4000000    //gaps without unique lines are aligned by a full LCS up to this size
+#define MERGE_WRITE_BUFFER  (1 << 20)
+
+
+class CMergeChunk
+{
+public:
+    int m_nState;
+    int m_nFirst[3];  //first line in the base, ours and theirs, indexed by CMerge3::File
+    int m_nCount[3];
+};
+
+
+//Merges the changes made in two files since their common base, like diff3. Each file is loaded once,
+//and every distinct line is given a token shared by all three, so the diffs of ours and theirs against
+//the base compare integers and run in parallel. The diffs are patience diffs: lines unique to both sides
+//anchor each gap, and gaps without any are aligned by an LCS if they are small enough.
+//
+//The merge is a list of chunks, each either the same in all three files or one change between two
+//base lines that are the same in all three. Write() streams the merged file out chunk by chunk, with
+//each line's own ending, so a CRLF file merges to a CRLF file.
+
+class CMerge3
+{
+public:
+    enum File { fileBase, fileOurs, fileTheirs };
+
+    CMerge3();
+
+    bool Load(CDiffDoc& loader, const char *pStrBase, const char *pStrOurs, const char *pStrTheirs);
+    void Merge();
+    bool Write(const char *pStrPath) const;  //conflicts between markers labelled with the loaded paths, e.g. to the loader's GetMergePath()
+
+    const std::vector<CMergeChunk>& GetChunks() const { return m_chunks; }
+    const line_array& GetLines(File file) const { return m_lines[file]; }
+    int GetTokenCount() const { return m_nTokens; }
+    int GetChangeCount() const { return m_nChanges; }  //chunks merged without a conflict
+    int GetConflictCount() const { return m_nConflicts; }
+
+    //Links each line of tokens1 to the line of tokens2 it matches, or -1. Safe to call from any thread.
+    static void Diff(const std::vector<int>& tokens1, const std::vector<int>& tokens2, int nTokens, std::vector<int>& links);
+
+private:
+    void intern();
+    void buildChunks(const std::vector<int>& linksOurs, const std::vector<int>& linksTheirs);
+    void addChunk(int nState, int nBase, int nBaseEnd, int nOurs, int nOursEnd, int nTheirs, int nTheirsEnd);
+    bool sameTokens(File file1, int nFirst1, int nEnd1, File file2, int nFirst2, int nEnd2) const;
+    static void lcs(const std::vector<int>& tokens1, const std::vector<int>& tokens2, int nFirst1, int nEnd1, int nFirst2, int nEnd2, std::vector<int>& links);
+    static void appendLines(QByteArray& buf, const line_array& lines, int nFirst, int nCount, const char *pStrEolNone);
+    static const char* fileEol(const line_array& lines);
+
+    std::string m_strPaths[3];
+    line_array m_lines[3];
+    const char *m_pStrEol[3];  //each file's line ending, for the conflict markers
+    std::vector<int> m_tokens[3];
+    int m_nTokens;
+    std::vector<CMergeChunk> m_chunks;
+    int m_nChanges;
+    int m_nConflicts;
+};
+
+#endif // MERGE3_H
@@ -0,0 +1,325 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "movedetector.h"
+#include <QFile>
+#include <map>
+#include <algorithm>
+#include <string.h>
+
+
+#define MINHASH_BANDS           16      //MINHASH_COUNT is split into this many bands for bucketing
+#define MINHASH_ROWS            (MINHASH_COUNT / MINHASH_BANDS)
+#define MINHASH_MAX_BUCKET      64      //bands shared by more files than this (e.g. common headers) don't suggest pairs
+#define MOVE_MIN_SIMILARITY     16      //out of MINHASH_COUNT, i.e. about half the distinct lines in common
+#define MOVE_MAX_SIMILAR_SIZE   (16 << 20)  //larger files are only paired if they are exactly the same
+#define MOVE_SIZE_RATIO         2       //files whose sizes differ by more than this factor are never paired
+
+
+struct CScoredPair
+{
+    int m_nScore;  //matching signature values, times two, plus one if the filename is the same
+    int m_nLeft;
+    int m_nRight;
+    bool operator<(const CScoredPair& other) const { return m_nScore > other.m_nScore; }  //best first
+};
+
+static quint64 mix64(quint64 n)
+{
+    //splitmix64 finalizer
+    n ^= n >> 30;
+    n *= 0xbf58476d1ce4e5b9ULL;
+    n ^= n >> 27;
+    n *= 0x94d049bb133111ebULL;
+    n ^= n >> 31;
+    return n;
+}
+
+static const quint64* getSeeds()
+{
+    static quint64 seeds[MINHASH_COUNT];
+    static bool bInit = false;
+    if (!bInit) {
+        for (int n=0; n<MINHASH_COUNT; n++)
+            seeds[n] = mix64(0x9e3779b97f4a7c15ULL * (n + 1));
+        bInit = true;
+    }
+    return seeds;
+}
+
+static bool isSizeCompatible(qint64 nSize1, qint64 nSize2)
+{
+    return (nSize1 <= nSize2 * MOVE_SIZE_RATIO) && (nSize2 <= nSize1 * MOVE_SIZE_RATIO);
+}
+
+//true if any of the sorted sizes is compatible with nSize
+static bool hasCompatibleSize(const std::vector<qint64>& sizes, qint64 nSize)
+{
+    std::vector<qint64>::const_iterator it = std::lower_bound(sizes.begin(), sizes.end(), (nSize + MOVE_SIZE_RATIO - 1) / MOVE_SIZE_RATIO);
+    return (it != sizes.end()) && isSizeCompatible(*it, nSize);
+}
+
+
+std::string CMoveCandidate::getFilename() const
+{
+    size_t nSlash = m_strRelativePath.rfind('/');
+    return (nSlash == std::string::npos) ? m_strRelativePath : m_strRelativePath.substr(nSlash + 1);
+}
+
+
+CMoveDetector::CMoveDetector(CHashCache* pHashCache)
+{
+    m_pHashCache = pHashCache;
+}
+
+void CMoveDetector::Add(const CMoveCandidate& candidate, bool bLeft)
+{
+    if (bLeft)
+        m_left.push_back(candidate);
+    else
+        m_right.push_back(candidate);
+}
+
+void CMoveDetector::Clear()
+{
+    m_left.clear();
+    m_right.clear();
+    m_leftMatched.clear();
+    m_rightMatched.clear();
+    m_moves.clear();
+}
+
+void CMoveDetector::Detect()
+{
+    m_leftMatched.assign(m_left.size(), false);
+    m_rightMatched.assign(m_right.size(), false);
+    m_moves.clear();
+
+    if (m_left.empty() || m_right.empty())
+        return;
+
+    detectExact();
+    detectSimilar();
+}
+
+void CMoveDetector::addMove(int nLeft, int nRight, bool bExact)
+{
+    CMove move;
+    move.m_nLeft = nLeft;
+    move.m_nRight = nRight;
+    move.m_bExact = bExact;
+    m_moves.push_back(move);
+
+    m_leftMatched[nLeft] = true;
+    m_rightMatched[nRight] = true;
+}
+
+void CMoveDetector::detectExact()
+{
+    //only sizes found on both sides can hold an exact move, so everything else is never read.
+    //Empty files are left alone, as they would all pair up with each other.
+    std::map<qint64, std::vector<int> > leftBySize, rightBySize;
+    for (size_t n=0; n<m_left.size(); n++)
+        if (m_left[n].m_nSize > 0)
+            leftBySize[m_left[n].m_nSize].push_back(n);
+    for (size_t n=0; n<m_right.size(); n++)
+        if (m_right[n].m_nSize > 0)
+            rightBySize[m_right[n].m_nSize].push_back(n);
+
+    std::map<qint64, std::vector<int> >::iterator itLeft = leftBySize.begin();
+    for ( ; itLeft != leftBySize.end(); ++itLeft)
+    {
+        std::map<qint64, std::vector<int> >::iterator itRight = rightBySize.find(itLeft->first);
+        if (itRight == rightBySize.end())
+            continue;
+
+        std::map<std::string, std::vector<int> > rightByHash;
+        const std::vector<int>& rights = itRight->second;
+        for (size_t n=0; n<rights.size(); n++) {
+            QByteArray hash;
+            if (getHash(m_right[rights[n]], hash))
+                rightByHash[std::string(hash.constData(), hash.size())].push_back(rights[n]);
+        }
+        if (rightByHash.empty())
+            continue;
+
+        const std::vector<int>& lefts = itLeft->second;
+        for (size_t n=0; n<lefts.size(); n++) {
+            QByteArray hash;
+            if (!getHash(m_left[lefts[n]], hash))
+                continue;
+            std::map<std::string, std::vector<int> >::iterator itHash = rightByHash.find(std::string(hash.constData(), hash.size()));
+            if (itHash == rightByHash.end())
+                continue;
+
+            //when there are several copies, prefer the one that kept its name
+            std::string strFilename = m_left[lefts[n]].getFilename();
+            int nBest = -1;
+            for (size_t i=0; i<itHash->second.size(); i++) {
+                int nRight = itHash->second[i];
+                if (m_rightMatched[nRight])
+                    continue;
+                if (nBest < 0)
+                    nBest = nRight;
+                if (m_right[nRight].getFilename() == strFilename) {
+                    nBest = nRight;
+                    break;
+                }
+            }
+            if (nBest >= 0)
+                addMove(lefts[n], nBest, true);
+        }
+    }
+}
+
+void CMoveDetector::detectSimilar()
+{
+    //Only files with a partner of roughly the same size on the other side are fingerprinted.
+    //Manifests only hold whole file hashes, so their entries can only be exact moves.
+    std::vector<qint64> leftSizes, rightSizes;
+    for (size_t n=0; n<m_left.size(); n++)
+        if (!m_leftMatched[n] && !m_left[n].m_pEntry && (m_left[n].m_nSize > 0) && (m_left[n].m_nSize <= MOVE_MAX_SIMILAR_SIZE))
+            leftSizes.push_back(m_left[n].m_nSize);
+    for (size_t n=0; n<m_right.size(); n++)
+        if (!m_rightMatched[n] && !m_right[n].m_pEntry && (m_right[n].m_nSize > 0) && (m_right[n].m_nSize <= MOVE_MAX_SIMILAR_SIZE))
+            rightSizes.push_back(m_right[n].m_nSize);
+    if (leftSizes.empty() || rightSizes.empty())
+        return;
+    std::sort(leftSizes.begin(), leftSizes.end());
+    std::sort(rightSizes.begin(), rightSizes.end());
+
+    //right side signatures, bucketed by band
+    std::vector<std::vector<quint64> > rightSignatures(m_right.size());
+    std::map<quint64, std::vector<int> > bands[MINHASH_BANDS];
+    for (size_t n=0; n<m_right.size(); n++)
+    {
+        const CMoveCandidate& right = m_right[n];
+        if (m_rightMatched[n] || right.m_pEntry || (right.m_nSize <= 0) || (right.m_nSize > MOVE_MAX_SIMILAR_SIZE))
+            continue;
+        if (!hasCompatibleSize(leftSizes, right.m_nSize))
+            continue;
+        if (!getSignature(right, rightSignatures[n]))
+            continue;
+        for (int nBand=0; nBand<MINHASH_BANDS; nBand++) {
+            quint64 nKey = 0;
+            for (int nRow=0; nRow<MINHASH_ROWS; nRow++)
+                nKey = mix64(nKey ^ rightSignatures[n][nBand * MINHASH_ROWS + nRow]);
+            bands[nBand][nKey].push_back(n);
+        }
+    }
+
+    //score every left file against the right files it shares a band with
+    std::vector<CScoredPair> pairs;
+    std::vector<quint64> signature;
+    std::vector<int> candidates;
+    for (size_t n=0; n<m_left.size(); n++)
+    {
+        const CMoveCandidate& left = m_left[n];
+        if (m_leftMatched[n] || left.m_pEntry || (left.m_nSize <= 0) || (left.m_nSize > MOVE_MAX_SIMILAR_SIZE))
+            continue;
+        if (!hasCompatibleSize(rightSizes, left.m_nSize))
+            continue;
+        if (!getSignature(left, signature))
+            continue;
+
+        candidates.clear();
+        for (int nBand=0; nBand<MINHASH_BANDS; nBand++) {
+            quint64 nKey = 0;
+            for (int nRow=0; nRow<MINHASH_ROWS; nRow++)
+                nKey = mix64(nKey ^ signature[nBand * MINHASH_ROWS + nRow]);
+            std::map<quint64, std::vector<int> >::iterator itBucket = bands[nBand].find(nKey);
+            if ((itBucket != bands[nBand].end()) && (itBucket->second.size() <= MINHASH_MAX_BUCKET))
+                candidates.insert(candidates.end(), itBucket->second.begin(), itBucket->second.end());
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        std::string strFilename = left.getFilename();
+        for (size_t i=0; i<candidates.size(); i++) {
+            int nRight = candidates[i];
+            if (!isSizeCompatible(left.m_nSize, m_right[nRight].m_nSize))
+                continue;
+            const std::vector<quint64>& rightSignature = rightSignatures[nRight];
+            int nSame = 0;
+            for (int nHash=0; nHash<MINHASH_COUNT; nHash++)
+                if (signature[nHash] == rightSignature[nHash])
+                    nSame++;
+            if (nSame < MOVE_MIN_SIMILARITY)
+                continue;
+
+            CScoredPair pair;
+            pair.m_nScore = nSame * 2 + ((m_right[nRight].getFilename() == strFilename) ? 1 : 0);
+            pair.m_nLeft = n;
+            pair.m_nRight = nRight;
+            pairs.push_back(pair);
+        }
+    }
+
+    //most similar pairs first, each file used once
+    std::stable_sort(pairs.begin(), pairs.end());
+    for (size_t n=0; n<pairs.size(); n++)
+        if (!m_leftMatched[pairs[n].m_nLeft] && !m_rightMatched[pairs[n].m_nRight])
+            addMove(pairs[n].m_nLeft, pairs[n].m_nRight, false);
+}
+
+bool CMoveDetector::getHash(const CMoveCandidate& candidate, QByteArray& hash)
+{
+    if (candidate.m_pEntry) {
+        hash = candidate.m_pEntry->m_hash;
+        return true;
+    }
+    return m_pHashCache->GetFileHash(candidate.m_strPath, candidate.m_nSize, candidate.m_nModified, hash);
+}
+
+bool CMoveDetector::getSignature(const CMoveCandidate& candidate, std::vector<quint64>& signature)
+{
+    //MinHash over the set of lines: each signature value is the smallest of one hash function over all
+    //the lines, so the fraction of values two files share estimates the fraction of lines they share.
+    //Line endings are ignored so that a file converted between CRLF and LF still pairs up.
+    QFile file(QString::fromLocal8Bit(candidate.m_strPath.c_str()));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+
+    const quint64* pSeeds = getSeeds();
+    signature.assign(MINHASH_COUNT, ~0ULL);
+    bool bAnyLines = false;
+
+    const char *p = data.constData();
+    const char *pEnd = p + data.size();
+    while (p < pEnd)
+    {
+        const char *pLineEnd = (const char *)memchr(p, '\n', pEnd - p);
+        if (!pLineEnd)
+            pLineEnd = pEnd;
+        const char *pNext = (pLineEnd < pEnd) ? pLineEnd + 1 : pEnd;
+        if ((pLineEnd > p) && (pLineEnd[-1] == '\r'))
+            pLineEnd--;
+
+        if (pLineEnd > p) {  //blank lines say nothing about where a file came from
+            quint64 nLine = 0xcbf29ce484222325ULL;  //FNV-1a
+            for (const char *pc = p; pc < pLineEnd; pc++)
+                nLine = (nLine ^ (unsigned char)*pc) * 0x100000001b3ULL;
+
+            for (int n=0; n<MINHASH_COUNT; n++) {
+                quint64 nValue = mix64(nLine ^ pSeeds[n]);
+                if (nValue < signature[n])
+                    signature[n] = nValue;
+            }
+            bAnyLines = true;
+        }
+        p = pNext;
+    }
+
+    return bAnyLines;
+}
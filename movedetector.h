@@ -0,0 +1,85 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef MOVEDETECTOR_H
+#define MOVEDETECTOR_H
+
+#include <QByteArray>
+#include <string>
+#include <vector>
+#include "treemanifest.h"
+
+
+#define MINHASH_COUNT   32  //values in a similarity signature
+
+class CMoveCandidate
+{
+public:
+    std::string m_strPath;          //full path, empty if from a manifest
+    std::string m_strRelativePath;
+    qint64 m_nSize;
+    qint64 m_nModified;
+    const CManifestEntry* m_pEntry;  //NULL unless from a manifest
+
+    std::string getFilename() const;
+};
+
+class CMove
+{
+public:
+    int m_nLeft;     //index into GetLeft()
+    int m_nRight;    //index into GetRight()
+    bool m_bExact;   //same contents, otherwise similar
+};
+
+
+//Pairs up files that are only in folder1 with files that are only in folder2, so that moved and
+//renamed files can be reported as such instead of as two unrelated files.
+//
+//Files are bucketed by size, and only files with a same size partner are hashed to find exact moves.
+//The rest are paired by similarity: each file gets a MinHash signature of its lines, and signatures
+//are bucketed in bands so that only likely pairs are scored. Files of very different sizes are never read.
+
+class CMoveDetector
+{
+public:
+    CMoveDetector(CHashCache* pHashCache);
+
+    void Add(const CMoveCandidate& candidate, bool bLeft);
+    bool IsEmpty() { return m_left.empty() && m_right.empty(); }
+    void Clear();
+
+    void Detect();
+
+    const std::vector<CMoveCandidate>& GetLeft() { return m_left; }
+    const std::vector<CMoveCandidate>& GetRight() { return m_right; }
+    const std::vector<CMove>& GetMoves() { return m_moves; }
+    bool IsLeftMoved(int n) { return (n < (int)m_leftMatched.size()) && m_leftMatched[n]; }  //false if Detect() wasn't called
+    bool IsRightMoved(int n) { return (n < (int)m_rightMatched.size()) && m_rightMatched[n]; }
+
+private:
+    void detectExact();
+    void detectSimilar();
+    bool getHash(const CMoveCandidate& candidate, QByteArray& hash);
+    bool getSignature(const CMoveCandidate& candidate, std::vector<quint64>& signature);
+    void addMove(int nLeft, int nRight, bool bExact);
+
+    CHashCache* m_pHashCache;
+    std::vector<CMoveCandidate> m_left;
+    std::vector<CMoveCandidate> m_right;
+    std::vector<char> m_leftMatched;
+    std::vector<char> m_rightMatched;
+    std::vector<CMove> m_moves;
+};
+
+#endif // MOVEDETECTOR_H
@@ -0,0 +1,214 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "patchwriter.h"
+#include <QFile>
+#include <QString>
+#include <stdio.h>
+#include <string.h>
+
+
+CPatchWriter::CPatchWriter(CDiffDoc* pDoc, int nContext)
+{
+    m_pDoc = pDoc;
+    m_nContext = qMax(nContext, 0);
+    m_format = formatUnified;
+    m_nHunks = 0;
+}
+
+bool CPatchWriter::Write(const char *pStrPath, const char *pStrLabel1, const char *pStrLabel2)
+{
+    findChanges();
+    m_nHunks = 0;
+
+    QFile file;
+    bool bOpen;
+    if (strcmp(pStrPath, "-") == 0)
+        bOpen = file.open(stdout, QIODevice::WriteOnly);
+    else {
+        file.setFileName(QString::fromLocal8Bit(pStrPath));
+        bOpen = file.open(QIODevice::WriteOnly);
+    }
+    if (!bOpen)
+        return false;
+    if (m_changes.empty())
+        return true;
+
+    QByteArray buf;
+    buf.reserve(PATCH_WRITE_BUFFER + 4096);
+    if (m_format == formatUnified) {
+        buf.append("--- ").append(pStrLabel1).append('\n');
+        buf.append("+++ ").append(pStrLabel2).append('\n');
+    }
+
+    //changes closer together than twice the context share a hunk. The normal format has no context.
+    size_t nChange = 0;
+    while (nChange < m_changes.size())
+    {
+        size_t nEndChange = nChange + 1;
+        if (m_format == formatNormal) {
+            writeNormalChange(buf, m_changes[nChange]);
+            m_nHunks++;
+        }
+        else {
+            while ((nEndChange < m_changes.size()) && (m_changes[nEndChange].m_nFirst1 - m_changes[nEndChange - 1].m_nEnd1 <= 2 * m_nContext))
+                nEndChange++;
+            writeHunk(buf, nChange, nEndChange);
+        }
+        nChange = nEndChange;
+
+        if (buf.size() >= PATCH_WRITE_BUFFER) {
+            if (file.write(buf) != buf.size())
+                return false;
+            buf.clear();
+        }
+    }
+
+    return (file.write(buf) == buf.size()) && file.flush();
+}
+
+void CPatchWriter::findChanges()
+{
+    //Walks both files together. A line goes in a change unless it is linked to the other file's
+    //current line with the same text. Links never cross after a compare, but a crossing link would
+    //only make a bigger change, never a wrong patch.
+    m_changes.clear();
+    const line_array& lines1 = m_pDoc->GetLines(VIEW_LEFT);
+    const line_array& lines2 = m_pDoc->GetLines(VIEW_RIGHT);
+    int nLines1 = lines1.size(), nLines2 = lines2.size();
+
+    CChange change;
+    bool bInChange = false;
+    int n1 = 0, n2 = 0;
+    while ((n1 < nLines1) || (n2 < nLines2))
+    {
+        int nLink1 = (n1 < nLines1) ? lines1[n1].m_nLink : -1;
+        if ((n1 < nLines1) && (nLink1 == n2) && (lines1[n1].m_strLine == lines2[n2].m_strLine) && (lines1[n1].m_nEol == lines2[n2].m_nEol)) {
+            if (bInChange) {
+                change.m_nEnd1 = n1;
+                change.m_nEnd2 = n2;
+                m_changes.push_back(change);
+                bInChange = false;
+            }
+            n1++;
+            n2++;
+            continue;
+        }
+
+        if (!bInChange) {
+            change.m_nFirst1 = n1;
+            change.m_nFirst2 = n2;
+            bInChange = true;
+        }
+        if ((n1 < nLines1) && (nLink1 == n2)) {
+            n1++;  //matched through the line filter
+            n2++;
+        }
+        else if ((n1 < nLines1) && (nLink1 < n2))
+            n1++;
+        else if ((n2 < nLines2) && (lines2[n2].m_nLink < n1))
+            n2++;
+        else
+            n1++;
+    }
+
+    if (bInChange) {
+        change.m_nEnd1 = nLines1;
+        change.m_nEnd2 = nLines2;
+        m_changes.push_back(change);
+    }
+}
+
+void CPatchWriter::writeHunk(QByteArray& buf, size_t nFirstChange, size_t nEndChange)
+{
+    const line_array& lines1 = m_pDoc->GetLines(VIEW_LEFT);
+    const line_array& lines2 = m_pDoc->GetLines(VIEW_RIGHT);
+    const CChange& first = m_changes[nFirstChange];
+    const CChange& last = m_changes[nEndChange - 1];
+
+    //the lines either side of a change are the same in both files
+    int nBefore = qMin(m_nContext, qMin(first.m_nFirst1, first.m_nFirst2));
+    int nAfter = qMin(m_nContext, qMin((int)lines1.size() - last.m_nEnd1, (int)lines2.size() - last.m_nEnd2));
+    int nFirst1 = first.m_nFirst1 - nBefore, nEnd1 = last.m_nEnd1 + nAfter;
+    int nFirst2 = first.m_nFirst2 - nBefore, nEnd2 = last.m_nEnd2 + nAfter;
+
+    buf.append("@@ -");
+    appendRange(buf, nFirst1, nEnd1 - nFirst1);
+    buf.append(" +");
+    appendRange(buf, nFirst2, nEnd2 - nFirst2);
+    buf.append(" @@\n");
+
+    int nLine1 = nFirst1;
+    for (size_t nChange=nFirstChange; nChange<nEndChange; nChange++) {
+        const CChange& change = m_changes[nChange];
+        appendLines(buf, ' ', lines1, nLine1, change.m_nFirst1);
+        appendLines(buf, '-', lines1, change.m_nFirst1, change.m_nEnd1);
+        appendLines(buf, '+', lines2, change.m_nFirst2, change.m_nEnd2);
+        nLine1 = change.m_nEnd1;
+    }
+    appendLines(buf, ' ', lines1, nLine1, nEnd1);
+
+    m_nHunks++;
+}
+
+void CPatchWriter::writeNormalChange(QByteArray& buf, const CChange& change)
+{
+    //e.g. "3,4c3", "7a8,9" or "12d11", where a or d give the line before on the side with none
+    const line_array& lines1 = m_pDoc->GetLines(VIEW_LEFT);
+    const line_array& lines2 = m_pDoc->GetLines(VIEW_RIGHT);
+    bool bLeft = (change.m_nEnd1 > change.m_nFirst1);
+    bool bRight = (change.m_nEnd2 > change.m_nFirst2);
+
+    appendNormalRange(buf, change.m_nFirst1, change.m_nEnd1);
+    buf.append(!bLeft ? 'a' : (!bRight ? 'd' : 'c'));
+    appendNormalRange(buf, change.m_nFirst2, change.m_nEnd2);
+    buf.append('\n');
+
+    appendLines(buf, '<', lines1, change.m_nFirst1, change.m_nEnd1, true);
+    if (bLeft && bRight)
+        buf.append("---\n");
+    appendLines(buf, '>', lines2, change.m_nFirst2, change.m_nEnd2, true);
+}
+
+void CPatchWriter::appendLines(QByteArray& buf, char cPrefix, const line_array& lines, int nFirst, int nEnd, bool bSpace)
+{
+    for (int nLine=nFirst; nLine<nEnd; nLine++) {
+        buf.append(cPrefix);
+        if (bSpace)
+            buf.append(' ');
+        buf.append(lines[nLine].m_strLine.c_str(), lines[nLine].m_strLine.size());
+        if (lines[nLine].m_nEol == EOL_CRLF)
+            buf.append("\r\n");
+        else if (lines[nLine].m_nEol == EOL_NONE)
+            buf.append("\n\\ No newline at end of file\n");
+        else
+            buf.append('\n');
+    }
+}
+
+void CPatchWriter::appendRange(QByteArray& buf, int nFirst, int nCount)
+{
+    //as GNU diff: the count is left out when it is 1, and an empty range starts at the line before it
+    buf.append(QByteArray::number((nCount == 0) ? nFirst : nFirst + 1));
+    if (nCount != 1)
+        buf.append(',').append(QByteArray::number(nCount));
+}
+
+void CPatchWriter::appendNormalRange(QByteArray& buf, int nFirst, int nEnd)
+{
+    //an empty range is the line before it, and a range of one line is just that line
+    if (nEnd - nFirst <= 1)
+        buf.append(QByteArray::number((nEnd == nFirst) ? nFirst : nEnd));
+    else
+        buf.append(QByteArray::number(nFirst + 1)).append(',').append(QByteArray::number(nEnd));
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef PATCHWRITER_H
+#define PATCHWRITER_H
+
+#include <QByteArray>
+#include <vector>
+#include "diffdoc.h"
+
+
+#define PATCH_DEFAULT_CONTEXT   3
+#define PATCH_WRITE_BUFFER      (1 << 20)
+
+
+//Writes a compared doc as a unified diff, or in diff(1)'s normal format. The changes are read off the line links the compare left,
+//so the patch has the changes the views show rather than however GNU diff would align the files.
+//Lines matched only through the line filter differ in their text, so the patch has them as changes, as do lines
+//whose line ends differ. A line's \r\n, or its lack of a newline at the end of the file, is kept as GNU diff keeps it.
+//
+//Lines go straight from the doc's line store into a buffer that is written out a MB at a time.
+
+class CPatchWriter
+{
+public:
+    enum Format { formatUnified, formatNormal };
+
+    CPatchWriter(CDiffDoc* pDoc, int nContext = PATCH_DEFAULT_CONTEXT);
+    void SetFormat(Format format) { m_format = format; }
+
+    bool Write(const char *pStrPath, const char *pStrLabel1, const char *pStrLabel2);  //"-" for stdout. Nothing is written if the files are the same.
+    int GetHunkCount() const { return m_nHunks; }
+    int GetChangeCount() const { return m_changes.size(); }
+
+private:
+    class CChange
+    {
+    public:
+        int m_nFirst1, m_nEnd1;
+        int m_nFirst2, m_nEnd2;
+    };
+
+    void findChanges();
+    void writeHunk(QByteArray& buf, size_t nFirstChange, size_t nEndChange);
+    void writeNormalChange(QByteArray& buf, const CChange& change);
+    static void appendLines(QByteArray& buf, char cPrefix, const line_array& lines, int nFirst, int nEnd, bool bSpace = false);
+    static void appendRange(QByteArray& buf, int nFirst, int nCount);
+    static void appendNormalRange(QByteArray& buf, int nFirst, int nEnd);
+
+    CDiffDoc* m_pDoc;
+    int m_nContext;
+    Format m_format;
+    std::vector<CChange> m_changes;
+    int m_nHunks;
+};
+
+#endif // PATCHWRITER_H
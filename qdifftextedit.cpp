@@ -15,6 +15,7 @@
 #include <QPainter>
 #include <QDebug>
 #include <QScrollBar>
+#include <QMouseEvent>
 #include <math.h>
 #include "mainwindow.h"
 #include <QApplication>
@@ -104,6 +105,23 @@ void QDiffTextEdit::paintEvent(QPaintEvent *_event)
 
 }
 
+void QDiffTextEdit::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    QTextEdit::mouseDoubleClickEvent(event);
+
+    //double clicking a moved block shows its other end in the other view
+    if (m_pDiffDoc == NULL)
+        return;
+    int nSection = getSectionAt(cursorForPosition(event->pos()).blockNumber());
+    section_list& secs = m_pDiffDoc->GetSecs(m_nView);
+    if ((nSection < 0) || !(secs[nSection].m_nState & STATE_MOVED) || (secs[nSection].m_nMoveLink < 0))
+        return;
+
+    section_list& otherSecs = m_pDiffDoc->GetSecs(OTHERVIEW(m_nView));
+    QDiffTextEdit* viewOther = qobject_cast<MainWindow*>(window())->getDiffEdit(OTHERVIEW(m_nView));
+    viewOther->scrollToLine(otherSecs[secs[nSection].m_nMoveLink].m_nFirstLine);
+}
+
 int QDiffTextEdit::getSectionAt(int nLine)
 {
     section_list& secs = m_pDiffDoc->GetSecs(m_nView);
@@ -166,7 +184,7 @@ void QDiffTextEdit::onVScroll(int n)
     int nOtherY = (nMidLineOther*m_nLineHeight) - (nWndSizeY/2) + nOffset;
 
     //Get other editCtrl and setScrollPosition on it.
-    QDiffTextEdit* viewOther = MainWindow::getInstance()->getDiffEdit(OTHERVIEW(m_nView));
+    QDiffTextEdit* viewOther = qobject_cast<MainWindow*>(window())->getDiffEdit(OTHERVIEW(m_nView));
     qDebug() << "set other scroll to: " << nOtherY << " otherView: " << OTHERVIEW(m_nView);
     viewOther->verticalScrollBar()->setValue(nOtherY);
 }
@@ -42,6 +42,7 @@ private slots:
 
 protected:
     virtual void paintEvent(QPaintEvent *_event);
+    virtual void mouseDoubleClickEvent(QMouseEvent *event);
 
     void setTextAttributes();
 
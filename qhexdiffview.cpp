@@ -0,0 +1,167 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "qhexdiffview.h"
+#include <QPainter>
+#include <QScrollBar>
+#include <QFontMetrics>
+#include "mainwindow.h"
+#include <limits.h>
+
+
+#define OTHERVIEW(n) ((!(n-1))+1)
+
+
+const std::string QHexDiffView::DEFAULT_FONT_NAME = "Monospace";
+const int QHexDiffView::DEFAULT_FONT_SIZE = 8;
+
+QHexDiffView::QHexDiffView(QWidget *parent) :
+    QAbstractScrollArea(parent),
+    m_font(DEFAULT_FONT_NAME.c_str(), DEFAULT_FONT_SIZE)
+{
+    m_font.setStyleHint(QFont::TypeWriter);
+
+    m_pBinaryDiff = NULL;
+    m_pDiffDoc = NULL;
+    m_nView = 0;
+    m_nOffsetDigits = 8;
+
+    connect( verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(onVScroll(int)) );
+}
+
+void QHexDiffView::reset()
+{
+    //8 hex digits of offset, or more for a file over 4GB
+    qint64 nSize = qMax(m_pBinaryDiff->GetSize(VIEW_LEFT), m_pBinaryDiff->GetSize(VIEW_RIGHT));
+    m_nOffsetDigits = 8;
+    while ((m_nOffsetDigits < 16) && ((nSize >> (m_nOffsetDigits * 4)) != 0))
+        m_nOffsetDigits++;
+
+    updateScrollBars();
+    verticalScrollBar()->setValue(0);
+    horizontalScrollBar()->setValue(0);
+    viewport()->update();
+}
+
+void QHexDiffView::updateScrollBars()
+{
+    QFontMetrics fm(m_font);
+    int nPageRows = qMax(1, viewport()->height() / fm.height());
+    qint64 nRows = m_pBinaryDiff ? m_pBinaryDiff->GetRowCount() : 0;
+
+    //a scroll bar value is an int, so a row each goes up to 32GB
+    verticalScrollBar()->setRange(0, (int)qMin(qMax(nRows - nPageRows, Q_INT64_C(0)), (qint64)INT_MAX));
+    verticalScrollBar()->setPageStep(nPageRows);
+    verticalScrollBar()->setSingleStep(1);
+
+    int nWidth = (m_nOffsetDigits + 2 + (BINARY_ROW_BYTES * 3) + 3 + BINARY_ROW_BYTES) * fm.width('0');
+    horizontalScrollBar()->setRange(0, qMax(0, nWidth - viewport()->width()));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+}
+
+void QHexDiffView::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void QHexDiffView::paintEvent(QPaintEvent *)
+{
+    QPainter pnt(viewport());
+    if ((m_pBinaryDiff == NULL) || (m_pDiffDoc == NULL))
+        return;
+
+    pnt.setFont(m_font);
+    QFontMetrics fm(m_font);
+    int nLineHeight = fm.height();
+    int nCharWidth = fm.width('0');
+    int nLeft = -horizontalScrollBar()->value();
+    int nHexColumn = m_nOffsetDigits + 2;
+    int nAsciiColumn = nHexColumn + (BINARY_ROW_BYTES * 3) + 2;
+
+    qint64 nTopRow = getTopRow();
+    int nRows = (viewport()->height() / nLineHeight) + 1;
+    uchar states[BINARY_ROW_BYTES];
+    for (int nRow=0; nRow<nRows; nRow++)
+    {
+        qint64 nOffset;
+        const uchar* pBytes;
+        int nBytes = m_pBinaryDiff->GetRow(nTopRow + nRow, m_nView, nOffset, pBytes, states);
+        if (nBytes == 0)
+            continue;  //the other side has bytes here that this one doesn't
+
+        int y = (nRow * nLineHeight) + fm.ascent();
+        drawRun(pnt, nLeft, y, QString("%1").arg(nOffset, m_nOffsetDigits, 16, QChar('0')), BINARY_SAME);
+
+        //runs of bytes in the same state are drawn with one call, and split at the gap mid row
+        int nStart = 0;
+        while (nStart < nBytes)
+        {
+            int nEnd = nStart + 1;
+            while ((nEnd < nBytes) && (states[nEnd] == states[nStart]) && (nEnd != BINARY_ROW_BYTES / 2))
+                nEnd++;
+
+            QString strHex, strAscii;
+            for (int n=nStart; n<nEnd; n++) {
+                strHex += QString("%1 ").arg((uint)pBytes[n], 2, 16, QChar('0'));
+                strAscii += ((pBytes[n] >= 0x20) && (pBytes[n] < 0x7f)) ? QChar(pBytes[n]) : QChar('.');
+            }
+            int nGap = (nStart >= BINARY_ROW_BYTES / 2) ? 1 : 0;
+            drawRun(pnt, nLeft + ((nHexColumn + (nStart * 3) + nGap) * nCharWidth), y, strHex, states[nStart]);
+            drawRun(pnt, nLeft + ((nAsciiColumn + nStart) * nCharWidth), y, strAscii, states[nStart]);
+            nStart = nEnd;
+        }
+    }
+}
+
+void QHexDiffView::drawRun(QPainter& pnt, int x, int y, const QString& strText, uchar nState)
+{
+    QColor clr;
+    if (nState == BINARY_CHANGED)
+        clr = m_pDiffDoc->getClrDifferent();
+    else if (nState == BINARY_ONLY)
+        clr = (m_nView == VIEW_LEFT) ? m_pDiffDoc->getClrOnlyLeft() : m_pDiffDoc->getClrOnlyRight();
+    else
+        clr = m_pDiffDoc->getClrIdentical();
+
+    pnt.setPen(clr);
+    pnt.drawText(x, y, strText);
+}
+
+qint64 QHexDiffView::getTopRow()
+{
+    return verticalScrollBar()->value();
+}
+
+qint64 QHexDiffView::getMidRow()
+{
+    return getTopRow() + (verticalScrollBar()->pageStep() / 2);
+}
+
+void QHexDiffView::scrollToRow(qint64 nRow)
+{
+    qint64 nTopRow = nRow - (verticalScrollBar()->pageStep() / 2);
+    verticalScrollBar()->setValue((int)qBound(Q_INT64_C(0), nTopRow, (qint64)INT_MAX));
+}
+
+void QHexDiffView::onVScroll(int n)
+{
+    //rows line up, so the other view just takes the same value. Setting the value it already has
+    //doesn't signal, so this doesn't bounce back.
+    MainWindow* pWnd = qobject_cast<MainWindow*>(window());
+    if (pWnd == NULL)
+        return;
+    QHexDiffView* viewOther = pWnd->getHexView(OTHERVIEW(m_nView));
+    if (viewOther->verticalScrollBar()->value() != n)
+        viewOther->verticalScrollBar()->setValue(n);
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef QHEXDIFFVIEW_H
+#define QHEXDIFFVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QFont>
+#include "binarydiff.h"
+#include "diffdoc.h"
+
+//One side of a binary compare as hex and ASCII, BINARY_ROW_BYTES to a row. Nothing is held as text:
+//each paint asks the binary diff for just the visible rows, so a file of hundreds of MB scrolls as
+//quickly as a small one. Rows line up with the other view's, so the views scroll together row for row.
+
+class QHexDiffView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    explicit QHexDiffView(QWidget *parent = 0);
+    void init(CBinaryDiff* pBinaryDiff, CDiffDoc* pDiffDoc, int nView) { m_pBinaryDiff = pBinaryDiff; m_pDiffDoc = pDiffDoc; m_nView = nView; }
+
+    void reset();  //after a compare
+    qint64 getTopRow();
+    qint64 getMidRow();
+    void scrollToRow(qint64 nRow);
+
+private slots:
+    void onVScroll(int n);
+
+protected:
+    virtual void paintEvent(QPaintEvent *event);
+    virtual void resizeEvent(QResizeEvent *event);
+
+    void updateScrollBars();
+    void drawRun(QPainter& pnt, int x, int y, const QString& strText, uchar nState);
+
+    static const std::string DEFAULT_FONT_NAME;
+    static const int DEFAULT_FONT_SIZE;
+
+    CBinaryDiff* m_pBinaryDiff;
+    CDiffDoc* m_pDiffDoc;  //for the colours
+    int m_nView;
+    int m_nOffsetDigits;
+
+    QFont m_font;
+};
+
+#endif // QHEXDIFFVIEW_H
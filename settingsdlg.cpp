@@ -28,12 +28,18 @@
 #include <QColorDialog>
 #include <QInputDialog>
 #include <QLineEdit>
+#include <QComboBox>
+#include <QMessageBox>
+#include <QRegExp>
+#include <QSpinBox>
+#include "foldercompare.h"
 
 
 SettingsDlg::SettingsDlg(QWidget *parent) :
     QDialog(parent)
 {
     m_pTabWidget = new QTabWidget;
+    m_pTabWidget->addTab(new CompareTab(), tr("Compare"));
     m_pTabWidget->addTab(new FoldersTab(), tr("Folders"));
     m_pTabWidget->addTab(new ColoursTab(), tr("Colours"));
 
@@ -63,6 +69,140 @@ void SettingsDlg::reject()
     QDialog::reject();
 }
 
+CompareTab::CompareTab(QWidget *parent)
+     : QWidget(parent)
+{
+    int nFlags = MainWindow::getInstance()->getDoc()->getCompareIgnoreFlags();
+
+    QCheckBox *pCheckIgnoreWhitespace = new QCheckBox(tr("Ignore spaces and tabs"));
+    pCheckIgnoreWhitespace->setChecked((nFlags & LINEFILTER_IGNORE_WHITESPACE) != 0);
+    connect(pCheckIgnoreWhitespace, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckIgnoreWhitespace(int)));
+    QCheckBox *pCheckIgnoreCase = new QCheckBox(tr("Ignore case"));
+    pCheckIgnoreCase->setChecked((nFlags & LINEFILTER_IGNORE_CASE) != 0);
+    connect(pCheckIgnoreCase, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckIgnoreCase(int)));
+    QCheckBox *pCheckIgnoreEol = new QCheckBox(tr("Ignore carriage returns at the ends of lines"));
+    pCheckIgnoreEol->setChecked((nFlags & LINEFILTER_IGNORE_EOL) != 0);
+    connect(pCheckIgnoreEol, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckIgnoreEol(int)));
+    QLabel *pIgnoreDescr = new QLabel(tr("Lines that differ only in what is ignored are shown as the same. The views still show each line as it is in its file."));
+    pIgnoreDescr->setMaximumWidth(300);
+    pIgnoreDescr->setWordWrap(true);
+
+    QLabel *pMasksLabel = new QLabel(tr("Masks"));
+    QLabel *pMasksDescr = new QLabel(tr("Text matching any of these regular expressions, e.g. timestamps or addresses, is ignored when lines are matched."));
+    pMasksDescr->setMaximumWidth(300);
+    pMasksDescr->setWordWrap(true);
+
+    m_pListMasks = new QListWidget();
+    QStringList masks = MainWindow::getInstance()->getDoc()->getCompareMasks();
+    for (int n=0; n<masks.size(); n++)
+      m_pListMasks->addItem(masks[n]);
+
+    QPushButton *pBtnAddMask = new QPushButton("Add");
+    connect(pBtnAddMask, SIGNAL(released()),this, SLOT(onClickBtnAddMask()));
+    QPushButton *pBtnRemoveMask = new QPushButton("Remove");
+    connect(pBtnRemoveMask, SIGNAL(released()),this, SLOT(onClickBtnRemoveMask()));
+    QVBoxLayout *pRowMaskButtons = new QVBoxLayout;
+    pRowMaskButtons->addWidget(pBtnAddMask,0);
+    pRowMaskButtons->addWidget(pBtnRemoveMask,0);
+    pRowMaskButtons->addStretch(1);
+
+    QHBoxLayout *pLayoutMasks = new QHBoxLayout;
+    pLayoutMasks->addWidget(m_pListMasks);
+    pLayoutMasks->addLayout(pRowMaskButtons);
+
+    QLabel *pLabelContext = new QLabel(tr("Lines of context in exported patches:"));
+    QSpinBox *pSpinContext = new QSpinBox();
+    pSpinContext->setRange(0, 1000);
+    pSpinContext->setValue(MainWindow::getInstance()->getDoc()->getPatchContext());
+    connect(pSpinContext, SIGNAL(valueChanged(int)),this, SLOT(onPatchContextChanged(int)));
+    QHBoxLayout *pRowContext = new QHBoxLayout;
+    pRowContext->addWidget(pLabelContext);
+    pRowContext->addWidget(pSpinContext);
+    pRowContext->addStretch(1);
+
+    QVBoxLayout *mainLayout = new QVBoxLayout;
+    mainLayout->addWidget(pCheckIgnoreWhitespace);
+    mainLayout->addWidget(pCheckIgnoreCase);
+    mainLayout->addWidget(pCheckIgnoreEol);
+    mainLayout->addWidget(pIgnoreDescr);
+    mainLayout->addSpacerItem(new QSpacerItem(10,20));
+    mainLayout->addWidget(pMasksLabel);
+    mainLayout->addWidget(pMasksDescr);
+    mainLayout->addLayout(pLayoutMasks);
+    mainLayout->addSpacerItem(new QSpacerItem(10,20));
+    mainLayout->addLayout(pRowContext);
+    setLayout(mainLayout);
+}
+
+void CompareTab::setIgnoreFlag(int nFlag, bool bSet)
+{
+    CDiffDoc* doc = MainWindow::getInstance()->getDoc();
+    int nFlags = doc->getCompareIgnoreFlags();
+    doc->setCompareIgnoreFlags(bSet ? (nFlags | nFlag) : (nFlags & ~nFlag));
+    recompare();
+}
+
+void CompareTab::recompare()
+{
+    if (MainWindow::getInstance()->getDoc()->IsCompared())
+        MainWindow::getInstance()->actionCompare_triggered();
+}
+
+void CompareTab::onPatchContextChanged(int nLines)
+{
+    MainWindow::getInstance()->getDoc()->setPatchContext(nLines);
+}
+
+void CompareTab::onClickBtnAddMask()
+{
+    bool ok;
+    QString text = QInputDialog::getText(this, tr("Mask"),
+                                         tr("Enter a regular expression for text to ignore:"), QLineEdit::Normal,
+                                         "", &ok);
+    if (!ok || text.isEmpty())
+        return;
+
+    QRegExp mask(text);
+    if (!mask.isValid()) {
+        QMessageBox::information(this, tr("Mask"), tr("Not a valid regular expression: ") + mask.errorString());
+        return;
+    }
+
+    m_pListMasks->addItem(text);
+    CDiffDoc* doc = MainWindow::getInstance()->getDoc();
+    QStringList list = doc->getCompareMasks();
+    list.push_back(text);
+    doc->setCompareMasks(list);
+    recompare();
+}
+
+void CompareTab::onClickBtnRemoveMask()
+{
+    qDeleteAll(m_pListMasks->selectedItems());
+
+    QStringList list;
+    for (int n=0; n<m_pListMasks->count(); n++)
+        list << m_pListMasks->item(n)->text();
+
+    MainWindow::getInstance()->getDoc()->setCompareMasks(list);
+    recompare();
+}
+
+void CompareTab::onClickCheckIgnoreWhitespace(int n)
+{
+    setIgnoreFlag(LINEFILTER_IGNORE_WHITESPACE, n != 0);
+}
+
+void CompareTab::onClickCheckIgnoreCase(int n)
+{
+    setIgnoreFlag(LINEFILTER_IGNORE_CASE, n != 0);
+}
+
+void CompareTab::onClickCheckIgnoreEol(int n)
+{
+    setIgnoreFlag(LINEFILTER_IGNORE_EOL, n != 0);
+}
+
 FoldersTab::FoldersTab(QWidget *parent)
      : QWidget(parent)
 {
@@ -73,12 +213,35 @@ FoldersTab::FoldersTab(QWidget *parent)
     connect(pCheckShowSame, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckShowSame(int)));
     bool bShowSame = doc->getFoldersShowSame();
     pCheckShowSame->setChecked(bShowSame);
+    QCheckBox *pCheckIgnoreFiles = new QCheckBox(tr("Skip files and folders listed in .gitignore and .ignore files"));
+    pCheckIgnoreFiles->setChecked(doc->getFoldersUseIgnoreFiles());
+    connect(pCheckIgnoreFiles, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckIgnoreFiles(int)));
+    QCheckBox *pCheckDetectMoves = new QCheckBox(tr("Detect moved and renamed files"));
+    pCheckDetectMoves->setChecked(doc->getFoldersDetectMoves());
+    connect(pCheckDetectMoves, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckDetectMoves(int)));
+    QCheckBox *pCheckLineStats = new QCheckBox(tr("Count added and removed lines of different files"));
+    pCheckLineStats->setChecked(doc->getFoldersLineStats());
+    connect(pCheckLineStats, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckLineStats(int)));
+
+    //order matches FOLDERS_VERIFY_*
+    QLabel *pLabelVerify = new QLabel(tr("Compare files in both folders by:"));
+    QComboBox *pComboVerify = new QComboBox;
+    pComboVerify->addItem(tr("Whole contents"));
+    pComboVerify->addItem(tr("Size and modified time only (quickest)"));
+    pComboVerify->addItem(tr("Size and sampled blocks"));
+    pComboVerify->addItem(tr("Size and sampled blocks, then whole contents"));
+    pComboVerify->setCurrentIndex(doc->getFoldersVerifyMode());
+    connect(pComboVerify, SIGNAL(currentIndexChanged(int)),this, SLOT(onVerifyModeChanged(int)));
+    QHBoxLayout *pRowVerify = new QHBoxLayout;
+    pRowVerify->addWidget(pLabelVerify);
+    pRowVerify->addWidget(pComboVerify, 1);
     QSpacerItem *pSpacer = new QSpacerItem(10, 20);
 
     QCheckBox *pCheckExceptions = new QCheckBox(tr("Exception Strings"));
     pCheckExceptions->setChecked(bExceptionsEnabled);
     connect(pCheckExceptions, SIGNAL(stateChanged(int)),this, SLOT(onClickCheckExceptions(int)));
-    QLabel *pExceptionsDescr = new QLabel(tr("Compared files with any of these strings in their relative paths will not be shown in the folders dialog list"));
+    QLabel *pExceptionsDescr = new QLabel(tr("Compared files with any of these strings in their relative paths will not be shown in the folders dialog list. "
+                                             "Wildcards (* ? [abc]) match file and folder names, or whole paths if they contain a /"));
     pExceptionsDescr->setMaximumWidth(300);
     pExceptionsDescr->setWordWrap(true);
     pExceptionsDescr->setIndent(18);
@@ -105,6 +268,10 @@ FoldersTab::FoldersTab(QWidget *parent)
 
     QVBoxLayout *mainLayout = new QVBoxLayout;
     mainLayout->addWidget(pCheckShowSame);
+    mainLayout->addWidget(pCheckIgnoreFiles);
+    mainLayout->addWidget(pCheckDetectMoves);
+    mainLayout->addWidget(pCheckLineStats);
+    mainLayout->addLayout(pRowVerify);
     mainLayout->addSpacerItem(pSpacer);
     mainLayout->addWidget(pCheckExceptions);
     mainLayout->addWidget(pExceptionsDescr);
@@ -119,7 +286,7 @@ void FoldersTab::onClickBtnAddExc()
 {
     bool ok;
     QString text = QInputDialog::getText(this, tr("File name exception"),
-                                         tr("Enter a part of a filename or path:"), QLineEdit::Normal,
+                                         tr("Enter a part of a filename or path, or a wildcard pattern:"), QLineEdit::Normal,
                                          "", &ok);
     if (ok && !text.isEmpty()) {
         //add item to UI list and save it to the reg/inifile
@@ -170,6 +337,36 @@ void FoldersTab::onClickCheckShowSame(int n)
     doc->setFoldersShowSame(bChecked);
 }
 
+void FoldersTab::onClickCheckIgnoreFiles(int n)
+{
+    bool bChecked = (n != 0);
+
+    CDiffDoc* doc = MainWindow::getInstance()->getDoc();
+    doc->setFoldersUseIgnoreFiles(bChecked);
+}
+
+void FoldersTab::onClickCheckDetectMoves(int n)
+{
+    bool bChecked = (n != 0);
+
+    CDiffDoc* doc = MainWindow::getInstance()->getDoc();
+    doc->setFoldersDetectMoves(bChecked);
+}
+
+void FoldersTab::onClickCheckLineStats(int n)
+{
+    bool bChecked = (n != 0);
+
+    CDiffDoc* doc = MainWindow::getInstance()->getDoc();
+    doc->setFoldersLineStats(bChecked);
+}
+
+void FoldersTab::onVerifyModeChanged(int nIndex)
+{
+    CDiffDoc* doc = MainWindow::getInstance()->getDoc();
+    doc->setFoldersVerifyMode(nIndex);
+}
+
 
 ColoursTab::ColoursTab(QWidget *parent)
      : QWidget(parent)
@@ -194,6 +391,10 @@ ColoursTab::ColoursTab(QWidget *parent)
     m_pBtnOnlyRight = new QPushButton(tr("Change"));
     addColourControlsRow(pLayoutTextColours, m_pLabelOnlyRight, m_pBtnOnlyRight);
     connect(m_pBtnOnlyRight, SIGNAL(released()),this, SLOT(onClickChangeOnlyRight()));
+    m_pLabelMoved = new QLabel(tr("Moved:"));
+    m_pBtnMoved = new QPushButton(tr("Change"));
+    addColourControlsRow(pLayoutTextColours, m_pLabelMoved, m_pBtnMoved);
+    connect(m_pBtnMoved, SIGNAL(released()),this, SLOT(onClickChangeMoved()));
 
     pGroupTextColour->setLayout(pLayoutTextColours);
 
@@ -231,6 +432,7 @@ void ColoursTab::paintEvent(QPaintEvent *_event)
     drawColourBox(&pnt, m_pLabelDifferent, m_pBtnDifferent, doc->getClrDifferent());
     drawColourBox(&pnt, m_pLabelOnlyLeft, m_pBtnOnlyLeft, doc->getClrOnlyLeft());
     drawColourBox(&pnt, m_pLabelOnlyRight, m_pBtnOnlyRight, doc->getClrOnlyRight());
+    drawColourBox(&pnt, m_pLabelMoved, m_pBtnMoved, doc->getClrMoved());
 }
 
 void ColoursTab::drawColourBox(QPainter* pnt, QWidget* wgLeft, QWidget* wgRight, QColor clr)
@@ -288,6 +490,16 @@ void ColoursTab::onClickChangeOnlyRight()
     }
 }
 
+void ColoursTab::onClickChangeMoved()
+{
+    QColor clr = MainWindow::getInstance()->getDoc()->getClrMoved();
+    QColor clrNew = QColorDialog::getColor(clr);
+    if (clrNew.isValid() && (clr != clrNew)) {
+        MainWindow::getInstance()->getDoc()->setClrMoved(clrNew);
+        reloadDiffViews();
+    }
+}
+
 void ColoursTab::onClickRestoreDefaults()
 {
     CDiffDoc* doc = MainWindow::getInstance()->getDoc();
@@ -295,6 +507,7 @@ void ColoursTab::onClickRestoreDefaults()
     doc->setClrDifferent(CDiffDoc::CLR_DEFAULT_DIFFERENT);
     doc->setClrOnlyLeft(CDiffDoc::CLR_DEFAULT_ONLYLEFT);
     doc->setClrOnlyRight(CDiffDoc::CLR_DEFAULT_ONLYRIGHT);
+    doc->setClrMoved(CDiffDoc::CLR_DEFAULT_MOVED);
     reloadDiffViews();
 }
 
@@ -42,6 +42,28 @@ private:
 };
 
 
+class CompareTab : public QWidget
+{
+    Q_OBJECT
+
+public:
+    CompareTab(QWidget *parent = 0);
+
+private slots:
+    void onClickCheckIgnoreWhitespace(int n);
+    void onClickCheckIgnoreCase(int n);
+    void onClickCheckIgnoreEol(int n);
+    void onClickBtnAddMask();
+    void onClickBtnRemoveMask();
+    void onPatchContextChanged(int nLines);
+
+private:
+    QListWidget* m_pListMasks;
+
+    void setIgnoreFlag(int nFlag, bool bSet);
+    void recompare();
+};
+
 class FoldersTab : public QWidget
 {
     Q_OBJECT
@@ -54,6 +76,10 @@ private slots:
     void onClickBtnRemoveExc();
     void onClickCheckExceptions(int n);
     void onClickCheckShowSame(int n);
+    void onClickCheckIgnoreFiles(int n);
+    void onClickCheckDetectMoves(int n);
+    void onClickCheckLineStats(int n);
+    void onVerifyModeChanged(int nIndex);
 
 private:
     QListWidget* m_pListFolderExceptions;
@@ -85,16 +111,19 @@ protected:
     QLabel *m_pLabelDifferent;
     QLabel *m_pLabelOnlyLeft;
     QLabel *m_pLabelOnlyRight;
+    QLabel *m_pLabelMoved;
     QPushButton *m_pBtnIdentical;
     QPushButton *m_pBtnDifferent;
     QPushButton *m_pBtnOnlyLeft;
     QPushButton *m_pBtnOnlyRight;
+    QPushButton *m_pBtnMoved;
 
 private slots:
     void onClickChangeIdentical();
     void onClickChangeDifferent();
     void onClickChangeOnlyLeft();
     void onClickChangeOnlyRight();
+    void onClickChangeMoved();
     void onClickRestoreDefaults();
 };
 
@@ -0,0 +1,159 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "singleinstance.h"
+#include "mainwindow.h"
+#include <QFile>
+#include <QList>
+#include <QDebug>
+
+
+//A request is four lines: this, both paths in UTF-8 (empty for just a new window) and the launch time.
+//The running instance answers "ok" once the window has loaded the files.
+#define INSTANCE_REQUEST    "xdiffr-compare"
+
+
+CSingleInstance::CSingleInstance(QObject *parent) :
+    QObject(parent)
+{
+    connect(&m_server, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+
+    //other users mustn't be able to connect and make this user's xdiffr open files
+#if QT_VERSION >= 0x050000
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+#endif
+}
+
+QString CSingleInstance::serverName()
+{
+    //one running instance per user
+    QString strUser = QString::fromLocal8Bit(qgetenv("USER"));
+    if (strUser.isEmpty())
+        strUser = QString::fromLocal8Bit(qgetenv("USERNAME"));
+    return QString(APP_NAME) + "-" + strUser;
+}
+
+bool CSingleInstance::ForwardCompare(const QString& strPath1, const QString& strPath2, qint64 nLaunchTime)
+{
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if (!socket.waitForConnected(INSTANCE_CONNECT_MS))
+        return false;
+
+    QByteArray request = INSTANCE_REQUEST "\n";
+    request += strPath1.toUtf8() + "\n";
+    request += strPath2.toUtf8() + "\n";
+    request += QByteArray::number(nLaunchTime) + "\n";
+    socket.write(request);
+    if (!socket.waitForBytesWritten(INSTANCE_CONNECT_MS))
+        return false;
+
+    while (!socket.canReadLine()) {
+        if (!socket.waitForReadyRead(INSTANCE_REPLY_MS))
+            return false;  //this process opens the compare itself rather than leave it undone
+    }
+    return socket.readLine().trimmed() == "ok";
+}
+
+bool CSingleInstance::Listen()
+{
+    QString strName = serverName();
+    if (listen(strName))
+        return true;
+
+    //either another instance has just started listening, or one that crashed left its socket behind
+    QLocalSocket socket;
+    socket.connectToServer(strName);
+    if (socket.waitForConnected(INSTANCE_CONNECT_MS))
+        return false;
+    QLocalServer::removeServer(strName);
+    return listen(strName);
+}
+
+bool CSingleInstance::listen(const QString& strName)
+{
+    if (!m_server.listen(strName))
+        return false;
+
+#if (QT_VERSION < 0x050000) && defined(Q_OS_UNIX)
+    //no socket options before Qt 5, so the socket file is restricted to its owner straight after
+    if (!QFile::setPermissions(m_server.fullServerName(), QFile::ReadOwner | QFile::WriteOwner)) {
+        m_server.close();
+        return false;
+    }
+#endif
+    return true;
+}
+
+void CSingleInstance::onNewConnection()
+{
+    while (QLocalSocket* pSocket = m_server.nextPendingConnection()) {
+        connect(pSocket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        connect(pSocket, SIGNAL(disconnected()), pSocket, SLOT(deleteLater()));
+        if (pSocket->bytesAvailable() > 0)
+            readRequest(pSocket);  //arrived before readyRead() was connected
+    }
+}
+
+void CSingleInstance::onReadyRead()
+{
+    QLocalSocket* pSocket = qobject_cast<QLocalSocket*>(sender());
+    if (pSocket)
+        readRequest(pSocket);
+}
+
+void CSingleInstance::readRequest(QLocalSocket* pSocket)
+{
+    if (pSocket->peek(pSocket->bytesAvailable()).count('\n') < 4)
+        return;  //the rest hasn't arrived yet
+
+    QList<QByteArray> fields = pSocket->readAll().split('\n');
+    if (fields[0] != INSTANCE_REQUEST) {
+        pSocket->disconnectFromServer();
+        return;
+    }
+    QString strPath1 = QString::fromUtf8(fields[1]);
+    QString strPath2 = QString::fromUtf8(fields[2]);
+
+    MainWindow* pWnd = new MainWindow;
+    pWnd->setAttribute(Qt::WA_DeleteOnClose);
+    pWnd->setLaunchTime(fields[3].toLongLong());
+    pWnd->show();
+    pWnd->raise();
+    pWnd->activateWindow();
+
+    //answered from onFilesLoaded() once the window has loaded the files, before it compares them
+    m_replies.insert(pWnd, pSocket);
+    if (!strPath1.isEmpty() && !strPath2.isEmpty()) {
+        connect(pWnd, SIGNAL(filesLoaded()), this, SLOT(onFilesLoaded()));
+        pWnd->setFileCombosAndDoCompare(strPath1.toLocal8Bit().constData(), strPath2.toLocal8Bit().constData());
+        disconnect(pWnd, SIGNAL(filesLoaded()), this, SLOT(onFilesLoaded()));
+    }
+    reply(pWnd);  //if the compare didn't get as far as loading
+}
+
+void CSingleInstance::onFilesLoaded()
+{
+    reply(sender());
+}
+
+void CSingleInstance::reply(QObject* pWnd)
+{
+    QPointer<QLocalSocket> pSocket = m_replies.take(pWnd);
+    if (!pSocket)
+        return;  //already answered, or the forwarding process has gone
+
+    pSocket->write("ok\n");
+    pSocket->flush();
+    pSocket->disconnectFromServer();
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef SINGLEINSTANCE_H
+#define SINGLEINSTANCE_H
+
+#include <QObject>
+#include <QString>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QMap>
+
+
+#define INSTANCE_CONNECT_MS     500    //a running instance that doesn't accept within this is taken to be gone
+#define INSTANCE_REPLY_MS       30000  //for the running instance to load both files
+
+
+//With --single-instance the first xdiffr listens on a local socket, and later ones started for a compare
+//hand their two paths to it and exit, so they don't pay for a QApplication and a main window of their
+//own. Each forwarded compare opens in a new main window.
+//
+//The forwarding process waits until both files have been loaded before exiting, as git difftool
+//deletes its temporary copies once the tool exits. It isn't kept waiting for the compare and layout
+//as well, which for big files could outlast INSTANCE_REPLY_MS and have it open the compare again.
+
+class CSingleInstance : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CSingleInstance(QObject *parent = 0);
+
+    //true if a running instance took the compare. Paths must be absolute, as its current folder may differ.
+    //nLaunchTime is when this process started, in msecs since epoch, for timing the first paint.
+    static bool ForwardCompare(const QString& strPath1, const QString& strPath2, qint64 nLaunchTime);
+
+    bool Listen();  //makes this process the running instance
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onFilesLoaded();
+
+private:
+    static QString serverName();
+    bool listen(const QString& strName);  //for the owner only
+    void readRequest(QLocalSocket* pSocket);
+    void reply(QObject* pWnd);
+
+    QLocalServer m_server;
+    QMap<QObject*, QPointer<QLocalSocket> > m_replies;  //key=window loading a forwarded compare; value=socket waiting for its "ok"
+};
+
+#endif // SINGLEINSTANCE_H
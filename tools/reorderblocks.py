@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+#writes a pair of files for timing the file compare: the second file has blocks
+#of the first moved to other places and some lines edited, the case the unique
+#line anchors have to keep in order
+#
+#  tools/reorderblocks.py [--lines=N] [--block=N] [--moves=N] [--edits=N] [--seed=N] <file1> <file2>
+#  xdiffr --diff --stats <file1> <file2> >/dev/null
+#
+#the same options and seed always write the same files
+
+import random
+import sys
+
+
+def main(argv):
+    opts = {"lines": 40000, "block": 200, "moves": 40, "edits": 300, "seed": 1}
+    paths = []
+    for arg in argv[1:]:
+        if arg.startswith("--") and "=" in arg:
+            name, value = arg[2:].split("=", 1)
+            if name not in opts:
+                sys.stderr.write("Unknown option %s\n" % arg)
+                return 2
+            opts[name] = int(value)
+        else:
+            paths.append(arg)
+    if len(paths) != 2 or opts["block"] < 1:
+        sys.stderr.write("Usage: reorderblocks.py [--lines=N] [--block=N] [--moves=N] [--edits=N] [--seed=N] <file1> <file2>\n")
+        return 2
+
+    rnd = random.Random(opts["seed"])
+
+    #a closing brace every 10 lines, so there are lines that are not unique
+    lines = []
+    for n in range(opts["lines"]):
+        if n % 10 == 0:
+            lines.append("    }")
+        else:
+            lines.append("int v%d = f(%d, %d);" % (n, n, rnd.randrange(1000000)))
+
+    blocks = [lines[n:n + opts["block"]] for n in range(0, len(lines), opts["block"])]
+    for _ in range(opts["moves"]):
+        block = blocks.pop(rnd.randrange(len(blocks)))
+        blocks.insert(rnd.randrange(len(blocks) + 1), block)
+    moved = [line for block in blocks for line in block]
+
+    for _ in range(opts["edits"]):
+        n = rnd.randrange(len(moved))
+        moved[n] = "changed " + moved[n]
+
+    for path, out in ((paths[0], lines), (paths[1], moved)):
+        with open(path, "w") as f:
+            f.write("\n".join(out) + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
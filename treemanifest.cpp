@@ -0,0 +1,359 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "treemanifest.h"
+#include "mainwindow.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSettings>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <string.h>
+
+
+#define MANIFEST_MAGIC          "XDIFFMAN"
+#define HASHCACHE_MAGIC         "XDIFFHSC"
+#define MANIFEST_MAGIC_SIZE     8
+#define MANIFEST_VERSION        1
+#define HASH_SIZE               16      //MD5
+#define ENTRY_MIN_SIZE          (4 + HASH_SIZE)  //four one byte varints and the hash
+#define HASHCACHE_MAX_ENTRIES   1000000
+#define WRITE_BUFFER_SIZE       (1 << 20)
+#define HASH_READ_SIZE          (1 << 20)
+
+
+//Variable length integers: 7 bits per byte, high bit set if more bytes follow.
+//Signed values (modified times) are zigzag encoded so small negative numbers stay short.
+
+static void putVarint(QByteArray& buf, quint64 n)
+{
+    while (n >= 0x80) {
+        buf.append(char((n & 0x7f) | 0x80));
+        n >>= 7;
+    }
+    buf.append(char(n));
+}
+
+static void putSigned(QByteArray& buf, qint64 n)
+{
+    putVarint(buf, (quint64(n) << 1) ^ quint64(n >> 63));
+}
+
+static bool getVarint(const char *&p, const char *pEnd, quint64& n)
+{
+    n = 0;
+    for (int nShift = 0; (p < pEnd) && (nShift < 64); nShift += 7) {
+        unsigned char c = *p++;
+        n |= quint64(c & 0x7f) << nShift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool getSigned(const char *&p, const char *pEnd, qint64& n)
+{
+    quint64 u;
+    if (!getVarint(p, pEnd, u))
+        return false;
+    n = qint64(u >> 1) ^ -qint64(u & 1);
+    return true;
+}
+
+//Entries are written with front coded paths: the length shared with the previous path, then the rest.
+static void putEntry(QByteArray& buf, const std::string& strPrev, const std::string& strPath,
+                     qint64 nSize, qint64 nModified, const QByteArray& hash)
+{
+    size_t nShared = 0;
+    while ((nShared < strPrev.size()) && (nShared < strPath.size()) && (strPrev[nShared] == strPath[nShared]))
+        nShared++;
+
+    putVarint(buf, nShared);
+    putVarint(buf, strPath.size() - nShared);
+    buf.append(strPath.data() + nShared, strPath.size() - nShared);
+    putVarint(buf, nSize);
+    putSigned(buf, nModified);
+    if (hash.size() == HASH_SIZE)
+        buf.append(hash);
+    else
+        buf.append(QByteArray(HASH_SIZE, 0));
+}
+
+static bool getEntry(const char *&p, const char *pEnd, std::string& strPath,
+                     qint64& nSize, qint64& nModified, QByteArray& hash)
+{
+    quint64 nShared, nSuffix, nSize64;
+    if (!getVarint(p, pEnd, nShared) || !getVarint(p, pEnd, nSuffix))
+        return false;
+    if ((nShared > strPath.size()) || (nSuffix > quint64(pEnd - p)))
+        return false;
+    strPath.resize(nShared);
+    strPath.append(p, nSuffix);
+    p += nSuffix;
+
+    if (!getVarint(p, pEnd, nSize64) || !getSigned(p, pEnd, nModified))
+        return false;
+    nSize = nSize64;
+
+    if ((pEnd - p) < HASH_SIZE)
+        return false;
+    hash = QByteArray(p, HASH_SIZE);
+    p += HASH_SIZE;
+    return true;
+}
+
+static bool writeHeader(QFile& file, const char *pStrMagic, quint64 nCount)
+{
+    QByteArray buf(pStrMagic, MANIFEST_MAGIC_SIZE);
+    putVarint(buf, MANIFEST_VERSION);
+    putVarint(buf, nCount);
+    return file.write(buf) == buf.size();
+}
+
+static bool readHeader(const char *&p, const char *pEnd, const char *pStrMagic, quint64& nCount)
+{
+    quint64 nVersion;
+    if (((pEnd - p) < MANIFEST_MAGIC_SIZE) || (memcmp(p, pStrMagic, MANIFEST_MAGIC_SIZE) != 0))
+        return false;
+    p += MANIFEST_MAGIC_SIZE;
+    if (!getVarint(p, pEnd, nVersion) || (nVersion != MANIFEST_VERSION))
+        return false;
+    if (!getVarint(p, pEnd, nCount))
+        return false;
+
+    //a corrupt count could otherwise reserve far more than the file could hold
+    return nCount <= quint64(pEnd - p) / ENTRY_MIN_SIZE;
+}
+
+////////////////// CTreeManifest /////////////////////////
+
+bool CTreeManifest::IsManifestFile(const QString& strPath)
+{
+    QFile file(strPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;  //also fails for folders
+
+    QByteArray magic = file.read(MANIFEST_MAGIC_SIZE);
+    return magic == QByteArray(MANIFEST_MAGIC);
+}
+
+bool CTreeManifest::Read(const QString& strFile)
+{
+    m_entries.clear();
+
+    QFile file(strFile);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray data = file.readAll();
+    const char *p = data.constData();
+    const char *pEnd = p + data.size();
+
+    quint64 nCount;
+    if (!readHeader(p, pEnd, MANIFEST_MAGIC, nCount))
+        return false;
+
+    m_entries.reserve(nCount);
+    std::string strPath;
+    for (quint64 n=0; n<nCount; n++) {
+        CManifestEntry entry;
+        if (!getEntry(p, pEnd, strPath, entry.m_nSize, entry.m_nModified, entry.m_hash)) {
+            qDebug() << "Corrupt manifest" << strFile;
+            m_entries.clear();
+            return false;
+        }
+        entry.m_strPath = strPath;
+        m_entries.push_back(entry);
+    }
+
+    return true;
+}
+
+bool CTreeManifest::Write(const QString& strFile) const
+{
+    QFile file(strFile);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    bool bOk = writeHeader(file, MANIFEST_MAGIC, m_entries.size());
+
+    QByteArray buf;
+    buf.reserve(WRITE_BUFFER_SIZE + 4096);
+    std::string strPrev;
+    for (size_t n=0; bOk && (n<m_entries.size()); n++) {
+        const CManifestEntry& entry = m_entries[n];
+        putEntry(buf, strPrev, entry.m_strPath, entry.m_nSize, entry.m_nModified, entry.m_hash);
+        strPrev = entry.m_strPath;
+
+        if (buf.size() >= WRITE_BUFFER_SIZE) {
+            bOk = (file.write(buf) == buf.size());
+            buf.clear();
+        }
+    }
+    bOk = bOk && (file.write(buf) == buf.size()) && file.flush();
+
+    if (!bOk)
+        file.remove();  //a partly written manifest would read as a folder with files missing
+    return bOk;
+}
+
+bool CTreeManifest::HashFile(const QString& strPath, QByteArray& hash)
+{
+    QFile file(strPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    QByteArray buf;
+    buf.resize(HASH_READ_SIZE);
+    for (;;) {
+        qint64 nRead = file.read(buf.data(), HASH_READ_SIZE);
+        if (nRead < 0)
+            return false;
+        if (nRead == 0)
+            break;
+        md5.addData(buf.constData(), nRead);
+    }
+
+    hash = md5.result();
+    return true;
+}
+
+////////////////// CHashCache /////////////////////////
+
+CHashCache::CHashCache()
+{
+    m_bLoaded = false;
+    m_bDirty = false;
+    m_nHits = 0;
+    m_nMisses = 0;
+}
+
+QString CHashCache::getCacheFilePath()
+{
+    //kept next to the settings file
+    QSettings settings(ORG_NAME, APP_NAME);
+    return QFileInfo(settings.fileName()).absolutePath() + "/hashcache.bin";
+}
+
+void CHashCache::Load()
+{
+    if (m_bLoaded)
+        return;
+    m_bLoaded = true;
+
+    QFile file(getCacheFilePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QByteArray data = file.readAll();
+    const char *p = data.constData();
+    const char *pEnd = p + data.size();
+
+    quint64 nCount;
+    if (!readHeader(p, pEnd, HASHCACHE_MAGIC, nCount))
+        return;
+
+    std::string strPath;
+    for (quint64 n=0; n<nCount; n++) {
+        CCacheEntry entry;
+        if (!getEntry(p, pEnd, strPath, entry.m_nSize, entry.m_nModified, entry.m_hash))
+            break;
+        m_map[strPath] = entry;
+    }
+}
+
+void CHashCache::Save()
+{
+    if (!m_bDirty)
+        return;
+
+    QString strFile = getCacheFilePath();
+    QDir().mkpath(QFileInfo(strFile).absolutePath());
+
+    //write to a temporary file first, so a failed write doesn't lose the old cache
+    QFile file(strFile + ".tmp");
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    bool bOk = writeHeader(file, HASHCACHE_MAGIC, m_map.size());
+
+    QByteArray buf;
+    buf.reserve(WRITE_BUFFER_SIZE + 4096);
+    std::string strPrev;
+    std::map<std::string, CCacheEntry>::iterator it = m_map.begin();
+    for ( ; bOk && (it != m_map.end()); ++it) {
+        putEntry(buf, strPrev, it->first, it->second.m_nSize, it->second.m_nModified, it->second.m_hash);
+        strPrev = it->first;
+        if (buf.size() >= WRITE_BUFFER_SIZE) {
+            bOk = (file.write(buf) == buf.size());
+            buf.clear();
+        }
+    }
+    bOk = bOk && (file.write(buf) == buf.size()) && file.flush();
+    file.close();
+
+    if (bOk) {
+        QFile::remove(strFile);
+        bOk = QFile::rename(strFile + ".tmp", strFile);
+    }
+    if (!bOk) {
+        QFile::remove(strFile + ".tmp");  //a partly written cache isn't left behind
+        return;
+    }
+    m_bDirty = false;
+}
+
+bool CHashCache::Lookup(const std::string& strPath, qint64 nSize, qint64 nModified, QByteArray& hash)
+{
+    std::map<std::string, CCacheEntry>::iterator it = m_map.find(strPath);
+    if ((it == m_map.end()) || (it->second.m_nSize != nSize) || (it->second.m_nModified != nModified))
+        return false;
+
+    hash = it->second.m_hash;
+    return true;
+}
+
+void CHashCache::Store(const std::string& strPath, qint64 nSize, qint64 nModified, const QByteArray& hash)
+{
+    std::map<std::string, CCacheEntry>::iterator it = m_map.find(strPath);
+    if (it == m_map.end()) {
+        if (m_map.size() >= HASHCACHE_MAX_ENTRIES)
+            return;
+        it = m_map.insert(std::make_pair(strPath, CCacheEntry())).first;
+    }
+
+    it->second.m_nSize = nSize;
+    it->second.m_nModified = nModified;
+    it->second.m_hash = hash;
+    m_bDirty = true;
+}
+
+bool CHashCache::GetFileHash(const std::string& strPath, qint64 nSize, qint64 nModified, QByteArray& hash)
+{
+    Load();
+
+    std::string strAbsPath = QFileInfo(QString::fromLocal8Bit(strPath.c_str())).absoluteFilePath().toLocal8Bit().constData();
+    if (Lookup(strAbsPath, nSize, nModified, hash)) {
+        m_nHits++;
+        return true;
+    }
+
+    m_nMisses++;
+    if (!CTreeManifest::HashFile(QString::fromLocal8Bit(strPath.c_str()), hash))
+        return false;
+
+    Store(strAbsPath, nSize, nModified, hash);
+    return true;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2013 Adam Kozicki <adam@adamk.org>
+// All rights reserved
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation. For the terms of this
+// license, see <http://www.gnu.org/licenses/>.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef TREEMANIFEST_H
+#define TREEMANIFEST_H
+
+#include <QString>
+#include <QByteArray>
+#include <string>
+#include <vector>
+#include <map>
+
+
+//Suggested file extension for manifests. Any file starting with the manifest magic is accepted though.
+#define MANIFEST_EXTENSION  ".xdm"
+
+class CManifestEntry
+{
+public:
+    CManifestEntry() { m_nSize = -1; m_nModified = 0; }
+
+    std::string m_strPath;  //relative path, e.g. "/src/main.cpp"
+    qint64 m_nSize;
+    qint64 m_nModified;     //msecs since epoch
+    QByteArray m_hash;      //MD5 of the contents
+};
+
+
+//A snapshot of a folder tree: the relative path, size, modified time and content hash of each file.
+//It can stand in for a folder on either side of a folder compare, so a deployed tree can be checked
+//against what was shipped without having both trees on the same machine.
+//Stored in a compact binary file with front coded paths and variable length integers.
+
+class CTreeManifest
+{
+public:
+    bool Read(const QString& strFile);
+    bool Write(const QString& strFile) const;
+
+    void AddEntry(const CManifestEntry& entry) { m_entries.push_back(entry); }
+    const std::vector<CManifestEntry>& GetEntries() const { return m_entries; }
+    void Clear() { m_entries.clear(); }
+
+    static bool IsManifestFile(const QString& strPath);
+    static bool HashFile(const QString& strPath, QByteArray& hash);
+
+private:
+    std::vector<CManifestEntry> m_entries;
+};
+
+
+//Remembers the content hashes of live files, keyed by absolute path and validated by size and modified time.
+//When they agree a file compared against a manifest doesn't have to be read at all.
+
+class CHashCache
+{
+public:
+    CHashCache();
+
+    void Load();
+    void Save();
+
+    bool Lookup(const std::string& strPath, qint64 nSize, qint64 nModified, QByteArray& hash);
+    void Store(const std::string& strPath, qint64 nSize, qint64 nModified, const QByteArray& hash);
+
+    //hashes the file, or takes the hash from the cache if its size and modified time haven't changed
+    bool GetFileHash(const std::string& strPath, qint64 nSize, qint64 nModified, QByteArray& hash);
+
+    int GetHits() { return m_nHits; }
+    int GetMisses() { return m_nMisses; }
+
+private:
+    QString getCacheFilePath();
+
+    struct CCacheEntry
+    {
+        qint64 m_nSize;
+        qint64 m_nModified;
+        QByteArray m_hash;
+    };
+    std::map<std::string, CCacheEntry> m_map;
+    bool m_bLoaded;
+    bool m_bDirty;
+    int m_nHits;
+    int m_nMisses;
+};
+
+#endif // TREEMANIFEST_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -18,7 +18,25 @@ SOURCES += main.cpp\
     qdifftextedit.cpp \
     foldersdlg.cpp \
     aboutdlg.cpp \
-    settingsdlg.cpp
+    settingsdlg.cpp \
+    exceptionmatcher.cpp \
+    ignorerules.cpp \
+    movedetector.cpp \
+    foldercompare.cpp \
+    commandline.cpp \
+    treemanifest.cpp \
+    batchio.cpp \
+    linestats.cpp \
+    diffprefetcher.cpp \
+    folderwatcher.cpp \
+    archive.cpp \
+    gitrepo.cpp \
+    singleinstance.cpp \
+    linefilter.cpp \
+    merge3.cpp \
+    binarydiff.cpp \
+    qhexdiffview.cpp \
+    patchwriter.cpp
 
 HEADERS  += mainwindow.h \
     diffdoc.h \
@@ -26,7 +44,25 @@ HEADERS  += mainwindow.h \
     foldersdlg.h \
     aboutdlg.h \
     settingsdlg.h \
-    version.h
+    version.h \
+    exceptionmatcher.h \
+    ignorerules.h \
+    movedetector.h \
+    foldercompare.h \
+    commandline.h \
+    treemanifest.h \
+    batchio.h \
+    linestats.h \
+    diffprefetcher.h \
+    folderwatcher.h \
+    archive.h \
+    gitrepo.h \
+    singleinstance.h \
+    linefilter.h \
+    merge3.h \
+    binarydiff.h \
+    qhexdiffview.h \
+    patchwriter.h
 
 FORMS    += mainwindow.ui \
     aboutdlg.ui
@@ -36,4 +72,14 @@ RESOURCES += \
 
 RC_FILE = xdiffr.rc
 
+#batched reads of small files through io_uring, where the kernel headers have it (Linux 5.6+ at run time)
+linux:exists(/usr/include/linux/io_uring.h): DEFINES += XDIFFR_IO_URING
+
+#zlib, for reading zip, tar.gz and gz files. Windows builds use the copy inside QtCore.
+unix: LIBS += -lz
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+
+#peak memory for xdiffr --diff --stats
+win32: LIBS += -lpsapi
+
 #CONFIG += static